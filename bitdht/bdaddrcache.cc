@@ -0,0 +1,203 @@
+/*
+ * bitdht/bdaddrcache.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdaddrcache.h"
+#include "util/bdlog.h"
+
+/***
+ * #define DEBUG_ADDRCACHE 1
+ ***/
+
+bdAddrCache::bdAddrCache(uint32_t maxEntries, time_t ttl)
+	:mMaxEntries(maxEntries), mTTL(ttl)
+{
+	resetCounters();
+}
+
+void	bdAddrCache::setLimits(uint32_t maxEntries, time_t ttl)
+{
+	mMaxEntries = maxEntries;
+	mTTL = ttl;
+	trim();
+}
+
+void	bdAddrCache::addAddress(const bdNodeId *id, const struct sockaddr_in *addr, time_t now)
+{
+	std::map<bdNodeId, bdAddrCacheEntry>::iterator it;
+	it = mEntries.find(*id);
+	if (it == mEntries.end())
+	{
+		bdAddrCacheEntry entry;
+		entry.mPingTS = 0;
+		mLru.push_front(*id);
+		entry.mLruIt = mLru.begin();
+		it = mEntries.insert(std::make_pair(*id, entry)).first;
+	}
+	else
+	{
+		touch(it->second, id);
+	}
+
+	it->second.mAddr = *addr;
+	it->second.mResolvedTS = now;
+
+#ifdef DEBUG_ADDRCACHE
+	LOG.info("bdAddrCache::addAddress() %s:%d entries: %d",
+			inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), (int) mEntries.size());
+#endif
+
+	trim();
+}
+
+bool	bdAddrCache::refreshAddress(const bdNodeId *id, const struct sockaddr_in *addr, time_t now)
+{
+	std::map<bdNodeId, bdAddrCacheEntry>::iterator it;
+	it = mEntries.find(*id);
+	if (it == mEntries.end())
+	{
+		return false;
+	}
+
+	touch(it->second, id);
+	it->second.mAddr = *addr;
+	it->second.mResolvedTS = now;
+	return true;
+}
+
+void	bdAddrCache::removeAddress(const bdNodeId *id)
+{
+	std::map<bdNodeId, bdAddrCacheEntry>::iterator it;
+	it = mEntries.find(*id);
+	if (it == mEntries.end())
+	{
+		return;
+	}
+
+	mLru.erase(it->second.mLruIt);
+	mEntries.erase(it);
+}
+
+bool	bdAddrCache::lookup(const bdNodeId *id, struct sockaddr_in &addr, time_t now)
+{
+	std::map<bdNodeId, bdAddrCacheEntry>::iterator it;
+	it = mEntries.find(*id);
+	if ((it == mEntries.end()) || (now - it->second.mResolvedTS > mTTL))
+	{
+		mCounterMisses++;
+		return false;
+	}
+
+	addr = it->second.mAddr;
+	mCounterHits++;
+	return true;
+}
+
+bool	bdAddrCache::needsRevalidation(const bdNodeId *id, time_t now)
+{
+	std::map<bdNodeId, bdAddrCacheEntry>::iterator it;
+	it = mEntries.find(*id);
+	if (it == mEntries.end())
+	{
+		return false;
+	}
+
+	if ((now - it->second.mResolvedTS < BITDHT_ADDRCACHE_REVALIDATE_AGE) ||
+		(now - it->second.mPingTS < BITDHT_ADDRCACHE_PING_PERIOD))
+	{
+		return false;
+	}
+
+	it->second.mPingTS = now;
+	return true;
+}
+
+/* entries are ordered by resolve time, so expired ones are at the back */
+void	bdAddrCache::cleanup(time_t now)
+{
+	while(!mLru.empty())
+	{
+		std::map<bdNodeId, bdAddrCacheEntry>::iterator it;
+		it = mEntries.find(mLru.back());
+		if (now - it->second.mResolvedTS <= mTTL)
+		{
+			break;
+		}
+
+		mEntries.erase(it);
+		mLru.pop_back();
+	}
+}
+
+void	bdAddrCache::clear()
+{
+	mEntries.clear();
+	mLru.clear();
+}
+
+uint32_t bdAddrCache::size()
+{
+	return mEntries.size();
+}
+
+uint32_t bdAddrCache::hits()
+{
+	return mCounterHits;
+}
+
+uint32_t bdAddrCache::misses()
+{
+	return mCounterMisses;
+}
+
+double	bdAddrCache::hitRate()
+{
+	uint32_t total = mCounterHits + mCounterMisses;
+	if (total == 0)
+	{
+		return 0;
+	}
+	return ((double) mCounterHits) / total;
+}
+
+void	bdAddrCache::resetCounters()
+{
+	mCounterHits = 0;
+	mCounterMisses = 0;
+}
+
+void	bdAddrCache::touch(bdAddrCacheEntry &entry, const bdNodeId *id)
+{
+	mLru.erase(entry.mLruIt);
+	mLru.push_front(*id);
+	entry.mLruIt = mLru.begin();
+}
+
+void	bdAddrCache::trim()
+{
+	while(mEntries.size() > mMaxEntries)
+	{
+		mEntries.erase(mLru.back());
+		mLru.pop_back();
+	}
+}
+
@@ -0,0 +1,100 @@
+#ifndef BITDHT_ADDR_CACHE_H
+#define BITDHT_ADDR_CACHE_H
+
+/*
+ * bitdht/bdaddrcache.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * Recently Resolved Address Cache.
+ *
+ * Remembers the address of peers we have recently found (successful
+ * queries), or heard from (pongs), so that repeat resolutions can be
+ * answered without another network lookup.
+ *
+ * Entries expire after mTTL seconds, and the cache is bounded at
+ * mMaxEntries - the least recently resolved entry is dropped first.
+ ******/
+
+#include "bitdht/bdpeer.h"
+
+#include <map>
+#include <list>
+
+#define BITDHT_ADDRCACHE_MAX_ENTRIES		1000
+#define BITDHT_ADDRCACHE_TTL			600	/* 10 minutes */
+#define BITDHT_ADDRCACHE_REVALIDATE_AGE		60	/* ping entries older than this on use */
+#define BITDHT_ADDRCACHE_PING_PERIOD		30	/* at most one revalidation ping per period */
+
+class bdAddrCacheEntry
+{
+public:
+	struct sockaddr_in mAddr;
+	time_t mResolvedTS;	/* last time the address was confirmed */
+	time_t mPingTS;		/* last revalidation ping */
+	std::list<bdNodeId>::iterator mLruIt;
+};
+
+class bdAddrCache
+{
+public:
+	bdAddrCache(uint32_t maxEntries = BITDHT_ADDRCACHE_MAX_ENTRIES,
+			time_t ttl = BITDHT_ADDRCACHE_TTL);
+
+	void	setLimits(uint32_t maxEntries, time_t ttl);
+
+	/* insert or replace - from a successful query */
+	void	addAddress(const bdNodeId *id, const struct sockaddr_in *addr, time_t now);
+	/* refresh an existing entry - from a verified pong */
+	bool	refreshAddress(const bdNodeId *id, const struct sockaddr_in *addr, time_t now);
+	void	removeAddress(const bdNodeId *id);
+
+	/* lookup updates the hit/miss counters */
+	bool	lookup(const bdNodeId *id, struct sockaddr_in &addr, time_t now);
+	/* true (and marks ping time) if the entry should be revalidated with a ping */
+	bool	needsRevalidation(const bdNodeId *id, time_t now);
+
+	void	cleanup(time_t now);
+	void	clear();
+
+	uint32_t size();
+	uint32_t hits();
+	uint32_t misses();
+	double	hitRate();
+	void	resetCounters();
+
+private:
+	void	touch(bdAddrCacheEntry &entry, const bdNodeId *id);
+	void	trim();
+
+	std::map<bdNodeId, bdAddrCacheEntry> mEntries;
+	std::list<bdNodeId> mLru;	/* front = most recently resolved */
+
+	uint32_t mMaxEntries;
+	time_t mTTL;
+
+	uint32_t mCounterHits;
+	uint32_t mCounterMisses;
+};
+
+#endif
+
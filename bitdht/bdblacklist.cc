@@ -0,0 +1,413 @@
+/*
+ * bitdht/bdblacklist.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdblacklist.h"
+#include "util/bdlog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/***
+ * #define DEBUG_BLACKLIST 1
+ ***/
+
+bdBlackList::bdBlackList()
+	:mRangeCount(0), mHits(0)
+{
+	clear();
+}
+
+bool	bdBlackList::add(const struct sockaddr_in &addr)
+{
+	return addRule(addr.sin_addr, addr.sin_port, 32);
+}
+
+bool	bdBlackList::remove(const struct sockaddr_in &addr)
+{
+	return removeRule(addr.sin_addr, addr.sin_port, 32);
+}
+
+bool	bdBlackList::addRule(struct in_addr addr, uint16_t port, int prefixLen)
+{
+	if ((prefixLen < 0) || (prefixLen > 32))
+	{
+		return false;
+	}
+
+	if (prefixLen == 32)
+	{
+		uint64_t key = exactKey(addr.s_addr, port);
+		if (mExact.find(key) != mExact.end())
+		{
+			return false;
+		}
+		mExact[key] = newRule(addr, port, prefixLen);
+		return true;
+	}
+
+	/* ranges always cover every port */
+	uint32_t hostAddr = ntohl(addr.s_addr);
+	if (prefixLen == 0)
+	{
+		hostAddr = 0;
+	}
+	else
+	{
+		hostAddr &= ~((1u << (32 - prefixLen)) - 1);
+	}
+
+	int32_t node = findTrieNode(hostAddr, prefixLen, true);
+	if (mTrie[node].mRule >= 0)
+	{
+		return false;
+	}
+
+	struct in_addr masked;
+	masked.s_addr = htonl(hostAddr);
+	mTrie[node].mRule = newRule(masked, 0, prefixLen);
+	mRangeCount++;
+	return true;
+}
+
+bool	bdBlackList::removeRule(struct in_addr addr, uint16_t port, int prefixLen)
+{
+	if ((prefixLen < 0) || (prefixLen > 32))
+	{
+		return false;
+	}
+
+	if (prefixLen == 32)
+	{
+		std::unordered_map<uint64_t, int32_t>::iterator it;
+		it = mExact.find(exactKey(addr.s_addr, port));
+		if (it == mExact.end())
+		{
+			return false;
+		}
+		freeRule(it->second);
+		mExact.erase(it);
+		return true;
+	}
+
+	uint32_t hostAddr = (prefixLen == 0) ? 0 :
+		(ntohl(addr.s_addr) & ~((1u << (32 - prefixLen)) - 1));
+
+	/* the nodes are left in place: they are cheap, and usually reused */
+	int32_t node = findTrieNode(hostAddr, prefixLen, false);
+	if ((node < 0) || (mTrie[node].mRule < 0))
+	{
+		return false;
+	}
+	freeRule(mTrie[node].mRule);
+	mTrie[node].mRule = -1;
+	mRangeCount--;
+	return true;
+}
+
+bool	bdBlackList::addRule(const std::string &rule)
+{
+	struct in_addr addr;
+	uint16_t port;
+	int prefixLen;
+	if (!parseRule(rule, addr, port, prefixLen))
+	{
+		return false;
+	}
+	return addRule(addr, port, prefixLen);
+}
+
+int	bdBlackList::loadFile(const std::string &file)
+{
+	FILE *fd = fopen(file.c_str(), "r");
+	if (!fd)
+	{
+		LOG.info("bdBlackList::loadFile() Failed to Open File: %s", file.c_str());
+		return -1;
+	}
+
+	int added = 0;
+	int bad = 0;
+	char line[1024];
+	while(line == fgets(line, sizeof(line), fd))
+	{
+		/* strip comments + trailing whitespace */
+		char *end = strchr(line, '#');
+		if (end)
+		{
+			*end = '\0';
+		}
+		end = line + strlen(line);
+		while((end > line) && ((end[-1] == ' ') || (end[-1] == '\t') ||
+				(end[-1] == '\r') || (end[-1] == '\n')))
+		{
+			*(--end) = '\0';
+		}
+
+		char *start = line;
+		while((*start == ' ') || (*start == '\t'))
+		{
+			start++;
+		}
+		if (*start == '\0')
+		{
+			continue;
+		}
+
+		struct in_addr addr;
+		uint16_t port;
+		int prefixLen;
+		if (!parseRule(start, addr, port, prefixLen))
+		{
+			bad++;
+#ifdef DEBUG_BLACKLIST
+			LOG.info("bdBlackList::loadFile() bad rule: %s", start);
+#endif
+			continue;
+		}
+
+		if (addRule(addr, port, prefixLen))
+		{
+			added++;
+		}
+	}
+	fclose(fd);
+
+	LOG.info("bdBlackList::loadFile() %s: %d rules added, %d bad lines",
+			file.c_str(), added, bad);
+	return added;
+}
+
+void	bdBlackList::clear()
+{
+	mRules.clear();
+	mFreeRules.clear();
+	mExact.clear();
+	mTrie.clear();
+	mRangeCount = 0;
+	mHits = 0;
+
+	TrieNode root;
+	root.mChild[0] = -1;
+	root.mChild[1] = -1;
+	root.mRule = -1;
+	mTrie.push_back(root);
+}
+
+bool	bdBlackList::isBlackListed(const struct sockaddr_in &addr)
+{
+	int32_t rule = -1;
+
+	if (!mExact.empty())
+	{
+		std::unordered_map<uint64_t, int32_t>::iterator it;
+		it = mExact.find(exactKey(addr.sin_addr.s_addr, addr.sin_port));
+		if (it == mExact.end())
+		{
+			it = mExact.find(exactKey(addr.sin_addr.s_addr, 0));
+		}
+		if (it != mExact.end())
+		{
+			rule = it->second;
+		}
+	}
+
+	if ((rule < 0) && (mRangeCount > 0))
+	{
+		/* longest matching prefix */
+		uint32_t hostAddr = ntohl(addr.sin_addr.s_addr);
+		int32_t node = 0;
+		rule = mTrie[0].mRule;
+		for(int bit = 31; bit >= 0; bit--)
+		{
+			node = mTrie[node].mChild[(hostAddr >> bit) & 1];
+			if (node < 0)
+			{
+				break;
+			}
+			if (mTrie[node].mRule >= 0)
+			{
+				rule = mTrie[node].mRule;
+			}
+		}
+	}
+
+	if (rule < 0)
+	{
+		return false;
+	}
+
+	mRules[rule].mHits++;
+	mHits++;
+	return true;
+}
+
+uint32_t bdBlackList::exactRules()
+{
+	return mExact.size();
+}
+
+uint32_t bdBlackList::rangeRules()
+{
+	return mRangeCount;
+}
+
+uint32_t bdBlackList::hits()
+{
+	return mHits;
+}
+
+void	bdBlackList::getRules(std::list<bdBlackListRule> &rules)
+{
+	std::vector<bdBlackListRule>::iterator it;
+	for(it = mRules.begin(); it != mRules.end(); it++)
+	{
+		if (it->mActive)
+		{
+			rules.push_back(*it);
+		}
+	}
+}
+
+bool	bdBlackList::parseRule(const std::string &rule, struct in_addr &addr,
+		uint16_t &port, int &prefixLen)
+{
+	char addrStr[64];
+	unsigned int num = 0;
+	char sep = '\0';
+
+	port = 0;
+	prefixLen = 32;
+
+	int n = sscanf(rule.c_str(), "%63[0-9.] %c%u", addrStr, &sep, &num);
+	if (n < 1)
+	{
+		return false;
+	}
+
+	/* full dotted quads only (inet_aton would take "10.1" too) */
+	int dots = 0;
+	for(char *c = addrStr; *c; c++)
+	{
+		if (*c == '.')
+		{
+			dots++;
+		}
+	}
+
+	if ((dots != 3) || (!bdnet_inet_aton(addrStr, &addr)))
+	{
+		return false;
+	}
+
+	if (n == 1)
+	{
+		return true;
+	}
+
+	if (n == 3)
+	{
+		if (sep == '/')
+		{
+			if (num > 32)
+			{
+				return false;
+			}
+			prefixLen = num;
+			return true;
+		}
+		if ((sep == ':') && (num > 0) && (num < 65536))
+		{
+			port = htons(num);
+			return true;
+		}
+	}
+
+	/* "addr port", as in the bdboot file */
+	if (1 == sscanf(rule.c_str(), "%*[0-9.] %u", &num) && (num > 0) && (num < 65536))
+	{
+		port = htons(num);
+		return true;
+	}
+	return false;
+}
+
+uint64_t bdBlackList::exactKey(uint32_t addr, uint16_t port)
+{
+	return (((uint64_t) addr) << 16) | port;
+}
+
+int32_t	bdBlackList::newRule(struct in_addr addr, uint16_t port, int prefixLen)
+{
+	bdBlackListRule rule;
+	rule.mAddr = addr;
+	rule.mPort = port;
+	rule.mPrefixLen = prefixLen;
+	rule.mHits = 0;
+	rule.mActive = true;
+
+	if (!mFreeRules.empty())
+	{
+		int32_t idx = mFreeRules.back();
+		mFreeRules.pop_back();
+		mRules[idx] = rule;
+		return idx;
+	}
+
+	mRules.push_back(rule);
+	return mRules.size() - 1;
+}
+
+void	bdBlackList::freeRule(int32_t idx)
+{
+	mRules[idx].mActive = false;
+	mFreeRules.push_back(idx);
+}
+
+int32_t	bdBlackList::findTrieNode(uint32_t hostAddr, int prefixLen, bool create)
+{
+	int32_t node = 0;
+	for(int i = 0; i < prefixLen; i++)
+	{
+		int b = (hostAddr >> (31 - i)) & 1;
+		int32_t child = mTrie[node].mChild[b];
+		if (child < 0)
+		{
+			if (!create)
+			{
+				return -1;
+			}
+
+			TrieNode leaf;
+			leaf.mChild[0] = -1;
+			leaf.mChild[1] = -1;
+			leaf.mRule = -1;
+			mTrie.push_back(leaf);
+			child = mTrie.size() - 1;
+			mTrie[node].mChild[b] = child;
+		}
+		node = child;
+	}
+	return node;
+}
+
@@ -0,0 +1,113 @@
+#ifndef BITDHT_BLACKLIST_H
+#define BITDHT_BLACKLIST_H
+
+/*
+ * bitdht/bdblacklist.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * Address Blacklist.
+ *
+ * Rules are an address and port, an address (any port), or a CIDR
+ * range (any port). Single addresses are kept in a hash table, ranges
+ * in a binary prefix trie - so a check is one or two hash lookups plus
+ * at most 32 trie steps, however many rules are loaded. The most
+ * specific matching rule gets the hit.
+ *
+ * The check is made by UdpBitDht as each datagram arrives, before it
+ * is decoded or queued.
+ *
+ * Rule text (one per line in a blacklist file, # for comments):
+ *	1.2.3.4			address, any port
+ *	1.2.3.4:6881		address and port (or "1.2.3.4 6881")
+ *	1.2.3.0/24		range
+ ******/
+
+#include "util/bdnet.h"
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+
+class bdBlackListRule
+{
+public:
+	struct in_addr mAddr;
+	uint16_t mPort;		/* network order, 0 = any */
+	int	mPrefixLen;	/* 32 for single addresses */
+	uint32_t mHits;
+	bool	mActive;
+};
+
+class bdBlackList
+{
+public:
+	bdBlackList();
+
+	/* exact address and port */
+	bool	add(const struct sockaddr_in &addr);
+	bool	remove(const struct sockaddr_in &addr);
+
+	/* port only applies to single addresses (prefixLen 32) */
+	bool	addRule(struct in_addr addr, uint16_t port, int prefixLen);
+	bool	removeRule(struct in_addr addr, uint16_t port, int prefixLen);
+	bool	addRule(const std::string &rule);
+
+	/* returns the number of rules added, -1 if the file can't be read */
+	int	loadFile(const std::string &file);
+	void	clear();
+
+	/* counts a hit against the matching rule */
+	bool	isBlackListed(const struct sockaddr_in &addr);
+
+	uint32_t exactRules();
+	uint32_t rangeRules();
+	uint32_t hits();
+	void	getRules(std::list<bdBlackListRule> &rules);
+
+private:
+	class TrieNode
+	{
+	public:
+		int32_t mChild[2];
+		int32_t mRule;	/* -1 = none */
+	};
+
+	bool	parseRule(const std::string &rule, struct in_addr &addr,
+			uint16_t &port, int &prefixLen);
+	uint64_t exactKey(uint32_t addr, uint16_t port);
+	int32_t	newRule(struct in_addr addr, uint16_t port, int prefixLen);
+	void	freeRule(int32_t idx);
+	int32_t	findTrieNode(uint32_t hostAddr, int prefixLen, bool create);
+
+	std::vector<bdBlackListRule> mRules;
+	std::vector<int32_t> mFreeRules;
+
+	std::unordered_map<uint64_t, int32_t> mExact;
+	std::vector<TrieNode> mTrie;	/* mTrie[0] is the root (/0) */
+	uint32_t mRangeCount;
+
+	uint32_t mHits;
+};
+
+#endif
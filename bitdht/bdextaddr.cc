@@ -0,0 +1,207 @@
+/*
+ * bitdht/bdextaddr.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdextaddr.h"
+#include "util/bdlog.h"
+
+#include <math.h>
+#include <string.h>
+
+/***
+ * #define DEBUG_EXTADDR 1
+ ***/
+
+static uint64_t addrKey(const struct sockaddr_in *addr)
+{
+	return (((uint64_t) ntohl(addr->sin_addr.s_addr)) << 16) | ntohs(addr->sin_port);
+}
+
+bdExtAddrVote::bdExtAddrVote(uint32_t maxVoters)
+	:mMaxVoters(maxVoters), mCounterVotes(0)
+{
+	return;
+}
+
+void	bdExtAddrVote::vote(const struct sockaddr_in *voter, const struct sockaddr_in *reported, time_t now)
+{
+	mCounterVotes++;
+
+	/* the voter's IP alone: its port costs nothing to change */
+	uint64_t key = ntohl(voter->sin_addr.s_addr);
+	std::map<uint64_t, bdExtAddrVoter>::iterator it = mVoters.find(key);
+	if ((it == mVoters.end()) && (mVoters.size() >= mMaxVoters))
+	{
+		/* replace the oldest vote */
+		std::map<uint64_t, bdExtAddrVoter>::iterator oldest = mVoters.begin();
+		for(it = mVoters.begin(); it != mVoters.end(); it++)
+		{
+			if (it->second.mTS < oldest->second.mTS)
+			{
+				oldest = it;
+			}
+		}
+		mVoters.erase(oldest);
+	}
+
+#ifdef DEBUG_EXTADDR
+	LOG.info("bdExtAddrVote::vote() %s:%d says %s:%d", inet_ntoa(voter->sin_addr),
+			ntohs(voter->sin_port), inet_ntoa(reported->sin_addr), ntohs(reported->sin_port));
+#endif
+
+	bdExtAddrVoter &entry = mVoters[key];
+	entry.mReported = *reported;
+	entry.mTS = now;
+}
+
+uint64_t bdExtAddrVote::tally(std::map<uint64_t, double> &weights, time_t now)
+{
+	std::map<uint64_t, bdExtAddrVoter>::iterator it;
+	for(it = mVoters.begin(); it != mVoters.end(); it++)
+	{
+		time_t age = now - it->second.mTS;
+		if (age > BITDHT_EXTADDR_MAX_AGE)
+		{
+			continue;
+		}
+		if (age < 0)
+		{
+			age = 0;
+		}
+		weights[addrKey(&(it->second.mReported))] += pow(0.5, (double) age / BITDHT_EXTADDR_HALF_LIFE);
+	}
+
+	uint64_t bestKey = 0;
+	double bestWeight = 0;
+	std::map<uint64_t, double>::iterator wit;
+	for(wit = weights.begin(); wit != weights.end(); wit++)
+	{
+		if (wit->second > bestWeight)
+		{
+			bestKey = wit->first;
+			bestWeight = wit->second;
+		}
+	}
+	return bestKey;
+}
+
+bool	bdExtAddrVote::best(struct sockaddr_in &addr, time_t now)
+{
+	std::map<uint64_t, double> weights;
+	uint64_t key = tally(weights, now);
+	if (!key)
+	{
+		return false;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl((uint32_t) (key >> 16));
+	addr.sin_port = htons((uint16_t) (key & 0xffff));
+	return true;
+}
+
+uint32_t bdExtAddrVote::natType(time_t now)
+{
+	std::map<uint64_t, double> weights;
+	uint64_t bestKey = tally(weights, now);
+
+	/* of the live votes for our best address, how many name its best port */
+	uint32_t voters = 0;
+	double total = 0;
+	std::map<uint64_t, double>::iterator it;
+	for(it = weights.begin(); it != weights.end(); it++)
+	{
+		if ((it->first >> 16) == (bestKey >> 16))
+		{
+			total += it->second;
+		}
+	}
+	std::map<uint64_t, bdExtAddrVoter>::iterator vit;
+	for(vit = mVoters.begin(); vit != mVoters.end(); vit++)
+	{
+		if ((now - vit->second.mTS <= BITDHT_EXTADDR_MAX_AGE) &&
+				((addrKey(&(vit->second.mReported)) >> 16) == (bestKey >> 16)))
+		{
+			voters++;
+		}
+	}
+
+	if ((!bestKey) || (voters < BITDHT_EXTADDR_MIN_VOTERS))
+	{
+		return BITDHT_NAT_UNKNOWN;
+	}
+
+	/* a rebinding leaves a minority on the old port for a while */
+	if (weights[bestKey] * 2 > total)
+	{
+		return BITDHT_NAT_STABLE;
+	}
+	return BITDHT_NAT_PORT_CHANGING;
+}
+
+uint32_t bdExtAddrVote::portSpread(time_t now)
+{
+	std::map<uint64_t, double> weights;
+	uint64_t bestKey = tally(weights, now);
+
+	uint32_t low = 0xffff;
+	uint32_t high = 0;
+	std::map<uint64_t, double>::iterator it;
+	for(it = weights.begin(); it != weights.end(); it++)
+	{
+		if ((it->first >> 16) == (bestKey >> 16))
+		{
+			uint32_t port = it->first & 0xffff;
+			if (port < low)
+			{
+				low = port;
+			}
+			if (port > high)
+			{
+				high = port;
+			}
+		}
+	}
+	if (high < low)
+	{
+		return 0;
+	}
+	return high - low;
+}
+
+void	bdExtAddrVote::clear()
+{
+	mVoters.clear();
+	mCounterVotes = 0;
+}
+
+uint32_t bdExtAddrVote::size()
+{
+	return mVoters.size();
+}
+
+uint32_t bdExtAddrVote::votes()
+{
+	return mCounterVotes;
+}
+
@@ -0,0 +1,92 @@
+#ifndef BITDHT_EXT_ADDR_H
+#define BITDHT_EXT_ADDR_H
+
+/*
+ * bitdht/bdextaddr.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * External Address Vote.
+ *
+ * Each reply_myip tells us the address a peer saw our packets come
+ * from. Every peer (keyed by its IP, so one host answering from many
+ * ports is still one voter) has one vote - its latest report - whose
+ * weight halves every BITDHT_EXTADDR_HALF_LIFE, so a rebinding NAT or
+ * a lying peer is soon outvoted. The voter table is bounded, dropping
+ * the oldest vote. Only replies to our own ask_myip are counted.
+ *
+ * The spread of reported ports for our best address classifies the
+ * NAT: one port for everyone is stable (punching works), a different
+ * port per peer is port-changing (punching will need luck, or a relay).
+ ******/
+
+#include "util/bdnet.h"
+
+#include <map>
+#include <inttypes.h>
+#include <time.h>
+
+#define BITDHT_EXTADDR_MAX_VOTERS	64
+#define BITDHT_EXTADDR_HALF_LIFE	300	/* secs for a vote's weight to halve */
+#define BITDHT_EXTADDR_MAX_AGE		1800	/* secs before a vote is ignored */
+#define BITDHT_EXTADDR_MIN_VOTERS	3	/* before the NAT is classified */
+
+#define BITDHT_NAT_UNKNOWN		0
+#define BITDHT_NAT_STABLE		1	/* same external port for every peer */
+#define BITDHT_NAT_PORT_CHANGING	2	/* a new external port per peer */
+
+class bdExtAddrVoter
+{
+public:
+	struct sockaddr_in mReported;
+	time_t	mTS;
+};
+
+class bdExtAddrVote
+{
+public:
+	bdExtAddrVote(uint32_t maxVoters = BITDHT_EXTADDR_MAX_VOTERS);
+
+	/* voter says our packets came from reported */
+	void	vote(const struct sockaddr_in *voter, const struct sockaddr_in *reported, time_t now);
+	/* highest weighted endpoint, false if there are no live votes */
+	bool	best(struct sockaddr_in &addr, time_t now);
+	/* one of BITDHT_NAT_xxx */
+	uint32_t natType(time_t now);
+	/* highest - lowest port reported for the best address */
+	uint32_t portSpread(time_t now);
+	void	clear();
+
+	uint32_t size();
+	uint32_t votes();	/* received since the last clear */
+
+private:
+	/* sums the live weights, per endpoint. returns the best's key, 0 if none */
+	uint64_t tally(std::map<uint64_t, double> &weights, time_t now);
+
+	std::map<uint64_t, bdExtAddrVoter> mVoters;
+	uint32_t mMaxVoters;
+	uint32_t mCounterVotes;
+};
+
+#endif
+
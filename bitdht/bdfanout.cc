@@ -0,0 +1,147 @@
+/*
+ * bitdht/bdfanout.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdfanout.h"
+#include "util/bdlog.h"
+
+/***
+ * #define DEBUG_FANOUT 1
+ ***/
+
+#define USECS	1000000ULL
+
+bdFanoutSchedule::bdFanoutSchedule(time_t period, uint32_t maxPeers)
+	:mRoundNext(0), mRoundStart(0), mPeriod(period), mMaxPeers(maxPeers)
+{
+	return;
+}
+
+void	bdFanoutSchedule::addPeer(const bdId *id, time_t now, bool fixed)
+{
+	std::map<bdId, bdFanoutPeer>::iterator it = mPeers.find(*id);
+	if (it != mPeers.end())
+	{
+		it->second.mLastSeenTS = now;
+		it->second.mFixed |= fixed;
+		return;
+	}
+
+	bdFanoutPeer &peer = mPeers[*id];
+	peer.mLastSeenTS = now;
+	peer.mFixed = fixed;
+
+	if (mPeers.size() > mMaxPeers)
+	{
+		trim();
+	}
+}
+
+void	bdFanoutSchedule::duePeers(std::list<bdId> &due, uint64_t now)
+{
+	if ((mRoundNext >= mRound.size()) &&
+		((mRound.empty()) || (now >= mRoundStart + mPeriod * USECS)))
+	{
+		startRound(now);
+	}
+
+	if (mRound.empty())
+	{
+		return;
+	}
+
+	/* the fraction of the round that has elapsed, rounded up */
+	uint64_t elapsed = now - mRoundStart;
+	uint64_t target = mRound.size();
+	if (elapsed < mPeriod * USECS)
+	{
+		target = (mRound.size() * elapsed) / (mPeriod * USECS) + 1;
+	}
+
+	for(; (mRoundNext < target) && (mRoundNext < mRound.size()); mRoundNext++)
+	{
+		due.push_back(mRound[mRoundNext]);
+	}
+}
+
+void	bdFanoutSchedule::clear()
+{
+	mPeers.clear();
+	mRound.clear();
+	mRoundNext = 0;
+}
+
+uint32_t bdFanoutSchedule::size()
+{
+	return mPeers.size();
+}
+
+uint32_t bdFanoutSchedule::roundSize()
+{
+	return mRound.size();
+}
+
+void	bdFanoutSchedule::startRound(uint64_t now)
+{
+	time_t nowTS = now / USECS;
+
+	mRound.clear();
+	mRoundNext = 0;
+	mRoundStart = now;
+
+	std::map<bdId, bdFanoutPeer>::iterator it;
+	for(it = mPeers.begin(); it != mPeers.end();)
+	{
+		if ((!it->second.mFixed) &&
+			(it->second.mLastSeenTS + BITDHT_FANOUT_PEER_TTL < nowTS))
+		{
+			mPeers.erase(it++);
+			continue;
+		}
+		mRound.push_back(it->first);
+		it++;
+	}
+
+#ifdef DEBUG_FANOUT
+	LOG.info("bdFanoutSchedule::startRound() %u peers", (uint32_t) mRound.size());
+#endif
+}
+
+/* drop the least recently seen (non fixed) peer */
+void	bdFanoutSchedule::trim()
+{
+	std::map<bdId, bdFanoutPeer>::iterator it, oldest = mPeers.end();
+	for(it = mPeers.begin(); it != mPeers.end(); it++)
+	{
+		if ((!it->second.mFixed) && ((oldest == mPeers.end()) ||
+			(it->second.mLastSeenTS < oldest->second.mLastSeenTS)))
+		{
+			oldest = it;
+		}
+	}
+
+	if (oldest != mPeers.end())
+	{
+		mPeers.erase(oldest);
+	}
+}
+
@@ -0,0 +1,89 @@
+#ifndef BITDHT_FANOUT_H
+#define BITDHT_FANOUT_H
+
+/*
+ * bitdht/bdfanout.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * Rendezvous Fan-out Schedule.
+ *
+ * ask_myip and broadcast_conn are only understood by peers running
+ * this engine, so they go to peers that have shown they do: a pong
+ * with our engine's version, or one of the extension messages. Those
+ * peers (and any fixed ones, e.g. the whitelist) are visited once per
+ * period, spread evenly over it rather than all at once.
+ *
+ * Peers that haven't been seen for BITDHT_FANOUT_PEER_TTL are dropped;
+ * the list is bounded, dropping the least recently seen.
+ ******/
+
+#include "bitdht/bdpeer.h"
+
+#include <map>
+#include <list>
+#include <vector>
+
+#define BITDHT_FANOUT_PERIOD		10	/* secs for a round of every peer */
+#define BITDHT_FANOUT_MAX_PEERS		1000
+#define BITDHT_FANOUT_PEER_TTL		1800	/* secs since last seen */
+#define BITDHT_FANOUT_MAX_REQUESTS	8	/* broadcast_conns per peer per round */
+
+class bdFanoutPeer
+{
+public:
+	time_t	mLastSeenTS;
+	bool	mFixed;
+};
+
+class bdFanoutSchedule
+{
+public:
+	bdFanoutSchedule(time_t period = BITDHT_FANOUT_PERIOD,
+			uint32_t maxPeers = BITDHT_FANOUT_MAX_PEERS);
+
+	/* seen to be rendezvous capable. fixed peers never expire.
+	 * now is in secs of the clock duePeers() is given.
+	 */
+	void	addPeer(const bdId *id, time_t now, bool fixed = false);
+	/* peers due a visit by now (usecs). rounds restart as they finish */
+	void	duePeers(std::list<bdId> &due, uint64_t now);
+	void	clear();
+
+	uint32_t size();
+	uint32_t roundSize();
+
+private:
+	void	startRound(uint64_t now);
+	void	trim();
+
+	std::map<bdId, bdFanoutPeer> mPeers;
+	std::vector<bdId> mRound;
+	uint32_t mRoundNext;
+	uint64_t mRoundStart;
+
+	time_t	mPeriod;
+	uint32_t mMaxPeers;
+};
+
+#endif
+
@@ -170,6 +170,13 @@ class PacketCallback
 public:
 	// receive a dht packet
 	virtual void onRecvCallback(const bdId *id, int type) {};
+	// a rendezvous paired a and b's connection requests. nonce
+	// authorises a relay session for them: return false if there is
+	// none, and the ends are told not to relay (nonce 0).
+	virtual bool onPairedCallback(const bdId *a, const bdId *b, uint64_t nonce) { return false; };
+	// rendezvous node 'relay' paired our request with peer: relayed
+	// packets through it must carry nonce.
+	virtual void onRelayCallback(const bdId *relay, const bdId *peer, uint64_t nonce) {};
 };
 
 class BitDhtInterface
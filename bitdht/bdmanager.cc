@@ -71,6 +71,11 @@ bdNodeManager::bdNodeManager(bdNodeId *id,
 	mNetworkSize = 0;
 	mBdNetworkSize = 0;
 
+	mAddrCacheRevalidate = true;
+
+	mQueryPeriod = BITDHT_MGR_QUERY_PERIOD;
+	mMaxQueries = BITDHT_MGR_MAX_QUERIES;
+
 	/* setup a query for self */
 #ifdef DEBUG_MGR
 
@@ -86,12 +91,15 @@ int	bdNodeManager::stopDht()
 	/* clean up node */
 	shutdownNode();
 
-	/* flag queries as inactive */
-	/* check if exists already */
+	/* flag queries as inactive, and look them all up again on restart */
+	mQuerySchedule.clear();
+	mPrioritySchedule.clear();
+
 	std::map<bdNodeId, bdQueryPeer>::iterator it;
 	for(it = mActivePeers.begin(); it != mActivePeers.end(); it++)
 	{
 		it->second.mStatus = BITDHT_QUERY_READY;
+		scheduleQuery(it->second, now, now);
 	}
 
 	/* set state flag */
@@ -131,6 +139,30 @@ uint32_t bdNodeManager::statsBDVersionSize()
 	return mBdNetworkSize;
 }
 
+double	bdNodeManager::statsAddrCacheHitRate()
+{
+	return mAddrCache.hitRate();
+}
+
+void	bdNodeManager::setAddrCacheRevalidate(bool revalidate)
+{
+	mAddrCacheRevalidate = revalidate;
+}
+
+void	bdNodeManager::setQueryPeriod(time_t period)
+{
+	if (period < BITDHT_MGR_ACTIVE_FACTOR)
+	{
+		period = BITDHT_MGR_ACTIVE_FACTOR;
+	}
+	mQueryPeriod = period;
+}
+
+void	bdNodeManager::setMaxQueries(uint32_t maxQueries)
+{
+	mMaxQueries = maxQueries;
+}
+
 void bdNodeManager::addFindNode(bdNodeId *id, uint32_t qflags)
 {
 #ifdef DEBUG_MGR
@@ -152,11 +184,17 @@ void bdNodeManager::addFindNode(bdNodeId *id, uint32_t qflags)
 	peer.mId.id = (*id);
 	peer.mStatus = BITDHT_QUERY_READY; //QUERYING;
 	peer.mQFlags = qflags;
+	peer.mLastQuery = 0;
+	peer.mLastFound = 0;
+	peer.mLastUsed = 0;
+	peer.mNextQuery = 0;
 
 	peer.mDhtAddr.sin_addr.s_addr = 0;
 	peer.mDhtAddr.sin_port = 0;
 
+	time_t now = time(NULL);
 	mActivePeers[*id] = peer;
+	scheduleQuery(mActivePeers[*id], now, now);
 #ifdef DEBUG_MGR
 	LOG.info("bdNodeManager::addFindNode() Added QueryPeer as READY....");
 #endif
@@ -167,31 +205,76 @@ void bdNodeManager::addFindNode(bdNodeId *id, uint32_t qflags)
 	return;
 }
 
-/* finds a queued query, and starts it */
+/* starts due queries: actively used peers first, then the rest,
+ * until we run out of query slots. The remainder wait for the next cycle.
+ */
 void bdNodeManager::startQueries()
 {
 #ifdef DEBUG_MGR
 	LOG.info("bdNodeManager::startQueries() ");
 #endif
-	/* check if exists already */
-	std::map<bdNodeId, bdQueryPeer>::iterator it;	
-	for(it = mActivePeers.begin(); it != mActivePeers.end(); it++)
+	time_t now = time(NULL);
+	if (startScheduled(mPrioritySchedule, now))
+	{
+		startScheduled(mQuerySchedule, now);
+	}
+	return;
+}
+
+/* returns false if it stopped because all query slots are in use */
+bool bdNodeManager::startScheduled(std::multimap<time_t, bdNodeId> &schedule, time_t now)
+{
+	while((!schedule.empty()) && (schedule.begin()->first <= now))
 	{
-		if (it->second.mStatus == BITDHT_QUERY_READY)
+		if (queryCount() >= mMaxQueries)
 		{
+			return false;
+		}
+
+		std::multimap<time_t, bdNodeId>::iterator sit = schedule.begin();
+		time_t due = sit->first;
+		bdNodeId id = sit->second;
+		schedule.erase(sit);
+
+		/* skip peers that were removed, rescheduled or are already running */
+		std::map<bdNodeId, bdQueryPeer>::iterator it;
+		it = mActivePeers.find(id);
+		if ((it == mActivePeers.end()) || (it->second.mNextQuery != due) ||
+			(it->second.mStatus == BITDHT_QUERY_QUERYING))
+		{
+			continue;
+		}
+
 #ifdef DEBUG_MGR
-			LOG.info("bdNodeManager::startQueries() Found READY Query.");
+		LOG.info("bdNodeManager::startQueries() Starting Query: %s",
+				mFns->bdPrintNodeId(&id).c_str());
 #endif
-			it->second.mStatus = BITDHT_QUERY_QUERYING;
+		it->second.mStatus = BITDHT_QUERY_QUERYING;
+		it->second.mLastQuery = now;
+		it->second.mNextQuery = 0;
 
-			uint32_t qflags = it->second.mQFlags | BITDHT_QFLAGS_DISGUISE;
-			addQuery(&(it->first), qflags); 
+		uint32_t qflags = it->second.mQFlags | BITDHT_QFLAGS_DISGUISE;
+		addQuery(&(it->first), qflags);
+	}
+	return true;
+}
 
-			// add all queries at the same time!
-			//return;
-		}
+void bdNodeManager::scheduleQuery(bdQueryPeer &peer, time_t due, time_t now)
+{
+	peer.mNextQuery = due;
+	if (isActivePeer(peer, now))
+	{
+		mPrioritySchedule.insert(std::make_pair(due, peer.mId.id));
+	}
+	else
+	{
+		mQuerySchedule.insert(std::make_pair(due, peer.mId.id));
 	}
-	return;
+}
+
+bool bdNodeManager::isActivePeer(const bdQueryPeer &peer, time_t now)
+{
+	return ((peer.mLastUsed != 0) && (now - peer.mLastUsed < BITDHT_MGR_ACTIVE_USE_AGE));
 }
 
 
@@ -240,6 +323,8 @@ void bdNodeManager::removeAllFindNode()
 
 	/* remove all from map */
 	mActivePeers.clear();
+	mQuerySchedule.clear();
+	mPrioritySchedule.clear();
 	return;
 }
 
@@ -392,14 +477,43 @@ void bdNodeManager::iteration()
 	}
 }
 
+void bdNodeManager::fastIteration()
+{
+	if (mMode == BITDHT_MGR_STATE_OFF)
+	{
+		bdNode::iterationOff();
+	}
+	else
+	{
+		bdNode::processIncomingMsgs();
+		bdNode::sendPacedMsgs();
+	}
+}
+
+bool bdNodeManager::nextPacedSend(uint64_t &waitUsecs)
+{
+	if (mMode == BITDHT_MGR_STATE_OFF)
+	{
+		return false;
+	}
+	return bdNode::nextPacedSend(waitUsecs);
+}
 
 int bdNodeManager::status()
 {
 	/* do status of bdNode */
 	printState();
+	resetCycleStats();
 
 	checkStatus();
 
+	mAddrCache.cleanup(time(NULL));
+	LOG.info("bdNodeManager::status() AddrCache entries: %u hits: %u misses: %u hitrate: %.2lf",
+			mAddrCache.size(), mAddrCache.hits(), mAddrCache.misses(), mAddrCache.hitRate());
+	LOG.info("bdNodeManager::status() Tracked: %d Scheduled: %d Priority: %d Queries: %u/%u",
+			(int) mActivePeers.size(), (int) mQuerySchedule.size(),
+			(int) mPrioritySchedule.size(), queryCount(), mMaxQueries);
+
 	/* update the network numbers */
 	mNetworkSize = mNodeSpace.calcNetworkSize();
 	mBdNetworkSize = mNodeSpace.calcNetworkSizeWithFlag(
@@ -419,13 +533,11 @@ int bdNodeManager::checkStatus()
 	LOG.info("bdNodeManager::checkStatus()");
 #endif
 
-	/* check queries */
-	std::map<bdNodeId, bdQueryStatus>::iterator it;
-	std::map<bdNodeId, bdQueryStatus> queryStatus;
-
-	QueryStatus(queryStatus);
+	/* consume the query events (state changes / new matches) since last time */
+	bdQueryEvent event;
+	time_t now = time(NULL);
 
-	for (it = queryStatus.begin(); it != queryStatus.end(); it++)
+	while(popQueryEvent(event))
 	{
 		bool doPing = false;
 		bool doRemove = false;
@@ -433,15 +545,16 @@ int bdNodeManager::checkStatus()
 		bool doSaveAddress = false;
 		uint32_t callbackStatus = 0;
 
-		switch(it->second.mStatus)
+		switch(event.mStatus)
 		{
 		default:
 		case BITDHT_QUERY_QUERYING:
 		{
 #ifdef DEBUG_MGR
-			LOG.info("bdNodeManager::checkStatus() Query in Progress id: %s",
-					mFns->bdPrintNodeId(&(it->first)).c_str());
+			LOG.info("bdNodeManager::checkStatus() Query in Progress, found match id: %s",
+					mFns->bdPrintNodeId(&(event.mId)).c_str());
 #endif
+			doCallback = true;
 		}
 		break;
 
@@ -449,7 +562,7 @@ int bdNodeManager::checkStatus()
 		{
 #ifdef DEBUG_MGR
 			LOG.info("bdNodeManager::checkStatus() Query Failed: id: %s",
-					mFns->bdPrintNodeId(&(it->first)).c_str());
+					mFns->bdPrintNodeId(&(event.mId)).c_str());
 #endif
 			// BAD.
 			doRemove = true;
@@ -462,7 +575,7 @@ int bdNodeManager::checkStatus()
 		{
 #ifdef DEBUG_MGR
 			LOG.info("bdNodeManager::checkStatus() Found Closest: id: %s",
-					mFns->bdPrintNodeId(&(it->first)).c_str());
+					mFns->bdPrintNodeId(&(event.mId)).c_str());
 #endif
 
 			doRemove = true;
@@ -475,7 +588,7 @@ int bdNodeManager::checkStatus()
 		{
 #ifdef DEBUG_MGR
 			LOG.info("bdNodeManager::checkStatus() the Peer Online but Unreachable: id: %s",
-					mFns->bdPrintNodeId(&(it->first)).c_str());
+					mFns->bdPrintNodeId(&(event.mId)).c_str());
 #endif
 
 			doRemove = true;
@@ -488,7 +601,7 @@ int bdNodeManager::checkStatus()
 		{
 #ifdef DEBUG_MGR
 			LOG.info("bdNodeManager::checkStatus() Found Query: id: %s",
-					mFns->bdPrintNodeId(&(it->first)).c_str());
+					mFns->bdPrintNodeId(&(event.mId)).c_str());
 #endif
 			//foundId =
 			doRemove = true;
@@ -502,7 +615,7 @@ int bdNodeManager::checkStatus()
 		/* remove done queries */
 		if (doRemove) 
 		{
-			if (it->second.mQFlags & BITDHT_QFLAGS_DO_IDLE)
+			if (event.mQFlags & BITDHT_QFLAGS_DO_IDLE)
 			{
 				doRemove = false;
 			}
@@ -512,14 +625,20 @@ int bdNodeManager::checkStatus()
 		{
 #ifdef DEBUG_MGR
 			LOG.info("bdNodeManager::checkStatus() Removing query: id: %s",
-					mFns->bdPrintNodeId(&(it->first)).c_str());
+					mFns->bdPrintNodeId(&(event.mId)).c_str());
 #endif
-			clearQuery(&(it->first));
+			clearQuery(&(event.mId));
+		}
+
+		/* remember where we found it, for repeat resolutions */
+		if ((doSaveAddress) && (event.mResults.size() > 0) && (!(event.mId == mOwnId)))
+		{
+			mAddrCache.addAddress(&(event.mId), &(event.mResults.front().addr), now);
 		}
 
 		/* FIND in activePeers */
 		std::map<bdNodeId, bdQueryPeer>::iterator pit;
-		pit = mActivePeers.find(it->first);
+		pit = mActivePeers.find(event.mId);
 
 		if (pit == mActivePeers.end())
 		{
@@ -528,41 +647,37 @@ int bdNodeManager::checkStatus()
 			doCallback = false;
 #ifdef DEBUG_MGR
 			LOG.info("bdNodeManager::checkStatus() Internal: no cb for id: %s",
-					mFns->bdPrintNodeId(&(it->first)).c_str());
+					mFns->bdPrintNodeId(&(event.mId)).c_str());
 #endif
 		}
 		else
 		{
-			if (pit->second.mStatus == it->second.mStatus)
-			{
-				/* status is unchanged */
-				doPing = false;
-				// always callback
-				doCallback = true;
-
 #ifdef DEBUG_MGR
-				LOG.info("bdNodeManager::checkStatus() Status unchanged for :%s status: %d",
-						mFns->bdPrintNodeId(&(it->first)).c_str(), it->second.mStatus);
+			LOG.info("bdNodeManager::checkStatus() Updating External Status for : %s to: %d",
+					mFns->bdPrintNodeId(&(event.mId)).c_str(), event.mStatus);
 #endif
-			}
-			else
-			{
+			/* update status */
+			pit->second.mStatus = event.mStatus;
 
-#ifdef DEBUG_MGR
-				LOG.info("bdNodeManager::checkStatus() Updating External Status for : %s to: %d",
-						mFns->bdPrintNodeId(&(it->first)).c_str(), it->second.mStatus);
-#endif
-				/* update status */
-				pit->second.mStatus = it->second.mStatus;
+			/* finished - schedule the next lookup, jittered over [period/2, 3*period/2) */
+			if (doRemove)
+			{
+				time_t period = mQueryPeriod;
+				if (isActivePeer(pit->second, now))
+				{
+					period /= BITDHT_MGR_ACTIVE_FACTOR;
+				}
+				scheduleQuery(pit->second, now + period / 2 + rand() % period, now);
 			}
 
 			if (doSaveAddress)
 			{
-				if (it->second.mResults.size() > 0)
+				pit->second.mLastFound = now;
+				if (event.mResults.size() > 0)
 				{
-					pit->second.mDhtAddr = it->second.mResults.front().addr;
+					pit->second.mDhtAddr = event.mResults.front().addr;
 
-					//doNodeCallback(&(it->second.mResults.front()), 0);
+					//doNodeCallback(&(event.mResults.front()), 0);
 				}
 				else
 				{
@@ -577,7 +692,7 @@ int bdNodeManager::checkStatus()
 		{
 #ifdef DEBUG_MGR
 			LOG.info("bdNodeManager::checkStatus() Starting Ping (TODO): id: %s",
-					mFns->bdPrintNodeId(&(it->first)).c_str());
+					mFns->bdPrintNodeId(&(event.mId)).c_str());
 #endif
 			/* add first matching peer */
 			//addPeerPing(foundId);
@@ -588,15 +703,12 @@ int bdNodeManager::checkStatus()
 		{
 #ifdef DEBUG_MGR
 			LOG.info("bdNodeManager::checkStatus() Doing Callback: id: %s",
-					mFns->bdPrintNodeId(&(it->first)).c_str());
+					mFns->bdPrintNodeId(&(event.mId)).c_str());
 #endif
 
-			std::list<bdPeer> list;
-			if (getIdFromQuery(&(it->first), list)) {
-				std::list<bdPeer>::iterator it;
-				for (it = list.begin(); it != list.end(); it++) {
-					doPeerCallback(&(*it), callbackStatus);
-				}
+			std::list<bdPeer>::iterator mit;
+			for (mit = event.mMatches.begin(); mit != event.mMatches.end(); mit++) {
+				doPeerCallback(&(*mit), callbackStatus);
 			}
 		}
 	}
@@ -717,6 +829,7 @@ int bdNodeManager::getDhtPeerAddress(const bdNodeId *id, struct sockaddr_in &fro
 
 	std::map<bdNodeId, bdQueryPeer>::iterator pit;
 	pit = mActivePeers.find(*id);
+	time_t now = time(NULL);
 
 	LOG.info(("bdNodeManager::getDhtPeerAddress() Id: " + mFns->bdPrintNodeId(id)).c_str());
 
@@ -724,6 +837,16 @@ int bdNodeManager::getDhtPeerAddress(const bdNodeId *id, struct sockaddr_in &fro
 	{
 		LOG.info("bdNodeManager::getDhtPeerAddress() Found ActiveQuery");
 
+		/* the application is using this peer: bring its next lookup forward */
+		bool wasActive = isActivePeer(pit->second, now);
+		pit->second.mLastUsed = now;
+
+		time_t period = mQueryPeriod / BITDHT_MGR_ACTIVE_FACTOR;
+		if ((!wasActive) && (pit->second.mNextQuery > now + period))
+		{
+			scheduleQuery(pit->second, now + rand() % period, now);
+		}
+
 		if (pit->second.mStatus == BITDHT_QUERY_SUCCESS)
 		{
 			from = pit->second.mDhtAddr;
@@ -734,6 +857,23 @@ int bdNodeManager::getDhtPeerAddress(const bdNodeId *id, struct sockaddr_in &fro
 			return 1;
 		}
 	}
+
+	/* fall back to a recently resolved address */
+	if (mAddrCache.lookup(id, from, now))
+	{
+		LOG.info("bdNodeManager::getDhtPeerAddress() Found Cached Address:%s:%d",
+				inet_ntoa(from.sin_addr), htons(from.sin_port));
+
+		if ((mAddrCacheRevalidate) && (mAddrCache.needsRevalidation(id, now)))
+		{
+			/* single ping - the pong refreshes the entry via addPeer() */
+			bdId pid(*id, from);
+			bdToken transId;
+			genNewTransId(&transId);
+			msgout_ping(&pid, &transId);
+		}
+		return 1;
+	}
 	return 0;
 }
 
@@ -790,6 +930,20 @@ void bdNodeManager::addPeer(const bdId *id, uint32_t peerflags)
 #endif
 	doNodeCallback(id, peerflags);
 
+	/* a pong confirms the address of tracked and cached peers */
+	if (peerflags & BITDHT_PEER_STATUS_RECV_PONG)
+	{
+		time_t now = time(NULL);
+		if (mActivePeers.find(id->id) != mActivePeers.end())
+		{
+			mAddrCache.addAddress(&(id->id), &(id->addr), now);
+		}
+		else
+		{
+			mAddrCache.refreshAddress(&(id->id), &(id->addr), now);
+		}
+	}
+
 	// call parent.
 	bdNode::addPeer(id, peerflags);
 
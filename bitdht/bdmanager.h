@@ -55,6 +55,7 @@
 
 #include "bdiface.h"
 #include "bdnode.h"
+#include "bdaddrcache.h"
 
 
 
@@ -66,6 +67,8 @@ public:
 	uint32_t mQFlags;
 	time_t mLastQuery;
 	time_t mLastFound;
+	time_t mLastUsed;	/* last getDhtPeerAddress() */
+	time_t mNextQuery;	/* scheduled re-lookup */
 	struct sockaddr_in mDhtAddr;
 };
 
@@ -81,6 +84,16 @@ public:
 #define MAX_STARTUP_TIME 10
 #define MAX_REFRESH_TIME 10
 
+/* Re-lookup schedule for tracked peers.
+ * Each id is looked up again every BITDHT_MGR_QUERY_PERIOD (+/- 50%, so the
+ * load spreads out), ids the application is using BITDHT_MGR_ACTIVE_FACTOR
+ * times as often. Never more than BITDHT_MGR_MAX_QUERIES running at once.
+ */
+#define BITDHT_MGR_QUERY_PERIOD		1800
+#define BITDHT_MGR_ACTIVE_FACTOR	4
+#define BITDHT_MGR_ACTIVE_USE_AGE	300
+#define BITDHT_MGR_MAX_QUERIES		64
+
 #define BITDHT_MGR_QUERY_FAILURE			1
 #define BITDHT_MGR_QUERY_PEER_OFFLINE		2
 #define BITDHT_MGR_QUERY_PEER_UNREACHABLE	3
@@ -103,6 +116,9 @@ public:
 			bdDhtFunctions *fns, PacketCallback *packetCallback);
 
 	void iteration();
+	/* between iterations: handle received messages, and send what the rate controller allows */
+	void fastIteration();
+	bool nextPacedSend(uint64_t &waitUsecs);
 
 	/***** Functions to Call down to bdNodeManager ****/
 	/* Request DHT Peer Lookup */
@@ -126,6 +142,14 @@ public:
 	virtual int stateDht(); /* STOPPED, STARTING, ACTIVE, FAILED */
 	virtual uint32_t statsNetworkSize();
 	virtual uint32_t statsBDVersionSize(); /* same version as us! */
+	double	statsAddrCacheHitRate();
+
+	/* ping cached addresses that are getting old, when they are handed out */
+	void	setAddrCacheRevalidate(bool revalidate);
+
+	/* re-lookup scheduling of tracked peers */
+	void	setQueryPeriod(time_t period);
+	void	setMaxQueries(uint32_t maxQueries);
 	/******************* Internals *************************/
 
 	// Overloaded from bdnode for external node callback.
@@ -145,10 +169,22 @@ private:
 	int 	checkPingStatus();
 	int 	SearchOutOfDate();
 	void	startQueries();
+	void	scheduleQuery(bdQueryPeer &peer, time_t due, time_t now);
+	bool	startScheduled(std::multimap<time_t, bdNodeId> &schedule, time_t now);
+	bool	isActivePeer(const bdQueryPeer &peer, time_t now);
 
 	std::map<bdNodeId, bdQueryPeer>	mActivePeers;
 	std::list<BitDhtCallback *> mCallbacks;
 
+	bdAddrCache mAddrCache;
+	bool mAddrCacheRevalidate;
+
+	/* due time -> id. entries are checked against mNextQuery when popped */
+	std::multimap<time_t, bdNodeId> mQuerySchedule;
+	std::multimap<time_t, bdNodeId> mPrioritySchedule;
+	time_t mQueryPeriod;
+	uint32_t mMaxQueries;
+
 	uint32_t mMode;
 	time_t   mModeTS;
 
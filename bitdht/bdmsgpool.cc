@@ -0,0 +1,186 @@
+/*
+ * bitdht/bdmsgpool.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdmsgpool.h"
+#include "util/bdlog.h"
+
+#include <string.h>
+
+/***
+ * #define DEBUG_MSGPOOL 1
+ ***/
+
+bdMsgQueue::bdMsgQueue()
+	:mHead(NULL), mTail(NULL), mCount(0)
+{
+	return;
+}
+
+void	bdMsgQueue::push(bdMsgSlot *slot)
+{
+	slot->mNext = NULL;
+	if (mTail)
+	{
+		mTail->mNext = slot;
+	}
+	else
+	{
+		mHead = slot;
+	}
+	mTail = slot;
+	mCount++;
+}
+
+bdMsgSlot *bdMsgQueue::pop()
+{
+	bdMsgSlot *slot = mHead;
+	if (!slot)
+	{
+		return NULL;
+	}
+
+	mHead = slot->mNext;
+	if (!mHead)
+	{
+		mTail = NULL;
+	}
+	slot->mNext = NULL;
+	mCount--;
+	return slot;
+}
+
+bdMsgSlot *bdMsgQueue::front()
+{
+	return mHead;
+}
+
+bool	bdMsgQueue::empty()
+{
+	return (mHead == NULL);
+}
+
+uint32_t bdMsgQueue::size()
+{
+	return mCount;
+}
+
+/******************************************************************/
+
+bdMsgPool::bdMsgPool(uint32_t capacity)
+	:mCapacity(capacity), mHighWater(0), mDrops(0)
+{
+	mSlots = new bdMsgSlot[capacity];
+	for(uint32_t i = 0; i < capacity; i++)
+	{
+		mFree.push(&(mSlots[i]));
+	}
+}
+
+bdMsgPool::~bdMsgPool()
+{
+	delete [] mSlots;
+}
+
+bdMsgSlot *bdMsgPool::alloc()
+{
+	bdMsgSlot *slot = mFree.pop();
+	if (!slot)
+	{
+		mDrops++;
+#ifdef DEBUG_MSGPOOL
+		LOG.info("bdMsgPool::alloc() pool exhausted (%u slots), drops: %u", mCapacity, mDrops);
+#endif
+		return NULL;
+	}
+
+	if (inUse() > mHighWater)
+	{
+		mHighWater = inUse();
+	}
+	slot->mRepeat = 1;
+	return slot;
+}
+
+bdMsgSlot *bdMsgPool::alloc(const char *data, int size, const struct sockaddr_in *addr)
+{
+	if ((size < 0) || (size > BITDHT_MSGPOOL_SLOT_SIZE))
+	{
+		mDrops++;
+#ifdef DEBUG_MSGPOOL
+		LOG.info("bdMsgPool::alloc() message too big: %d", size);
+#endif
+		return NULL;
+	}
+
+	bdMsgSlot *slot = alloc();
+	if (!slot)
+	{
+		return NULL;
+	}
+
+	memcpy(slot->data, data, size);
+	slot->mSize = size;
+	slot->addr = *addr;
+	return slot;
+}
+
+void	bdMsgPool::release(bdMsgSlot *slot)
+{
+	mFree.push(slot);
+}
+
+void	bdMsgPool::discard(bdMsgSlot *slot)
+{
+	mDrops++;
+	mFree.push(slot);
+}
+
+void	bdMsgPool::release(bdMsgQueue &queue)
+{
+	bdMsgSlot *slot;
+	while(NULL != (slot = queue.pop()))
+	{
+		mFree.push(slot);
+	}
+}
+
+uint32_t bdMsgPool::capacity()
+{
+	return mCapacity;
+}
+
+uint32_t bdMsgPool::inUse()
+{
+	return mCapacity - mFree.size();
+}
+
+uint32_t bdMsgPool::highWater()
+{
+	return mHighWater;
+}
+
+uint32_t bdMsgPool::drops()
+{
+	return mDrops;
+}
+
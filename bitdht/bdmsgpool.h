@@ -0,0 +1,104 @@
+#ifndef BITDHT_MSG_POOL_H
+#define BITDHT_MSG_POOL_H
+
+/*
+ * bitdht/bdmsgpool.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * Message Buffer Pool.
+ *
+ * Datagrams waiting to be processed or sent are held in fixed size
+ * slots, allocated once up front. A slot is linked into one queue at a
+ * time through its own mNext pointer - the pool's free list, or a
+ * bdMsgQueue - so queueing and recycling never touch the allocator.
+ *
+ * When the pool is exhausted (or a datagram won't fit in a slot) the
+ * message is dropped and counted. The high-water mark shows how close
+ * to capacity the pool has come.
+ ******/
+
+#include "util/bdnet.h"
+#include <inttypes.h>
+
+#define BITDHT_MSGPOOL_SLOT_SIZE	1500	/* one ethernet MTU */
+
+class bdMsgSlot
+{
+public:
+	char data[BITDHT_MSGPOOL_SLOT_SIZE];
+	int mSize;
+	struct sockaddr_in addr;
+	int mRepeat;	/* copies to send back to back, 1 from alloc() */
+
+	bdMsgSlot *mNext; /* intrusive link - owned by whichever queue holds the slot */
+};
+
+/* intrusive FIFO of slots */
+class bdMsgQueue
+{
+public:
+	bdMsgQueue();
+
+	void	push(bdMsgSlot *slot);
+	bdMsgSlot *pop();	/* NULL if empty */
+	bdMsgSlot *front();
+	bool	empty();
+	uint32_t size();
+
+private:
+	bdMsgSlot *mHead;
+	bdMsgSlot *mTail;
+	uint32_t mCount;
+};
+
+class bdMsgPool
+{
+public:
+	bdMsgPool(uint32_t capacity);
+	~bdMsgPool();
+
+	/* NULL (and a drop is counted) if the pool is exhausted */
+	bdMsgSlot *alloc();
+	/* copies the datagram into a new slot, NULL if full or too big */
+	bdMsgSlot *alloc(const char *data, int size, const struct sockaddr_in *addr);
+	void	release(bdMsgSlot *slot);
+	/* releases a slot whose message couldn't be sent, counting a drop */
+	void	discard(bdMsgSlot *slot);
+	/* releases every slot in the queue */
+	void	release(bdMsgQueue &queue);
+
+	uint32_t capacity();
+	uint32_t inUse();
+	uint32_t highWater();
+	uint32_t drops();
+
+private:
+	bdMsgSlot *mSlots;
+	bdMsgQueue mFree;
+	uint32_t mCapacity;
+	uint32_t mHighWater;
+	uint32_t mDrops;
+};
+
+#endif
+
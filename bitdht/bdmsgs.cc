@@ -614,7 +614,7 @@ int bitdht_broadcast_conn_msg(bdToken *tid, bdNodeId *id, bdNodeId *nodeId, bdNo
 B: Hi nodeId! peerId with IP want to connect you.
 */
 int bitdht_ask_conn_msg(bdToken *tid, bdNodeId *id, bdNodeId *nodeId, bdId *peerId,
-		char *msg, int avail)
+		uint64_t relayNonce, char *msg, int avail)
 {
 #ifdef DEBUG_MSGS
 	LOG.info("bitdht_ask_conn_msg()\n");
@@ -636,6 +636,17 @@ int bitdht_ask_conn_msg(bdToken *tid, bdNodeId *id, bdNodeId *nodeId, bdId *peer
 	be_add_keypair(iddict, "nid", nidnode);
 	be_add_keypair(iddict, "pid", pidnode);
 
+	if (relayNonce)
+	{
+		/* 8 bytes, network order */
+		char nonce[8];
+		for(int i = 0; i < 8; i++)
+		{
+			nonce[i] = (relayNonce >> (8 * (7 - i))) & 0xff;
+		}
+		be_add_keypair(iddict, "rn", be_create_str_wlen(nonce, 8));
+	}
+
 	be_add_keypair(dict, "a", iddict);
 
 	be_add_keypair(dict, "q", ask);
@@ -1121,3 +1132,17 @@ int beMsgGetUInt32(be_node *n, uint32_t *port)
 	return 1;
 }
 
+int beMsgGetNonce(be_node *n, uint64_t &nonce)
+{
+	if ((n->type != BE_STR) || (be_str_len(n) != 8))
+	{
+		return 0;
+	}
+	nonce = 0;
+	for(int i = 0; i < 8; i++)
+	{
+		nonce = (nonce << 8) | (unsigned char) n->val.s[i];
+	}
+	return 1;
+}
+
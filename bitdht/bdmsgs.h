@@ -90,8 +90,9 @@ int bitdht_reply_myip_msg(bdToken *tid, bdNodeId *id, bdId *peerId,
 		char *msg, bool started, int avail);
 int bitdht_broadcast_conn_msg(bdToken *tid, bdNodeId *id, bdNodeId *nodeId, bdNodeId *peerId,
 		char *msg, int avail);
+/* relayNonce: authorises a relay session through us, 0 for none */
 int bitdht_ask_conn_msg(bdToken *tid, bdNodeId *id, bdNodeId *nodeId, bdId *peerId,
-		char *msg, int avail);
+		uint64_t relayNonce, char *msg, int avail);
 int bitdht_reply_conn_msg(bdToken *tid, bdNodeId *id, bool started,
 		char *msg, int avail);
 
@@ -117,6 +118,7 @@ int beMsgGetListBdIds(be_node *n, std::list<bdId> &nodes);
 
 int beMsgGetListStrings(be_node *n, std::list<std::string> &values);
 int beMsgGetUInt32(be_node *n, uint32_t *port);
+int beMsgGetNonce(be_node *n, uint64_t &nonce);
 
 /* Low Level conversion functions */
 int decodeCompactPeerId(struct sockaddr_in *addr, char *enc, int len);
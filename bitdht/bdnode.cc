@@ -30,6 +30,7 @@
 
 #include "util/bdnet.h"
 #include "util/bdlog.h"
+#include "util/bdtime.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -38,13 +39,27 @@
 #include <iostream>
 #include <iomanip>
 #include <sstream>
-#include <atomic>
+#include <algorithm>
+#include <vector>
 
 
 #define BITDHT_QUERY_START_PEERS    10
 #define BITDHT_QUERY_NEIGHBOUR_PEERS    8
 #define BITDHT_MAX_REMOTE_QUERY_AGE	10
 
+/* remote queries are answered inline as they arrive, then from the queue,
+ * as the reply rate allows (bdratectrl.h). The queue is drained within
+ * a time budget, and beyond BITDHT_MAX_REMOTE_QUERIES the oldest are shed.
+ */
+#define BITDHT_REMOTE_QUERY_MAX_USECS	50000
+#define BITDHT_MAX_REMOTE_QUERIES	2000
+
+/* lookups whose targets share at least this many leading bits
+ * can share a find_node reply from the same peer.
+ */
+#define BITDHT_COALESCE_PREFIX_BITS	16
+#define BITDHT_COALESCE_MAX_AGE		10
+
 /****
  * #define USE_HISTORY	1
  *
@@ -71,8 +86,17 @@ bdNode::bdNode(bdNodeId *ownId,
 		mOwnId(*ownId), mNodeSpace(ownId, fns),
 		mStore(bootfile, fns),
 		mWhiteNodes(whitelist, fns),
-		mDhtVersion(dhtVersion), mFns(fns), mPacketCallback(packetCallback)
+		mDhtVersion(dhtVersion), mFns(fns), mPacketCallback(packetCallback),
+		mOutgoingPool(BITDHT_NODE_OUTGOING_SLOTS),
+		mIncomingShards(1),
+		mRandomTokens(BITDHT_NODE_TOKEN_WINDOW)
 {
+	mIncomingRings[0] = new bdRing<bdMsgSlot>(BITDHT_NODE_INCOMING_SLOTS);
+	for(int i = 1; i < BITDHT_NODE_MAX_SHARDS; i++)
+	{
+		mIncomingRings[i] = NULL;
+	}
+
 	timeval t1;
 	gettimeofday(&t1, NULL);
 	unsigned int seed =  t1.tv_usec * t1.tv_sec;
@@ -86,9 +110,22 @@ bdNode::bdNode(bdNodeId *ownId,
 	}
 	srand((seed + seed2) % (unsigned int)-1);
 
+	mRandom.seed(((uint64_t) seed2 << 32) ^ bdClockUsecs() ^ (uint64_t) (uintptr_t) this);
+	mTransIdCounter = mRandom.next32();
+
+	mQueryTurns = 0;
+	mFanoutCursor = 0;
 	resetStats();
 }
 
+bdNode::~bdNode()
+{
+	for(int i = 0; i < BITDHT_NODE_MAX_SHARDS; i++)
+	{
+		delete mIncomingRings[i];
+	}
+}
+
 void bdNode::getOwnId(bdNodeId *id)
 {
 	*id = mOwnId;
@@ -111,6 +148,7 @@ void bdNode::restartNode()
 	list = mWhiteNodes.getStore();
 	for (std::list<bdPeer>::iterator it = list.begin(); it != list.end(); ++it) {
 		addPotentialPeer(&(it->mPeerId));
+		mFanout.addPeer(&(it->mPeerId), bdClockUsecs() / 1000000, true);
 	}
 }
 
@@ -119,6 +157,14 @@ void bdNode::shutdownNode()
 	/* clear the queries */
 	mLocalQueries.clear();
 	mRemoteQueries.clear();
+	mInFlightQueries.clear();
+	mTransTable.clear();
+	mQueryEvents.clear();
+	mQueryTurns = 0;
+	mPunch.clear();
+	mRendezvous.clear();
+	mFanout.clear();
+	mFanoutCursor = 0;
 
 	/* clear the space */
 	mNodeSpace.clear();
@@ -129,14 +175,7 @@ void bdNode::shutdownNode()
 	mStore.clear();
 
 	/* clean up any outgoing messages */
-	while(mOutgoingMsgs.size() > 0)
-	{
-		bdNodeNetMsg *msg = mOutgoingMsgs.front();
-		mOutgoingMsgs.pop_front();
-
-		/* cleanup message */
-		delete msg;
-	}
+	mOutgoingPool.release(mOutgoingMsgs);
 }
 
 /* Crappy initial store... use bdspace as answer */
@@ -166,10 +205,12 @@ void bdNode::printQueries()
 	LOG.info(("bdNode::printQueries() for Peer: " +
 			mFns->bdPrintNodeId(&mOwnId)).c_str());
 
-	std::list<sockaddr_in>::iterator itp;
-	for (itp = mMyIPs.begin(); itp != mMyIPs.end(); itp++) {
-		LOG.info("bdNode::printQueries() my IP is %s:%d",
-				inet_ntoa(itp->sin_addr), htons(itp->sin_port));
+	sockaddr_in extAddr;
+	time_t now = time(NULL);
+	if (mExtAddr.best(extAddr, now)) {
+		LOG.info("bdNode::printQueries() my IP is %s:%d (NAT type %u, port spread %u, %u voters)",
+				inet_ntoa(extAddr.sin_addr), htons(extAddr.sin_port),
+				mExtAddr.natType(now), mExtAddr.portSpread(now), mExtAddr.size());
 	}
 
 	int i = 0;
@@ -184,27 +225,96 @@ void bdNode::printQueries()
 void bdNode::iterationOff()
 {
 	/* clean up any incoming messages */
-	while(mIncomingMsgs.size() > 0)
+	uint32_t shards = mIncomingShards.load(std::memory_order_acquire);
+	for(uint32_t i = 0; i < shards; i++)
 	{
-		bdNodeNetMsg *msg = mIncomingMsgs.front();
-		mIncomingMsgs.pop_front();
+		while (NULL != mIncomingRings[i]->front())
+		{
+			mIncomingRings[i]->pop();
+		}
+	}
+}
 
-		/* cleanup message */
-		delete msg;
+/* also called between iterations, as soon as messages arrive.
+ * messages are handled in place, in the ring's cell. The shards
+ * take turns a message at a time, so a busy one can't starve the rest.
+ */
+void bdNode::processIncomingMsgs()
+{
+	uint32_t shards = mIncomingShards.load(std::memory_order_acquire);
+	bool more = true;
+	while(more)
+	{
+		more = false;
+		for(uint32_t i = 0; i < shards; i++)
+		{
+			bdMsgSlot *msg = mIncomingRings[i]->front();
+			if (msg)
+			{
+				recvPkt(msg->data, msg->mSize, msg->addr);
+				mIncomingRings[i]->pop();
+				more = true;
+			}
+		}
 	}
 }
 
-void bdNode::punching(int times)
+/* the rings are published before the count, so a receive thread
+ * never sees a shard without its ring.
+ */
+void bdNode::setIncomingShards(uint32_t shards)
 {
-	std::list<bdId>::iterator it;
-	for (it = mPunching.begin(); it != mPunching.end(); it++) {
+	if (shards > BITDHT_NODE_MAX_SHARDS)
+	{
+		shards = BITDHT_NODE_MAX_SHARDS;
+	}
+
+	uint32_t current = mIncomingShards.load(std::memory_order_relaxed);
+	if (shards <= current)
+	{
+		return;
+	}
+
+	for(uint32_t i = current; i < shards; i++)
+	{
+		mIncomingRings[i] = new bdRing<bdMsgSlot>(BITDHT_NODE_INCOMING_SLOTS);
+	}
+	mIncomingShards.store(shards, std::memory_order_release);
+}
+
+/* punch bursts are sent as a single datagram, repeated by the udp layer.
+ * they are charged to the ping budget, not limited by it: the peer is
+ * punching towards us at the same time.
+ */
+void bdNode::sendPunchBursts(uint64_t now)
+{
+	bdId id;
+	uint32_t count;
+	while(mPunch.nextBurst(id, count, now))
+	{
+		bdMsgSlot *slot = mOutgoingPool.alloc();
+		if (!slot)
+		{
+			return;	/* dropped, counted by the pool */
+		}
+
+		/* only once there is a slot: no transaction for a ping never sent */
 		bdToken transId;
 		genNewTransId(&transId);
-		for (int i = 0; i < times; i++) {
-			msgout_ping(&(*it), &transId);
+		registerOutgoingMsg(&id, &transId, BITDHT_MSG_TYPE_PING);
+
+		int blen = bitdht_create_ping_msg(&transId, &(mOwnId), slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
+		sendSlot(slot, blen, id.addr, count);
+
+		for(uint32_t i = 0; i < count; i++)
+		{
+			mRateCtrl.charge(BITDHT_RATE_PING, now);
 		}
-		LOG.info("bdNode::iteration() Punching Peer: %s",
-				mFns->bdPrintId(&(*it)).c_str());
+
+#ifdef DEBUG_NODE_ACTIONS
+		LOG.info("bdNode::sendPunchBursts() Punching Peer: %s x%u",
+				mFns->bdPrintId(&id).c_str(), count);
+#endif
 	}
 }
 
@@ -217,92 +327,91 @@ void bdNode::iteration()
 	/* iterate through queries */
 
 	bdId id;
-	bdNodeId targetNodeId;
 	std::list<bdQuery>::iterator it;
 	//	std::list<bdId>::iterator bit;
 
-	/* process incoming msgs */
-	while (mIncomingMsgs.size() > 0)
-	{
-		bdNodeNetMsg *msg = mIncomingMsgs.front();
-		mIncomingMsgs.pop_front();
+	processIncomingMsgs();
 
-		recvPkt(msg->data, msg->mSize, msg->addr);
+	/* Outgoing pings, find_node requests and replies are paced by the
+	 * rate controller (bdratectrl.h). Whatever it allows goes out now,
+	 * the rest from sendPacedMsgs() between iterations, as tokens become
+	 * available - rather than in a burst here once per second.
+	 *
+	 * each query still gets one find_node request per iteration.
+	 */
+	mQueryTurns = mLocalQueries.size();
+	sendPacedMsgs();
 
-		/* cleanup message */
-		delete msg;
+	std::list<bdQuery *>::iterator qit;
+	for(qit = mLocalQueries.begin(); qit != mLocalQueries.end(); qit++)
+	{
+		if (((*qit)->mState != BITDHT_QUERY_QUERYING) && (!(*qit)->mPathRecorded))
+		{
+			recordQueryPath(*qit);
+		}
 	}
 
-	/* assume that this is called once per second... limit the messages 
-	 * in theory, a query can generate up to 10 peers (which will all require a ping!).
-	 * we want to handle all the pings we can... so we don't hold up the process.
-	 * but we also want enough queries to keep things moving.
-	 * so allow up to 90% of messages to be pings.
-	 *
-	 * ignore responses to other peers... as the number is very small generally
-	 */
+	cleanupInFlightQueries();
+	cleanupTransIdRegister();
+	mPotentialPeers.cleanup(time(NULL));
+	mRendezvous.expire(bdClockUsecs());
+	checkQueryEvents();
 
-#define BDNODE_MESSAGE_RATE_HIGH 	1
-#define BDNODE_MESSAGE_RATE_MED 	2
-#define BDNODE_MESSAGE_RATE_LOW 	3
-#define BDNODE_MESSAGE_RATE_TRICKLE 	4
+	/* refreshing the routing table must not be starved by other pings,
+	 * so these are charged to the ping budget rather than limited by it.
+	 */
+	uint64_t now = bdClockUsecs();
+	while(mNodeSpace.out_of_date_peer(id))
+	{
+		/* push out ping */
+		bdToken transId;
+		genNewTransId(&transId);
+		//registerOutgoingMsg(&id, &transId, BITDHT_MSG_TYPE_PING);
+		if (msgout_ping(&id, &transId))
+		{
+			mRateCtrl.charge(BITDHT_RATE_PING, now);
+			mRateCtrl.sentRequest();
+		}
 
-#define BDNODE_HIGH_MSG_RATE	100
-#define BDNODE_MED_MSG_RATE	50
-#define BDNODE_LOW_MSG_RATE	20
-#define BDNODE_TRICKLE_MSG_RATE	5
+#ifdef DEBUG_NODE_MSGS 
+		LOG.info("bdNode::iteration() Pinging Out-Of-Date Peer: %s",
+				mFns->bdPrintId(&id).c_str());
+#endif
 
-	int maxMsgs = BDNODE_MED_MSG_RATE;
-	int mAllowedMsgRate = BDNODE_MESSAGE_RATE_MED;
+		mCounterOutOfDatePing++;
 
-	switch(mAllowedMsgRate)
-	{
-	case BDNODE_MESSAGE_RATE_HIGH:
-		maxMsgs = BDNODE_HIGH_MSG_RATE;
-		break;
+		//registerOutgoingMsg(&id, &transId, BITDHT_MSG_TYPE_FIND_NODE);
+		//msgout_find_node(&id, &transId, &(id.id));
+	}
 
-	case BDNODE_MESSAGE_RATE_MED:
-		maxMsgs = BDNODE_MED_MSG_RATE;
-		break;
+	mRateCtrl.adjust(now);
 
-	case BDNODE_MESSAGE_RATE_LOW:
-		maxMsgs = BDNODE_LOW_MSG_RATE;
-		break;
+	broadcastPeers();
 
-	case BDNODE_MESSAGE_RATE_TRICKLE:
-		maxMsgs = BDNODE_TRICKLE_MSG_RATE;
-		break;
+	// handle
 
-	default:
-		break;
-	}
+	doStats();
 
-	int allowedPings = 0.9 * maxMsgs;
-	int sentMsgs = 0;
-	int sentPings = 0;
+	//printStats(LOG << log4cpp::Priority::INFO);
 
-#if 0
-	int ilim = mLocalQueries.size() * 15;
-	if (ilim < 20)
-	{
-		ilim = 20;
-	}
-	if (ilim > 500)
-	{
-		ilim = 500;
-	}
-#endif
+	//printQueries();
+}
 
-	while((mPotentialPeers.size() > 0) && (sentMsgs < allowedPings))
-	{
-		/* check history ... is we have pinged them already...
-		 * then simulate / pretend we have received a pong,
-		 * and don't bother sending another ping.
-		 */
+/* send whatever the rate controller allows: pings to potential peers,
+ * find_node requests (round robin, one per query per iteration) and
+ * replies to remote queries.
+ */
+void bdNode::sendPacedMsgs()
+{
+	uint64_t now = bdClockUsecs();
 
-		bdId pid = mPotentialPeers.front();	
-		mPotentialPeers.pop_front();
+	sendPunchBursts(now);
 
+	time_t nowTS = time(NULL);
+	bdId pid;
+	while((!mPotentialPeers.empty()) && (mRateCtrl.waitUsecs(BITDHT_RATE_PING, now) == 0)
+			&& (mPotentialPeers.pop(pid, nowTS)))
+	{
 		/* don't send too many queries ... check history first */
 #ifdef USE_HISTORY
 		if (mHistory.validPeer(&pid))
@@ -317,108 +426,132 @@ void bdNode::iteration()
 		}
 #endif
 
-		/**** TEMP ****/
-
+		bdToken transId;
+		genNewTransId(&transId);
+		//registerOutgoingMsg(&pid, &transId, BITDHT_MSG_TYPE_PING);
+		if (!msgout_ping(&pid, &transId))
 		{
-			bdToken transId;
-			genNewTransId(&transId);
-			//registerOutgoingMsg(&pid, &transId, BITDHT_MSG_TYPE_PING);
-			msgout_ping(&pid, &transId);
-
-			sentMsgs++;
-			sentPings++;
+			break;	/* outgoing queue full, retry next time round */
+		}
+		mRateCtrl.take(BITDHT_RATE_PING, now);
+		mRateCtrl.sentRequest();
 
 #if 0 // def DEBUG_NODE_MSGS
-			LOG.info("bdNode::iteration() Pinging Potential Peer : %s",
-					mFns->bdPrintId(&pid).c_str());
+		LOG.info("bdNode::sendPacedMsgs() Pinging Potential Peer : %s",
+				mFns->bdPrintId(&pid).c_str());
 #endif
 
-			mCounterPings++;
-		}
+		mCounterPings++;
 	}
 
-	/* allow each query to send up to one query... until maxMsgs has been reached */
-	int numQueries = mLocalQueries.size();
-	int sentQueries = 0;
-	int i = 0;
-	while((i < numQueries) && (sentMsgs < maxMsgs))
+	while((mQueryTurns > 0) && (mLocalQueries.size() > 0) &&
+			(mRateCtrl.waitUsecs(BITDHT_RATE_QUERY, now) == 0))
 	{
 		bdQuery *query = mLocalQueries.front();
 		mLocalQueries.pop_front();
 		mLocalQueries.push_back(query);
+		mQueryTurns--;
+
+		/* go through the possible queries,
+		 * skipping peers that already have a request in flight for a nearby target.
+		 * compared on the target actually sent: a disguised query asks each
+		 * peer for a random mid point, not for query->mId.
+		 */
+		bdId id;
+		bdNodeId targetNodeId;
+		bool found = false;
+		while(query->nextQuery(id, targetNodeId))
+		{
+			if (!isCoalescedQuery(&id, &targetNodeId))
+			{
+				found = true;
+				break;
+			}
+
+#ifdef DEBUG_NODE_MSGS 
+			LOG.info("bdNode::sendPacedMsgs() Coalesced Find Node Req for : %s searching for : %s",
+					mFns->bdPrintId(&id).c_str(),
+					mFns->bdPrintNodeId(&targetNodeId).c_str());
+#endif
+			mCounterCoalescedQuery++;
+			mCycleCoalescedQuery++;
+		}
 
-		/* go through the possible queries */
-		if (query->nextQuery(id, targetNodeId))
+		if (found)
 		{
 			/* push out query */
 			bdToken transId;
 			genNewTransId(&transId);
 			//registerOutgoingMsg(&id, &transId, BITDHT_MSG_TYPE_FIND_NODE);
 
-			msgout_find_node(&id, &transId, &targetNodeId);
+			if (!msgout_find_node(&id, &transId, &targetNodeId))
+			{
+				break;	/* outgoing queue full, retry next time round */
+			}
+			addInFlightQuery(&id, &targetNodeId);
+			query->mQueryCount++;
+			mRateCtrl.take(BITDHT_RATE_QUERY, now);
+			mRateCtrl.sentRequest();
 
 #ifdef DEBUG_NODE_MSGS 
-			LOG.info("bdNode::iteration() Find Node Req for : %s searching for : %s",
+			LOG.info("bdNode::sendPacedMsgs() Find Node Req for : %s searching for : %s",
 					mFns->bdPrintId(&id).c_str(),
 					mFns->bdPrintNodeId(&targetNodeId).c_str());
 #endif
 
-			// report self
-//			if (id)
-//			query->result()
-
 			mCounterQueryNode++;
-			sentMsgs++;
-			sentQueries++;
 		}
-		i++;
 	}
 
-#ifdef DEBUG_NODE_ACTIONS 
-	LOG.info("bdNode::iteration() maxMsgs: %d sentPings: %d /  sentQueries: %d / %d",
-			maxMsgs, sentPings, allowedPings, sentQueries, numQueries);
-#endif
-
-	/* process remote query too */
 	processRemoteQuery();
+}
 
-	while(mNodeSpace.out_of_date_peer(id))
-	{
-		/* push out ping */
-		bdToken transId;
-		genNewTransId(&transId);
-		//registerOutgoingMsg(&id, &transId, BITDHT_MSG_TYPE_PING);
-		msgout_ping(&id, &transId);
-
-#ifdef DEBUG_NODE_MSGS 
-		LOG.info("bdNode::iteration() Pinging Out-Of-Date Peer: %s",
-				mFns->bdPrintId(&id).c_str());
-#endif
-
-		mCounterOutOfDatePing++;
+/* false if nothing is waiting on the rate controller,
+ * otherwise the usecs until sendPacedMsgs() can make progress.
+ */
+bool bdNode::nextPacedSend(uint64_t &waitUsecs)
+{
+	uint64_t now = bdClockUsecs();
+	bool pending = false;
+	waitUsecs = UINT64_MAX;
 
-		//registerOutgoingMsg(&id, &transId, BITDHT_MSG_TYPE_FIND_NODE);
-		//msgout_find_node(&id, &transId, &(id.id));
+	uint64_t punchWait;
+	if (mPunch.nextBurstDue(punchWait, now))
+	{
+		pending = true;
+		waitUsecs = std::min(waitUsecs, punchWait);
 	}
-
-	static int broadcast_count = 0;
-	broadcast_count++;
-
-	if (broadcast_count % 10 == 0) {
-		broadcastPeers();
+	if (!mPotentialPeers.empty())
+	{
+		pending = true;
+		waitUsecs = std::min(waitUsecs, mRateCtrl.waitUsecs(BITDHT_RATE_PING, now));
 	}
-
-	if (broadcast_count % 2 == 0) {
-		punching(100);
+	if ((mQueryTurns > 0) && (mLocalQueries.size() > 0))
+	{
+		pending = true;
+		waitUsecs = std::min(waitUsecs, mRateCtrl.waitUsecs(BITDHT_RATE_QUERY, now));
 	}
+	if (mRemoteQueries.size() > 0)
+	{
+		pending = true;
+		waitUsecs = std::min(waitUsecs, mRateCtrl.waitUsecs(BITDHT_RATE_REPLY, now));
+	}
+	return pending;
+}
 
-	// handle
-
-	doStats();
+void bdNode::setMsgRate(int type, double rate)
+{
+	mRateCtrl.setRate(type, rate, bdClockUsecs());
+}
 
-	//printStats(LOG << log4cpp::Priority::INFO);
+double bdNode::getMsgRate(int type)
+{
+	return mRateCtrl.currentRate(type);
+}
 
-	//printQueries();
+void bdNode::setAdaptiveMsgRate(bool adaptive)
+{
+	mRateCtrl.setAdaptive(adaptive, bdClockUsecs());
 }
 
 void bdNode::addConnReq(const bdNodeId &id)
@@ -426,37 +559,58 @@ void bdNode::addConnReq(const bdNodeId &id)
 	mConnectRequests[mOwnId] = id;
 }
 
+/* called every iteration: each rendezvous capable peer gets its
+ * ask_myip, and the connect requests still waiting for a match, once
+ * per BITDHT_FANOUT_PERIOD.
+ *
+ * A peer gets at most BITDHT_FANOUT_MAX_REQUESTS of the requests per
+ * round, taken in turn from mFanoutCursor, and all of them come out of
+ * the BITDHT_RATE_BROADCAST bucket - so a full rendezvous table is
+ * passed on over several rounds, not multiplied by the fan out.
+ */
 void bdNode::broadcastPeers()
 {
-	std::list<bdPeer> list = mWhiteNodes.getStore();
-	for (std::list<bdPeer>::iterator it = list.begin(); it != list.end(); ++it) {
-		bdToken transId;
-		genNewTransId(&transId);
-		msgout_ask_myip(&it->mPeerId, &transId);
+	uint64_t now = bdClockUsecs();
+	std::list<bdId> due;
+	mFanout.duePeers(due, now);
+	if (due.empty())
+	{
+		return;
+	}
 
-		std::map<bdNodeId, bdNodeId>::iterator itt;
-		for (itt = mConnectRequests.begin(); itt != mConnectRequests.end(); itt++) {
-			bdNodeId id0 = itt->first, id1 = itt->second;
+	/* our own requests, and those of others still waiting for a match */
+	std::vector<std::pair<bdNodeId, bdNodeId> > requests;
+	std::map<bdNodeId, bdNodeId>::iterator itt;
+	for (itt = mConnectRequests.begin(); itt != mConnectRequests.end(); itt++) {
+		requests.push_back(*itt);
+	}
 
-			bdToken transId;
-			genNewTransId(&transId);
-			msgout_broadcast_conn(&it->mPeerId, &transId, &id0, &id1);
-		}
+	std::list<bdRendezvousEntry> unpaired;
+	mRendezvous.getUnpaired(unpaired);
+	std::list<bdRendezvousEntry>::iterator uit;
+	for (uit = unpaired.begin(); uit != unpaired.end(); uit++) {
+		requests.push_back(std::make_pair(uit->mFrom.id, uit->mTo));
 	}
 
-	list = mStore.getStore();
-	for (std::list<bdPeer>::iterator it = list.begin(); it != list.end(); ++it) {
+	uint32_t perPeer = std::min((uint32_t) requests.size(), (uint32_t) BITDHT_FANOUT_MAX_REQUESTS);
+	for (std::list<bdId>::iterator it = due.begin(); it != due.end(); ++it) {
 		bdToken transId;
 		genNewTransId(&transId);
-		msgout_ask_myip(&it->mPeerId, &transId);
+		msgout_ask_myip(&(*it), &transId);
+		mCounterBroadcastMsgs++;
 
-		std::map<bdNodeId, bdNodeId>::iterator itt;
-		for (itt = mConnectRequests.begin(); itt != mConnectRequests.end(); itt++) {
-			bdNodeId id0 = itt->first, id1 = itt->second;
+		for (uint32_t i = 0; i < perPeer; i++) {
+			if (!mRateCtrl.take(BITDHT_RATE_BROADCAST, now))
+			{
+				break; /* the rest wait for their next round */
+			}
 
+			std::pair<bdNodeId, bdNodeId> &request =
+					requests[mFanoutCursor++ % requests.size()];
 			bdToken transId;
 			genNewTransId(&transId);
-			msgout_broadcast_conn(&it->mPeerId, &transId, &id0, &id1);
+			msgout_broadcast_conn(&(*it), &transId, &(request.first), &(request.second));
+			mCounterBroadcastMsgs++;
 		}
 	}
 }
@@ -493,6 +647,20 @@ void bdNode::doStats()
 	mLpfRecvReplyQueryHash *= (LPF_FACTOR);  	
 	mLpfRecvReplyQueryHash += (1.0 - LPF_FACTOR) * mCounterRecvReplyQueryHash;	
 
+	mLpfCoalescedQuery *= (LPF_FACTOR);
+	mLpfCoalescedQuery += (1.0 - LPF_FACTOR) * mCounterCoalescedQuery;
+
+	mLpfRemoteAnswered *= (LPF_FACTOR);
+	mLpfRemoteAnswered += (1.0 - LPF_FACTOR) * mCounterRemoteAnswered;
+	mLpfRemoteExpired *= (LPF_FACTOR);
+	mLpfRemoteExpired += (1.0 - LPF_FACTOR) * mCounterRemoteExpired;
+	mLpfRemoteShed *= (LPF_FACTOR);
+	mLpfRemoteShed += (1.0 - LPF_FACTOR) * mCounterRemoteShed;
+	mLpfRendezvousPaired *= (LPF_FACTOR);
+	mLpfRendezvousPaired += (1.0 - LPF_FACTOR) * mCounterRendezvousPaired;
+	mLpfBroadcastMsgs *= (LPF_FACTOR);
+	mLpfBroadcastMsgs += (1.0 - LPF_FACTOR) * mCounterBroadcastMsgs;
+
 	resetCounters();
 }
 
@@ -507,6 +675,61 @@ void bdNode::printStats()
 	LOG.info("  mLpfQueryHash          : %10lf  mLpfRecvReplyQueryHash : %10lf", mLpfQueryHash, mLpfRecvReplyQueryHash);
 	LOG.info("  mLpfReplyFindNode      : %10lf  mLpfRecvQueryNode      : %10lf", mLpfReplyFindNode, mLpfRecvQueryNode);
 	LOG.info("  mLpfReplyQueryHash/sec : %10lf  mLpfRecvQueryHash/sec  : %10lf", mLpfReplyQueryHash, mLpfRecvQueryHash);
+	LOG.info("  mLpfCoalescedQuery     : %10lf  Coalesced this cycle   : %10u", mLpfCoalescedQuery, mCycleCoalescedQuery);
+	LOG.info("  Seeded Queries         : %10u  Avg Hops               : %10lf", mPathSeededQueries,
+			mPathSeededQueries ? (double) mPathSeededHops / mPathSeededQueries : 0.0);
+	LOG.info("  Unseeded Queries       : %10u  Avg Hops               : %10lf", mPathUnseededQueries,
+			mPathUnseededQueries ? (double) mPathUnseededHops / mPathUnseededQueries : 0.0);
+	LOG.info("  Path Cache Entries     : %10u", mPathCache.size());
+	LOG.info("  mLpfRemoteAnswered     : %10lf  Remote Queue           : %10d", mLpfRemoteAnswered, (int) mRemoteQueries.size());
+	LOG.info("  mLpfRemoteExpired      : %10lf  mLpfRemoteShed         : %10lf", mLpfRemoteExpired, mLpfRemoteShed);
+	LOG.info("  Reply Latency (usecs)  : p50: %lu p90: %lu p99: %lu (%u replies this cycle)",
+			(unsigned long) mCycleRemoteLatency.percentile(0.50),
+			(unsigned long) mCycleRemoteLatency.percentile(0.90),
+			(unsigned long) mCycleRemoteLatency.percentile(0.99),
+			mCycleRemoteLatency.count());
+	LOG.info("  Transactions           : open: %u matched: %u unmatched: %u expired: %u (this cycle)",
+			mTransTable.size(), mTransTable.matched(),
+			mTransTable.unmatched(), mTransTable.expired());
+	LOG.info("  Rpc Latency (usecs)    : p50: %lu p90: %lu p99: %lu (%u replies this cycle)",
+			(unsigned long) mCycleRpcLatency.percentile(0.50),
+			(unsigned long) mCycleRpcLatency.percentile(0.90),
+			(unsigned long) mCycleRpcLatency.percentile(0.99),
+			mCycleRpcLatency.count());
+	LOG.info("  Msg Rates (now/set)    : ping: %.1lf/%.1lf query: %.1lf/%.1lf reply: %.1lf/%.1lf broadcast: %.1lf/%.1lf %s",
+			mRateCtrl.currentRate(BITDHT_RATE_PING), mRateCtrl.getRate(BITDHT_RATE_PING),
+			mRateCtrl.currentRate(BITDHT_RATE_QUERY), mRateCtrl.getRate(BITDHT_RATE_QUERY),
+			mRateCtrl.currentRate(BITDHT_RATE_REPLY), mRateCtrl.getRate(BITDHT_RATE_REPLY),
+			mRateCtrl.currentRate(BITDHT_RATE_BROADCAST), mRateCtrl.getRate(BITDHT_RATE_BROADCAST),
+			mRateCtrl.isAdaptive() ? "(adaptive)" : "");
+	uint32_t shards = mIncomingShards.load(std::memory_order_acquire);
+	for(uint32_t i = 0; i < shards; i++)
+	{
+		LOG.info("  Incoming Msg Ring %-4u : used: %u/%u high: %u overflows: %u", i,
+				mIncomingRings[i]->size(), mIncomingRings[i]->capacity(),
+				mIncomingRings[i]->highWater(), mIncomingRings[i]->overflows());
+	}
+	LOG.info("  Outgoing Msg Slots     : used: %u/%u high: %u drops: %u",
+			mOutgoingPool.inUse(), mOutgoingPool.capacity(),
+			mOutgoingPool.highWater(), mOutgoingPool.drops());
+	LOG.info("  Potential Peers        : queued: %u added: %u dups: %u skipped: %u expired: %u (this cycle)",
+			mPotentialPeers.size(), mPotentialPeers.added(), mPotentialPeers.duplicates(),
+			mPotentialPeers.skipped(), mPotentialPeers.expired());
+	LOG.info("  Punches                : active: %u ok: %u failed: %u pkts/ok: %.1lf first pkt p50: %lu usecs (this cycle)",
+			mPunch.active(), mPunch.succeeded(), mPunch.failed(), mPunch.packetsPerSuccess(),
+			(unsigned long) mPunch.firstPacketUsecs().percentile(0.50));
+	LOG.info("  Rendezvous             : pairs/sec: %.2lf held: %u paired: %u dups: %u refused: %u expired: %u (this cycle)",
+			mLpfRendezvousPaired, mRendezvous.size(), mRendezvous.pairings(),
+			mRendezvous.duplicates(), mRendezvous.refused(), mRendezvous.expired());
+	LOG.info("  Pairing Wait (usecs)   : p50: %lu p90: %lu",
+			(unsigned long) mRendezvous.matchUsecs().percentile(0.50),
+			(unsigned long) mRendezvous.matchUsecs().percentile(0.90));
+	LOG.info("  mLpfBroadcastMsgs      : %10lf  Fan-out Peers          : %10u",
+			mLpfBroadcastMsgs, mFanout.size());
+
+	bdStackMutex stack(mBlackListMtx); /********** MUTEX LOCKED *************/
+	LOG.info("  BlackList              : addrs: %u ranges: %u hits: %u",
+			mBlackList.exactRules(), mBlackList.rangeRules(), mBlackList.hits());
 }
 
 void bdNode::resetCounters()
@@ -525,6 +748,15 @@ void bdNode::resetCounters()
 	mCounterRecvQueryHash = 0;
 	mCounterRecvReplyFindNode = 0;
 	mCounterRecvReplyQueryHash = 0;
+
+	mCounterCoalescedQuery = 0;
+
+	mCounterRemoteAnswered = 0;
+	mCounterRemoteExpired = 0;
+	mCounterRemoteShed = 0;
+
+	mCounterRendezvousPaired = 0;
+	mCounterBroadcastMsgs = 0;
 }
 
 void bdNode::resetStats()
@@ -544,7 +776,34 @@ void bdNode::resetStats()
 	mLpfRecvReplyFindNode = 0;
 	mLpfRecvReplyQueryHash = 0;
 
+	mLpfCoalescedQuery = 0;
+
+	mLpfRemoteAnswered = 0;
+	mLpfRemoteExpired = 0;
+	mLpfRemoteShed = 0;
+
+	mLpfRendezvousPaired = 0;
+	mLpfBroadcastMsgs = 0;
+
+	mPathSeededQueries = 0;
+	mPathSeededHops = 0;
+	mPathUnseededQueries = 0;
+	mPathUnseededHops = 0;
+
 	resetCounters();
+	resetCycleStats();
+}
+
+/* called by the manager once per refresh cycle, after the stats are printed */
+void bdNode::resetCycleStats()
+{
+	mCycleCoalescedQuery = 0;
+	mCycleRemoteLatency.reset();
+	mCycleRpcLatency.reset();
+	mTransTable.resetCounters();
+	mPotentialPeers.resetCounters();
+	mPunch.resetCounters();
+	mRendezvous.resetCounters();
 }
 
 void bdNode::checkPotentialPeer(bdId *id)
@@ -570,7 +829,32 @@ void bdNode::checkPotentialPeer(bdId *id)
 
 void bdNode::addPotentialPeer(bdId *id)
 {
-	mPotentialPeers.push_back(*id);
+	mPotentialPeers.add(id, potentialPeerScore(id), time(NULL));
+}
+
+/* lower is better: the bucket distance to the nearest query target
+ * (or to us, if there are no queries), pushed back if the peer's bucket
+ * in our own table is already full.
+ */
+uint32_t bdNode::potentialPeerScore(const bdId *id)
+{
+	uint32_t score = mFns->bdBucketDistance(&mOwnId, &(id->id));
+
+	std::list<bdQuery *>::iterator it;
+	for(it = mLocalQueries.begin(); it != mLocalQueries.end(); it++)
+	{
+		uint32_t dist = mFns->bdBucketDistance(&((*it)->mId), &(id->id));
+		if (dist < score)
+		{
+			score = dist;
+		}
+	}
+
+	if (mNodeSpace.isBucketFull(&(id->id)))
+	{
+		score += BITDHT_NODE_FULL_BUCKET_PENALTY;
+	}
+	return score;
 }
 
 extern bdNodeId g_peerId;
@@ -591,6 +875,7 @@ void bdNode::addPeer(const bdId *id, uint32_t peerflags)
 	}
 
 	mNodeSpace.add_peer(id, peerflags);
+	mPotentialPeers.verified(id, time(NULL));
 
 	bdPeer peer;
 	peer.mPeerId = *id;
@@ -643,12 +928,34 @@ void bdNode::addQuery(const bdNodeId *id, uint32_t qflags)
 
 	LOG.info(("bdNode::addQuery(" + mFns->bdPrintNodeId(id) + ")").c_str());
 
-	for(it = nearest.begin(); it != nearest.end(); it++)
+	/* mix in the peers a previous query for a nearby target ended up at,
+	 * and keep the closest BITDHT_QUERY_START_PEERS of the lot.
+	 */
+	std::list<bdId> pathList;
+	bool seeded = mPathCache.getPath(id, pathList, time(NULL));
+
+	std::list<bdId>::iterator pit;
+	for(pit = pathList.begin(); pit != pathList.end(); pit++)
+	{
+		bdMetric dist;
+		mFns->bdDistance(id, &(pit->id), &dist);
+		nearest.insert(std::pair<bdMetric, bdId>(dist, *pit));
+	}
+
+	int i = 0;
+	for(it = nearest.begin(); (it != nearest.end()) && (i < BITDHT_QUERY_START_PEERS); it++)
 	{
+		/* duplicates are adjacent (same distance) */
+		if ((!startList.empty()) && (startList.back() == it->second))
+		{
+			continue;
+		}
 		startList.push_back(it->second);
+		i++;
 	}
 
 	bdQuery *query = new bdQuery(id, startList, qflags, mFns);
+	query->mSeeded = seeded;
 	mLocalQueries.push_back(query);
 }
 
@@ -671,6 +978,11 @@ void bdNode::clearQuery(const bdNodeId *rmId)
 	}
 }
 
+uint32_t bdNode::queryCount()
+{
+	return mLocalQueries.size();
+}
+
 void bdNode::QueryStatus(std::map<bdNodeId, bdQueryStatus> &statusMap)
 {
 	std::list<bdQuery *>::iterator it;
@@ -684,6 +996,51 @@ void bdNode::QueryStatus(std::map<bdNodeId, bdQueryStatus> &statusMap)
 	}
 }
 
+/* queue an event for each query that changed state, or found its target,
+ * since the last check. The manager consumes them with popQueryEvent().
+ */
+void bdNode::checkQueryEvents()
+{
+	std::list<bdQuery *>::iterator it;
+	for(it = mLocalQueries.begin(); it != mLocalQueries.end(); it++)
+	{
+		bdQuery *query = (*it);
+		if ((query->mState == query->mReportedState) && (!query->mNewMatch))
+		{
+			continue;
+		}
+
+		mQueryEvents.push_back(bdQueryEvent());
+		bdQueryEvent &event = mQueryEvents.back();
+		event.mId = query->mId;
+		event.mStatus = query->mState;
+		event.mQFlags = query->mQueryFlags;
+		query->result(event.mResults);
+		query->matchResult(event.mMatches);
+
+		query->mReportedState = query->mState;
+		query->mNewMatch = false;
+	}
+}
+
+bool bdNode::popQueryEvent(bdQueryEvent &event)
+{
+	if (mQueryEvents.empty())
+	{
+		return false;
+	}
+
+	/* swap rather than copy the lists */
+	bdQueryEvent &front = mQueryEvents.front();
+	event.mId = front.mId;
+	event.mStatus = front.mStatus;
+	event.mQFlags = front.mQFlags;
+	event.mResults.swap(front.mResults);
+	event.mMatches.swap(front.mMatches);
+	mQueryEvents.pop_front();
+	return true;
+}
+
 bool bdNode::getIdFromQuery(const bdNodeId *id, std::list<bdPeer> &idList)
 {
 #ifdef DEBUG_NODE_MSGS
@@ -703,71 +1060,140 @@ bool bdNode::getIdFromQuery(const bdNodeId *id, std::list<bdPeer> &idList)
 	return false;
 }
 
-/************************************ Process Remote Query *************************/
-void bdNode::processRemoteQuery()
+/************************************ Lookup Coalescing ****************************/
+
+/* A find_node reply from a peer lists its closest nodes to the requested target.
+ * If another lookup already has a request outstanding at this peer, for a target
+ * that shares a long prefix with ours (and is closer to ours than the peer is),
+ * the reply is just as useful to us - so don't send a duplicate.
+ */
+bool bdNode::isCoalescedQuery(const bdId *id, const bdNodeId *target)
 {
-	bool processed = false;
-	time_t oldTS = time(NULL) - BITDHT_MAX_REMOTE_QUERY_AGE;
-	while(!processed)
+	std::multimap<bdId, bdInFlightQuery>::iterator it, eit;
+	it = mInFlightQueries.lower_bound(*id);
+	eit = mInFlightQueries.upper_bound(*id);
+	if (it == eit)
 	{
-		/* extra exit clause */
-		if (mRemoteQueries.size() < 1) return;
+		return false;
+	}
 
-		bdRemoteQuery &query = mRemoteQueries.front();
+	int peerDist = mFns->bdBucketDistance(target, &(id->id));
+	time_t oldTS = time(NULL) - BITDHT_COALESCE_MAX_AGE;
+	for(; it != eit; it++)
+	{
+		if (it->second.mSendTS < oldTS)
+		{
+			continue;
+		}
 
-		/* discard older ones (stops queue getting overloaded) */
-		if (query.mQueryTS > oldTS)
+		int targetDist = mFns->bdBucketDistance(target, &(it->second.mTarget));
+		if ((targetDist <= BITDHT_KEY_BITLEN - BITDHT_COALESCE_PREFIX_BITS) &&
+				(targetDist < peerDist))
 		{
-			/* recent enough to process! */
-			processed = true;
+			return true;
+		}
+	}
+	return false;
+}
 
-			switch(query.mQueryType)
-			{
-			case BD_QUERY_NEIGHBOURS:
-			{
-				/* search bdSpace for neighbours */
-				std::list<bdId> excludeList;
-				std::list<bdId> nearList;
-				std::multimap<bdMetric, bdId> nearest;
-				std::multimap<bdMetric, bdId>::iterator it;
+void bdNode::addInFlightQuery(const bdId *id, const bdNodeId *target)
+{
+	mInFlightQueries.insert(std::pair<bdId, bdInFlightQuery>(*id,
+			bdInFlightQuery(target, time(NULL), bdClockUsecs())));
+}
 
-				mNodeSpace.find_nearest_nodes(&(query.mQuery), BITDHT_QUERY_NEIGHBOUR_PEERS, excludeList, nearest);
+/* returns when the oldest request to this peer was sent (0 if none) */
+uint64_t bdNode::removeInFlightQuery(const bdId *id)
+{
+	uint64_t sentUsecs = 0;
+	std::multimap<bdId, bdInFlightQuery>::iterator it, eit;
+	it = mInFlightQueries.lower_bound(*id);
+	eit = mInFlightQueries.upper_bound(*id);
+	for(; it != eit; it++)
+	{
+		if ((sentUsecs == 0) || (it->second.mSendUsecs < sentUsecs))
+		{
+			sentUsecs = it->second.mSendUsecs;
+		}
+	}
 
-				for(it = nearest.begin(); it != nearest.end(); it++)
-				{
-					nearList.push_back(it->second);
-				}
-				msgout_reply_find_node(&(query.mId), &(query.mTransId), nearList);
-#ifdef DEBUG_NODE_MSGS 
-				LOG.info("bdNode::processRemoteQuery() Reply to Find Node: %s searching for : %s , found %d nodes ",
-						mFns->bdPrintId(&(query.mId)).c_str(),
-						mFns->bdPrintNodeId(&(query.mQuery)).c_str(), nearest.size());
-#endif
+	mInFlightQueries.erase(*id);
+	return sentUsecs;
+}
 
-				mCounterReplyFindNode++;
+void bdNode::cleanupInFlightQueries()
+{
+	time_t oldTS = time(NULL) - BITDHT_COALESCE_MAX_AGE;
+	std::multimap<bdId, bdInFlightQuery>::iterator it;
+	for(it = mInFlightQueries.begin(); it != mInFlightQueries.end();)
+	{
+		if (it->second.mSendTS < oldTS)
+		{
+			mInFlightQueries.erase(it++);
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
 
-				break;
-			}
-			case BD_QUERY_HASH:
-			{
-#ifdef DEBUG_NODE_MSGS 
-				LOG.info("bdNode::processRemoteQuery() Reply to Query Node: %s TODO",
-						mFns->bdPrintId(&(query.mId)).c_str());
+/************************************ Lookup Path Cache ****************************/
+
+/* called once, when a query leaves the QUERYING state.
+ * Stores where it ended up (for seeding later queries), and counts its hops.
+ */
+void bdNode::recordQueryPath(bdQuery *query)
+{
+	query->mPathRecorded = true;
+
+	std::list<bdId> peers;
+	if (query->responsivePeers(peers) > 0)
+	{
+		mPathCache.addPath(&(query->mId), peers, time(NULL));
+	}
+
+	if (query->mSeeded)
+	{
+		mPathSeededQueries++;
+		mPathSeededHops += query->mQueryCount;
+	}
+	else
+	{
+		mPathUnseededQueries++;
+		mPathUnseededHops += query->mQueryCount;
+	}
+
+#ifdef DEBUG_NODE_ACTIONS
+	LOG.info("bdNode::recordQueryPath() %s seeded: %d hops: %u cached peers: %d",
+			mFns->bdPrintNodeId(&(query->mId)).c_str(), query->mSeeded,
+			query->mQueryCount, (int) peers.size());
 #endif
-				mCounterReplyQueryHash++;
+}
 
+/************************************ Process Remote Query *************************/
+
+/* drain the queue (oldest first) until it is empty, or the reply
+ * rate or this pass's time budget runs out. Anything too old is discarded.
+ */
+void bdNode::processRemoteQuery()
+{
+	time_t oldTS = time(NULL) - BITDHT_MAX_REMOTE_QUERY_AGE;
+	uint64_t now = bdClockUsecs();
+	uint64_t endUsecs = now + BITDHT_REMOTE_QUERY_MAX_USECS;
+
+	while(mRemoteQueries.size() > 0)
+	{
+		bdRemoteQuery &query = mRemoteQueries.front();
 
-				/* TODO */
-				break;
-			}
-			default:
+		/* discard older ones (stops queue getting overloaded) */
+		if (query.mQueryTS > oldTS)
+		{
+			if (!mRateCtrl.take(BITDHT_RATE_REPLY, now))
 			{
-				/* drop */
-				/* unprocess! */
-				processed = false;
 				break;
 			}
-			}
+			answerRemoteQuery(query);
 		}
 		else
 		{
@@ -775,32 +1201,79 @@ void bdNode::processRemoteQuery()
 			LOG.info("bdNode::processRemoteQuery() Query Too Old: Discarding: %s",
 					mFns->bdPrintId(&(query.mId)).c_str());
 #endif
+			mCounterRemoteExpired++;
 		}
 
-
 		mRemoteQueries.pop_front();
+
+		if (bdClockUsecs() > endUsecs)
+		{
+			break;
+		}
+	}
+}
+
+void bdNode::answerRemoteQuery(bdRemoteQuery &query)
+{
+	switch(query.mQueryType)
+	{
+	case BD_QUERY_NEIGHBOURS:
+	{
+		/* search bdSpace for neighbours */
+		std::list<bdId> excludeList;
+		std::list<bdId> nearList;
+		std::multimap<bdMetric, bdId> nearest;
+		std::multimap<bdMetric, bdId>::iterator it;
+
+		mNodeSpace.find_nearest_nodes(&(query.mQuery), BITDHT_QUERY_NEIGHBOUR_PEERS, excludeList, nearest);
+
+		for(it = nearest.begin(); it != nearest.end(); it++)
+		{
+			nearList.push_back(it->second);
+		}
+		msgout_reply_find_node(&(query.mId), &(query.mTransId), nearList);
+#ifdef DEBUG_NODE_MSGS 
+		LOG.info("bdNode::processRemoteQuery() Reply to Find Node: %s searching for : %s , found %d nodes ",
+				mFns->bdPrintId(&(query.mId)).c_str(),
+				mFns->bdPrintNodeId(&(query.mQuery)).c_str(), nearest.size());
+#endif
+
+		mCounterReplyFindNode++;
+		break;
+	}
+	case BD_QUERY_HASH:
+	{
+#ifdef DEBUG_NODE_MSGS 
+		LOG.info("bdNode::processRemoteQuery() Reply to Query Node: %s TODO",
+				mFns->bdPrintId(&(query.mId)).c_str());
+#endif
+		mCounterReplyQueryHash++;
+
+		/* TODO - until then it goes unanswered, and isn't counted as answered */
+		return;
+	}
+	default:
+	{
+		/* drop */
+		return;
+	}
 	}
+
+	mCounterRemoteAnswered++;
+	mCycleRemoteLatency.add(bdClockUsecs() - query.mRecvUsecs);
 }
 
 // It is a rough solution for to block fake nodes
 uint32_t bdNode::getRandomToken()
 {
-	uint32_t num = rand();
-	mRandomTokenArray.push_back(num);
-	if (mRandomTokenArray.size() > 1000) {
-		mRandomTokenArray.erase(mRandomTokenArray.begin());
-	}
+	uint32_t num = mRandom.next32();
+	mRandomTokens.add(num);
 	return num;
 }
 
 bool bdNode::isUsedToken(uint32_t token)
 {
-	for (std::vector<uint32_t>::iterator it = mRandomTokenArray.begin(); it != mRandomTokenArray.end(); ++it) {
-		if (*it == token) {
-			return true;
-		}
-	}
-	return false;
+	return mRandomTokens.contains(token);
 }
 
 /************************************ Message Buffering ****************************/
@@ -808,12 +1281,9 @@ bool bdNode::isUsedToken(uint32_t token)
 /* interaction with outside world */
 int bdNode::outgoingMsg(struct sockaddr_in *addr, char *msg, int *len)
 {
-	if (mOutgoingMsgs.size() > 0)
+	if (!mOutgoingMsgs.empty())
 	{
-		bdNodeNetMsg *bdmsg = mOutgoingMsgs.front();
-		//bdmsg->print(LOG << log4cpp::Priority::INFO);
-		mOutgoingMsgs.pop_front();
-		//bdmsg->print(LOG << log4cpp::Priority::INFO);
+		bdMsgSlot *bdmsg = mOutgoingMsgs.pop();
 
 		/* truncate if necessary */
 		if (bdmsg->mSize < *len)
@@ -833,25 +1303,57 @@ int bdNode::outgoingMsg(struct sockaddr_in *addr, char *msg, int *len)
 		memcpy(msg, bdmsg->data, *len);
 		*addr = bdmsg->addr;
 
-		//bdmsg->print(LOG << log4cpp::Priority::INFO);
-
-		delete bdmsg;
+		mOutgoingPool.release(bdmsg);
 		return 1;
 	}
 	return 0;
 }
 
-void bdNode::incomingMsg(struct sockaddr_in *addr, char *msg, int len)
+/* zero-copy alternative to outgoingMsg(): the caller sends straight
+ * from the slot, then hands it back with releaseOutgoingMsg().
+ */
+bdMsgSlot *bdNode::popOutgoingMsg()
+{
+	return mOutgoingMsgs.pop();
+}
+
+void bdNode::releaseOutgoingMsg(bdMsgSlot *slot)
+{
+	mOutgoingPool.release(slot);
+}
+
+/* called from the receive thread, without the node's lock: only
+ * touches the incoming ring.
+ */
+void bdNode::incomingMsg(struct sockaddr_in *addr, char *msg, int len, uint32_t shard)
 {
-	bdNodeNetMsg *bdmsg = new bdNodeNetMsg(msg, len, addr);
-	mIncomingMsgs.push_back(bdmsg);
+	if ((len < 0) || (len > BITDHT_MSGPOOL_SLOT_SIZE))
+	{
+		return;	/* can't be a dht message */
+	}
+
+	/* more receive threads than rings: they share (the ring is multi-producer) */
+	bdRing<bdMsgSlot> *ring = mIncomingRings[shard % mIncomingShards.load(std::memory_order_acquire)];
+
+	/* dropped (and counted by the ring) if we are too far behind */
+	uint32_t pos;
+	bdMsgSlot *bdmsg = ring->claim(pos);
+	if (!bdmsg)
+	{
+		return;
+	}
+
+	memcpy(bdmsg->data, msg, len);
+	bdmsg->mSize = len;
+	bdmsg->addr = *addr;
+	ring->publish(pos);
 }
 
 /************************************ Message Handling *****************************/
 
 /* Outgoing Messages */
 
-void bdNode::msgout_ping(bdId *id, bdToken *transId)
+bool bdNode::msgout_ping(bdId *id, bdToken *transId)
 {
 #ifdef DEBUG_NODE_MSGOUT
 	LOG.info("bdNode::msgout_ping() TransId: ";
@@ -861,15 +1363,22 @@ void bdNode::msgout_ping(bdId *id, bdToken *transId)
 	LOG.info(std::endl;
 #endif
 
-	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_PING);
-
+	/* encode straight into an outgoing slot */
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return false;	/* dropped, counted by the pool */
+	}
 
-	/* create string */
-	char msg[10240];
-	int avail = 10240;
+	int blen = bitdht_create_ping_msg(transId, &(mOwnId), slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
+	if (!sendSlot(slot, blen, id->addr))
+	{
+		return false;
+	}
 
-	int blen = bitdht_create_ping_msg(transId, &(mOwnId), msg, avail-1);
-	sendPkt(msg, blen, id->addr);
+	/* only a request that actually went out is waiting on a reply */
+	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_PING);
+	return true;
 }
 
 void bdNode::msgout_pong(bdId *id, bdToken *transId)
@@ -883,8 +1392,6 @@ void bdNode::msgout_pong(bdId *id, bdToken *transId)
 	LOG.info(std::endl;
 #endif
 
-	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_PONG);
-
 	/* generate message, send to udp */
 	bdToken vid;
 	uint32_t vlen = BITDHT_TOKEN_MAX_LEN;
@@ -895,16 +1402,21 @@ void bdNode::msgout_pong(bdId *id, bdToken *transId)
 	memcpy(vid.data, mDhtVersion.c_str(), vlen);	
 	vid.len = vlen;
 
-	char msg[10240];
-	int avail = 10240;
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
+
+	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_PONG);
 
-	int blen = bitdht_response_ping_msg(transId, &(mOwnId), &vid, msg, avail-1);
+	int blen = bitdht_response_ping_msg(transId, &(mOwnId), &vid, slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
 
-	sendPkt(msg, blen, id->addr);
+	sendSlot(slot, blen, id->addr);
 }
 
 
-void bdNode::msgout_find_node(bdId *id, bdToken *transId, bdNodeId *query)
+bool bdNode::msgout_find_node(bdId *id, bdToken *transId, bdNodeId *query)
 {
 #ifdef DEBUG_NODE_MSGOUT
 	LOG.info("bdNode::msgout_find_node() TransId: ";
@@ -916,27 +1428,36 @@ void bdNode::msgout_find_node(bdId *id, bdToken *transId, bdNodeId *query)
 	LOG.info(std::endl;
 #endif
 
-	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_FIND_NODE);
-
-	char msg[10240];
-	int avail = 10240;
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return false;	/* dropped, counted by the pool */
+	}
 
-	int blen = bitdht_find_node_msg(transId, &(mOwnId), query, msg, avail-1);
+	int blen = bitdht_find_node_msg(transId, &(mOwnId), query, slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
+	if (!sendSlot(slot, blen, id->addr))
+	{
+		return false;
+	}
 
-	sendPkt(msg, blen, id->addr);
+	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_FIND_NODE, query);
+	return true;
 }
 
 void bdNode::msgout_reply_find_node(bdId *id, bdToken *transId, std::list<bdId> &peers)
 {
-	char msg[10240];
-	int avail = 10240;
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
 
 	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_REPLY_NODE);
 
 
-	int blen = bitdht_resp_node_msg(transId, &(mOwnId), peers, msg, avail-1);
+	int blen = bitdht_resp_node_msg(transId, &(mOwnId), peers, slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
 
-	sendPkt(msg, blen, id->addr);
+	sendSlot(slot, blen, id->addr);
 
 #ifdef DEBUG_NODE_MSGOUT
 	LOG.info("bdNode::msgout_reply_find_node() TransId: ";
@@ -959,7 +1480,7 @@ void bdNode::msgout_reply_find_node(bdId *id, bdToken *transId, std::list<bdId>
  *
  *****/
 
-void bdNode::msgout_get_hash(bdId *id, bdToken *transId, bdNodeId *info_hash)
+bool bdNode::msgout_get_hash(bdId *id, bdToken *transId, bdNodeId *info_hash)
 {
 #ifdef DEBUG_NODE_MSGOUT
 	LOG.info("bdNode::msgout_get_hash() TransId: ";
@@ -971,15 +1492,20 @@ void bdNode::msgout_get_hash(bdId *id, bdToken *transId, bdNodeId *info_hash)
 	LOG.info(std::endl;
 #endif
 
-	char msg[10240];
-	int avail = 10240;
-
-	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_GET_HASH);
-
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return false;	/* dropped, counted by the pool */
+	}
 
-	int blen = bitdht_get_peers_msg(transId, &(mOwnId), info_hash, msg, avail-1);
+	int blen = bitdht_get_peers_msg(transId, &(mOwnId), info_hash, slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
+	if (!sendSlot(slot, blen, id->addr))
+	{
+		return false;
+	}
 
-	sendPkt(msg, blen, id->addr);
+	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_GET_HASH, info_hash);
+	return true;
 }
 
 void bdNode::msgout_reply_hash(bdId *id, bdToken *transId, bdToken *token, std::list<std::string> &values)
@@ -1002,14 +1528,17 @@ void bdNode::msgout_reply_hash(bdId *id, bdToken *transId, bdToken *token, std::
 	LOG.info(std::endl;
 #endif
 
-	char msg[10240];
-	int avail = 10240;
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
 
 	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_REPLY_HASH);
 
-	int blen = bitdht_peers_reply_hash_msg(transId, &(mOwnId), token, values, msg, avail-1);
+	int blen = bitdht_peers_reply_hash_msg(transId, &(mOwnId), token, values, slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
 
-	sendPkt(msg, blen, id->addr);
+	sendSlot(slot, blen, id->addr);
 }
 
 void bdNode::msgout_reply_nearest(bdId *id, bdToken *transId, bdToken *token, std::list<bdId> &nodes)
@@ -1032,17 +1561,20 @@ void bdNode::msgout_reply_nearest(bdId *id, bdToken *transId, bdToken *token, st
 	LOG.info(std::endl;
 #endif
 
-	char msg[10240];
-	int avail = 10240;
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
 
 	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_REPLY_NEAR);
 
-	int blen = bitdht_peers_reply_closest_msg(transId, &(mOwnId), token, nodes, msg, avail-1);
+	int blen = bitdht_peers_reply_closest_msg(transId, &(mOwnId), token, nodes, slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
 
-	sendPkt(msg, blen, id->addr);
+	sendSlot(slot, blen, id->addr);
 }
 
-void bdNode::msgout_post_hash(bdId *id, bdToken *transId, bdNodeId *info_hash, uint32_t port, bdToken *token)
+bool bdNode::msgout_post_hash(bdId *id, bdToken *transId, bdNodeId *info_hash, uint32_t port, bdToken *token)
 {
 #ifdef DEBUG_NODE_MSGOUT
 	LOG.info("bdNode::msgout_post_hash() TransId: ";
@@ -1057,16 +1589,20 @@ void bdNode::msgout_post_hash(bdId *id, bdToken *transId, bdNodeId *info_hash, u
 	LOG.info(std::endl;
 #endif
 
-	char msg[10240];
-	int avail = 10240;
-
-	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_POST_HASH);
-
-
-	int blen = bitdht_announce_peers_msg(transId,&(mOwnId),info_hash,port,token,msg,avail-1);
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return false;	/* dropped, counted by the pool */
+	}
 
-	sendPkt(msg, blen, id->addr);
+	int blen = bitdht_announce_peers_msg(transId,&(mOwnId),info_hash,port,token,slot->data,BITDHT_MSGPOOL_SLOT_SIZE);
+	if (!sendSlot(slot, blen, id->addr))
+	{
+		return false;
+	}
 
+	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_POST_HASH, info_hash);
+	return true;
 }
 
 void bdNode::msgout_reply_post(bdId *id, bdToken *transId)
@@ -1080,14 +1616,17 @@ void bdNode::msgout_reply_post(bdId *id, bdToken *transId)
 #endif
 
 	/* generate message, send to udp */
-	char msg[10240];
-	int avail = 10240;
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
 
 	registerOutgoingMsg(id, transId, BITDHT_MSG_TYPE_REPLY_POST);
 
-	int blen = bitdht_reply_announce_msg(transId, &(mOwnId), msg, avail-1);
+	int blen = bitdht_reply_announce_msg(transId, &(mOwnId), slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
 
-	sendPkt(msg, blen, id->addr);
+	sendSlot(slot, blen, id->addr);
 }
 
 void bdNode::msgout_ask_myip(const bdId *dhtId, bdToken *transId)
@@ -1099,13 +1638,26 @@ void bdNode::msgout_ask_myip(const bdId *dhtId, bdToken *transId)
 			ss.str().c_str(), mFns->bdPrintId(dhtId).c_str());
 #endif
 
-	/* create string */
-	char msg[10240];
-	int avail = 10240;
+	/* encode straight into an outgoing slot */
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
 
-	int blen = bitdht_ask_myip_msg(transId, &(mOwnId), msg, avail-1);
-	blen = bitdht_ecrypt(msg, blen, avail-1, getRandomToken());
-	sendPkt(msg, blen, dhtId->addr);
+	int blen = bitdht_ask_myip_msg(transId, &(mOwnId), slot->data, BITDHT_NODE_ECRYPT_AVAIL);
+	if (blen > BITDHT_NODE_ECRYPT_AVAIL)
+	{
+		mOutgoingPool.discard(slot);
+		return;
+	}
+	blen = bitdht_ecrypt(slot->data, blen, BITDHT_MSGPOOL_SLOT_SIZE, getRandomToken());
+	if (sendSlot(slot, blen, dhtId->addr))
+	{
+		/* the reply is only believed if it answers this */
+		bdId id(*dhtId);
+		registerOutgoingMsg(&id, transId, BITDHT_MSG_TYPE_NEWCONN);
+	}
 }
 
 void bdNode::msgout_reply_ask_myip(bdId *tunnelId, bdToken *transId)
@@ -1117,14 +1669,22 @@ void bdNode::msgout_reply_ask_myip(bdId *tunnelId, bdToken *transId)
 			ss.str().c_str(), mFns->bdPrintId(tunnelId).c_str());
 #endif
 
-	/* create string */
-	char msg[10240];
-	int avail = 10240;
+	/* encode straight into an outgoing slot */
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
 
 	int blen = bitdht_reply_myip_msg(transId, &(mOwnId), tunnelId,
-			msg, true, avail-1);
-	blen = bitdht_ecrypt(msg, blen, avail-1, getRandomToken());
-	sendPkt(msg, blen, tunnelId->addr);
+			slot->data, true, BITDHT_NODE_ECRYPT_AVAIL);
+	if (blen > BITDHT_NODE_ECRYPT_AVAIL)
+	{
+		mOutgoingPool.discard(slot);
+		return;
+	}
+	blen = bitdht_ecrypt(slot->data, blen, BITDHT_MSGPOOL_SLOT_SIZE, getRandomToken());
+	sendSlot(slot, blen, tunnelId->addr);
 }
 
 void bdNode::msgout_broadcast_conn(
@@ -1139,16 +1699,19 @@ void bdNode::msgout_broadcast_conn(
 			mFns->bdPrintNodeId(peerId).c_str());
 #endif
 
-	char msg[10240];
-	int avail = 10240;
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
 
 	int blen = bitdht_broadcast_conn_msg(tid, &(mOwnId), nodeId, peerId,
-			msg, avail-1);
-	sendPkt(msg, blen, id->addr);
+			slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
+	sendSlot(slot, blen, id->addr);
 }
 
 void bdNode::msgout_ask_conn(
-		const bdId *id, bdToken *tid, bdNodeId *nodeId, bdId *peerId)
+		const bdId *id, bdToken *tid, bdNodeId *nodeId, bdId *peerId, uint64_t relayNonce)
 {
 	// #ifdef DEBUG_NODE_MSGOUT
 	std::ostringstream ss;
@@ -1156,12 +1719,15 @@ void bdNode::msgout_ask_conn(
 	LOG.info("bdNode::msgout_ask_conn() TransId: %s To: %s",
 			ss.str().c_str(), mFns->bdPrintId(id).c_str());
 	// #endif
-	char msg[10240];
-	int avail = 10240;
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
 
-	int blen = bitdht_ask_conn_msg(tid, &(mOwnId), nodeId, peerId,
-			msg, avail-1);
-	sendPkt(msg, blen, id->addr);
+	int blen = bitdht_ask_conn_msg(tid, &(mOwnId), nodeId, peerId, relayNonce,
+			slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
+	sendSlot(slot, blen, id->addr);
 }
 
 void bdNode::msgout_reply_conn(
@@ -1173,25 +1739,40 @@ void bdNode::msgout_reply_conn(
 	LOG.info("bdNode::msgout_reply_conn() TransId: %s To: %s",
 			ss.str().c_str(), mFns->bdPrintId(id).c_str());
 	// #endif
-	char msg[10240];
-	int avail = 10240;
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
 
 	int blen = bitdht_reply_conn_msg(tid, nodeId, true,
-			msg, avail-1);
-	sendPkt(msg, blen, id->addr);
+			slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
+	sendSlot(slot, blen, id->addr);
 }
 
-void bdNode::sendPkt(char *msg, int len, struct sockaddr_in addr)
+/* queues a slot the msgout_* functions have encoded into.
+ * be_encode() reports the full length even when it didn't fit,
+ * so an oversized message is dropped here rather than truncated.
+ */
+bool bdNode::sendSlot(bdMsgSlot *slot, int len, struct sockaddr_in addr, int repeat)
 {
-	//LOG.info("bdNode::sendPkt(%d) to %s:%d\n", 
+	//LOG.info("bdNode::sendSlot(%d) to %s:%d\n", 
 	//		len, inet_ntoa(addr.sin_addr), htons(addr.sin_port));
 
-	bdNodeNetMsg *bdmsg = new bdNodeNetMsg(msg, len, &addr);
-	//bdmsg->print(LOG << log4cpp::Priority::INFO);
-	mOutgoingMsgs.push_back(bdmsg);
-	//bdmsg->print(LOG << log4cpp::Priority::INFO);
+	if ((len <= 0) || (len > BITDHT_MSGPOOL_SLOT_SIZE))
+	{
+#ifdef DEBUG_NODE_MSGOUT
+		LOG.info("bdNode::sendSlot() dropping oversized msg: %d", len);
+#endif
+		mOutgoingPool.discard(slot);
+		return false;
+	}
 
-	return;
+	slot->mSize = len;
+	slot->addr = addr;
+	slot->mRepeat = repeat;
+	mOutgoingMsgs.push(slot);
+	return true;
 }
 
 /********************* Incoming Messages *************************/
@@ -1202,9 +1783,6 @@ void bdNode::sendPkt(char *msg, int len, struct sockaddr_in addr)
 
 void bdNode::recvPkt(char *msg, int len, struct sockaddr_in addr)
 {
-	if (isMemberOfBlackList(addr))
-		return;
-
 #ifdef DEBUG_NODE_PARSE
 	std::ostringstream ss;
 	char buf[100];
@@ -1318,6 +1896,16 @@ void bdNode::recvPkt(char *msg, int len, struct sockaddr_in addr)
 		return;
 	}
 
+	/* Construct Source Id */
+	bdId srcId(id, addr);
+
+	/* drop unsolicited replies before doing any more work */
+	if (!checkIncomingMsg(&srcId, &transId, beType))
+	{
+		be_free(node);
+		return;
+	}
+
 	/************************ handle version (optional:pong) **************/
 	be_node *be_version = NULL;
 	bdToken versionId;
@@ -1547,6 +2135,7 @@ void bdNode::recvPkt(char *msg, int len, struct sockaddr_in addr)
 
 	bdNodeId thisNodeId2;
 	bdId peerNodeId2;
+	uint64_t relayNonce = 0;
 	if (beType == BITDHT_MSG_TYPE::BITDHT_MSG_TYPE_ASK_CONN)
 	{
 		be_node  *be_id = NULL;
@@ -1583,6 +2172,16 @@ void bdNode::recvPkt(char *msg, int len, struct sockaddr_in addr)
 		if (!beMsgGetBdId(be_pid, peerNodeId2)) {
 #ifdef DEBUG_NODE_PARSE
 			LOG.info("bdTunnelNode::recvPkt() REPLY_NEWCONN decode pid fail. Dropping Msg");
+#endif
+			be_free(node);
+			return;
+		}
+
+		/* optional: only from rendezvous nodes that relay */
+		be_node *be_rn = beMsgGetDictNode(be_data, "rn");
+		if ((be_rn) && (!beMsgGetNonce(be_rn, relayNonce))) {
+#ifdef DEBUG_NODE_PARSE
+			LOG.info("bdTunnelNode::recvPkt() ASK_CONN decode rn fail. Dropping Msg");
 #endif
 			be_free(node);
 			return;
@@ -1596,10 +2195,6 @@ void bdNode::recvPkt(char *msg, int len, struct sockaddr_in addr)
 	}
 
 	/****************** Bits Parsed Ok. Process Msg ***********************/
-	/* Construct Source Id */
-	bdId srcId(id, addr);
-
-	checkIncomingMsg(&srcId, &transId, beType);
 	switch(beType)
 	{
 	case BITDHT_MSG_TYPE_PING:  /* a: id, transId */
@@ -1743,7 +2338,8 @@ void bdNode::recvPkt(char *msg, int len, struct sockaddr_in addr)
 				valid ? "valid" : "invalid");
 #endif
 		if (valid) {
-			msgin_reply_ask_myip(&peerId, &transId);
+			mFanout.addPeer(&srcId, bdClockUsecs() / 1000000);
+			msgin_reply_ask_myip(&srcId, &peerId, &transId);
 		}
 		break;
 	}
@@ -1771,7 +2367,7 @@ void bdNode::recvPkt(char *msg, int len, struct sockaddr_in addr)
 				mFns->bdPrintId(&peerNodeId2).c_str());
 #endif
 		if (valid) {
-			msgin_ask_conn(&srcId, &transId, &thisNodeId2, &peerNodeId2);
+			msgin_ask_conn(&srcId, &transId, &thisNodeId2, &peerNodeId2, relayNonce);
 		}
 		break;
 	}
@@ -1815,8 +2411,9 @@ void bdNode::msgin_ping(bdId *id, bdToken *transId)
 	uint32_t peerflags = 0; /* no id typically, so cant get version */
 	addPeer(id, peerflags);
 
-	/* reply */
+	/* reply - never dropped, but slows other replies */
 	msgout_pong(id, transId);
+	mRateCtrl.charge(BITDHT_RATE_REPLY, bdClockUsecs());
 
 	mPacketCallback->onRecvCallback(id, BITDHT_MSG_TYPE_PING);
 }
@@ -1839,6 +2436,16 @@ void bdNode::msgin_pong(bdId *id, bdToken *transId, bdToken *versionId)
 #endif
 
 	mCounterRecvPong++;
+
+	/* the hole is open: stop punching. punch bursts aren't counted as
+	 * requests (mostly unanswered, for reasons that aren't congestion),
+	 * so their pongs aren't counted as responses.
+	 */
+	if (!mPunch.gotPong(id, bdClockUsecs()))
+	{
+		mRateCtrl.gotResponse();
+	}
+
 	/* recv pong, and peer is alive. add to DHT */
 	//uint32_t vId = 0; // TODO XXX convertBdVersionToVID(versionId);
 
@@ -1891,6 +2498,7 @@ void bdNode::msgin_pong(bdId *id, bdToken *transId, bdToken *versionId)
 	if (sameDhtEngine)
 	{
 		peerflags |= BITDHT_PEER_STATUS_DHT_ENGINE; 
+		mFanout.addPeer(id, bdClockUsecs() / 1000000);
 	}
 	if (sameAppl)
 	{
@@ -1955,6 +2563,16 @@ void bdNode::msgin_reply_find_node(bdId *id, bdToken *transId, std::list<bdId> &
 	(void) transId;
 #endif
 	mCounterRecvReplyFindNode++;
+	mRateCtrl.gotResponse();
+
+	/* the reply is shared by every query: the loop below and addPeer()
+	 * feed it to all of them, including any that were coalesced onto it.
+	 */
+	uint64_t sentUsecs = removeInFlightQuery(id);
+	if (sentUsecs)
+	{
+		mRateCtrl.addRttSample(bdClockUsecs() - sentUsecs);
+	}
 
 	/* add neighbours to the potential list */
 	for(it = nodes.begin(); it != nodes.end(); it++)
@@ -2092,28 +2710,20 @@ void bdNode::msgin_reply_post(bdId *id, bdToken *transId)
 
 void bdNode::msgin_ask_myip(bdId *tunnelId, bdToken *transId)
 {
+	mFanout.addPeer(tunnelId, bdClockUsecs() / 1000000);
 	msgout_reply_ask_myip(tunnelId, transId);
 	mPacketCallback->onRecvCallback(tunnelId, BITDHT_MSG_TYPE_NEWCONN);
 }
 
-void bdNode::msgin_reply_ask_myip(bdId *tunnelId, bdToken *transId)
+void bdNode::msgin_reply_ask_myip(bdId *id, bdId *tunnelId, bdToken *transId)
 {
 	mPacketCallback->onRecvCallback(tunnelId, BITDHT_MSG_TYPE_REPLY_NEWCONN);
 
-	if (mOwnId == tunnelId->id) {
-		int count = 0;
-		std::list<sockaddr_in>::iterator itp;
-		for (itp = mMyIPs.begin(); itp != mMyIPs.end(); itp++) {
-			if (itp->sin_family == tunnelId->addr.sin_family &&
-				memcmp(&itp->sin_addr, &tunnelId->addr.sin_addr, sizeof(itp->sin_addr)) == 0 &&
-				itp->sin_port == tunnelId->addr.sin_port) {
-				count++;
-				break;
-			};
-		}
-		if (count == 0) {
-			mMyIPs.push_back(tunnelId->addr);
-		}
+	/* only a reply to an ask_myip we sent gets a vote */
+	bdTransEntry entry;
+	if ((mOwnId == tunnelId->id) &&
+			(mTransTable.matchType(transId, &(id->addr), BITDHT_MSG_TYPE_NEWCONN, entry))) {
+		mExtAddr.vote(&(id->addr), &(tunnelId->addr), time(NULL));
 	}
 
 	// my IP is here:tunnelId
@@ -2124,42 +2734,47 @@ void bdNode::msgin_reply_ask_myip(bdId *tunnelId, bdToken *transId)
 void bdNode::msgin_broadcast_conn(
 		bdId *id, bdToken *tid, bdNodeId *nodeId, bdNodeId *peerId)
 {
+	/* only one of the two ends can make the request */
+	bdNodeId *other;
 	if (id->id == *nodeId) {
-		// record IP?
-		mConnectRequests[*nodeId] = *peerId;
-
-		mPeerAddrs[id->id] = id->addr;
-		if (mPeerAddrs.find(*peerId) != mPeerAddrs.end()) {
-			// pair match!
-			bdId peer(*peerId, mPeerAddrs[*peerId]);
-			bdToken transId;
-			genNewTransId(&transId);
-			msgout_ask_conn(&peer, &transId, peerId, id);
-
-			genNewTransId(&transId);
-			msgout_ask_conn(id, &transId, peerId, &peer);
-		}
+		other = peerId;
 	}
 	else if (id->id == *peerId) {
-		// record IP?
-		mConnectRequests[*peerId] = *nodeId;
+		other = nodeId;
+	}
+	else {
+		return;
+	}
+	mFanout.addPeer(id, bdClockUsecs() / 1000000);
 
-		mPeerAddrs[id->id] = id->addr;
-		if (mPeerAddrs.find(*nodeId) != mPeerAddrs.end()) {
-			// pair match!
-			bdId peer(*nodeId, mPeerAddrs[*nodeId]);
-			bdToken transId;
-			genNewTransId(&transId);
-			msgout_ask_conn(&peer, &transId, nodeId, id);
+	bdId match;
+	if (BITDHT_RDV_PAIRED != mRendezvous.add(id, other, bdClockUsecs(), match)) {
+		return;
+	}
 
-			genNewTransId(&transId);
-			msgout_ask_conn(id, &transId, peerId, &peer);
-		}
+	// pair match! tell each end where the other is.
+	mCounterRendezvousPaired++;
+
+	/* a fresh secret per pairing, known only to the two ends: relayed
+	 * packets must carry it. 0 (no entropy source, or no relay session
+	 * for them) means no relay.
+	 */
+	uint64_t nonce = 0;
+	if ((!bdSecureRandom(nonce)) || (!mPacketCallback->onPairedCallback(&match, id, nonce)))
+	{
+		nonce = 0;
 	}
+
+	bdToken transId;
+	genNewTransId(&transId);
+	msgout_ask_conn(&match, &transId, &(match.id), id, nonce);
+
+	genNewTransId(&transId);
+	msgout_ask_conn(id, &transId, &(id->id), &match, nonce);
 }
 
 void bdNode::msgin_ask_conn(
-		bdId *id, bdToken *tid, bdNodeId *nodeId, bdId *peerId)
+		bdId *id, bdToken *tid, bdNodeId *nodeId, bdId *peerId, uint64_t relayNonce)
 {
 #ifdef DEBUG_NODE_ACTIONS
 	LOG.info("bdNode::msgin_ask_conn() from: %s for: %s and %s",
@@ -2167,21 +2782,24 @@ void bdNode::msgin_ask_conn(
 			mFns->bdPrintNodeId(nodeId).c_str(),
 			mFns->bdPrintId(peerId).c_str());
 #endif
+	mFanout.addPeer(id, bdClockUsecs() / 1000000);
+
 	if (mOwnId == *nodeId) {
 		// found!!!
-		int count = 0;
-		std::list<bdId>::iterator it;
-		for(it = mPunching.begin(); it != mPunching.end(); it++) {
-			if (it->id == peerId->id &&
-				it->addr.sin_family == peerId->addr.sin_family &&
-				it->addr.sin_addr.s_addr == peerId->addr.sin_addr.s_addr &&
-				it->addr.sin_port == peerId->addr.sin_port) {
-				count++;
-				break;
-			}
+		mPunch.add(peerId, bdClockUsecs());
+		if (relayNonce) {
+			mPacketCallback->onRelayCallback(id, peerId, relayNonce);
 		}
-		if (count == 0) {
-			mPunching.push_back(*peerId);
+
+		/* paired: stop broadcasting the request */
+		std::map<bdNodeId, bdNodeId>::iterator it;
+		for (it = mConnectRequests.begin(); it != mConnectRequests.end();) {
+			if (it->second == peerId->id) {
+				mConnectRequests.erase(it++);
+			}
+			else {
+				it++;
+			}
 		}
 		return;
 	}
@@ -2204,40 +2822,30 @@ void bdNode::genNewToken(bdToken *token)
 	LOG.info("bdNode::genNewToken()");
 #endif
 
-	std::ostringstream out;
-	out << std::setw(4) << std::setfill('0') << rand() << std::setw(4) << std::setfill('0') << rand();
-	std::string num = out.str();
-	int len = num.size();
-	if (len > BITDHT_TOKEN_MAX_LEN)
-		len = BITDHT_TOKEN_MAX_LEN;
-
-	for(int i = 0; i < len; i++)
+	uint64_t num = mRandom.next();
+	for(int i = 0; i < BITDHT_TOKEN_LEN; i++)
 	{
-		token->data[i] = num[i];
+		token->data[i] = (num >> (8 * i)) & 0xff;
 	}
-	token->len = len;
+	token->len = BITDHT_TOKEN_LEN;
 }
 
-std::atomic_ulong transIdCounter(0);
+/* fixed width binary: a 16 bit per-node counter, so ids aren't reused
+ * while a request could still be outstanding, plus 16 random bits so
+ * replies can't be forged by following the sequence.
+ */
 void bdNode::genNewTransId(bdToken *token)
 {
-	/* generate message, send to udp */
 #ifdef DEBUG_NODE_ACTIONS 
 	LOG.info("bdNode::genNewTransId()");
 #endif
 
-	std::ostringstream out;
-	out << std::setw(2) << std::setfill('0') << transIdCounter++;
-	std::string num = out.str();
-	int len = num.size();
-	if (len > BITDHT_TOKEN_MAX_LEN)
-		len = BITDHT_TOKEN_MAX_LEN;
-
-	for(int i = 0; i < len; i++)
-	{
-		token->data[i] = num[i];
-	}
-	token->len = len;
+	uint32_t num = ((mTransIdCounter++ & 0xffff) << 16) | (mRandom.next32() & 0xffff);
+	token->data[0] = (num >> 24) & 0xff;
+	token->data[1] = (num >> 16) & 0xff;
+	token->data[2] = (num >> 8) & 0xff;
+	token->data[3] = num & 0xff;
+	token->len = BITDHT_TRANSID_LEN;
 }
 
 /* Store Remote Query for processing */
@@ -2247,45 +2855,56 @@ int bdNode::queueQuery(bdId *id, bdNodeId *query, bdToken *transId, uint32_t que
 	LOG.info("bdnode::queueQuery()");
 #endif
 
-	mRemoteQueries.push_back(bdRemoteQuery(id, query, transId, query_type));	
+	bdRemoteQuery remote(id, query, transId, query_type);
+
+	/* nothing waiting ahead of it: answer straight away */
+	if ((mRemoteQueries.empty()) && (mRateCtrl.take(BITDHT_RATE_REPLY, bdClockUsecs())))
+	{
+		answerRemoteQuery(remote);
+		return 1;
+	}
+
+	mRemoteQueries.push_back(remote);
+
+	/* shed the oldest if we are too far behind */
+	while(mRemoteQueries.size() > BITDHT_MAX_REMOTE_QUERIES)
+	{
+		mRemoteQueries.pop_front();
+		mCounterRemoteShed++;
+	}
 
 	return 1;
 }
 
 /*************** Register Transaction Ids *************/
 
-void bdNode::registerOutgoingMsg(bdId *id, bdToken *transId, uint32_t msgType)
+void bdNode::registerOutgoingMsg(bdId *id, bdToken *transId, uint32_t msgType,
+		const bdNodeId *target)
 {
 
 #ifdef DEBUG_MSG_CHECKS
 	LOG.info("bdNode::registerOutgoingMsg(%s, %d)",
-			mFns->bdPrintId(id), msgType);
-#else
-	(void) id;
-	(void) msgType;
+			mFns->bdPrintId(id).c_str(), msgType);
 #endif
 
 #ifdef USE_HISTORY
 	mHistory.addMsg(id, transId, msgType, false);
-#else
-	(void) transId;
 #endif
 
-
-
-	/****
-#define BITDHT_MSG_TYPE_UNKNOWN         0
-#define BITDHT_MSG_TYPE_PING            1
-#define BITDHT_MSG_TYPE_PONG            2
-#define BITDHT_MSG_TYPE_FIND_NODE       3
-#define BITDHT_MSG_TYPE_REPLY_NODE      4
-#define BITDHT_MSG_TYPE_GET_HASH        5
-#define BITDHT_MSG_TYPE_REPLY_HASH      6
-#define BITDHT_MSG_TYPE_REPLY_NEAR      7
-#define BITDHT_MSG_TYPE_POST_HASH       8
-#define BITDHT_MSG_TYPE_REPLY_POST      9
-	 ***/
-
+	/* requests expect a reply */
+	switch(msgType)
+	{
+		case BITDHT_MSG_TYPE_PING:
+		case BITDHT_MSG_TYPE_FIND_NODE:
+		case BITDHT_MSG_TYPE_GET_HASH:
+		case BITDHT_MSG_TYPE_POST_HASH:
+		case BITDHT_MSG_TYPE_NEWCONN:	/* ask_myip */
+			mTransTable.add(transId, &(id->addr), msgType, target,
+					bdClockUsecs(), time(NULL));
+			break;
+		default:
+			break;
+	}
 }
 
 
@@ -2296,81 +2915,102 @@ uint32_t bdNode::checkIncomingMsg(bdId *id, bdToken *transId, uint32_t msgType)
 #ifdef DEBUG_MSG_CHECKS
 	LOG.info("bdNode::checkIncomingMsg(%s, %d)",
 			mFns->bdPrintId(id).c_str(), msgType);
-#else
-	(void) id;
-	(void) msgType;
 #endif
 
 #ifdef USE_HISTORY
 	mHistory.addMsg(id, transId, msgType, true);
-#else
-	(void) transId;
 #endif
 
-	return 0;
+	/* replies must match a request we sent, to that address.
+	 * (reply types can't be told apart reliably - a reply_post
+	 * parses as a pong - so any outstanding request will do)
+	 */
+	switch(msgType)
+	{
+		case BITDHT_MSG_TYPE_PONG:
+		case BITDHT_MSG_TYPE_REPLY_NODE:
+		case BITDHT_MSG_TYPE_REPLY_HASH:
+		case BITDHT_MSG_TYPE_REPLY_NEAR:
+		case BITDHT_MSG_TYPE_REPLY_POST:
+		{
+			bdTransEntry entry;
+			if ((!matchPunchPong(id, transId, msgType, entry)) &&
+				(!mTransTable.match(transId, &(id->addr), entry)))
+			{
+#ifdef DEBUG_MSG_CHECKS
+				LOG.info("bdNode::checkIncomingMsg() unsolicited reply from %s. Dropping Msg",
+						mFns->bdPrintId(id).c_str());
+#endif
+				return 0;
+			}
+			mCycleRpcLatency.add(bdClockUsecs() - entry.mSendUsecs);
+			return entry.mMsgType;
+		}
+		default:
+			break;
+	}
+
+	return msgType;
 }
 
-void bdNode::cleanupTransIdRegister()
+/* a punched NAT may map the peer's reply to a different port than the
+ * one we pinged. A pong from the same host is still ours if it carries
+ * the node id we are punching, and answers one of the punch pings.
+ */
+bool bdNode::matchPunchPong(bdId *id, bdToken *transId, uint32_t msgType, bdTransEntry &entry)
 {
-	return;
-}
+	bdId target;
+	if ((msgType != BITDHT_MSG_TYPE_PONG) || (!mPunch.getTarget(&(id->id), target)))
+	{
+		return false;
+	}
 
-/*************** Internal Msg Storage *****************/
+	if ((target.addr.sin_addr.s_addr != id->addr.sin_addr.s_addr) ||
+		(target.addr.sin_port == id->addr.sin_port))
+	{
+		return false;
+	}
 
-bdNodeNetMsg::bdNodeNetMsg(char *msg, int len, struct sockaddr_in *in_addr)
-:data(NULL), mSize(len), addr(*in_addr)
-{
-	data = (char *) malloc(len);
-	memcpy(data, msg, len);
-	//print(LOG << log4cpp::Priority::INFO);
+	/* only a punch ping may be answered from elsewhere */
+	return mTransTable.matchType(transId, &(target.addr), BITDHT_MSG_TYPE_PING, entry);
 }
 
-void bdNodeNetMsg::print(std::ostream &out)
+void bdNode::cleanupTransIdRegister()
 {
-	out << "bdNodeNetMsg::print(" << mSize << ") to "
-			<< inet_ntoa(addr.sin_addr) << ":" << htons(addr.sin_port);
-	out << std::endl;
+	mTransTable.expire(time(NULL));
 }
 
-bdNodeNetMsg::~bdNodeNetMsg()
+/* the blacklist has its own lock: it is checked from the receive thread */
+bool bdNode::isMemberOfBlackList(sockaddr_in &blackAddr)
 {
-	free(data);
+	bdStackMutex stack(mBlackListMtx); /********** MUTEX LOCKED *************/
+	return mBlackList.isBlackListed(blackAddr);
 }
 
-bool bdNode::isMemberOfBlackList(sockaddr_in &blackAddr)
+int bdNode::loadBlackList(const std::string &file)
 {
-	for (std::list<sockaddr_in>::iterator it = mBlackNodes.begin();
-			it != mBlackNodes.end(); ++it) {
-		if ((it->sin_addr.s_addr == blackAddr.sin_addr.s_addr) &&
-				(it->sin_port == blackAddr.sin_port)) {
-			return true;
-		}
-	}
-	return false;
+	bdStackMutex stack(mBlackListMtx); /********** MUTEX LOCKED *************/
+	return mBlackList.loadFile(file);
 }
 
 void bdNode::addBlackList(sockaddr_in &blackAddr)
 {
-	for (std::list<sockaddr_in>::iterator it = mBlackNodes.begin();
-			it != mBlackNodes.end(); ++it) {
-		if ((it->sin_addr.s_addr == blackAddr.sin_addr.s_addr) &&
-				(it->sin_port == blackAddr.sin_port)) {
-			return;
-		}
-	}
-	mBlackNodes.push_back(blackAddr);
+	bdStackMutex stack(mBlackListMtx); /********** MUTEX LOCKED *************/
+	mBlackList.add(blackAddr);
 }
 
 void bdNode::removeBlackList(sockaddr_in &blackAddr)
 {
-	for (std::list<sockaddr_in>::iterator it = mBlackNodes.begin();
-			it != mBlackNodes.end();) {
-		if ((it->sin_addr.s_addr == blackAddr.sin_addr.s_addr) &&
-				(it->sin_port == blackAddr.sin_port)) {
-			it = mBlackNodes.erase(it);
-		}
-		else {
-			++it;
-		}
-	}
+	bdStackMutex stack(mBlackListMtx); /********** MUTEX LOCKED *************/
+	mBlackList.remove(blackAddr);
+}
+
+bool bdNode::getExternalAddress(sockaddr_in &addr)
+{
+	return mExtAddr.best(addr, time(NULL));
+}
+
+uint32_t bdNode::getNatType()
+{
+	return mExtAddr.natType(time(NULL));
 }
@@ -33,6 +33,21 @@
 #include "bitdht/bdobj.h"
 #include "bitdht/bdhash.h"
 #include "bitdht/bdhistory.h"
+#include "bitdht/bdpathcache.h"
+#include "bitdht/bdratectrl.h"
+#include "bitdht/bdmsgpool.h"
+#include "bitdht/bdtranstable.h"
+#include "bitdht/bdblacklist.h"
+#include "bitdht/bdpendingpeers.h"
+#include "bitdht/bdpunch.h"
+#include "bitdht/bdrendezvous.h"
+#include "bitdht/bdfanout.h"
+#include "bitdht/bdextaddr.h"
+#include "util/bdhistogram.h"
+#include "util/bdrandom.h"
+#include "util/bdrecentset.h"
+#include "util/bdring.h"
+#include "util/bdthreads.h"
 
 
 #define BD_QUERY_NEIGHBOURS		1
@@ -75,19 +90,30 @@ output -> call back to Udp().
 
  *********/
 
-class bdNodeNetMsg
+/* slots preallocated for datagrams waiting to be processed / sent */
+#define BITDHT_NODE_INCOMING_SLOTS	512	/* per receive shard */
+#define BITDHT_NODE_MAX_SHARDS		16
+#define BITDHT_NODE_OUTGOING_SLOTS	1024
+/* ask_myip tokens remembered for checking replies */
+#define BITDHT_NODE_TOKEN_WINDOW	1000
+/* potential peers for full buckets queue behind those this many buckets further away */
+#define BITDHT_NODE_FULL_BUCKET_PENALTY	32
+/* encoding space, leaving room for the bitdht_ecrypt() checksum + token */
+#define BITDHT_NODE_ECRYPT_AVAIL	(BITDHT_MSGPOOL_SLOT_SIZE - 8)
+
+/* an outstanding find_node request.
+ * lookups for nearby targets piggyback on the reply instead of
+ * sending a duplicate request to the same peer.
+ */
+class bdInFlightQuery
 {
-
 public:
-	bdNodeNetMsg(char *data, int size, struct sockaddr_in *addr);
-	~bdNodeNetMsg();
-
-	void print(std::ostream &out);
-
-	char *data;
-	int mSize;
-	struct sockaddr_in addr;
+	bdInFlightQuery(const bdNodeId *target, time_t ts, uint64_t usecs)
+		: mTarget(*target), mSendTS(ts), mSendUsecs(usecs) {}
 
+	bdNodeId mTarget; /* real target of the lookup (not the disguised one) */
+	time_t mSendTS;
+	uint64_t mSendUsecs; /* for round trip times */
 };
 
 class bdNode
@@ -99,6 +125,7 @@ public:
 			const std::string &whitelist,
 			bdDhtFunctions *fns,
 			PacketCallback *packetCallback);
+	~bdNode();
 
 	/* startup / shutdown node */
 	void restartNode();
@@ -115,11 +142,21 @@ public:
 	void addQuery(const bdNodeId *id, uint32_t qflags);
 	void clearQuery(const bdNodeId *id);
 	void QueryStatus(std::map<bdNodeId, bdQueryStatus> &statusMap);
+	uint32_t queryCount();
+	bool popQueryEvent(bdQueryEvent &event);
 	bool getIdFromQuery(const bdNodeId *id, std::list<bdPeer> &idList);
 
 	void iterationOff();
 	void iteration();
+	void processIncomingMsgs();
+	void sendPacedMsgs();
+	bool nextPacedSend(uint64_t &waitUsecs);
 	void processRemoteQuery();
+
+	/* outbound rate limits, msgs/sec per BITDHT_RATE_ type */
+	void setMsgRate(int type, double rate);
+	double getMsgRate(int type);
+	void setAdaptiveMsgRate(bool adaptive);
 	void updateStore();
 
 	void addConnReq(const bdNodeId &id);
@@ -127,25 +164,31 @@ public:
 
 	/* interaction with outside world */
 	int 	outgoingMsg(struct sockaddr_in *addr, char *msg, int *len);
-	void 	incomingMsg(struct sockaddr_in *addr, char *msg, int len);
+	bdMsgSlot *popOutgoingMsg();	/* NULL if none */
+	void	releaseOutgoingMsg(bdMsgSlot *slot);
+	void 	incomingMsg(struct sockaddr_in *addr, char *msg, int len, uint32_t shard = 0);	/* any thread */
+	/* an incoming ring per receive thread, so they don't contend.
+	 * shards can be added at any time, but not removed.
+	 */
+	void	setIncomingShards(uint32_t shards);
 
 	/* internal interaction with network */
-	void	sendPkt(char *msg, int len, struct sockaddr_in addr);
+	bool	sendSlot(bdMsgSlot *slot, int len, struct sockaddr_in addr, int repeat = 1);
 	void	recvPkt(char *msg, int len, struct sockaddr_in addr);
 
 	/* output functions (send msg) */
-	void msgout_ping(bdId *id, bdToken *transId);
+	bool msgout_ping(bdId *id, bdToken *transId);
 	void msgout_pong(bdId *id, bdToken *transId);
-	void msgout_find_node(bdId *id, bdToken *transId, bdNodeId *query);
+	bool msgout_find_node(bdId *id, bdToken *transId, bdNodeId *query);
 	void msgout_reply_find_node(bdId *id, bdToken *transId, 
 			std::list<bdId> &peers);
-	void msgout_get_hash(bdId *id, bdToken *transId, bdNodeId *info_hash);
+	bool msgout_get_hash(bdId *id, bdToken *transId, bdNodeId *info_hash);
 	void msgout_reply_hash(bdId *id, bdToken *transId, 
 			bdToken *token, std::list<std::string> &values);
 	void msgout_reply_nearest(bdId *id, bdToken *transId, 
 			bdToken *token, std::list<bdId> &peers);
 
-	void msgout_post_hash(bdId *id, bdToken *transId, bdNodeId *info_hash, 
+	bool msgout_post_hash(bdId *id, bdToken *transId, bdNodeId *info_hash, 
 			uint32_t port, bdToken *token);
 	void msgout_reply_post(bdId *id, bdToken *transId);
 
@@ -153,7 +196,8 @@ public:
 	void msgout_reply_ask_myip(bdId *tunnelId, bdToken *transId);
 
 	void msgout_broadcast_conn(const bdId *id, bdToken *tid, bdNodeId *nodeId, bdNodeId *peerId);
-	void msgout_ask_conn(const bdId *id, bdToken *tid, bdNodeId *nodeId, bdId *peerId);
+	void msgout_ask_conn(const bdId *id, bdToken *tid, bdNodeId *nodeId, bdId *peerId,
+			uint64_t relayNonce);
 	void msgout_reply_conn(const bdId *id, bdToken *tid, bdNodeId *nodeId, bool started);
 
 	/* input functions (once mesg is parsed) */
@@ -175,10 +219,11 @@ public:
 	void msgin_reply_post(bdId *id, bdToken *transId);
 
 	void msgin_ask_myip(bdId *tunnelId, bdToken *transId);
-	void msgin_reply_ask_myip(bdId *tunnelId, bdToken *transId);
+	void msgin_reply_ask_myip(bdId *id, bdId *tunnelId, bdToken *transId);
 
 	void msgin_broadcast_conn(bdId *id, bdToken *tid, bdNodeId *nodeId, bdNodeId *peerId);
-	void msgin_ask_conn(bdId *id, bdToken *tid, bdNodeId *nodeId, bdId *peerId);
+	void msgin_ask_conn(bdId *id, bdToken *tid, bdNodeId *nodeId, bdId *peerId,
+			uint64_t relayNonce);
 	void msgin_reply_conn(bdId *id, bdToken *tid, bdNodeId *nodeId, bool started);
 
 	/* token handling */
@@ -187,8 +232,11 @@ public:
 
 	/* transId handling */
 	void genNewTransId(bdToken *token);
-	void registerOutgoingMsg(bdId *id, bdToken *transId, uint32_t msgType);
+	void registerOutgoingMsg(bdId *id, bdToken *transId, uint32_t msgType,
+			const bdNodeId *target = NULL);
+	/* returns 0 if the msg is an unsolicited reply, and must be dropped */
 	uint32_t checkIncomingMsg(bdId *id, bdToken *transId, uint32_t msgType);
+	bool matchPunchPong(bdId *id, bdToken *transId, uint32_t msgType, bdTransEntry &entry);
 	void cleanupTransIdRegister();
 
 	void getOwnId(bdNodeId *id);
@@ -199,26 +247,46 @@ public:
 
 	void resetCounters();
 	void resetStats();
+	void resetCycleStats();
 
-protected:
+	/* checked by the udp layer as each datagram arrives */
 	bool isMemberOfBlackList(sockaddr_in &blackAddr);
+	int loadBlackList(const std::string &file);
+
+	/* our external address, as voted by reply_myip. false if unknown */
+	bool getExternalAddress(sockaddr_in &addr);
+	/* BITDHT_NAT_xxx, see bdextaddr.h */
+	uint32_t getNatType();
+
+protected:
 	void addBlackList(sockaddr_in &blackAddr);
 	void removeBlackList(sockaddr_in &blackAddr);
 
 protected:
 	bdNodeId mOwnId;
-	std::list<sockaddr_in> mMyIPs;
+	bdExtAddrVote mExtAddr;
 	bdSpace mNodeSpace;
 
 private:
 	uint32_t getRandomToken();
 	bool isUsedToken(uint32_t);
-	void punching(int times);
+	void sendPunchBursts(uint64_t now);
+	uint32_t potentialPeerScore(const bdId *id);
+
+	bool isCoalescedQuery(const bdId *id, const bdNodeId *target);
+	void addInFlightQuery(const bdId *id, const bdNodeId *target);
+	uint64_t removeInFlightQuery(const bdId *id);
+	void cleanupInFlightQueries();
+
+	void recordQueryPath(bdQuery *query);
+	void answerRemoteQuery(bdRemoteQuery &query);
+	void checkQueryEvents();
 
 private:
 	bdStore mStore;
 	bdStore mWhiteNodes;
-	std::list<sockaddr_in> mBlackNodes;
+	bdBlackList mBlackList;
+	bdMutex mBlackListMtx;	/* for mBlackList: checked by the receive thread */
 	std::string mDhtVersion;
 
 	bdDhtFunctions *mFns;
@@ -229,17 +297,31 @@ private:
 	bdHistory mHistory; /* for understanding the DHT */
 
 	std::list<bdQuery *> mLocalQueries;
+	std::list<bdQueryEvent> mQueryEvents;
 	std::list<bdRemoteQuery> mRemoteQueries;
-	std::list<bdId> mPotentialPeers;
-
-	std::map<bdNodeId, bdNodeId> mConnectRequests;
-	std::map<bdNodeId, struct sockaddr_in> mPeerAddrs;
-	std::list<bdId> mPunching;
-
-	std::list<bdNodeNetMsg *> mOutgoingMsgs;
-	std::list<bdNodeNetMsg *> mIncomingMsgs;
-
-	std::vector<uint32_t> mRandomTokenArray;
+	bdRateController mRateCtrl;
+	int mQueryTurns; /* queries yet to send a find_node this iteration */
+	std::multimap<bdId, bdInFlightQuery> mInFlightQueries;
+	bdPathCache mPathCache;
+	bdTransTable mTransTable;
+	bdPendingPeers mPotentialPeers;
+
+	std::map<bdNodeId, bdNodeId> mConnectRequests;	/* our own */
+	bdRendezvousTable mRendezvous;			/* other peers' */
+	bdFanoutSchedule mFanout;	/* where ask_myip / broadcast_conn go */
+	uint32_t mFanoutCursor;		/* next connect request to broadcast */
+	bdPunchEngine mPunch;
+
+	bdMsgPool mOutgoingPool;
+	bdMsgQueue mOutgoingMsgs;
+	/* one per receive thread: mIncomingShards are valid */
+	bdRing<bdMsgSlot> *mIncomingRings[BITDHT_NODE_MAX_SHARDS];
+	std::atomic<uint32_t> mIncomingShards;
+
+	bdRecentSet mRandomTokens;	/* sent with ask_myip, for checking replies */
+
+	bdRandom mRandom;
+	uint32_t mTransIdCounter;
 
 	// Statistics.
 	double mCounterOutOfDatePing;
@@ -271,6 +353,32 @@ private:
 	double mLpfRecvQueryHash;
 	double mLpfRecvReplyFindNode;
 	double mLpfRecvReplyQueryHash;
+
+	double mCounterCoalescedQuery;
+	double mLpfCoalescedQuery;
+
+	double mCounterRemoteAnswered;
+	double mCounterRemoteExpired;
+	double mCounterRemoteShed;
+	double mLpfRemoteAnswered;
+	double mLpfRemoteExpired;
+	double mLpfRemoteShed;
+
+	double mCounterRendezvousPaired;
+	double mLpfRendezvousPaired;
+	double mCounterBroadcastMsgs;
+	double mLpfBroadcastMsgs;
+
+	// Per Refresh-Cycle Statistics.
+	uint32_t mCycleCoalescedQuery;
+	bdHistogram mCycleRemoteLatency;
+	bdHistogram mCycleRpcLatency;	/* request -> matching reply */
+
+	// Path Cache Statistics (hops = find_node requests per completed query).
+	uint32_t mPathSeededQueries;
+	uint32_t mPathSeededHops;
+	uint32_t mPathUnseededQueries;
+	uint32_t mPathUnseededHops;
 };
 
 #endif // BITDHT_NODE_H
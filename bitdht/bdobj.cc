@@ -25,12 +25,13 @@
  */
 
 #include "bitdht/bdobj.h"
+#include <iomanip>
 
 
+/* transaction ids are binary: print as hex */
 void bdPrintTransId(std::ostream &out, bdToken *transId)
 {
-	out << transId->data;
-	return;
+	bdPrintToken(out, transId);
 }
 
 
@@ -38,9 +39,9 @@ void bdPrintToken(std::ostream &out, bdToken *token)
 {
 	for(unsigned int i = 0; i < token->len; i++)
 	{
-		out << std::hex << (uint32_t) token->data[i];
+		out << std::hex << std::setw(2) << std::setfill('0') << (uint32_t) token->data[i];
 	}
-	out << std::dec;
+	out << std::dec << std::setfill(' ');
 }
 
 void bdPrintCompactPeerId(std::ostream &out, std::string /*cpi*/ )
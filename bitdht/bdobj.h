@@ -29,6 +29,10 @@
 
 #define BITDHT_TOKEN_MAX_LEN 20
 
+/* length of the binary transaction ids / tokens we generate */
+#define BITDHT_TRANSID_LEN 4
+#define BITDHT_TOKEN_LEN 8
+
 #include <iostream>
 #include <inttypes.h>
 
@@ -0,0 +1,111 @@
+/*
+ * bitdht/bdpathcache.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdpathcache.h"
+#include "util/bdlog.h"
+
+/***
+ * #define DEBUG_PATHCACHE 1
+ ***/
+
+bdPathCache::bdPathCache(uint32_t maxEntries, time_t ttl)
+	:mMaxEntries(maxEntries), mTTL(ttl)
+{
+	return;
+}
+
+void	bdPathCache::addPath(const bdNodeId *target, const std::list<bdId> &peers, time_t now)
+{
+	if (peers.empty())
+	{
+		return;
+	}
+
+	uint32_t key = prefix(target);
+	std::map<uint32_t, bdPathCacheEntry>::iterator it;
+	it = mEntries.find(key);
+	if (it == mEntries.end())
+	{
+		bdPathCacheEntry entry;
+		mLru.push_front(key);
+		entry.mLruIt = mLru.begin();
+		it = mEntries.insert(std::make_pair(key, entry)).first;
+	}
+	else
+	{
+		mLru.erase(it->second.mLruIt);
+		mLru.push_front(key);
+		it->second.mLruIt = mLru.begin();
+	}
+
+	it->second.mPeers = peers;
+	it->second.mUpdateTS = now;
+
+#ifdef DEBUG_PATHCACHE
+	LOG.info("bdPathCache::addPath() prefix: %08x peers: %d entries: %d",
+			key, (int) peers.size(), (int) mEntries.size());
+#endif
+
+	trim();
+}
+
+bool	bdPathCache::getPath(const bdNodeId *target, std::list<bdId> &peers, time_t now)
+{
+	std::map<uint32_t, bdPathCacheEntry>::iterator it;
+	it = mEntries.find(prefix(target));
+	if ((it == mEntries.end()) || (now - it->second.mUpdateTS > mTTL))
+	{
+		return false;
+	}
+
+	peers.insert(peers.end(), it->second.mPeers.begin(), it->second.mPeers.end());
+	return true;
+}
+
+void	bdPathCache::clear()
+{
+	mEntries.clear();
+	mLru.clear();
+}
+
+uint32_t bdPathCache::size()
+{
+	return mEntries.size();
+}
+
+uint32_t bdPathCache::prefix(const bdNodeId *id)
+{
+	uint32_t key = (id->data[0] << 24) | (id->data[1] << 16) |
+			(id->data[2] << 8) | id->data[3];
+	return key >> (32 - BITDHT_PATHCACHE_PREFIX_BITS);
+}
+
+void	bdPathCache::trim()
+{
+	while(mEntries.size() > mMaxEntries)
+	{
+		mEntries.erase(mLru.back());
+		mLru.pop_back();
+	}
+}
+
@@ -0,0 +1,83 @@
+#ifndef BITDHT_PATH_CACHE_H
+#define BITDHT_PATH_CACHE_H
+
+/*
+ * bitdht/bdpathcache.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * Lookup Path Cache.
+ *
+ * Our routing table is sparse far from our own id, so a new query
+ * has to walk several hops before it reaches the target's neighbourhood.
+ * When a query completes, the closest peers that replied to it are
+ * remembered against the target's prefix. Later queries for a target
+ * with the same prefix start from those peers instead.
+ *
+ * Bounded at mMaxEntries prefixes (least recently updated dropped first),
+ * and entries older than mTTL are ignored.
+ ******/
+
+#include "bitdht/bdpeer.h"
+
+#include <map>
+#include <list>
+
+#define BITDHT_PATHCACHE_PREFIX_BITS		16	/* max 32 */
+#define BITDHT_PATHCACHE_MAX_ENTRIES		256
+#define BITDHT_PATHCACHE_TTL			900	/* 15 minutes */
+
+class bdPathCacheEntry
+{
+public:
+	std::list<bdId> mPeers;
+	time_t mUpdateTS;
+	std::list<uint32_t>::iterator mLruIt;
+};
+
+class bdPathCache
+{
+public:
+	bdPathCache(uint32_t maxEntries = BITDHT_PATHCACHE_MAX_ENTRIES,
+			time_t ttl = BITDHT_PATHCACHE_TTL);
+
+	/* store the responsive peers closest to target (replaces any existing path) */
+	void	addPath(const bdNodeId *target, const std::list<bdId> &peers, time_t now);
+	/* appends the cached peers for target's prefix, returns false if none */
+	bool	getPath(const bdNodeId *target, std::list<bdId> &peers, time_t now);
+
+	void	clear();
+	uint32_t size();
+
+private:
+	uint32_t prefix(const bdNodeId *id);
+	void	trim();
+
+	std::map<uint32_t, bdPathCacheEntry> mEntries;
+	std::list<uint32_t> mLru;	/* front = most recently updated */
+
+	uint32_t mMaxEntries;
+	time_t mTTL;
+};
+
+#endif
+
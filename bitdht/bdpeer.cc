@@ -136,7 +136,7 @@ int operator<(const bdId &a, const bdId &b)
 	/* else NodeIds the same - check id addresses */
 	if (a.addr.sin_addr.s_addr < b.addr.sin_addr.s_addr)
 		return 1;
-	if (b.addr.sin_addr.s_addr > a.addr.sin_addr.s_addr)
+	if (b.addr.sin_addr.s_addr < a.addr.sin_addr.s_addr)
 		return 0;
 
 	if (a.addr.sin_port < b.addr.sin_port)
@@ -948,3 +948,10 @@ uint32_t  bdSpace::calcSpaceSize()
 	}
 	return totalcount;
 }
+
+bool	bdSpace::isBucketFull(const bdNodeId *id)
+{
+	int bucket = mFns->bdBucketDistance(&(mOwnId), id);
+	return (buckets[bucket].entries.size() >= mFns->bdNodesPerBucket());
+}
+
@@ -145,6 +145,7 @@ public:
 	uint32_t calcNetworkSize();
 	uint32_t calcNetworkSizeWithFlag(uint32_t withFlag);
 	uint32_t calcSpaceSize();
+	bool	isBucketFull(const bdNodeId *id);	/* the bucket id would go in */
 
 	/* to add later */
 	int	updateOwnId(bdNodeId *newOwnId);
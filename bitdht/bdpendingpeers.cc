@@ -0,0 +1,230 @@
+/*
+ * bitdht/bdpendingpeers.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdpendingpeers.h"
+#include "util/bdlog.h"
+
+/***
+ * #define DEBUG_PENDING 1
+ ***/
+
+bdPendingPeers::bdPendingPeers(uint32_t maxEntries, time_t ttl)
+	:mMaxEntries(maxEntries), mTTL(ttl), mSweepTS(0),
+	mCounterAdded(0), mCounterDuplicates(0), mCounterSkipped(0), mCounterExpired(0)
+{
+	return;
+}
+
+bool	bdPendingPeers::add(const bdId *id, uint32_t score, time_t now)
+{
+	std::map<bdId, bdPendingPeer>::iterator it = mPeers.find(*id);
+	if (it != mPeers.end())
+	{
+		mCounterDuplicates++;
+		if (score < it->second.mScore)
+		{
+			/* keeps its place in the ttl, moves up the queue */
+			mQueue.erase(it->second.mQueueIt);
+			it->second.mScore = score;
+			it->second.mQueueIt = mQueue.insert(std::make_pair(score, *id));
+		}
+		return false;
+	}
+
+	if (isRecent(id, now))
+	{
+		mCounterSkipped++;
+		return false;
+	}
+
+	if (mPeers.size() >= mMaxEntries)
+	{
+		/* make room by dropping the least useful, if this is better */
+		std::multimap<uint32_t, bdId>::iterator worst = mQueue.end();
+		worst--;
+		if (worst->first <= score)
+		{
+			mCounterSkipped++;
+			return false;
+		}
+		remove(mPeers.find(worst->second));
+		mCounterSkipped++;
+	}
+
+	bdPendingPeer &peer = mPeers[*id];
+	peer.mScore = score;
+	peer.mExpireTS = now + mTTL;
+	peer.mQueueIt = mQueue.insert(std::make_pair(score, *id));
+	mCounterAdded++;
+	return true;
+}
+
+bool	bdPendingPeers::pop(bdId &id, time_t now)
+{
+	while(!mQueue.empty())
+	{
+		std::map<bdId, bdPendingPeer>::iterator it = mPeers.find(mQueue.begin()->second);
+		bool stale = (it->second.mExpireTS < now);
+		if (!stale)
+		{
+			id = it->first;
+		}
+		remove(it);
+
+		if (stale)
+		{
+			mCounterExpired++;
+			continue;
+		}
+
+		setRecent(&id, now + BITDHT_PENDING_PINGED_PERIOD);
+		return true;
+	}
+	return false;
+}
+
+void	bdPendingPeers::verified(const bdId *id, time_t now)
+{
+	std::map<bdId, bdPendingPeer>::iterator it = mPeers.find(*id);
+	if (it != mPeers.end())
+	{
+#ifdef DEBUG_PENDING
+		LOG.info("bdPendingPeers::verified() dropping queued ping, peer is active");
+#endif
+		remove(it);
+		mCounterSkipped++;
+	}
+	setRecent(id, now + BITDHT_PENDING_VERIFIED_PERIOD);
+}
+
+void	bdPendingPeers::cleanup(time_t now)
+{
+	if (now - mSweepTS < BITDHT_PENDING_SWEEP_PERIOD)
+	{
+		return;
+	}
+	mSweepTS = now;
+
+	std::map<bdId, bdPendingPeer>::iterator it;
+	for(it = mPeers.begin(); it != mPeers.end();)
+	{
+		if (it->second.mExpireTS < now)
+		{
+			mCounterExpired++;
+			remove(it++);
+		}
+		else
+		{
+			it++;
+		}
+	}
+
+	std::map<bdId, time_t>::iterator rit;
+	for(rit = mRecent.begin(); rit != mRecent.end();)
+	{
+		if (rit->second < now)
+		{
+			mRecent.erase(rit++);
+		}
+		else
+		{
+			rit++;
+		}
+	}
+
+#ifdef DEBUG_PENDING
+	LOG.info("bdPendingPeers::cleanup() queued: %u recent: %u",
+			(uint32_t) mPeers.size(), (uint32_t) mRecent.size());
+#endif
+}
+
+void	bdPendingPeers::clear()
+{
+	mPeers.clear();
+	mQueue.clear();
+	mRecent.clear();
+}
+
+uint32_t bdPendingPeers::size()
+{
+	return mPeers.size();
+}
+
+bool	bdPendingPeers::empty()
+{
+	return mPeers.empty();
+}
+
+uint32_t bdPendingPeers::added()
+{
+	return mCounterAdded;
+}
+
+uint32_t bdPendingPeers::duplicates()
+{
+	return mCounterDuplicates;
+}
+
+uint32_t bdPendingPeers::skipped()
+{
+	return mCounterSkipped;
+}
+
+uint32_t bdPendingPeers::expired()
+{
+	return mCounterExpired;
+}
+
+void	bdPendingPeers::resetCounters()
+{
+	mCounterAdded = 0;
+	mCounterDuplicates = 0;
+	mCounterSkipped = 0;
+	mCounterExpired = 0;
+}
+
+void	bdPendingPeers::remove(std::map<bdId, bdPendingPeer>::iterator it)
+{
+	mQueue.erase(it->second.mQueueIt);
+	mPeers.erase(it);
+}
+
+void	bdPendingPeers::setRecent(const bdId *id, time_t until)
+{
+	std::map<bdId, time_t>::iterator it = mRecent.find(*id);
+	if (it == mRecent.end())
+	{
+		mRecent[*id] = until;
+	}
+	else if (it->second < until)
+	{
+		it->second = until;
+	}
+}
+
+bool	bdPendingPeers::isRecent(const bdId *id, time_t now)
+{
+	std::map<bdId, time_t>::iterator it = mRecent.find(*id);
+	return ((it != mRecent.end()) && (it->second >= now));
+}
+
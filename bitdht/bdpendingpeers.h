@@ -0,0 +1,106 @@
+#ifndef BITDHT_PENDING_PEERS_H
+#define BITDHT_PENDING_PEERS_H
+
+/*
+ * bitdht/bdpendingpeers.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * Potential Peer Queue.
+ *
+ * Peers mentioned in find_node replies (or loaded from the store) wait
+ * here to be pinged. Each peer is queued once, however often it is
+ * mentioned, and the queue is ordered by score - lower is more useful -
+ * so the rate limited pings go to the best candidates first. Entries
+ * that wait longer than the ttl are dropped.
+ *
+ * Peers we have recently heard from are not queued at all, nor are
+ * peers we have just pinged: either way another ping tells us nothing.
+ ******/
+
+#include "bitdht/bdpeer.h"
+
+#include <map>
+#include <list>
+
+#define BITDHT_PENDING_MAX_ENTRIES	1000
+#define BITDHT_PENDING_TTL		60	/* secs in the queue before giving up */
+#define BITDHT_PENDING_VERIFIED_PERIOD	300	/* no ping after traffic from the peer */
+#define BITDHT_PENDING_PINGED_PERIOD	30	/* no second ping within this */
+#define BITDHT_PENDING_SWEEP_PERIOD	10
+
+class bdPendingPeer
+{
+public:
+	uint32_t mScore;
+	time_t	mExpireTS;
+	std::multimap<uint32_t, bdId>::iterator mQueueIt;
+};
+
+class bdPendingPeers
+{
+public:
+	bdPendingPeers(uint32_t maxEntries = BITDHT_PENDING_MAX_ENTRIES,
+			time_t ttl = BITDHT_PENDING_TTL);
+
+	/* false if the peer is already queued (the better score is kept),
+	 * recently verified / pinged, or the queue is full of better peers.
+	 */
+	bool	add(const bdId *id, uint32_t score, time_t now);
+	/* the most useful peer. It counts as pinged from now */
+	bool	pop(bdId &id, time_t now);
+	/* heard from the peer: dequeue it, and don't queue it for a while */
+	void	verified(const bdId *id, time_t now);
+
+	void	cleanup(time_t now);
+	void	clear();
+
+	uint32_t size();
+	bool	empty();
+
+	uint32_t added();
+	uint32_t duplicates();
+	uint32_t skipped();
+	uint32_t expired();
+	void	resetCounters();
+
+private:
+	void	remove(std::map<bdId, bdPendingPeer>::iterator it);
+	void	setRecent(const bdId *id, time_t until);
+	bool	isRecent(const bdId *id, time_t now);
+
+	std::map<bdId, bdPendingPeer> mPeers;
+	std::multimap<uint32_t, bdId> mQueue;	/* score order, FIFO within a score */
+	std::map<bdId, time_t> mRecent;		/* verified / pinged: until ts */
+
+	uint32_t mMaxEntries;
+	time_t	mTTL;
+	time_t	mSweepTS;
+
+	uint32_t mCounterAdded;
+	uint32_t mCounterDuplicates;
+	uint32_t mCounterSkipped;
+	uint32_t mCounterExpired;
+};
+
+#endif
+
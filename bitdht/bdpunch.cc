@@ -0,0 +1,194 @@
+/*
+ * bitdht/bdpunch.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdpunch.h"
+#include "util/bdlog.h"
+
+/***
+ * #define DEBUG_PUNCH 1
+ ***/
+
+bdPunchEngine::bdPunchEngine()
+	:mCounterSucceeded(0), mCounterFailed(0), mCounterSuccessPackets(0)
+{
+	return;
+}
+
+bool	bdPunchEngine::add(const bdId *id, uint64_t now)
+{
+	if (mTargets.find(id->id) != mTargets.end())
+	{
+		return false;
+	}
+
+	if (mTargets.size() >= BITDHT_PUNCH_MAX_TARGETS)
+	{
+#ifdef DEBUG_PUNCH
+		LOG.info("bdPunchEngine::add() too many punches running");
+#endif
+		return false;
+	}
+
+	bdPunchTarget &target = mTargets[id->id];
+	target.mId = *id;
+	target.mStartUsecs = now;
+	target.mNextUsecs = now;	/* first burst straight away */
+	target.mInterval = BITDHT_PUNCH_FIRST_INTERVAL;
+	target.mBursts = 0;
+	target.mPackets = 0;
+	return true;
+}
+
+bool	bdPunchEngine::nextBurst(bdId &id, uint32_t &count, uint64_t now)
+{
+	std::map<bdNodeId, bdPunchTarget>::iterator it;
+	for(it = mTargets.begin(); it != mTargets.end();)
+	{
+		bdPunchTarget &target = it->second;
+		if (target.mNextUsecs > now)
+		{
+			it++;
+			continue;
+		}
+
+		if (target.mBursts >= BITDHT_PUNCH_MAX_BURSTS)
+		{
+			/* last burst has had its time to be answered */
+#ifdef DEBUG_PUNCH
+			LOG.info("bdPunchEngine::nextBurst() giving up after %u packets", target.mPackets);
+#endif
+			mCounterFailed++;
+			mTargets.erase(it++);
+			continue;
+		}
+
+		id = target.mId;
+		count = BITDHT_PUNCH_BURST_SIZE;
+
+		target.mBursts++;
+		target.mPackets += count;
+		target.mNextUsecs = now + target.mInterval;
+		target.mInterval *= 2;
+		if (target.mInterval > BITDHT_PUNCH_MAX_INTERVAL)
+		{
+			target.mInterval = BITDHT_PUNCH_MAX_INTERVAL;
+		}
+		return true;
+	}
+	return false;
+}
+
+bool	bdPunchEngine::nextBurstDue(uint64_t &waitUsecs, uint64_t now)
+{
+	if (mTargets.empty())
+	{
+		return false;
+	}
+
+	uint64_t next = UINT64_MAX;
+	std::map<bdNodeId, bdPunchTarget>::iterator it;
+	for(it = mTargets.begin(); it != mTargets.end(); it++)
+	{
+		if (it->second.mNextUsecs < next)
+		{
+			next = it->second.mNextUsecs;
+		}
+	}
+
+	waitUsecs = (next > now) ? next - now : 0;
+	return true;
+}
+
+bool	bdPunchEngine::gotPong(const bdId *id, uint64_t now)
+{
+	std::map<bdNodeId, bdPunchTarget>::iterator it = mTargets.find(id->id);
+	if (it == mTargets.end())
+	{
+		return false;
+	}
+
+#ifdef DEBUG_PUNCH
+	LOG.info("bdPunchEngine::gotPong() punched after %lu usecs, %u packets",
+			(unsigned long) (now - it->second.mStartUsecs), it->second.mPackets);
+#endif
+
+	mFirstPacket.add(now - it->second.mStartUsecs);
+	mCounterSucceeded++;
+	mCounterSuccessPackets += it->second.mPackets;
+	mTargets.erase(it);
+	return true;
+}
+
+bool	bdPunchEngine::getTarget(const bdNodeId *id, bdId &target)
+{
+	std::map<bdNodeId, bdPunchTarget>::iterator it = mTargets.find(*id);
+	if (it == mTargets.end())
+	{
+		return false;
+	}
+	target = it->second.mId;
+	return true;
+}
+
+void	bdPunchEngine::clear()
+{
+	mTargets.clear();
+}
+
+uint32_t bdPunchEngine::active()
+{
+	return mTargets.size();
+}
+
+uint32_t bdPunchEngine::succeeded()
+{
+	return mCounterSucceeded;
+}
+
+uint32_t bdPunchEngine::failed()
+{
+	return mCounterFailed;
+}
+
+double	bdPunchEngine::packetsPerSuccess()
+{
+	if (mCounterSucceeded == 0)
+	{
+		return 0;
+	}
+	return (double) mCounterSuccessPackets / mCounterSucceeded;
+}
+
+bdHistogram &bdPunchEngine::firstPacketUsecs()
+{
+	return mFirstPacket;
+}
+
+void	bdPunchEngine::resetCounters()
+{
+	mCounterSucceeded = 0;
+	mCounterFailed = 0;
+	mCounterSuccessPackets = 0;
+	mFirstPacket.reset();
+}
+
@@ -0,0 +1,103 @@
+#ifndef BITDHT_PUNCH_H
+#define BITDHT_PUNCH_H
+
+/*
+ * bitdht/bdpunch.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * NAT Hole Punching.
+ *
+ * Once a connect request tells us a peer's address, we send it bursts
+ * of pings so the mapping in our own NAT opens while the peer does the
+ * same towards us. Bursts start close together and back off
+ * exponentially, and the punch stops at the first pong from the peer -
+ * or is given up after BITDHT_PUNCH_MAX_BURSTS unanswered bursts.
+ *
+ * The engine only keeps the schedule: the node asks for the bursts
+ * that are due (each a fresh transaction id, sent as one datagram
+ * repeated) and reports pongs back.
+ *
+ * Stats: time from the punch starting to the first pong, and the
+ * packets it took, for each successful punch.
+ ******/
+
+#include "bitdht/bdpeer.h"
+#include "util/bdhistogram.h"
+
+#include <map>
+
+#define BITDHT_PUNCH_BURST_SIZE		8	/* pings per burst */
+#define BITDHT_PUNCH_FIRST_INTERVAL	250000	/* usecs to the second burst */
+#define BITDHT_PUNCH_MAX_INTERVAL	8000000	/* backoff limit, usecs */
+#define BITDHT_PUNCH_MAX_BURSTS		10
+#define BITDHT_PUNCH_MAX_TARGETS	64
+
+class bdPunchTarget
+{
+public:
+	bdId	mId;
+	uint64_t mStartUsecs;
+	uint64_t mNextUsecs;	/* next burst due */
+	uint64_t mInterval;
+	uint32_t mBursts;
+	uint32_t mPackets;
+};
+
+class bdPunchEngine
+{
+public:
+	bdPunchEngine();
+
+	/* false if already punching the peer, or too many punches running */
+	bool	add(const bdId *id, uint64_t now);
+	/* a target whose burst is due, and how many packets to send it.
+	 * schedules its next burst, or gives up on it (returning the next).
+	 */
+	bool	nextBurst(bdId &id, uint32_t &count, uint64_t now);
+	/* false if idle, otherwise usecs until the next burst */
+	bool	nextBurstDue(uint64_t &waitUsecs, uint64_t now);
+	/* a pong: true (ending the punch) if we were punching the peer */
+	bool	gotPong(const bdId *id, uint64_t now);
+	/* the address we are punching the peer at, false if we aren't */
+	bool	getTarget(const bdNodeId *id, bdId &target);
+	void	clear();
+
+	uint32_t active();
+	uint32_t succeeded();
+	uint32_t failed();
+	double	packetsPerSuccess();
+	bdHistogram &firstPacketUsecs();	/* of successful punches */
+	void	resetCounters();
+
+private:
+	/* by node id - the pong may come from a different port than we punched */
+	std::map<bdNodeId, bdPunchTarget> mTargets;
+
+	uint32_t mCounterSucceeded;
+	uint32_t mCounterFailed;
+	uint32_t mCounterSuccessPackets;
+	bdHistogram mFirstPacket;
+};
+
+#endif
+
@@ -28,6 +28,7 @@
 #include "bitdht/bdquery.h"
 #include "util/bdnet.h"
 #include "util/bdlog.h"
+#include "util/bdtime.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -86,6 +87,13 @@ bdQuery::bdQuery(const bdNodeId *id, std::list<bdId> &startList, uint32_t queryF
 
 	mQueryIdlePeerRetryPeriod = QUERY_IDLE_RETRY_PEER_PERIOD;
 
+	mSeeded = false;
+	mQueryCount = 0;
+	mPathRecorded = false;
+
+	mReportedState = mState;
+	mNewMatch = false;
+
 	/* setup the limit of the search
 	 * by default it is setup to 000000 = exact match
 	 */
@@ -129,6 +137,23 @@ bool bdQuery::matchResult(std::list<bdPeer> &idList)
 	return (i > 0);
 }
 
+int bdQuery::responsivePeers(std::list<bdId> &peers)
+{
+	int i = 0;
+	std::multimap<bdMetric, bdPeer>::iterator it;
+	for(it = mClosest.begin(); it != mClosest.end(); it++)
+	{
+		bool hasRecv = (it->second.mLastRecvTime != 0);
+		bool hasReply = (it->second.mLastRecvTime >= it->second.mLastSendTime);
+		if (hasRecv && hasReply)
+		{
+			peers.push_back(it->second.mPeerId);
+			i++;
+		}
+	}
+	return i;
+}
+
 int bdQuery::nextQuery(bdId &id, bdNodeId &targetNodeId)
 {
 	if ((mState != BITDHT_QUERY_QUERYING) && !(mQueryFlags & BITDHT_QFLAGS_DO_IDLE))
@@ -412,6 +437,10 @@ int bdQuery::addPeer(const bdId *id, uint32_t mode)
 	}
 
 	mClosest.insert(std::pair<bdMetric, bdPeer>(dist, peer));
+	if (id->id == mId)
+	{
+		mNewMatch = true;
+	}
 	return 1;
 }
 
@@ -559,6 +588,10 @@ int bdQuery::addPotentialPeer(const bdId *id, uint32_t mode)
 	peer.mLastRecvTime = ts;
 	peer.mFoundTime = ts;
 	mPotentialClosest.insert(std::pair<bdMetric, bdPeer>(dist, peer));
+	if (id->id == mId)
+	{
+		mNewMatch = true;
+	}
 
 #ifdef DEBUG_QUERY 
 	LOG.info("Flagging as Potential Peer!\n");
@@ -679,4 +712,5 @@ bdRemoteQuery::bdRemoteQuery(bdId *id, bdNodeId *query, bdToken *transId, uint32
 	:mId(*id), mQuery(*query), mTransId(*transId), mQueryType(query_type)
 {
 	mQueryTS = time(NULL);
+	mRecvUsecs = bdClockUsecs();
 }
@@ -53,6 +53,9 @@ public:
 	int 	addPotentialPeer(const bdId *id, uint32_t mode);
 	int 	printQuery();
 
+	// closest peers that have replied - for the path cache.
+	int 	responsivePeers(std::list<bdId> &peers);
+
 	// searching for
 	bdNodeId mId;
 	bdMetric mLimit;
@@ -63,6 +66,14 @@ public:
 
 	int32_t mQueryIdlePeerRetryPeriod; // seconds between retries.
 
+	bool mSeeded;		// started from the path cache.
+	uint32_t mQueryCount;	// find_node requests sent (hops).
+	bool mPathRecorded;	// completed, and stored in the path cache.
+
+	// for state-transition events.
+	uint32_t mReportedState;
+	bool mNewMatch;		// a peer matching mId has been added.
+
 private:
 
 	// closest peers
@@ -80,6 +91,17 @@ public:
 	std::list<bdId> mResults;
 };
 
+/* queued by bdNode when a query changes state, or finds a matching peer */
+class bdQueryEvent
+{
+public:
+	bdNodeId mId;
+	uint32_t mStatus;
+	uint32_t mQFlags;
+	std::list<bdId> mResults;
+	std::list<bdPeer> mMatches;
+};
+
 /* this is just a container class.
  * we locally seach for this, once then discard.
  */
@@ -94,6 +116,7 @@ public:
 	uint32_t mQueryType;
 
 	time_t mQueryTS;
+	uint64_t mRecvUsecs; /* for reply latency */
 };
 
 #endif
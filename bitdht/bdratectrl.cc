@@ -0,0 +1,296 @@
+/*
+ * bitdht/bdratectrl.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdratectrl.h"
+#include "util/bdlog.h"
+
+/***
+ * #define DEBUG_RATECTRL 1
+ ***/
+
+#define RTT_SMOOTHING	0.125
+
+bdTokenBucket::bdTokenBucket()
+	:mRate(0), mBurst(1), mTokens(1), mLastUsecs(0)
+{
+	return;
+}
+
+void	bdTokenBucket::setRate(double rate, uint64_t now)
+{
+	refill(now);
+
+	mRate = rate;
+	mBurst = rate * BITDHT_RATE_BURST_SECS;
+	if (mBurst < 1)
+	{
+		mBurst = 1;
+	}
+	if (mTokens > mBurst)
+	{
+		mTokens = mBurst;
+	}
+}
+
+double	bdTokenBucket::rate()
+{
+	return mRate;
+}
+
+void	bdTokenBucket::refill(uint64_t now)
+{
+	/* first use, or the clock went backwards */
+	if ((mLastUsecs == 0) || (now < mLastUsecs))
+	{
+		mLastUsecs = now;
+		return;
+	}
+
+	mTokens += mRate * (now - mLastUsecs) / 1000000.0;
+	if (mTokens > mBurst)
+	{
+		mTokens = mBurst;
+	}
+	mLastUsecs = now;
+}
+
+bool	bdTokenBucket::take(uint64_t now)
+{
+	refill(now);
+	if (mTokens < 1)
+	{
+		return false;
+	}
+	mTokens -= 1;
+	return true;
+}
+
+void	bdTokenBucket::charge(uint64_t now)
+{
+	refill(now);
+	mTokens -= 1;
+
+	double maxDebt = mRate * BITDHT_RATE_MAX_DEBT_SECS;
+	if (mTokens < -maxDebt)
+	{
+		mTokens = -maxDebt;
+	}
+}
+
+uint64_t bdTokenBucket::waitUsecs(uint64_t now)
+{
+	refill(now);
+	if (mTokens >= 1)
+	{
+		return 0;
+	}
+	if (mRate <= 0)
+	{
+		return UINT64_MAX;
+	}
+	return (uint64_t) ((1 - mTokens) * 1000000.0 / mRate) + 1;
+}
+
+/******************************************************************/
+
+bdRateController::bdRateController()
+	:mAdaptive(false), mFactor(1.0), mRequests(0), mResponses(0),
+	mSrtt(0), mBaseRtt(0), mWindowRtt(0), mWindowStart(0)
+{
+	mRates[BITDHT_RATE_PING] = BITDHT_RATE_DEF_PING;
+	mRates[BITDHT_RATE_QUERY] = BITDHT_RATE_DEF_QUERY;
+	mRates[BITDHT_RATE_REPLY] = BITDHT_RATE_DEF_REPLY;
+	mRates[BITDHT_RATE_BROADCAST] = BITDHT_RATE_DEF_BROADCAST;
+	applyFactor(0);
+}
+
+void	bdRateController::setRate(int type, double rate, uint64_t now)
+{
+	if ((type < 0) || (type >= BITDHT_RATE_TYPES) || (rate < 0))
+	{
+		return;
+	}
+	mRates[type] = rate;
+	applyFactor(now);
+}
+
+double	bdRateController::getRate(int type)
+{
+	if ((type < 0) || (type >= BITDHT_RATE_TYPES))
+	{
+		return 0;
+	}
+	return mRates[type];
+}
+
+double	bdRateController::currentRate(int type)
+{
+	if ((type < 0) || (type >= BITDHT_RATE_TYPES))
+	{
+		return 0;
+	}
+	return mBuckets[type].rate();
+}
+
+void	bdRateController::setAdaptive(bool adaptive, uint64_t now)
+{
+	mAdaptive = adaptive;
+	mFactor = 1.0;
+	mRequests = 0;
+	mResponses = 0;
+	applyFactor(now);
+}
+
+bool	bdRateController::isAdaptive()
+{
+	return mAdaptive;
+}
+
+bool	bdRateController::take(int type, uint64_t now)
+{
+	if ((type < 0) || (type >= BITDHT_RATE_TYPES))
+	{
+		return false;
+	}
+	return mBuckets[type].take(now);
+}
+
+void	bdRateController::charge(int type, uint64_t now)
+{
+	if ((type < 0) || (type >= BITDHT_RATE_TYPES))
+	{
+		return;
+	}
+	mBuckets[type].charge(now);
+}
+
+uint64_t bdRateController::waitUsecs(int type, uint64_t now)
+{
+	if ((type < 0) || (type >= BITDHT_RATE_TYPES))
+	{
+		return UINT64_MAX;	/* never */
+	}
+	return mBuckets[type].waitUsecs(now);
+}
+
+void	bdRateController::sentRequest()
+{
+	mRequests++;
+}
+
+void	bdRateController::gotResponse()
+{
+	mResponses++;
+}
+
+void	bdRateController::addRttSample(uint64_t usecs)
+{
+	if (mSrtt == 0)
+	{
+		mSrtt = usecs;
+	}
+	else
+	{
+		mSrtt += RTT_SMOOTHING * ((double) usecs - mSrtt);
+	}
+
+	if ((mWindowRtt == 0) || (mSrtt < mWindowRtt))
+	{
+		mWindowRtt = mSrtt;
+	}
+	if ((mBaseRtt == 0) || (mSrtt < mBaseRtt))
+	{
+		mBaseRtt = mSrtt;
+	}
+}
+
+/* the baseline forgets anything older than the last window */
+void	bdRateController::ageBaseRtt(uint64_t now)
+{
+	if (mWindowStart == 0)
+	{
+		mWindowStart = now;
+		return;
+	}
+	if (now < mWindowStart + BITDHT_RATE_ADAPT_RTT_WINDOW * (uint64_t) 1000000)
+	{
+		return;
+	}
+
+	mBaseRtt = mWindowRtt;
+	mWindowRtt = 0;
+	mWindowStart = now;
+}
+
+/* AIMD on the fraction of the configured rate */
+void	bdRateController::adjust(uint64_t now)
+{
+	ageBaseRtt(now);
+
+	if ((!mAdaptive) || (mRequests < BITDHT_RATE_ADAPT_MIN_SAMPLES))
+	{
+		return;
+	}
+
+	double answered = (double) mResponses / mRequests;
+	bool congested = (answered < BITDHT_RATE_ADAPT_LOSS);
+	if ((mBaseRtt > 0) && (mSrtt > BITDHT_RATE_ADAPT_RTT * mBaseRtt))
+	{
+		congested = true;
+	}
+
+	if (congested)
+	{
+		mFactor *= BITDHT_RATE_ADAPT_DECREASE;
+		if (mFactor < BITDHT_RATE_ADAPT_MIN)
+		{
+			mFactor = BITDHT_RATE_ADAPT_MIN;
+		}
+	}
+	else
+	{
+		mFactor += BITDHT_RATE_ADAPT_INCREASE;
+		if (mFactor > 1.0)
+		{
+			mFactor = 1.0;
+		}
+	}
+
+#ifdef DEBUG_RATECTRL
+	LOG.info("bdRateController::adjust() answered: %u/%u srtt: %.0lf base: %.0lf => factor: %.2lf",
+			mResponses, mRequests, mSrtt, mBaseRtt, mFactor);
+#endif
+
+	mRequests = 0;
+	mResponses = 0;
+	applyFactor(now);
+}
+
+void	bdRateController::applyFactor(uint64_t now)
+{
+	mBuckets[BITDHT_RATE_PING].setRate(mRates[BITDHT_RATE_PING] * mFactor, now);
+	mBuckets[BITDHT_RATE_QUERY].setRate(mRates[BITDHT_RATE_QUERY] * mFactor, now);
+	mBuckets[BITDHT_RATE_REPLY].setRate(mRates[BITDHT_RATE_REPLY], now);
+	mBuckets[BITDHT_RATE_BROADCAST].setRate(mRates[BITDHT_RATE_BROADCAST], now);
+}
+
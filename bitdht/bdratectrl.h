@@ -0,0 +1,138 @@
+#ifndef BITDHT_RATE_CTRL_H
+#define BITDHT_RATE_CTRL_H
+
+/*
+ * bitdht/bdratectrl.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * Outbound Message Rate Controller.
+ *
+ * One token bucket per class of message (pings, find_node queries,
+ * replies, connect request broadcasts). Buckets are only BITDHT_RATE_BURST_SECS deep, so a backlog
+ * goes out as a steady trickle rather than a burst once per second.
+ *
+ * take() sends only if a token is available. charge() always succeeds,
+ * but runs the bucket into debt - for messages that must not be
+ * dropped (pongs, routing table refresh) yet should slow the rest.
+ *
+ * In adaptive mode the ping and query rates back off when requests go
+ * unanswered, or round trip times climb well above their baseline, and
+ * creep back up to the configured rate when things recover. The
+ * baseline is the lowest smoothed rtt over the last one to two
+ * BITDHT_RATE_ADAPT_RTT_WINDOW periods, so it follows a lasting change
+ * of route rather than holding on to the best rtt ever seen.
+ ******/
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#define BITDHT_RATE_PING		0
+#define BITDHT_RATE_QUERY		1
+#define BITDHT_RATE_REPLY		2
+#define BITDHT_RATE_BROADCAST		3
+#define BITDHT_RATE_TYPES		4
+
+/* msgs/sec - the old per-iteration limit was 50, up to 90% pings */
+#define BITDHT_RATE_DEF_PING		45
+#define BITDHT_RATE_DEF_QUERY		25
+#define BITDHT_RATE_DEF_REPLY		200
+#define BITDHT_RATE_DEF_BROADCAST	20
+
+#define BITDHT_RATE_BURST_SECS		0.1	/* bucket depth */
+#define BITDHT_RATE_MAX_DEBT_SECS	1.0	/* charge() never goes further behind */
+
+#define BITDHT_RATE_ADAPT_MIN_SAMPLES	20	/* requests per adjustment */
+#define BITDHT_RATE_ADAPT_LOSS		0.5	/* back off if fewer answered */
+#define BITDHT_RATE_ADAPT_RTT		3.0	/* back off if srtt above this x baseline */
+#define BITDHT_RATE_ADAPT_RTT_WINDOW	30	/* secs, baseline min rtt window */
+#define BITDHT_RATE_ADAPT_DECREASE	0.75
+#define BITDHT_RATE_ADAPT_INCREASE	0.05	/* of the configured rate */
+#define BITDHT_RATE_ADAPT_MIN		0.1	/* floor, as a fraction of the configured rate */
+
+class bdTokenBucket
+{
+public:
+	bdTokenBucket();
+
+	void	setRate(double rate, uint64_t now);
+	double	rate();
+
+	bool	take(uint64_t now);
+	void	charge(uint64_t now);
+	/* usecs until take() would succeed */
+	uint64_t waitUsecs(uint64_t now);
+
+private:
+	void	refill(uint64_t now);
+
+	double	mRate;
+	double	mBurst;
+	double	mTokens;
+	uint64_t mLastUsecs;
+};
+
+class bdRateController
+{
+public:
+	bdRateController();
+
+	/* configured rate (msgs/sec) - the ceiling in adaptive mode */
+	void	setRate(int type, double rate, uint64_t now);
+	double	getRate(int type);
+	/* current rate, after any adaptive back off */
+	double	currentRate(int type);
+
+	void	setAdaptive(bool adaptive, uint64_t now);
+	bool	isAdaptive();
+
+	bool	take(int type, uint64_t now);
+	void	charge(int type, uint64_t now);
+	uint64_t waitUsecs(int type, uint64_t now);
+
+	/* feedback for adaptive mode */
+	void	sentRequest();
+	void	gotResponse();
+	void	addRttSample(uint64_t usecs);
+	/* called once per iteration: adjusts once enough requests have been sent */
+	void	adjust(uint64_t now);
+
+private:
+	void	applyFactor(uint64_t now);
+	void	ageBaseRtt(uint64_t now);
+
+	bdTokenBucket mBuckets[BITDHT_RATE_TYPES];
+	double	mRates[BITDHT_RATE_TYPES];
+
+	bool	mAdaptive;
+	double	mFactor;	/* applied to ping + query rates */
+
+	uint32_t mRequests;
+	uint32_t mResponses;
+	double	mSrtt;		/* usecs, smoothed */
+	double	mBaseRtt;	/* lowest srtt of this window and the last */
+	double	mWindowRtt;	/* lowest srtt of this window, 0 if none */
+	uint64_t mWindowStart;
+};
+
+#endif
+
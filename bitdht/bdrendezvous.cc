@@ -0,0 +1,262 @@
+/*
+ * bitdht/bdrendezvous.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdrendezvous.h"
+#include "util/bdlog.h"
+#include "util/bdrandom.h"
+
+#include <string.h>
+#include <algorithm>
+
+/***
+ * #define DEBUG_RENDEZVOUS 1
+ ***/
+
+#define USECS	1000000ULL
+
+bool bdRendezvousKey::operator==(const bdRendezvousKey &other) const
+{
+	return ((mFrom == other.mFrom) && (mTo == other.mTo));
+}
+
+/* splitmix64's finaliser */
+static uint64_t bdRendezvousMix(uint64_t h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+static uint64_t bdRendezvousMixId(uint64_t h, const bdNodeId &id)
+{
+	for(int i = 0; i + 4 <= BITDHT_KEY_LEN; i += 4)
+	{
+		uint32_t word;
+		memcpy(&word, id.data + i, sizeof(word));
+		h = bdRendezvousMix(h ^ word);
+	}
+	return h;
+}
+
+/* the ids are claimed, not earned: every byte goes through the keyed
+ * mix, or requests differing only in the rest would share a bucket.
+ */
+size_t bdRendezvousKeyHash::operator()(const bdRendezvousKey &key) const
+{
+	uint64_t h = bdRendezvousMixId(mSecret, key.mFrom);
+	return (size_t) bdRendezvousMixId(h, key.mTo);
+}
+
+static uint64_t bdRendezvousSecret()
+{
+	uint64_t secret;
+	if (!bdSecureRandom(secret))
+	{
+		bdRandom rnd;
+		secret = rnd.next();
+	}
+	return secret;
+}
+
+bdRendezvousTable::bdRendezvousTable(uint32_t maxEntries, uint32_t maxPerSource)
+	:mEntries(0, bdRendezvousKeyHash(bdRendezvousSecret())),
+	mMaxEntries(maxEntries), mMaxPerSource(maxPerSource), mSweepUsecs(0),
+	mCounterDuplicates(0), mCounterPairings(0), mCounterRefused(0), mCounterExpired(0)
+{
+	return;
+}
+
+int	bdRendezvousTable::add(const bdId *from, const bdNodeId *to, uint64_t now, bdId &match)
+{
+	int ret = BITDHT_RDV_NEW;
+
+	bdRendezvousKey key;
+	key.mFrom = from->id;
+	key.mTo = *to;
+
+	bdRendezvousMap::iterator it = mEntries.find(key);
+	if (it != mEntries.end())
+	{
+		/* repeat broadcast: refresh, the address may have changed */
+		it->second.mFrom = *from;
+		it->second.mLastUsecs = now;
+		mCounterDuplicates++;
+		ret = BITDHT_RDV_DUPLICATE;
+	}
+	else
+	{
+		/* one address can't fill the table for everyone else */
+		uint32_t sourceIp = from->addr.sin_addr.s_addr;
+		uint32_t &perSource = mPerSource[sourceIp];
+		if ((mEntries.size() >= mMaxEntries) || (perSource >= mMaxPerSource))
+		{
+			if (!perSource)
+			{
+				mPerSource.erase(sourceIp);
+			}
+			mCounterRefused++;
+			return BITDHT_RDV_FULL;
+		}
+
+		bdRendezvousEntry entry;
+		entry.mFrom = *from;
+		entry.mTo = *to;
+		entry.mFirstUsecs = now;
+		entry.mLastUsecs = now;
+		entry.mPairedUsecs = 0;
+		entry.mSourceIp = sourceIp;
+		it = mEntries.insert(std::make_pair(key, entry)).first;
+		perSource++;
+	}
+
+	/* has the other end asked for us? */
+	bdRendezvousKey reverse;
+	reverse.mFrom = *to;
+	reverse.mTo = from->id;
+
+	bdRendezvousMap::iterator rit = mEntries.find(reverse);
+	if (rit == mEntries.end())
+	{
+		return ret;
+	}
+
+	bdRendezvousEntry &entry = it->second;
+	bdRendezvousEntry &other = rit->second;
+	if (entry.mPairedUsecs && other.mPairedUsecs &&
+		(now < entry.mPairedUsecs + BITDHT_RDV_REPAIR_PERIOD * USECS))
+	{
+		/* already told them */
+		return ret;
+	}
+
+	if (!entry.mPairedUsecs || !other.mPairedUsecs)
+	{
+		uint64_t first = std::min(entry.mFirstUsecs, other.mFirstUsecs);
+		mMatchUsecs.add(now - first);
+		mCounterPairings++;
+
+#ifdef DEBUG_RENDEZVOUS
+		LOG.info("bdRendezvousTable::add() paired after %lu usecs",
+				(unsigned long) (now - first));
+#endif
+	}
+
+	entry.mPairedUsecs = now;
+	other.mPairedUsecs = now;
+	match = other.mFrom;
+	return BITDHT_RDV_PAIRED;
+}
+
+void	bdRendezvousTable::expire(uint64_t now)
+{
+	if (now < mSweepUsecs + BITDHT_RDV_SWEEP_PERIOD * USECS)
+	{
+		return;
+	}
+	mSweepUsecs = now;
+
+	bdRendezvousMap::iterator it;
+	for(it = mEntries.begin(); it != mEntries.end();)
+	{
+		if (it->second.mLastUsecs + BITDHT_RDV_TTL * USECS < now)
+		{
+			erased(it->second);
+			it = mEntries.erase(it);
+			mCounterExpired++;
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
+void	bdRendezvousTable::clear()
+{
+	mEntries.clear();
+	mPerSource.clear();
+}
+
+void	bdRendezvousTable::erased(const bdRendezvousEntry &entry)
+{
+	std::unordered_map<uint32_t, uint32_t>::iterator it = mPerSource.find(entry.mSourceIp);
+	if ((it != mPerSource.end()) && (0 == --(it->second)))
+	{
+		mPerSource.erase(it);
+	}
+}
+
+void	bdRendezvousTable::getUnpaired(std::list<bdRendezvousEntry> &entries)
+{
+	bdRendezvousMap::iterator it;
+	for(it = mEntries.begin(); it != mEntries.end(); it++)
+	{
+		if (!it->second.mPairedUsecs)
+		{
+			entries.push_back(it->second);
+		}
+	}
+}
+
+uint32_t bdRendezvousTable::size()
+{
+	return mEntries.size();
+}
+
+uint32_t bdRendezvousTable::duplicates()
+{
+	return mCounterDuplicates;
+}
+
+uint32_t bdRendezvousTable::pairings()
+{
+	return mCounterPairings;
+}
+
+uint32_t bdRendezvousTable::refused()
+{
+	return mCounterRefused;
+}
+
+uint32_t bdRendezvousTable::expired()
+{
+	return mCounterExpired;
+}
+
+bdHistogram &bdRendezvousTable::matchUsecs()
+{
+	return mMatchUsecs;
+}
+
+void	bdRendezvousTable::resetCounters()
+{
+	mCounterDuplicates = 0;
+	mCounterPairings = 0;
+	mCounterRefused = 0;
+	mCounterExpired = 0;
+	mMatchUsecs.reset();
+}
+
@@ -0,0 +1,142 @@
+#ifndef BITDHT_RENDEZVOUS_H
+#define BITDHT_RENDEZVOUS_H
+
+/*
+ * bitdht/bdrendezvous.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * Rendezvous Table.
+ *
+ * A peer that wants to connect to another broadcasts (from, to)
+ * connect requests. A node that hears both (A, B) from A and (B, A)
+ * from B pairs them, telling each the other's address so both can
+ * start punching.
+ *
+ * Requests are hashed on (from, to), so a repeated broadcast just
+ * refreshes its entry and pairing is a single lookup of the reverse
+ * request. The ids are whatever the sender claims, so the hash is
+ * keyed with a per-table secret: nobody can pick ids that all land in
+ * one bucket. Entries expire BITDHT_RDV_TTL after they were last heard,
+ * and the table is bounded: when full, or when the sending address
+ * already has BITDHT_RDV_MAX_PER_SOURCE entries, new requests are
+ * refused.
+ *
+ * A pair is not announced again for BITDHT_RDV_REPAIR_PERIOD, unless
+ * the peers are still broadcasting after that (the ask_conn was lost).
+ ******/
+
+#include "bitdht/bdpeer.h"
+#include "util/bdhistogram.h"
+
+#include <list>
+#include <unordered_map>
+
+#define BITDHT_RDV_MAX_ENTRIES		4096
+#define BITDHT_RDV_TTL			120	/* secs since last heard */
+#define BITDHT_RDV_REPAIR_PERIOD	30	/* secs before a pair is announced again */
+#define BITDHT_RDV_SWEEP_PERIOD		10
+#define BITDHT_RDV_MAX_PER_SOURCE	32	/* live requests per IP */
+
+/* add() results */
+#define BITDHT_RDV_NEW			1
+#define BITDHT_RDV_DUPLICATE		2
+#define BITDHT_RDV_PAIRED		3	/* tell both ends */
+#define BITDHT_RDV_FULL			4
+
+class bdRendezvousKey
+{
+public:
+	bool operator==(const bdRendezvousKey &other) const;
+
+	bdNodeId mFrom;
+	bdNodeId mTo;
+};
+
+class bdRendezvousKeyHash
+{
+public:
+	bdRendezvousKeyHash(uint64_t secret = 0)
+		:mSecret(secret) { return; }
+
+	size_t operator()(const bdRendezvousKey &key) const;
+
+private:
+	uint64_t mSecret;
+};
+
+class bdRendezvousEntry
+{
+public:
+	bdId	mFrom;		/* requester, with the address it was heard from */
+	bdNodeId mTo;
+	uint64_t mFirstUsecs;
+	uint64_t mLastUsecs;
+	uint64_t mPairedUsecs;	/* 0 = not paired */
+	uint32_t mSourceIp;	/* charged for the entry (mFrom's may change) */
+};
+
+class bdRendezvousTable
+{
+public:
+	bdRendezvousTable(uint32_t maxEntries = BITDHT_RDV_MAX_ENTRIES,
+			uint32_t maxPerSource = BITDHT_RDV_MAX_PER_SOURCE);
+
+	/* a broadcast_conn from 'from' for 'to'.
+	 * on BITDHT_RDV_PAIRED, match is the other end (the 'to' peer).
+	 */
+	int	add(const bdId *from, const bdNodeId *to, uint64_t now, bdId &match);
+	void	expire(uint64_t now);
+	void	clear();
+
+	/* live requests waiting for their other end */
+	void	getUnpaired(std::list<bdRendezvousEntry> &entries);
+
+	uint32_t size();
+
+	uint32_t duplicates();
+	uint32_t pairings();
+	uint32_t refused();	/* table, or the sender's share of it, full */
+	uint32_t expired();
+	bdHistogram &matchUsecs();	/* first request to pairing */
+	void	resetCounters();
+
+private:
+	typedef std::unordered_map<bdRendezvousKey, bdRendezvousEntry, bdRendezvousKeyHash> bdRendezvousMap;
+
+	void	erased(const bdRendezvousEntry &entry);
+
+	bdRendezvousMap mEntries;
+	std::unordered_map<uint32_t, uint32_t> mPerSource;	/* IP -> entries */
+	uint32_t mMaxEntries;
+	uint32_t mMaxPerSource;
+	uint64_t mSweepUsecs;
+
+	uint32_t mCounterDuplicates;
+	uint32_t mCounterPairings;
+	uint32_t mCounterRefused;
+	uint32_t mCounterExpired;
+	bdHistogram mMatchUsecs;
+};
+
+#endif
+
@@ -0,0 +1,362 @@
+/*
+ * bitdht/bdtranstable.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdtranstable.h"
+#include "util/bdlog.h"
+
+#include <string.h>
+
+/***
+ * #define DEBUG_TRANSTABLE 1
+ ***/
+
+bool bdTransKey::operator==(const bdTransKey &other) const
+{
+	return ((mAddr == other.mAddr) && (mPort == other.mPort) &&
+		(mTidLen == other.mTidLen) &&
+		(0 == memcmp(mTid, other.mTid, mTidLen)));
+}
+
+bdTransEntry::bdTransEntry()
+	:mMsgType(0), mSendUsecs(0), mExpireTS(0), mUsed(false)
+{
+	memset(&mKey, 0, sizeof(mKey));
+	memset(mTarget.data, 0, BITDHT_KEY_LEN);
+}
+
+/******************************************************************/
+
+bdTransTable::bdTransTable(uint32_t capacity, time_t timeout)
+	:mSize(0), mTimeout(timeout), mWheelTS(0),
+	mCounterMatched(0), mCounterUnmatched(0), mCounterExpired(0)
+{
+	/* round up to a power of 2 */
+	uint32_t cap = 16;
+	while(cap < capacity)
+	{
+		cap <<= 1;
+	}
+	mTable.resize(cap);
+	mMask = cap - 1;
+
+	if (mTimeout >= BITDHT_TRANS_WHEEL_SLOTS)
+	{
+		mTimeout = BITDHT_TRANS_WHEEL_SLOTS - 1;
+	}
+}
+
+void	bdTransTable::add(const bdToken *tid, const struct sockaddr_in *addr, uint32_t msgType,
+		const bdNodeId *target, uint64_t sendUsecs, time_t now)
+{
+	bdTransEntry entry;
+	if (!makeKey(tid, addr, entry.mKey))
+	{
+		return;
+	}
+
+	entry.mMsgType = msgType;
+	if (target)
+	{
+		entry.mTarget = *target;
+	}
+	entry.mSendUsecs = sendUsecs;
+	entry.mExpireTS = now + mTimeout;
+	entry.mUsed = true;
+
+	int idx = find(entry.mKey);
+	if (idx >= 0)
+	{
+		/* tid reused for the same peer: the newer request wins */
+		mTable[idx] = entry;
+	}
+	else
+	{
+		if (2 * (mSize + 1) > mTable.size())
+		{
+			grow();
+		}
+		insert(entry);
+	}
+
+	mWheel[entry.mExpireTS % BITDHT_TRANS_WHEEL_SLOTS].push_back(entry.mKey);
+}
+
+bool	bdTransTable::match(const bdToken *tid, const struct sockaddr_in *addr, bdTransEntry &entry)
+{
+	bdTransKey key;
+	int idx = -1;
+	if (makeKey(tid, addr, key))
+	{
+		idx = find(key);
+	}
+
+	if (idx < 0)
+	{
+		mCounterUnmatched++;
+		return false;
+	}
+
+	/* the wheel's reference is dropped lazily when its slot comes round */
+	entry = mTable[idx];
+	erase(idx);
+	mCounterMatched++;
+	return true;
+}
+
+bool	bdTransTable::matchType(const bdToken *tid, const struct sockaddr_in *addr,
+		uint32_t msgType, bdTransEntry &entry)
+{
+	bdTransKey key;
+	if (!makeKey(tid, addr, key))
+	{
+		return false;
+	}
+
+	int idx = find(key);
+	if ((idx < 0) || (mTable[idx].mMsgType != msgType))
+	{
+		return false;
+	}
+
+	entry = mTable[idx];
+	erase(idx);
+	mCounterMatched++;
+	return true;
+}
+
+void	bdTransTable::expire(time_t now)
+{
+	if ((mWheelTS == 0) || (now < mWheelTS))
+	{
+		/* first call, or the clock went backwards: any entry will still
+		 * expire, at worst a full turn of the wheel late.
+		 */
+		mWheelTS = now;
+		return;
+	}
+
+	time_t ts = mWheelTS + 1;
+	if (now - mWheelTS > BITDHT_TRANS_WHEEL_SLOTS)
+	{
+		ts = now - BITDHT_TRANS_WHEEL_SLOTS + 1;
+	}
+
+	for(; ts <= now; ts++)
+	{
+		expireSlot(ts % BITDHT_TRANS_WHEEL_SLOTS, now);
+	}
+	mWheelTS = now;
+}
+
+void	bdTransTable::expireSlot(uint32_t slot, time_t now)
+{
+	std::vector<bdTransKey> &keys = mWheel[slot];
+	uint32_t kept = 0;
+	for(uint32_t i = 0; i < keys.size(); i++)
+	{
+		int idx = find(keys[i]);
+		if (idx < 0)
+		{
+			/* already matched */
+			continue;
+		}
+
+		bdTransEntry &entry = mTable[idx];
+		if (entry.mExpireTS <= now)
+		{
+#ifdef DEBUG_TRANSTABLE
+			LOG.info("bdTransTable::expireSlot() request type %u timed out", entry.mMsgType);
+#endif
+			erase(idx);
+			mCounterExpired++;
+		}
+		else if ((uint32_t) (entry.mExpireTS % BITDHT_TRANS_WHEEL_SLOTS) == slot)
+		{
+			/* due on a later turn of the wheel */
+			keys[kept++] = keys[i];
+		}
+		/* else re-added since: referenced from another slot */
+	}
+	keys.resize(kept);
+}
+
+void	bdTransTable::clear()
+{
+	for(uint32_t i = 0; i < mTable.size(); i++)
+	{
+		mTable[i].mUsed = false;
+	}
+	mSize = 0;
+
+	for(int i = 0; i < BITDHT_TRANS_WHEEL_SLOTS; i++)
+	{
+		mWheel[i].clear();
+	}
+}
+
+uint32_t bdTransTable::size()
+{
+	return mSize;
+}
+
+uint32_t bdTransTable::capacity()
+{
+	return mTable.size();
+}
+
+uint32_t bdTransTable::matched()
+{
+	return mCounterMatched;
+}
+
+uint32_t bdTransTable::unmatched()
+{
+	return mCounterUnmatched;
+}
+
+uint32_t bdTransTable::expired()
+{
+	return mCounterExpired;
+}
+
+void	bdTransTable::resetCounters()
+{
+	mCounterMatched = 0;
+	mCounterUnmatched = 0;
+	mCounterExpired = 0;
+}
+
+bool	bdTransTable::makeKey(const bdToken *tid, const struct sockaddr_in *addr, bdTransKey &key)
+{
+	if (tid->len > BITDHT_TOKEN_MAX_LEN)
+	{
+		return false;
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.mAddr = addr->sin_addr.s_addr;
+	key.mPort = addr->sin_port;
+	key.mTidLen = tid->len;
+	memcpy(key.mTid, tid->data, tid->len);
+	return true;
+}
+
+/* FNV-1a */
+uint32_t bdTransTable::hash(const bdTransKey &key)
+{
+	uint32_t h = 2166136261u;
+	const unsigned char *p = (const unsigned char *) &(key.mAddr);
+	for(int i = 0; i < 4; i++)
+	{
+		h = (h ^ p[i]) * 16777619u;
+	}
+	p = (const unsigned char *) &(key.mPort);
+	for(int i = 0; i < 2; i++)
+	{
+		h = (h ^ p[i]) * 16777619u;
+	}
+	for(int i = 0; i < key.mTidLen; i++)
+	{
+		h = (h ^ key.mTid[i]) * 16777619u;
+	}
+	return h;
+}
+
+int	bdTransTable::find(const bdTransKey &key)
+{
+	uint32_t idx = hash(key) & mMask;
+	while(mTable[idx].mUsed)
+	{
+		if (mTable[idx].mKey == key)
+		{
+			return idx;
+		}
+		idx = (idx + 1) & mMask;
+	}
+	return -1;
+}
+
+void	bdTransTable::insert(const bdTransEntry &entry)
+{
+	uint32_t idx = hash(entry.mKey) & mMask;
+	while(mTable[idx].mUsed)
+	{
+		idx = (idx + 1) & mMask;
+	}
+	mTable[idx] = entry;
+	mSize++;
+}
+
+/* backward shift: pull later members of the probe run into the hole,
+ * so lookups never need tombstones.
+ */
+void	bdTransTable::erase(uint32_t idx)
+{
+	mTable[idx].mUsed = false;
+	mSize--;
+
+	uint32_t hole = idx;
+	uint32_t j = idx;
+	while(true)
+	{
+		j = (j + 1) & mMask;
+		if (!mTable[j].mUsed)
+		{
+			break;
+		}
+
+		/* can j move to the hole? only if its home slot is not
+		 * (cyclically) between the hole and j.
+		 */
+		uint32_t home = hash(mTable[j].mKey) & mMask;
+		if (((j - home) & mMask) >= ((j - hole) & mMask))
+		{
+			mTable[hole] = mTable[j];
+			mTable[j].mUsed = false;
+			hole = j;
+		}
+	}
+}
+
+void	bdTransTable::grow()
+{
+	std::vector<bdTransEntry> old;
+	old.swap(mTable);
+
+	mTable.resize(old.size() * 2);
+	mMask = mTable.size() - 1;
+	mSize = 0;
+
+#ifdef DEBUG_TRANSTABLE
+	LOG.info("bdTransTable::grow() to %u slots", (uint32_t) mTable.size());
+#endif
+
+	for(uint32_t i = 0; i < old.size(); i++)
+	{
+		if (old[i].mUsed)
+		{
+			insert(old[i]);
+		}
+	}
+}
+
@@ -0,0 +1,124 @@
+#ifndef BITDHT_TRANS_TABLE_H
+#define BITDHT_TRANS_TABLE_H
+
+/*
+ * bitdht/bdtranstable.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * Outstanding Transaction Table.
+ *
+ * Every request we send (ping, find_node, get_peers, announce) is
+ * recorded against its (transaction id, peer address). A reply is only
+ * accepted if it matches an entry - which is removed, giving the round
+ * trip time - so unsolicited replies can be dropped before they cost
+ * any work.
+ *
+ * The table is open addressed (linear probing, backward shift delete)
+ * and doubles when half full. Expiry is driven by a timer wheel of one
+ * second slots, so each iteration only looks at the entries that are
+ * actually due.
+ ******/
+
+#include "bitdht/bdpeer.h"
+#include "bitdht/bdobj.h"
+
+#include <vector>
+
+#define BITDHT_TRANS_INIT_CAPACITY	1024	/* power of 2 */
+#define BITDHT_TRANS_TIMEOUT		20	/* secs before a request is given up on */
+#define BITDHT_TRANS_WHEEL_SLOTS	64	/* secs, must exceed the timeout */
+
+class bdTransKey
+{
+public:
+	bool operator==(const bdTransKey &other) const;
+
+	uint32_t mAddr;		/* network order */
+	uint16_t mPort;		/* network order */
+	uint16_t mTidLen;
+	unsigned char mTid[BITDHT_TOKEN_MAX_LEN];
+};
+
+class bdTransEntry
+{
+public:
+	bdTransEntry();
+
+	bdTransKey mKey;
+	uint32_t mMsgType;	/* of the request */
+	bdNodeId mTarget;	/* find_node target / info_hash (zero otherwise) */
+	uint64_t mSendUsecs;
+	time_t	mExpireTS;
+	bool	mUsed;
+};
+
+class bdTransTable
+{
+public:
+	bdTransTable(uint32_t capacity = BITDHT_TRANS_INIT_CAPACITY,
+			time_t timeout = BITDHT_TRANS_TIMEOUT);
+
+	/* record an outgoing request (target may be NULL) */
+	void	add(const bdToken *tid, const struct sockaddr_in *addr, uint32_t msgType,
+			const bdNodeId *target, uint64_t sendUsecs, time_t now);
+	/* removes the matching request, if any. Updates matched/unmatched */
+	bool	match(const bdToken *tid, const struct sockaddr_in *addr, bdTransEntry &entry);
+	/* as match(), but only a request of msgType - and a miss isn't counted */
+	bool	matchType(const bdToken *tid, const struct sockaddr_in *addr, uint32_t msgType,
+			bdTransEntry &entry);
+	/* drops requests that have timed out. Updates expired */
+	void	expire(time_t now);
+	void	clear();
+
+	uint32_t size();
+	uint32_t capacity();
+
+	uint32_t matched();
+	uint32_t unmatched();
+	uint32_t expired();
+	void	resetCounters();
+
+private:
+	bool	makeKey(const bdToken *tid, const struct sockaddr_in *addr, bdTransKey &key);
+	uint32_t hash(const bdTransKey &key);
+	int	find(const bdTransKey &key);	/* slot index, or -1 */
+	void	insert(const bdTransEntry &entry);
+	void	erase(uint32_t idx);
+	void	grow();
+	void	expireSlot(uint32_t slot, time_t now);
+
+	std::vector<bdTransEntry> mTable;
+	uint32_t mMask;
+	uint32_t mSize;
+	time_t	mTimeout;
+
+	std::vector<bdTransKey> mWheel[BITDHT_TRANS_WHEEL_SLOTS];
+	time_t	mWheelTS;	/* last second the wheel was turned to */
+
+	uint32_t mCounterMatched;
+	uint32_t mCounterUnmatched;
+	uint32_t mCounterExpired;
+};
+
+#endif
+
@@ -49,6 +49,7 @@
 #include <ctype.h>
 
 #include "util/bdnet.h"
+#include "util/bdtime.h"
 #include "util/bdlog.h"
 
 /***
@@ -99,6 +100,13 @@ int	bdTunnelManager::startTunnel()
 	/* set startup mode */
 	restartNode();
 
+	/* try every peer again */
+	std::map<bdId, bdTunnelPeer>::iterator it;
+	for(it = mTunnelPeers.begin(); it != mTunnelPeers.end(); it++)
+	{
+		it->second.mStatus = bdTunnelPeer::CONNECTING;
+	}
+
 	mMode = BITDHT_TUN_MGR_STATE_STARTUP;
 	mModeTS = now;
 
@@ -129,12 +137,17 @@ void bdTunnelManager::connectNode(const bdId *id)
 	}
 #endif
 	/* check if exists already */
-	if (mTunnelPeers.count(*id) > 0) {
+	std::map<bdId, bdTunnelPeer>::iterator eit = mTunnelPeers.find(*id);
+	if (eit != mTunnelPeers.end()) {
 #ifdef DEBUG_MGR
 		std::ostringstream ss;
 		bdStdPrintId(ss, id);
 		LOG.info("bdTunnelManager::connectNode() Found existing:%s....", ss.str().c_str());
 #endif
+		/* a dead tunnel is only retried when asked for again */
+		if (eit->second.mStatus == bdTunnelPeer::DISCONNECTED) {
+			eit->second.mStatus = bdTunnelPeer::CONNECTING;
+		}
 		return;
 	}
 
@@ -168,7 +181,7 @@ void bdTunnelManager::disconnectNode(const bdId *id)
 		return;
 	}
 
-	// TODO::
+	clearTunnel(id);
 
 	/* remove from map */
 	mTunnelPeers.erase(it);
@@ -217,7 +230,9 @@ void bdTunnelManager::iteration()
 			bdId id;
 			std::map<bdId, bdTunnelPeer>::iterator it;
 			for (it = mTunnelPeers.begin(); it != mTunnelPeers.end(); it++) {
-				addTunnel(&(it->first));
+				if (it->second.mStatus != bdTunnelPeer::DISCONNECTED) {
+					addTunnel(&(it->first));
+				}
 			}
 		}
 		break;
@@ -242,6 +257,68 @@ void bdTunnelManager::iteration()
 	{
 		/* tick parent */
 		bdTunnelNode::iteration();
+		updatePeerStatus();
+	}
+}
+
+void bdTunnelManager::processIncoming()
+{
+	if (mMode == BITDHT_TUN_MGR_STATE_OFF)
+	{
+		bdTunnelNode::iterationOff();
+	}
+	else
+	{
+		bdTunnelNode::processIncomingMsgs();
+		bdTunnelNode::sendTunnelMsgs(bdClockUsecs());
+	}
+}
+
+bool bdTunnelManager::nextTunnelSend(uint64_t &waitUsecs)
+{
+	if (mMode == BITDHT_TUN_MGR_STATE_OFF)
+	{
+		return false;
+	}
+	return bdTunnelNode::nextTunnelSend(waitUsecs, bdClockUsecs());
+}
+
+/* copy the node's tunnel states to the peers. peers whose tunnel died
+ * are not re-added until connectNode() asks for them again.
+ */
+void bdTunnelManager::updatePeerStatus()
+{
+	std::map<bdId, bdTunnelReqStatus> statusMap;
+	tunnelStatus(statusMap);
+
+	std::map<bdId, bdTunnelReqStatus>::iterator sit;
+	for(sit = statusMap.begin(); sit != statusMap.end(); sit++)
+	{
+		std::map<bdId, bdTunnelPeer>::iterator it = mTunnelPeers.find(sit->first);
+		if (it == mTunnelPeers.end())
+		{
+			continue;
+		}
+		if (sit->second.mStatus == BITDHT_TUNNEL_CONNECTED)
+		{
+			it->second.mStatus = bdTunnelPeer::CONNECTED;
+		}
+	}
+
+	std::list<bdId> dead;
+	popDeadTunnels(dead);
+	std::list<bdId>::iterator dit;
+	for(dit = dead.begin(); dit != dead.end(); dit++)
+	{
+		std::map<bdId, bdTunnelPeer>::iterator it = mTunnelPeers.find(*dit);
+		if (it != mTunnelPeers.end())
+		{
+#ifdef DEBUG_MGR
+			LOG.info("bdTunnelManager::updatePeerStatus() tunnel to %s dead",
+					mFns->bdPrintId(&(*dit)).c_str());
+#endif
+			it->second.mStatus = bdTunnelPeer::DISCONNECTED;
+		}
 	}
 }
 
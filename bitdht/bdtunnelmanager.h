@@ -33,6 +33,9 @@ public:
 	bdTunnelManager(const bdNodeId &ownId, bdDhtFunctions *fns);
 
 	void iteration();
+	/* between iterations: handle received messages, send due retries */
+	void processIncoming();
+	bool nextTunnelSend(uint64_t &waitUsecs);
 
 	void ask(const bdId *id);
 
@@ -58,6 +61,7 @@ private:
 	int		checkStatus();
 	int 	checkPingStatus();
 	int 	SearchOutOfDate();
+	void	updatePeerStatus();
 
 	std::map<bdId, bdTunnelPeer> 		mTunnelPeers;
 	std::list<BitDhtCallback *> 		mCallbacks;
@@ -30,14 +30,15 @@
 
 #include "util/bdnet.h"
 #include "util/bdlog.h"
+#include "util/bdtime.h"
 
 #include <string.h>
 #include <stdlib.h>
 
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <sstream>
-#include <atomic>
 
 
 #define BITDHT_QUERY_START_PEERS			10
@@ -61,8 +62,11 @@
 
 
 bdTunnelNode::bdTunnelNode(const bdNodeId &ownId, bdDhtFunctions *fns) :
-	mOwnId(ownId), mFns(fns)
+	mOwnId(ownId), mFns(fns),
+	mOutgoingPool(BITDHT_TUNNEL_OUTGOING_SLOTS),
+	mIncomingPool(BITDHT_TUNNEL_INCOMING_SLOTS)
 {
+	mTransIdCounter = mRandom.next32();
 }
 
 void bdTunnelNode::getOwnId(bdNodeId *id)
@@ -78,67 +82,154 @@ void bdTunnelNode::restartNode()
 void bdTunnelNode::shutdownNode()
 {
 	/* clean up any outgoing messages */
-	while(mOutgoingMsgs.size() > 0)
-	{
-		bdTunnelNodeNetMsg *msg = mOutgoingMsgs.front();
-		mOutgoingMsgs.pop_front();
+	mOutgoingPool.release(mOutgoingMsgs);
 
-		/* cleanup message */
-		delete msg;
+	/* tunnels are added again when the manager restarts */
+	std::list<bdTunnelReq *>::iterator it;
+	for(it = mTunnelRequests.begin(); it != mTunnelRequests.end(); it++)
+	{
+		delete (*it);
 	}
+	mTunnelRequests.clear();
+	mDeadTunnels.clear();
 }
 
 void bdTunnelNode::iterationOff()
 {
 	/* clean up any incoming messages */
-	while(mIncomingMsgs.size() > 0)
-	{
-		bdTunnelNodeNetMsg *msg = mIncomingMsgs.front();
-		mIncomingMsgs.pop_front();
-
-		/* cleanup message */
-		delete msg;
-	}
+	mIncomingPool.release(mIncomingMsgs);
 }
 
-void bdTunnelNode::iteration()
+/* also called between iterations, as soon as messages arrive */
+void bdTunnelNode::processIncomingMsgs()
 {
-	/* process incoming msgs */
-	while (mIncomingMsgs.size() > 0)
+	bdMsgSlot *msg;
+	while (NULL != (msg = mIncomingMsgs.pop()))
 	{
-		bdTunnelNodeNetMsg *msg = mIncomingMsgs.front();
-		mIncomingMsgs.pop_front();
-
 		recvPkt(msg->data, msg->mSize, msg->addr);
 
-		/* cleanup message */
-		delete msg;
+		/* return slot to the pool */
+		mIncomingPool.release(msg);
 	}
+}
 
-	/* allow each query to send up to one query... until maxMsgs has been reached */
-	int numQueries = mTunnelRequests.size();
-	int i = 0;
+void bdTunnelNode::iteration()
+{
+	processIncomingMsgs();
+	sendTunnelMsgs(bdClockUsecs());
+}
 
+void bdTunnelNode::sendTunnelMsgs(uint64_t now)
+{
 #ifdef DEBUG_NODE_MULTIPEER
-	LOG.info("bdTunnelNode::iteration():%d", numQueries);
+	LOG.info("bdTunnelNode::sendTunnelMsgs():%d", (int) mTunnelRequests.size());
 #endif
 
-	/* iterate through queries */
-	while(i < numQueries)
+	std::list<bdTunnelReq *>::iterator it;
+	for(it = mTunnelRequests.begin(); it != mTunnelRequests.end();)
 	{
+		bdTunnelReq *req = (*it);
+		bool send = false;
+		bool dead = false;
+
+		if (req->mState == BITDHT_TUNNEL_CONNECTING)
+		{
+			if ((req->mStartUsecs) &&
+				(now - req->mStartUsecs > BITDHT_TUNNEL_CONNECT_TIMEOUT * (uint64_t) 1000000))
+			{
+				dead = true;
+			}
+			else if (now >= req->mNextSendUsecs)
+			{
+				send = true;
+				if (!req->mStartUsecs)
+				{
+					req->mStartUsecs = now;
+				}
+				req->mNextSendUsecs = now + req->mRetryUsecs;
+				req->mRetryUsecs = std::min(2 * req->mRetryUsecs,
+						(uint64_t) BITDHT_TUNNEL_RETRY_MAX_USECS);
+			}
+		}
+		else
+		{
+			uint64_t lastActive = std::max(req->mLastSendUsecs, req->mLastRecvUsecs);
+			if (now - req->mLastRecvUsecs > BITDHT_TUNNEL_DEAD_TIMEOUT * (uint64_t) 1000000)
+			{
+				dead = true;
+			}
+			else if (now - lastActive >= BITDHT_TUNNEL_KEEPALIVE_IDLE * (uint64_t) 1000000)
+			{
+				send = true;
+			}
+		}
+
+		if (dead)
+		{
 #ifdef DEBUG_NODE_MULTIPEER
-		LOG.info("bdTunnelNode::iteration():num %d, index.%d", numQueries, i);
+			LOG.info("bdTunnelNode::sendTunnelMsgs() %s dead in state %u",
+					mFns->bdPrintId(&(req->mId)).c_str(), req->mState);
 #endif
-		bdTunnelReq *query = mTunnelRequests.front();
-		mTunnelRequests.pop_front();
-		mTunnelRequests.push_back(query);
+			mDeadTunnels.push_back(req->mId);
+			it = mTunnelRequests.erase(it);
+			delete req;
+			continue;
+		}
 
-		/* push out query */
-		bdToken transId;
-		genNewTransId(&transId);
+		if (send)
+		{
+			bdToken transId;
+			genNewTransId(&transId);
+			msgout_newconn(&(req->mId), &transId);
+			req->mLastSendUsecs = now;
+		}
+		it++;
+	}
+}
 
-		msgout_newconn(&query->mId, &transId);
-		i++;
+bool bdTunnelNode::nextTunnelSend(uint64_t &waitUsecs, uint64_t now)
+{
+	bool pending = false;
+	waitUsecs = UINT64_MAX;
+
+	/* connected tunnels can wait for the next iteration */
+	std::list<bdTunnelReq *>::iterator it;
+	for(it = mTunnelRequests.begin(); it != mTunnelRequests.end(); it++)
+	{
+		if ((*it)->mState != BITDHT_TUNNEL_CONNECTING)
+		{
+			continue;
+		}
+
+		pending = true;
+		if ((*it)->mNextSendUsecs <= now)
+		{
+			waitUsecs = 0;
+			break;
+		}
+		waitUsecs = std::min(waitUsecs, (*it)->mNextSendUsecs - now);
+	}
+	return pending;
+}
+
+void bdTunnelNode::tunnelActivity(const bdId *id, uint64_t now)
+{
+	std::list<bdTunnelReq *>::iterator it;
+	for(it = mTunnelRequests.begin(); it != mTunnelRequests.end(); it++)
+	{
+		if ((*it)->mId == *id)
+		{
+			if ((*it)->mState == BITDHT_TUNNEL_CONNECTING)
+			{
+#ifdef DEBUG_NODE_MULTIPEER
+				LOG.info("bdTunnelNode::tunnelActivity() %s connected",
+						mFns->bdPrintId(id).c_str());
+#endif
+				(*it)->mState = BITDHT_TUNNEL_CONNECTED;
+			}
+			(*it)->mLastRecvUsecs = now;
+			return;
+		}
 	}
 }
 
@@ -185,22 +276,25 @@ void bdTunnelNode::tunnelStatus(std::map<bdId, bdTunnelReqStatus> &statusMap)
 	for(it = mTunnelRequests.begin(); it != mTunnelRequests.end(); it++)
 	{
 		bdTunnelReqStatus status;
-		// TODO::
+		status.mStatus = (*it)->mState;
+		status.mQFlags = 0;
+		statusMap[(*it)->mId] = status;
 	}
 }
 
+void bdTunnelNode::popDeadTunnels(std::list<bdId> &dead)
+{
+	dead.splice(dead.end(), mDeadTunnels);
+}
+
 /************************************ Message Buffering ****************************/
 
 /* interaction with outside world */
 int bdTunnelNode::outgoingMsg(struct sockaddr_in *addr, char *msg, int *len)
 {
-	if (mOutgoingMsgs.size() > 0)
+	bdMsgSlot *bdmsg = mOutgoingMsgs.pop();
+	if (bdmsg)
 	{
-		bdTunnelNodeNetMsg *bdmsg = mOutgoingMsgs.front();
-		//bdmsg->print(LOG << log4cpp::Priority::INFO);
-		mOutgoingMsgs.pop_front();
-		//bdmsg->print(LOG << log4cpp::Priority::INFO);
-
 		/* truncate if necessary */
 		if (bdmsg->mSize < *len)
 		{
@@ -219,21 +313,33 @@ int bdTunnelNode::outgoingMsg(struct sockaddr_in *addr, char *msg, int *len)
 		memcpy(msg, bdmsg->data, *len);
 		*addr = bdmsg->addr;
 
-		//bdmsg->print(LOG << log4cpp::Priority::INFO);
-
-		delete bdmsg;
+		mOutgoingPool.release(bdmsg);
 		return 1;
 	}
 	return 0;
 }
 
+/* zero-copy: send from the slot, then hand it back */
+bdMsgSlot *bdTunnelNode::popOutgoingMsg()
+{
+	return mOutgoingMsgs.pop();
+}
+
+void bdTunnelNode::releaseOutgoingMsg(bdMsgSlot *slot)
+{
+	mOutgoingPool.release(slot);
+}
+
 void bdTunnelNode::incomingMsg(struct sockaddr_in *addr, char *msg, int len)
 {
 	LOG.info("bdTunnelNode::incomingMsg() ******************************* Address:%s:%d",
 			inet_ntoa(addr->sin_addr), htons(addr->sin_port));
 
-	bdTunnelNodeNetMsg *bdmsg = new bdTunnelNodeNetMsg(msg, len, addr);
-	mIncomingMsgs.push_back(bdmsg);
+	bdMsgSlot *bdmsg = mIncomingPool.alloc(msg, len, addr);
+	if (bdmsg)
+	{
+		mIncomingMsgs.push(bdmsg);
+	}
 }
 
 /************************************ Message Handling *****************************/
@@ -260,12 +366,15 @@ void bdTunnelNode::msgout_newconn(bdId *dhtId, bdToken *transId)
 			ss.str().c_str(), mFns->bdPrintId(dhtId).c_str());
 #endif
 
-	/* create string */
-	char msg[10240];
-	int avail = 10240;
+	/* encode straight into an outgoing slot */
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
 
-	int blen = bitdht_ask_myip_msg(transId, &(mOwnId), msg, avail-1);
-	sendPkt(msg, blen, dhtId->addr);
+	int blen = bitdht_ask_myip_msg(transId, &(mOwnId), slot->data, BITDHT_MSGPOOL_SLOT_SIZE);
+	sendSlot(slot, blen, dhtId->addr);
 }
 
 void bdTunnelNode::msgout_reply_newconn(bdId *tunnelId, bdToken *transId)
@@ -277,21 +386,30 @@ void bdTunnelNode::msgout_reply_newconn(bdId *tunnelId, bdToken *transId)
 			ss.str().c_str(), mFns->bdPrintId(tunnelId).c_str());
 	// #endif
 
-	/* create string */
-	char msg[10240];
-	int avail = 10240;
+	/* encode straight into an outgoing slot */
+	bdMsgSlot *slot = mOutgoingPool.alloc();
+	if (!slot)
+	{
+		return;	/* dropped, counted by the pool */
+	}
 
 	int blen = bitdht_reply_myip_msg(transId, &(mOwnId), tunnelId,
-			msg, true, avail-1);
-	sendPkt(msg, blen, tunnelId->addr);
+			slot->data, true, BITDHT_MSGPOOL_SLOT_SIZE);
+	sendSlot(slot, blen, tunnelId->addr);
 }
 
-void bdTunnelNode::sendPkt(char *msg, int len, struct sockaddr_in addr)
+/* drops, rather than truncates, a message too big for its slot */
+void bdTunnelNode::sendSlot(bdMsgSlot *slot, int len, struct sockaddr_in addr)
 {
-	bdTunnelNodeNetMsg *bdmsg = new bdTunnelNodeNetMsg(msg, len, &addr);
-	mOutgoingMsgs.push_back(bdmsg);
+	if ((len <= 0) || (len > BITDHT_MSGPOOL_SLOT_SIZE))
+	{
+		mOutgoingPool.discard(slot);
+		return;
+	}
 
-	return;
+	slot->mSize = len;
+	slot->addr = addr;
+	mOutgoingMsgs.push(slot);
 }
 
 /********************* Incoming Messages *************************/
@@ -606,6 +724,7 @@ void bdTunnelNode::recvPkt(char *msg, int len, struct sockaddr_in addr)
 	bdId srcId(id, addr);
 
 	checkIncomingMsg(&srcId, &transId, beType);
+	tunnelActivity(&srcId, bdClockUsecs());
 	if (beType == BITDHT_MSG_TYPE_NEWCONN) {
 		//#ifdef DEBUG_NODE_MSGS
 		LOG.info("bdTunnelNode::recvPkt() NewConn from: %s",
@@ -639,41 +758,27 @@ void bdTunnelNode::genNewToken(bdToken *token)
 	LOG.info("bdTunnelNode::genNewToken()");
 #endif
 
-	std::ostringstream out;
-	out << std::setw(4) << std::setfill('0') << rand() << std::setw(4) << std::setfill('0') << rand();
-	std::string num = out.str();
-	int len = num.size();
-	if (len > BITDHT_TOKEN_MAX_LEN)
-		len = BITDHT_TOKEN_MAX_LEN;
-
-	for(int i = 0; i < len; i++)
+	uint64_t num = mRandom.next();
+	for(int i = 0; i < BITDHT_TOKEN_LEN; i++)
 	{
-		token->data[i] = num[i];
+		token->data[i] = (num >> (8 * i)) & 0xff;
 	}
-	token->len = len;
+	token->len = BITDHT_TOKEN_LEN;
 }
 
-extern std::atomic_ulong transIdCounter;
-
+/* same layout as bdNode::genNewTransId() */
 void bdTunnelNode::genNewTransId(bdToken *token)
 {
-	/* generate message, send to udp */
 #ifdef DEBUG_NODE_ACTIONS 
 	LOG.info("bdTunnelNode::genNewTransId()");
 #endif
 
-	std::ostringstream out;
-	out << std::setw(2) << std::setfill('0') << transIdCounter++;
-	std::string num = out.str();
-	int len = num.size();
-	if (len > BITDHT_TOKEN_MAX_LEN)
-		len = BITDHT_TOKEN_MAX_LEN;
-
-	for(int i = 0; i < len; i++)
-	{
-		token->data[i] = num[i];
-	}
-	token->len = len;
+	uint32_t num = ((mTransIdCounter++ & 0xffff) << 16) | (mRandom.next32() & 0xffff);
+	token->data[0] = (num >> 24) & 0xff;
+	token->data[1] = (num >> 16) & 0xff;
+	token->data[2] = (num >> 8) & 0xff;
+	token->data[3] = num & 0xff;
+	token->len = BITDHT_TRANSID_LEN;
 }
 
 uint32_t bdTunnelNode::checkIncomingMsg(bdId *id, bdToken *transId, uint32_t msgType)
@@ -701,25 +806,3 @@ void bdTunnelNode::cleanupTransIdRegister()
 	return;
 }
 
-/*************** Internal Msg Storage *****************/
-
-bdTunnelNodeNetMsg::bdTunnelNodeNetMsg(char *msg, int len, struct sockaddr_in *in_addr)
-:data(NULL), mSize(len), addr(*in_addr)
-{
-	data = (char *) malloc(len);
-	memcpy(data, msg, len);
-	//print(LOG << log4cpp::Priority::INFO);
-}
-
-void bdTunnelNodeNetMsg::print(std::ostream &out)
-{
-	out << "bdTunnelNodeNetMsg::print(" << mSize << ") to "
-			<< inet_ntoa(addr.sin_addr) << ":" << htons(addr.sin_port);
-	out << std::endl;
-}
-
-
-bdTunnelNodeNetMsg::~bdTunnelNodeNetMsg()
-{
-	free(data);
-}
@@ -33,29 +33,48 @@
 #include "bitdht/bdobj.h"
 #include "bitdht/bdhash.h"
 #include "bitdht/bdhistory.h"
+#include "bitdht/bdmsgpool.h"
+#include "util/bdrandom.h"
 
 
 #define BD_QUERY_NEIGHBOURS		1
 #define BD_QUERY_HASH			2
 
-class bdTunnelNodeNetMsg
-{
-public:
-	bdTunnelNodeNetMsg(char *data, int size, struct sockaddr_in *addr);
-	~bdTunnelNodeNetMsg();
+#define BITDHT_TUNNEL_INCOMING_SLOTS	256
+#define BITDHT_TUNNEL_OUTGOING_SLOTS	256
 
-	void print(std::ostream &out);
+/* tunnel states */
+#define BITDHT_TUNNEL_CONNECTING	1
+#define BITDHT_TUNNEL_CONNECTED		2
 
-	char *data;
-	int mSize;
-	struct sockaddr_in addr;
-};
+/* connecting: newconn retries, doubling from the first interval */
+#define BITDHT_TUNNEL_RETRY_FIRST_USECS	250000
+#define BITDHT_TUNNEL_RETRY_MAX_USECS	4000000
+#define BITDHT_TUNNEL_CONNECT_TIMEOUT	30	/* secs without a reply, then dead */
+/* connected: a keepalive once the link has been quiet this long */
+#define BITDHT_TUNNEL_KEEPALIVE_IDLE	20	/* secs */
+#define BITDHT_TUNNEL_DEAD_TIMEOUT	90	/* secs without hearing from the peer */
 
+/*
+ * A tunnel costs traffic according to its state: a connecting tunnel
+ * retries quickly then backs off, a connected one only sends when the
+ * link has gone quiet, and one that stops answering is removed (and
+ * reported through popDeadTunnels()).
+ */
 class bdTunnelReq {
 public:
-	bdTunnelReq(const bdId &id) : mId(id) {};
+	bdTunnelReq(const bdId &id)
+		: mId(id), mState(BITDHT_TUNNEL_CONNECTING), mStartUsecs(0),
+		mNextSendUsecs(0), mRetryUsecs(BITDHT_TUNNEL_RETRY_FIRST_USECS),
+		mLastSendUsecs(0), mLastRecvUsecs(0) {};
 
 	bdId mId;
+	uint32_t mState;
+	uint64_t mStartUsecs;	/* first newconn, 0 until sent */
+	uint64_t mNextSendUsecs;
+	uint64_t mRetryUsecs;	/* connecting: current backoff */
+	uint64_t mLastSendUsecs;
+	uint64_t mLastRecvUsecs;
 };
 
 class bdTunnelReqStatus
@@ -82,16 +101,31 @@ public:
 	void addTunnel(const bdId *id);
 	void clearTunnel(const bdId *id);
 	void tunnelStatus(std::map<bdId, bdTunnelReqStatus> &statusMap);
+	/* tunnels removed since the last call, because the peer stopped answering */
+	void popDeadTunnels(std::list<bdId> &dead);
 
 	void iterationOff();
 	void iteration();
+	void processIncomingMsgs();
+
+	/* sends the newconns / keepalives that are due.
+	 * all the times here are bdClockUsecs() - tunnels must not die
+	 * when the wall clock is stepped.
+	 */
+	void sendTunnelMsgs(uint64_t now);
+	/* false if no tunnel is connecting, otherwise usecs until the next retry */
+	bool nextTunnelSend(uint64_t &waitUsecs, uint64_t now);
+	/* heard from the peer: connects the tunnel / resets its idle timer */
+	void tunnelActivity(const bdId *id, uint64_t now);
 
 	/* interaction with outside world */
 	int outgoingMsg(struct sockaddr_in *addr, char *msg, int *len);
+	bdMsgSlot *popOutgoingMsg();	/* NULL if none */
+	void releaseOutgoingMsg(bdMsgSlot *slot);
 	void incomingMsg(struct sockaddr_in *addr, char *msg, int len);
 
 	/* internal interaction with network */
-	void sendPkt(char *msg, int len, struct sockaddr_in addr);
+	void sendSlot(bdMsgSlot *slot, int len, struct sockaddr_in addr);
 	void recvPkt(char *msg, int len, struct sockaddr_in addr);
 
 	void msgin_newconn(bdId *tunnelId, bdToken *transId);
@@ -121,8 +155,14 @@ protected:
 private:
 	bdDhtFunctions *mFns;
 	std::list<bdTunnelReq *> mTunnelRequests;
-	std::list<bdTunnelNodeNetMsg *> mOutgoingMsgs;
-	std::list<bdTunnelNodeNetMsg *> mIncomingMsgs;
+	std::list<bdId> mDeadTunnels;
+	bdMsgPool mOutgoingPool;
+	bdMsgPool mIncomingPool;
+	bdMsgQueue mOutgoingMsgs;
+	bdMsgQueue mIncomingMsgs;
+
+	bdRandom mRandom;
+	uint32_t mTransIdCounter;
 };
 
 #endif // BITDHT_TUNNEL_NODE_H
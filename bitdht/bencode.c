@@ -418,62 +418,74 @@ void be_dump_str(be_node *node)
  *
  */
 
-int be_encode(be_node *node, char *str, int len)
+/* appends n bytes at loc, if they fit. returns the new loc either way */
+static int be_put(char *str, int len, int loc, const char *data, int n)
+{
+	if ((loc >= 0) && (loc + n <= len))
+	{
+		memcpy(&(str[loc]), data, n);
+	}
+	return loc + n;
+}
+
+static int be_encode_at(be_node *node, char *str, int len, int loc)
 {
 	size_t i;
-	int loc = 0;
+	char tmp[32];
 
 	switch (node->type) {
 		case BE_STR:
-			snprintf(str, len, "%lli:", be_str_len(node));
-			loc += strlen(&(str[loc]));
-
-			memcpy(&(str[loc]), node->val.s, be_str_len(node));
-			loc += be_str_len(node);
+			snprintf(tmp, sizeof(tmp), "%lli:", be_str_len(node));
+			loc = be_put(str, len, loc, tmp, strlen(tmp));
+			loc = be_put(str, len, loc, node->val.s, be_str_len(node));
 			break;
 
 		case BE_INT:
-			snprintf(str, len, "i%llie", node->val.i);
-			loc += strlen(&(str[loc]));
+			snprintf(tmp, sizeof(tmp), "i%llie", node->val.i);
+			loc = be_put(str, len, loc, tmp, strlen(tmp));
 			break;
 
 		case BE_LIST:
-
-			snprintf(str, len, "l");
-			loc += 1;
-
+			loc = be_put(str, len, loc, "l", 1);
 			for (i = 0; node->val.l[i]; ++i)
 			{
-				loc += be_encode(node->val.l[i], &(str[loc]), len-loc);
+				loc = be_encode_at(node->val.l[i], str, len, loc);
 			}
-
-			snprintf(&(str[loc]), len - loc, "e");
-			loc += 1;
-
+			loc = be_put(str, len, loc, "e", 1);
 			break;
 
 		case BE_DICT:
-			snprintf(str, len, "d");
-			loc += 1;
-
+			loc = be_put(str, len, loc, "d", 1);
 			for (i = 0; node->val.d[i].val; ++i) {
 				
 				/* assumption that key must be ascii! */
-				snprintf(&(str[loc]), len-loc, "%i:%s", 
-						(int) strlen(node->val.d[i].key),
-						node->val.d[i].key);
-				loc += strlen(&(str[loc]));
-				loc += be_encode(node->val.d[i].val, &(str[loc]), len-loc);
+				snprintf(tmp, sizeof(tmp), "%i:", 
+						(int) strlen(node->val.d[i].key));
+				loc = be_put(str, len, loc, tmp, strlen(tmp));
+				loc = be_put(str, len, loc, node->val.d[i].key,
+						strlen(node->val.d[i].key));
+				loc = be_encode_at(node->val.d[i].val, str, len, loc);
 			}
-
-			snprintf(&(str[loc]), len - loc, "e");
-			loc += 1;
-
+			loc = be_put(str, len, loc, "e", 1);
 			break;
 	}
 	return loc;
 }
 
+/* Like snprintf: never writes past len, and returns the full encoded
+ * length - so a result > len means the buffer was too small.
+ * The output is nul terminated if there is room.
+ */
+int be_encode(be_node *node, char *str, int len)
+{
+	int loc = be_encode_at(node, str, len, 0);
+	if (loc < len)
+	{
+		str[loc] = '\0';
+	}
+	return loc;
+}
+
 /* hackish way to create nodes! */
 be_node *be_create_dict()
 {
@@ -62,6 +62,8 @@ extern void be_dump_str(be_node *node);
 
 // New Functions for the other half of the work - encoding */
 
+/* returns the full encoded length: > len if it did not fit (nothing is
+ * written past len) */
 extern int be_encode(be_node *node, char *str, int len);
 
 
@@ -0,0 +1,105 @@
+/*
+ * bitdht/bdaddrcache_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdaddrcache.h"
+#include "bitdht/bdstddht.h"
+#include "utest.h"
+
+/*******************************************************************
+ * Test of the recently resolved address cache in bdaddrcache.cc
+ *
+ * Checks expiry, eviction order, pong refresh and the hit counters.
+ */
+
+#define N_CACHE_ENTRIES	10
+#define CACHE_TTL	100
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdAddrCache cache(N_CACHE_ENTRIES, CACHE_TTL);
+	time_t now = 1000;
+
+	bdId ids[N_CACHE_ENTRIES + 1];
+	for(int i = 0; i < N_CACHE_ENTRIES + 1; i++)
+	{
+		bdStdRandomId(&(ids[i]));
+	}
+
+	struct sockaddr_in addr;
+
+	/* unknown id is a miss */
+	CHECK(!cache.lookup(&(ids[0].id), addr, now));
+	CHECK(cache.misses() == 1);
+
+	/* added id is a hit, with the right address */
+	cache.addAddress(&(ids[0].id), &(ids[0].addr), now);
+	CHECK(cache.lookup(&(ids[0].id), addr, now));
+	CHECK(addr.sin_addr.s_addr == ids[0].addr.sin_addr.s_addr);
+	CHECK(addr.sin_port == ids[0].addr.sin_port);
+	CHECK(cache.hits() == 1);
+	CHECK(cache.hitRate() == 0.5);
+
+	REPORT("Basic Lookup");
+
+	/* expired entries miss, and are dropped by cleanup */
+	CHECK(!cache.lookup(&(ids[0].id), addr, now + CACHE_TTL + 1));
+	cache.cleanup(now + CACHE_TTL + 1);
+	CHECK(cache.size() == 0);
+
+	/* pong refresh only applies to existing entries */
+	CHECK(!cache.refreshAddress(&(ids[0].id), &(ids[0].addr), now));
+	CHECK(cache.size() == 0);
+
+	REPORT("Expiry");
+
+	/* fill past capacity: the oldest entry is evicted */
+	for(int i = 0; i < N_CACHE_ENTRIES + 1; i++)
+	{
+		cache.addAddress(&(ids[i].id), &(ids[i].addr), now + i);
+	}
+	CHECK(cache.size() == N_CACHE_ENTRIES);
+	CHECK(!cache.lookup(&(ids[0].id), addr, now + N_CACHE_ENTRIES));
+	CHECK(cache.lookup(&(ids[N_CACHE_ENTRIES].id), addr, now + N_CACHE_ENTRIES));
+
+	/* refreshing the now-oldest entry saves it from the next eviction */
+	CHECK(cache.refreshAddress(&(ids[1].id), &(ids[1].addr), now + N_CACHE_ENTRIES));
+	cache.addAddress(&(ids[0].id), &(ids[0].addr), now + N_CACHE_ENTRIES);
+	CHECK(cache.lookup(&(ids[1].id), addr, now + N_CACHE_ENTRIES));
+	CHECK(!cache.lookup(&(ids[2].id), addr, now + N_CACHE_ENTRIES));
+
+	REPORT("Eviction");
+
+	/* revalidation is requested once per ping period, for old entries */
+	time_t later = now + N_CACHE_ENTRIES + BITDHT_ADDRCACHE_REVALIDATE_AGE;
+	CHECK(!cache.needsRevalidation(&(ids[1].id), now + N_CACHE_ENTRIES));
+	CHECK(cache.needsRevalidation(&(ids[1].id), later));
+	CHECK(!cache.needsRevalidation(&(ids[1].id), later + 1));
+
+	REPORT("Revalidation");
+
+	FINALREPORT("bdAddrCache Tests");
+	return TESTRESULT();
+}
+
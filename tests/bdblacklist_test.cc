@@ -0,0 +1,168 @@
+/*
+ * bitdht/bdblacklist_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdblacklist.h"
+#include "utest.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/*******************************************************************
+ * Test of the address blacklist in bdblacklist.cc
+ *
+ * Checks exact, any port and range rules, longest match hit counting,
+ * removal, and bulk loading from a file.
+ */
+
+static struct sockaddr_in mkaddr(const char *ip, int port)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	bdnet_inet_aton(ip, &(addr.sin_addr));
+	addr.sin_port = htons(port);
+	return addr;
+}
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdBlackList bl;
+
+	/* exact address and port */
+	struct sockaddr_in a = mkaddr("10.0.0.1", 6881);
+	CHECK(!bl.isBlackListed(a));
+	CHECK(bl.add(a));
+	CHECK(!bl.add(a));
+	CHECK(bl.isBlackListed(a));
+	CHECK(!bl.isBlackListed(mkaddr("10.0.0.1", 6882)));
+	CHECK(!bl.isBlackListed(mkaddr("10.0.0.2", 6881)));
+	CHECK(bl.exactRules() == 1);
+
+	/* any port */
+	CHECK(bl.addRule("10.0.0.3"));
+	CHECK(bl.isBlackListed(mkaddr("10.0.0.3", 1)));
+	CHECK(bl.isBlackListed(mkaddr("10.0.0.3", 65535)));
+	CHECK(bl.addRule("10.0.0.4:1234"));
+	CHECK(bl.addRule("10.0.0.5 4321"));
+	CHECK(bl.isBlackListed(mkaddr("10.0.0.4", 1234)));
+	CHECK(!bl.isBlackListed(mkaddr("10.0.0.4", 1235)));
+	CHECK(bl.isBlackListed(mkaddr("10.0.0.5", 4321)));
+
+	/* bad rules */
+	CHECK(!bl.addRule("10.0.0"));
+	CHECK(!bl.addRule("10.0.0.6/33"));
+	CHECK(!bl.addRule("10.0.0.6:0"));
+	CHECK(!bl.addRule("hostname"));
+
+	CHECK(bl.remove(a));
+	CHECK(!bl.remove(a));
+	CHECK(!bl.isBlackListed(a));
+
+	REPORT("Exact Rules");
+
+	/* ranges: the most specific one gets the hit */
+	CHECK(bl.addRule("192.168.0.0/16"));
+	CHECK(bl.addRule("192.168.10.77/24")); /* host bits ignored */
+	CHECK(!bl.addRule("192.168.10.0/24"));
+	CHECK(bl.rangeRules() == 2);
+
+	CHECK(bl.isBlackListed(mkaddr("192.168.1.1", 1)));
+	CHECK(bl.isBlackListed(mkaddr("192.168.10.1", 2)));
+	CHECK(bl.isBlackListed(mkaddr("192.168.10.2", 3)));
+	CHECK(!bl.isBlackListed(mkaddr("192.169.0.1", 4)));
+	CHECK(!bl.isBlackListed(mkaddr("11.168.10.1", 5)));
+
+	std::list<bdBlackListRule> rules;
+	bl.getRules(rules);
+	uint32_t wideHits = 0;
+	uint32_t narrowHits = 0;
+	std::list<bdBlackListRule>::iterator it;
+	for(it = rules.begin(); it != rules.end(); it++)
+	{
+		if (it->mPrefixLen == 16)
+			wideHits = it->mHits;
+		if (it->mPrefixLen == 24)
+		{
+			narrowHits = it->mHits;
+			CHECK(it->mAddr.s_addr == mkaddr("192.168.10.0", 0).sin_addr.s_addr);
+		}
+	}
+	CHECK(wideHits == 1);
+	CHECK(narrowHits == 2);
+
+	CHECK(bl.removeRule(mkaddr("192.168.10.0", 0).sin_addr, 0, 24));
+	CHECK(bl.isBlackListed(mkaddr("192.168.10.1", 2)));
+	CHECK(bl.removeRule(mkaddr("192.168.0.0", 0).sin_addr, 0, 16));
+	CHECK(!bl.isBlackListed(mkaddr("192.168.10.1", 2)));
+	CHECK(bl.rangeRules() == 0);
+
+	/* /0 covers everything */
+	CHECK(bl.addRule("0.0.0.0/0"));
+	CHECK(bl.isBlackListed(mkaddr("1.2.3.4", 5)));
+	bl.clear();
+	CHECK(!bl.isBlackListed(mkaddr("1.2.3.4", 5)));
+	CHECK(bl.exactRules() == 0);
+
+	REPORT("Range Rules");
+
+	/* bulk load */
+	char file[] = "/tmp/bdblacklist_test.XXXXXX";
+	int fd = mkstemp(file);
+	CHECK(fd >= 0);
+	FILE *fp = fdopen(fd, "w");
+	fprintf(fp, "# test blacklist\n\n");
+	int count = 0;
+	for(int i = 0; i < 200; i++)
+	{
+		for(int j = 0; j < 250; j++)
+		{
+			fprintf(fp, "172.%d.%d.1:%d\n", i, j, 1000 + j);
+			count++;
+		}
+		fprintf(fp, "  10.%d.0.0/16   # range\n", i);
+		count++;
+	}
+	fprintf(fp, "not an address\n");
+	fclose(fp);
+
+	CHECK(bl.loadFile(file) == count);
+	CHECK(bl.exactRules() == 50000);
+	CHECK(bl.rangeRules() == 200);
+	CHECK(bl.isBlackListed(mkaddr("172.199.249.1", 1249)));
+	CHECK(!bl.isBlackListed(mkaddr("172.199.249.1", 1248)));
+	CHECK(bl.isBlackListed(mkaddr("10.150.3.4", 1)));
+	CHECK(!bl.isBlackListed(mkaddr("10.200.3.4", 1)));
+	CHECK(bl.hits() == 2);
+
+	unlink(file);
+	CHECK(bl.loadFile(file) == -1);
+
+	REPORT("Bulk Load");
+
+	FINALREPORT("bdBlackList Tests");
+	return TESTRESULT();
+}
+
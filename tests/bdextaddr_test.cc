@@ -0,0 +1,176 @@
+/*
+ * bitdht/bdextaddr_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdextaddr.h"
+#include "utest.h"
+
+#include <string.h>
+
+/*******************************************************************
+ * Test of the external address vote in bdextaddr.cc
+ *
+ * Checks one vote per peer (and per host), the time decay, the voter
+ * limit and the NAT classification.
+ */
+
+static struct sockaddr_in makeAddr(uint32_t ip, uint16_t port)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(ip);
+	addr.sin_port = htons(port);
+	return addr;
+}
+
+static bool sameAddr(const struct sockaddr_in &a, const struct sockaddr_in &b)
+{
+	return ((a.sin_addr.s_addr == b.sin_addr.s_addr) && (a.sin_port == b.sin_port));
+}
+
+#define EXT_IP		0x01020304
+#define OTHER_IP	0x05060708
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	time_t now = 100000;
+	bdExtAddrVote vote;
+	struct sockaddr_in best;
+
+	CHECK(!vote.best(best, now));
+	CHECK(vote.natType(now) == BITDHT_NAT_UNKNOWN);
+
+	/* one peer repeating itself is still one vote */
+	struct sockaddr_in ext = makeAddr(EXT_IP, 5000);
+	struct sockaddr_in liar = makeAddr(OTHER_IP, 6000);
+	for(int i = 0; i < 10; i++)
+	{
+		vote.vote(&ext, &liar, now);	/* voter 1.2.3.4:5000 */
+	}
+	struct sockaddr_in v1 = makeAddr(0x0a000001, 1000);
+	struct sockaddr_in v2 = makeAddr(0x0a000002, 1000);
+	vote.vote(&v1, &ext, now);
+	vote.vote(&v2, &ext, now);
+	CHECK(vote.size() == 3);
+	CHECK(vote.votes() == 12);
+	CHECK(vote.best(best, now));
+	CHECK(sameAddr(best, ext));
+	CHECK(vote.natType(now) == BITDHT_NAT_UNKNOWN);	/* only 2 for the address */
+
+	REPORT("One Vote Per Peer");
+
+	/* nor does one host answering from many ports outvote the rest */
+	vote.clear();
+	for(uint32_t i = 0; i < 3; i++)
+	{
+		struct sockaddr_in voter = makeAddr(0x0a000000 + i, 1000);
+		vote.vote(&voter, &ext, now);
+	}
+	for(uint16_t port = 2000; port < 2050; port++)
+	{
+		struct sockaddr_in sybil = makeAddr(OTHER_IP, port);
+		vote.vote(&sybil, &liar, now);
+	}
+	CHECK(vote.size() == 4);
+	CHECK(vote.best(best, now));
+	CHECK(sameAddr(best, ext));
+
+	REPORT("One Vote Per Host");
+
+	/* old votes lose out to newer ones, then drop out altogether */
+	vote.clear();
+	CHECK(vote.size() == 0);
+	for(uint32_t i = 0; i < 3; i++)
+	{
+		struct sockaddr_in voter = makeAddr(0x0a000000 + i, 1000);
+		vote.vote(&voter, &ext, now);
+	}
+	struct sockaddr_in moved = makeAddr(OTHER_IP, 7000);
+	now += 3 * BITDHT_EXTADDR_HALF_LIFE;
+	for(uint32_t i = 0; i < 2; i++)
+	{
+		struct sockaddr_in voter = makeAddr(0x0b000000 + i, 1000);
+		vote.vote(&voter, &moved, now);
+	}
+	CHECK(vote.best(best, now));
+	CHECK(sameAddr(best, moved));
+
+	now += BITDHT_EXTADDR_MAX_AGE + 1;
+	CHECK(!vote.best(best, now));
+
+	REPORT("Time Decay");
+
+	/* bounded: the oldest vote is replaced */
+	bdExtAddrVote small(4);
+	for(uint32_t i = 0; i < 10; i++)
+	{
+		struct sockaddr_in voter = makeAddr(0x0a000000 + i, 1000);
+		small.vote(&voter, (i < 6) ? &liar : &ext, now + i);
+	}
+	CHECK(small.size() == 4);
+	CHECK(small.best(best, now + 10));
+	CHECK(sameAddr(best, ext));
+
+	REPORT("Voter Limit");
+
+	/* stable: everyone sees the same port */
+	vote.clear();
+	for(uint32_t i = 0; i < 5; i++)
+	{
+		struct sockaddr_in voter = makeAddr(0x0a000000 + i, 1000);
+		vote.vote(&voter, &ext, now);
+	}
+	CHECK(vote.natType(now) == BITDHT_NAT_STABLE);
+	CHECK(vote.portSpread(now) == 0);
+
+	/* a rebinding leaves a stale minority: still stable */
+	struct sockaddr_in rebound = makeAddr(EXT_IP, 5100);
+	for(uint32_t i = 0; i < 2; i++)
+	{
+		struct sockaddr_in voter = makeAddr(0x0b000000 + i, 1000);
+		vote.vote(&voter, &rebound, now);
+	}
+	CHECK(vote.natType(now) == BITDHT_NAT_STABLE);
+	CHECK(vote.portSpread(now) == 100);
+
+	/* port-changing: a new port for each peer */
+	vote.clear();
+	for(uint32_t i = 0; i < 6; i++)
+	{
+		struct sockaddr_in voter = makeAddr(0x0a000000 + i, 1000);
+		struct sockaddr_in mapped = makeAddr(EXT_IP, 40000 + 2 * i);
+		vote.vote(&voter, &mapped, now);
+	}
+	CHECK(vote.natType(now) == BITDHT_NAT_PORT_CHANGING);
+	CHECK(vote.portSpread(now) == 10);
+	CHECK(vote.best(best, now));
+	CHECK(best.sin_addr.s_addr == htonl(EXT_IP));
+
+	REPORT("NAT Type");
+
+	FINALREPORT("bdExtAddrVote Tests");
+	return TESTRESULT();
+}
+
@@ -0,0 +1,131 @@
+/*
+ * bitdht/bdfanout_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdfanout.h"
+#include "bitdht/bdstddht.h"
+#include "utest.h"
+
+/*******************************************************************
+ * Test of the rendezvous fan-out schedule in bdfanout.cc
+ *
+ * Checks that a round visits every peer once, spread over the period,
+ * and the expiry and size bound.
+ */
+
+#define SEC		1000000ULL
+#define N_PEERS		100
+#define PERIOD		10
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdFanoutSchedule fanout(PERIOD, N_PEERS);
+	time_t nowTS = 1000;
+	uint64_t now = nowTS * SEC;
+
+	std::list<bdId> due;
+	fanout.duePeers(due, now);
+	CHECK(due.empty());
+
+	bdId ids[N_PEERS + 1];
+	for(int i = 0; i < N_PEERS; i++)
+	{
+		bdStdRandomId(&(ids[i]));
+		fanout.addPeer(&(ids[i]), nowTS, (i == 0));
+	}
+	fanout.addPeer(&(ids[1]), nowTS);
+	CHECK(fanout.size() == N_PEERS);
+
+	/* one step a second: the first peer straight away, then a tenth each */
+	std::map<bdId, int> visits;
+	for(int step = 0; step < PERIOD; step++)
+	{
+		due.clear();
+		fanout.duePeers(due, now + step * SEC);
+		if (step == 0)
+			CHECK(due.size() == 1);
+		else
+			CHECK(due.size() == N_PEERS / PERIOD);
+
+		std::list<bdId>::iterator it;
+		for(it = due.begin(); it != due.end(); it++)
+		{
+			visits[*it]++;
+		}
+	}
+
+	/* the round finishes on time, every peer once */
+	due.clear();
+	fanout.duePeers(due, now + PERIOD * SEC - 1);
+	CHECK(visits.size() + due.size() == N_PEERS);
+
+	/* then a new round */
+	due.clear();
+	fanout.duePeers(due, now + PERIOD * SEC);
+	CHECK(due.size() >= 1);
+	CHECK(fanout.roundSize() == N_PEERS);
+
+	REPORT("Round Schedule");
+
+	/* unseen peers expire when the next round starts, fixed ones don't */
+	fanout.addPeer(&(ids[2]), nowTS + BITDHT_FANOUT_PEER_TTL);
+	uint64_t later = (nowTS + BITDHT_FANOUT_PEER_TTL + 1) * SEC;
+	while(fanout.roundSize() == N_PEERS)
+	{
+		due.clear();
+		fanout.duePeers(due, later);
+		later += SEC;
+	}
+	CHECK(fanout.size() == 2);
+	CHECK(fanout.roundSize() == 2);
+
+	REPORT("Expiry");
+
+	/* bounded: the least recently seen goes */
+	fanout.clear();
+	nowTS = later / SEC;
+	for(int i = 0; i < N_PEERS; i++)
+	{
+		fanout.addPeer(&(ids[i]), nowTS + i);
+	}
+	bdStdRandomId(&(ids[N_PEERS]));
+	fanout.addPeer(&(ids[N_PEERS]), nowTS + N_PEERS);
+	CHECK(fanout.size() == N_PEERS);
+
+	due.clear();
+	fanout.duePeers(due, later + 100 * SEC);
+	fanout.duePeers(due, later + 200 * SEC);
+	CHECK(due.size() == N_PEERS);
+	std::list<bdId>::iterator it;
+	for(it = due.begin(); it != due.end(); it++)
+	{
+		CHECK(!(*it == ids[0]));
+	}
+
+	REPORT("Size Limit");
+
+	FINALREPORT("bdFanoutSchedule Tests");
+	return TESTRESULT();
+}
+
@@ -0,0 +1,75 @@
+/*
+ * bitdht/bdhistogram_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "util/bdhistogram.h"
+#include "utest.h"
+
+/*******************************************************************
+ * Test of the latency histogram in util/bdhistogram.cc
+ */
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdHistogram hist;
+
+	CHECK(hist.count() == 0);
+	CHECK(hist.percentile(0.5) == 0);
+
+	/* 90 fast samples (~100us), 9 medium (~10ms), 1 slow (~1s) */
+	for(int i = 0; i < 90; i++)
+	{
+		hist.add(100);
+	}
+	for(int i = 0; i < 9; i++)
+	{
+		hist.add(10000);
+	}
+	hist.add(1000000);
+
+	CHECK(hist.count() == 100);
+
+	/* percentiles are bucket upper bounds: within a factor of two */
+	CHECK(hist.percentile(0.50) > 100);
+	CHECK(hist.percentile(0.50) <= 200);
+	CHECK(hist.percentile(0.95) > 10000);
+	CHECK(hist.percentile(0.95) <= 20000);
+	CHECK(hist.percentile(1.0) > 1000000);
+	CHECK(hist.percentile(1.0) <= 2000000);
+
+	REPORT("Percentiles");
+
+	/* huge values land in the last bucket */
+	hist.add(~0ULL);
+	CHECK(hist.count() == 101);
+
+	hist.reset();
+	CHECK(hist.count() == 0);
+
+	REPORT("Overflow / Reset");
+
+	FINALREPORT("bdHistogram Tests");
+	return TESTRESULT();
+}
+
@@ -0,0 +1,123 @@
+/*
+ * bitdht/bdmsgpool_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdmsgpool.h"
+#include "utest.h"
+
+#include <string.h>
+
+/*******************************************************************
+ * Test of the message buffer pool in bdmsgpool.cc
+ *
+ * Checks queue ordering, exhaustion / drop accounting and that
+ * released slots are reused.
+ */
+
+#define TEST_SLOTS	8
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdMsgPool pool(TEST_SLOTS);
+	bdMsgQueue queue;
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+
+	CHECK(pool.capacity() == TEST_SLOTS);
+	CHECK(pool.inUse() == 0);
+	CHECK(queue.empty());
+	CHECK(queue.pop() == NULL);
+
+	/* fill the pool, each message tagged by its port */
+	char data[BITDHT_MSGPOOL_SLOT_SIZE + 1];
+	for(int i = 0; i < TEST_SLOTS; i++)
+	{
+		addr.sin_port = htons(1000 + i);
+		snprintf(data, sizeof(data), "msg %d", i);
+		bdMsgSlot *slot = pool.alloc(data, strlen(data) + 1, &addr);
+		CHECK(slot != NULL);
+		queue.push(slot);
+	}
+	CHECK(queue.size() == TEST_SLOTS);
+	CHECK(pool.inUse() == TEST_SLOTS);
+	CHECK(pool.highWater() == TEST_SLOTS);
+	CHECK(pool.drops() == 0);
+
+	REPORT("Fill Pool");
+
+	/* full: further messages are dropped and counted */
+	CHECK(pool.alloc(data, 10, &addr) == NULL);
+	CHECK(pool.alloc() == NULL);
+	CHECK(pool.drops() == 2);
+
+	REPORT("Exhaustion");
+
+	/* FIFO order, contents intact */
+	for(int i = 0; i < TEST_SLOTS / 2; i++)
+	{
+		bdMsgSlot *slot = queue.pop();
+		CHECK(slot != NULL);
+		CHECK(ntohs(slot->addr.sin_port) == 1000 + i);
+		snprintf(data, sizeof(data), "msg %d", i);
+		CHECK(0 == strcmp(slot->data, data));
+		CHECK(slot->mSize == (int) strlen(data) + 1);
+		pool.release(slot);
+	}
+	CHECK(queue.size() == TEST_SLOTS / 2);
+	CHECK(pool.inUse() == TEST_SLOTS / 2);
+
+	REPORT("Queue Order");
+
+	/* released slots are handed out again */
+	bdMsgSlot *slot = pool.alloc();
+	CHECK(slot != NULL);
+	CHECK(pool.inUse() == TEST_SLOTS / 2 + 1);
+	pool.release(slot);
+
+	/* releasing the queue returns everything */
+	pool.release(queue);
+	CHECK(queue.empty());
+	CHECK(queue.size() == 0);
+	CHECK(pool.inUse() == 0);
+	CHECK(pool.highWater() == TEST_SLOTS);
+
+	/* oversize messages never take a slot */
+	memset(data, 'x', sizeof(data));
+	CHECK(pool.alloc(data, BITDHT_MSGPOOL_SLOT_SIZE + 1, &addr) == NULL);
+	CHECK(pool.drops() == 3);
+	CHECK(pool.inUse() == 0);
+
+	slot = pool.alloc(data, BITDHT_MSGPOOL_SLOT_SIZE, &addr);
+	CHECK(slot != NULL);
+	CHECK(slot->mSize == BITDHT_MSGPOOL_SLOT_SIZE);
+	pool.release(slot);
+
+	REPORT("Recycling");
+
+	FINALREPORT("bdMsgPool Tests");
+	return TESTRESULT();
+}
+
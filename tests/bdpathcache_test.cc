@@ -0,0 +1,99 @@
+/*
+ * bitdht/bdpathcache_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdpathcache.h"
+#include "bitdht/bdstddht.h"
+#include "utest.h"
+
+/*******************************************************************
+ * Test of the lookup path cache in bdpathcache.cc
+ *
+ * Paths are shared between targets with the same prefix,
+ * expire, and are bounded.
+ */
+
+#define N_PATH_ENTRIES	4
+#define PATH_TTL	100
+#define N_PATH_PEERS	8
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdPathCache cache(N_PATH_ENTRIES, PATH_TTL);
+	time_t now = 1000;
+
+	std::list<bdId> peers;
+	for(int i = 0; i < N_PATH_PEERS; i++)
+	{
+		bdId id;
+		bdStdRandomId(&id);
+		peers.push_back(id);
+	}
+
+	bdNodeId target;
+	bdStdRandomNodeId(&target);
+
+	/* same prefix, different tail */
+	bdNodeId nearby = target;
+	nearby.data[BITDHT_KEY_LEN - 1] ^= 0xff;
+
+	/* different prefix */
+	bdNodeId faraway = target;
+	faraway.data[0] ^= 0x80;
+
+	std::list<bdId> found;
+	CHECK(!cache.getPath(&target, found, now));
+
+	cache.addPath(&target, peers, now);
+	CHECK(cache.getPath(&nearby, found, now));
+	CHECK(found.size() == N_PATH_PEERS);
+	CHECK(found == peers);
+
+	found.clear();
+	CHECK(!cache.getPath(&faraway, found, now));
+	CHECK(found.empty());
+
+	REPORT("Prefix Lookup");
+
+	CHECK(!cache.getPath(&target, found, now + PATH_TTL + 1));
+
+	REPORT("Expiry");
+
+	for(int i = 0; i < N_PATH_ENTRIES; i++)
+	{
+		bdNodeId other;
+		bdStdRandomNodeId(&other);
+		other.data[0] = target.data[0] ^ 0x40;
+		other.data[1] = i;
+		cache.addPath(&other, peers, now + i + 1);
+	}
+	CHECK(cache.size() == N_PATH_ENTRIES);
+	CHECK(!cache.getPath(&target, found, now + N_PATH_ENTRIES));
+
+	REPORT("Bounded");
+
+	FINALREPORT("bdPathCache Tests");
+	return TESTRESULT();
+}
+
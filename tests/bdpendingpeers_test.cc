@@ -0,0 +1,130 @@
+/*
+ * bitdht/bdpendingpeers_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdpendingpeers.h"
+#include "bitdht/bdstddht.h"
+#include "utest.h"
+
+/*******************************************************************
+ * Test of the potential peer queue in bdpendingpeers.cc
+ *
+ * Checks de-duplication, score order, expiry, overflow and the
+ * verified / pinged suppression.
+ */
+
+#define N_PEERS		10
+#define PENDING_TTL	60
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdPendingPeers pending(N_PEERS, PENDING_TTL);
+	time_t now = 1000;
+
+	bdId ids[2 * N_PEERS];
+	for(int i = 0; i < 2 * N_PEERS; i++)
+	{
+		bdStdRandomId(&(ids[i]));
+	}
+
+	/* each peer is queued once, however often it is mentioned */
+	CHECK(pending.add(&(ids[0]), 50, now));
+	CHECK(!pending.add(&(ids[0]), 50, now));
+	CHECK(!pending.add(&(ids[0]), 60, now));
+	CHECK(pending.size() == 1);
+	CHECK(pending.added() == 1);
+	CHECK(pending.duplicates() == 2);
+
+	REPORT("De-duplication");
+
+	/* popped in score order, FIFO for equal scores */
+	CHECK(pending.add(&(ids[1]), 10, now));
+	CHECK(pending.add(&(ids[2]), 30, now));
+	CHECK(pending.add(&(ids[3]), 30, now));
+	/* a better score moves it up */
+	CHECK(!pending.add(&(ids[0]), 20, now));
+
+	bdId id;
+	CHECK(pending.pop(id, now) && (id == ids[1]));
+	CHECK(pending.pop(id, now) && (id == ids[0]));
+	CHECK(pending.pop(id, now) && (id == ids[2]));
+	CHECK(pending.pop(id, now) && (id == ids[3]));
+	CHECK(!pending.pop(id, now));
+	CHECK(pending.empty());
+
+	REPORT("Score Order");
+
+	/* just pinged: not queued again until the period is over */
+	CHECK(!pending.add(&(ids[1]), 10, now + 1));
+	CHECK(pending.skipped() == 1);
+	CHECK(pending.add(&(ids[1]), 10, now + BITDHT_PENDING_PINGED_PERIOD + 1));
+
+	/* heard from: dequeued, and not queued again for a while */
+	pending.verified(&(ids[1]), now);
+	CHECK(pending.empty());
+	CHECK(!pending.add(&(ids[1]), 10, now + BITDHT_PENDING_VERIFIED_PERIOD));
+	CHECK(pending.add(&(ids[1]), 10, now + BITDHT_PENDING_VERIFIED_PERIOD + 1));
+	CHECK(pending.pop(id, now + BITDHT_PENDING_VERIFIED_PERIOD + 1));
+
+	REPORT("Suppression");
+
+	/* stale entries are skipped by pop, and swept by cleanup */
+	pending.resetCounters();
+	CHECK(pending.add(&(ids[4]), 10, now));
+	CHECK(pending.add(&(ids[5]), 20, now + 10));
+	CHECK(pending.pop(id, now + PENDING_TTL + 5) && (id == ids[5]));
+	CHECK(pending.expired() == 1);
+
+	CHECK(pending.add(&(ids[6]), 10, now));
+	pending.cleanup(now + PENDING_TTL + 1);
+	CHECK(pending.empty());
+	CHECK(pending.expired() == 2);
+
+	REPORT("Expiry");
+
+	/* full: better peers displace the worst, worse ones are refused */
+	now += 10000;
+	for(int i = 0; i < N_PEERS; i++)
+	{
+		CHECK(pending.add(&(ids[N_PEERS + i]), 100 + i, now));
+	}
+	CHECK(!pending.add(&(ids[7]), 200, now));
+	CHECK(pending.add(&(ids[7]), 5, now));
+	CHECK(pending.size() == N_PEERS);
+	CHECK(pending.pop(id, now) && (id == ids[7]));
+
+	uint32_t count = 0;
+	while(pending.pop(id, now))
+	{
+		CHECK(!(id == ids[2 * N_PEERS - 1]));
+		count++;
+	}
+	CHECK(count == N_PEERS - 1);
+
+	REPORT("Overflow");
+
+	FINALREPORT("bdPendingPeers Tests");
+	return TESTRESULT();
+}
+
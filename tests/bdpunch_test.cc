@@ -0,0 +1,212 @@
+/*
+ * bitdht/bdpunch_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdpunch.h"
+#include "bitdht/bdnode.h"
+#include "bitdht/bdmsgs.h"
+#include "bitdht/bdstddht.h"
+#include "utest.h"
+
+#include <string.h>
+
+/*******************************************************************
+ * Test of the hole punching schedule in bdpunch.cc
+ *
+ * Checks the burst schedule and backoff, termination on a pong,
+ * giving up, and the success stats. Then, through a pair of bdNodes,
+ * that the pong to a punch is taken when the peer's NAT maps it to
+ * another port.
+ */
+
+INITTEST();
+
+/* notes the pongs that get through to the routing table */
+class PongNode: public bdNode
+{
+public:
+	PongNode(bdNodeId *id, bdDhtFunctions *fns)
+	:bdNode(id, "bdTEST", "", "", fns, &mCallback), mPongs(0) { return; }
+
+	virtual void addPeer(const bdId *id, uint32_t peerflags)
+	{
+		if (peerflags & BITDHT_PEER_STATUS_RECV_PONG)
+		{
+			mPongs++;
+			mLastPong = *id;
+		}
+		bdNode::addPeer(id, peerflags);
+	}
+
+	PacketCallback mCallback;
+	int mPongs;
+	bdId mLastPong;
+};
+
+/* everything 'from' has queued for 'to', as if sent from 'addr' */
+static int deliver(bdNode *from, bdNode *to, const bdId *dest, struct sockaddr_in addr)
+{
+	int n = 0;
+	bdMsgSlot *slot;
+	while(NULL != (slot = from->popOutgoingMsg()))
+	{
+		if (slot->addr.sin_port == dest->addr.sin_port)
+		{
+			to->incomingMsg(&addr, slot->data, slot->mSize);
+			n++;
+		}
+		from->releaseOutgoingMsg(slot);
+	}
+	to->processIncomingMsgs();
+	return n;
+}
+
+static void setAddr(bdId &id, uint32_t ip, uint16_t port)
+{
+	id.addr.sin_family = AF_INET;
+	id.addr.sin_addr.s_addr = htonl(ip);
+	id.addr.sin_port = htons(port);
+}
+
+int main(int argc, char **argv)
+{
+	bdPunchEngine punch;
+	uint64_t now = 1000000000;
+
+	bdId a, b;
+	bdStdRandomId(&a);
+	bdStdRandomId(&b);
+
+	uint64_t wait;
+	CHECK(!punch.nextBurstDue(wait, now));
+
+	/* one punch per peer */
+	CHECK(punch.add(&a, now));
+	CHECK(!punch.add(&a, now));
+	CHECK(punch.active() == 1);
+
+	/* first burst straight away, then backing off */
+	CHECK(punch.nextBurstDue(wait, now) && (wait == 0));
+
+	bdId id;
+	uint32_t count;
+	CHECK(punch.nextBurst(id, count, now));
+	CHECK(id == a);
+	CHECK(count == BITDHT_PUNCH_BURST_SIZE);
+	CHECK(!punch.nextBurst(id, count, now));
+	CHECK(punch.nextBurstDue(wait, now) && (wait == BITDHT_PUNCH_FIRST_INTERVAL));
+
+	uint64_t interval = BITDHT_PUNCH_FIRST_INTERVAL;
+	uint64_t t = now;
+	for(int i = 1; i < 5; i++)
+	{
+		t += interval;
+		CHECK(!punch.nextBurst(id, count, t - 1));
+		CHECK(punch.nextBurst(id, count, t));
+		interval *= 2;
+	}
+	CHECK(punch.nextBurstDue(wait, t) && (wait == interval));
+
+	REPORT("Burst Schedule");
+
+	/* a pong ends it */
+	CHECK(!punch.gotPong(&b, t));
+	CHECK(punch.gotPong(&a, t + 1000));
+	CHECK(punch.active() == 0);
+	CHECK(!punch.nextBurstDue(wait, t));
+	CHECK(punch.succeeded() == 1);
+	CHECK(punch.packetsPerSuccess() == 5 * BITDHT_PUNCH_BURST_SIZE);
+	CHECK(punch.firstPacketUsecs().count() == 1);
+	CHECK(punch.firstPacketUsecs().percentile(0.5) >= t + 1000 - now);
+
+	REPORT("Success");
+
+	/* unanswered: given up after the last burst has had its time */
+	CHECK(punch.add(&b, t));
+	int bursts = 0;
+	for(int i = 0; i < 1000; i++)
+	{
+		t += 100000;
+		while(punch.nextBurst(id, count, t))
+		{
+			bursts++;
+		}
+	}
+	CHECK(bursts == BITDHT_PUNCH_MAX_BURSTS);
+	CHECK(punch.active() == 0);
+	CHECK(punch.failed() == 1);
+
+	/* bounded */
+	punch.resetCounters();
+	CHECK(punch.succeeded() == 0);
+	for(int i = 0; i < BITDHT_PUNCH_MAX_TARGETS; i++)
+	{
+		bdStdRandomId(&id);
+		CHECK(punch.add(&id, t));
+	}
+	CHECK(!punch.add(&a, t));
+	punch.clear();
+	CHECK(punch.active() == 0);
+
+	REPORT("Give Up");
+
+	/* a rendezvous tells A about B: A punches B's known port */
+	bdDhtFunctions *fns = new bdStdDht();
+	bdId r;
+	bdStdRandomId(&r);
+	setAddr(a, 0x7f000001, 17901);
+	setAddr(b, 0x7f000002, 17902);
+	setAddr(r, 0x7f000003, 17903);
+	PongNode nodeA(&(a.id), fns);
+	PongNode nodeB(&(b.id), fns);
+
+	bdToken tid;
+	tid.len = 2;
+	memcpy(tid.data, "ac", 2);
+	char msg[BITDHT_MAX_PKTSIZE];
+	int len = bitdht_ask_conn_msg(&tid, &(r.id), &(a.id), &b, 0, msg, sizeof(msg));
+	nodeA.incomingMsg(&(r.addr), msg, len);
+	nodeA.processIncomingMsgs();
+	nodeA.iteration();
+
+	/* B answers from a port of its NAT's choosing */
+	CHECK(1 == deliver(&nodeA, &nodeB, &b, a.addr));
+	bdId mapped = b;
+	setAddr(mapped, 0x7f000002, 17912);
+	CHECK(1 == deliver(&nodeB, &nodeA, &a, mapped.addr));
+	CHECK(nodeA.mPongs == 1);
+	CHECK(nodeA.mLastPong == mapped);
+
+	/* and another port only works for a punch ping */
+	bdToken vid;
+	vid.len = 0;
+	len = bitdht_response_ping_msg(&tid, &(b.id), &vid, msg, sizeof(msg));
+	nodeA.incomingMsg(&(mapped.addr), msg, len);
+	nodeA.processIncomingMsgs();
+	CHECK(nodeA.mPongs == 1);
+
+	REPORT("Pong From Another Port");
+
+	FINALREPORT("bdPunchEngine Tests");
+	return TESTRESULT();
+}
+
@@ -0,0 +1,201 @@
+/*
+ * bitdht/bdratectrl_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdratectrl.h"
+#include "utest.h"
+
+/*******************************************************************
+ * Test of the outbound rate controller in bdratectrl.cc
+ *
+ * Checks bucket depth, refill pacing, debt from charge() and the
+ * adaptive back off / recovery.
+ */
+
+#define SEC	1000000
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdRateController ctrl;
+	uint64_t now = 1000 * (uint64_t) SEC;
+
+	/* 100/sec: bucket holds 0.1 sec = 10 tokens */
+	ctrl.setRate(BITDHT_RATE_PING, 100, now);
+	CHECK(ctrl.getRate(BITDHT_RATE_PING) == 100);
+	ctrl.take(BITDHT_RATE_PING, now); /* starts the clock */
+	now += SEC;
+
+	int sent = 0;
+	while(ctrl.take(BITDHT_RATE_PING, now))
+	{
+		sent++;
+	}
+	CHECK(sent == 10);
+
+	/* next token in 10ms */
+	uint64_t wait = ctrl.waitUsecs(BITDHT_RATE_PING, now);
+	CHECK((wait > 9000) && (wait <= 10001));
+	CHECK(!ctrl.take(BITDHT_RATE_PING, now + 5000));
+	CHECK(ctrl.take(BITDHT_RATE_PING, now + wait));
+
+	REPORT("Bucket Depth and Refill");
+
+	/* a second of steady sending gets the full rate, no more */
+	now += wait;
+	sent = 0;
+	for(int i = 1; i <= 1000; i++)
+	{
+		while(ctrl.take(BITDHT_RATE_PING, now + i * 1000))
+		{
+			sent++;
+		}
+	}
+	CHECK((sent >= 99) && (sent <= 101));
+
+	REPORT("Steady Rate");
+
+	/* charge() always succeeds, but the debt delays take() */
+	now += 10 * SEC;
+	for(int i = 0; i < 20; i++)
+	{
+		ctrl.charge(BITDHT_RATE_PING, now);
+	}
+	CHECK(!ctrl.take(BITDHT_RATE_PING, now));
+	wait = ctrl.waitUsecs(BITDHT_RATE_PING, now);
+	CHECK((wait > 100000) && (wait <= 110001));
+
+	/* but is limited to a second's worth */
+	for(int i = 0; i < 1000; i++)
+	{
+		ctrl.charge(BITDHT_RATE_PING, now);
+	}
+	wait = ctrl.waitUsecs(BITDHT_RATE_PING, now);
+	CHECK(wait <= SEC + 10001);
+
+	REPORT("Charge Debt");
+
+	/* changing a rate keeps the time the bucket has earned */
+	ctrl.setRate(BITDHT_RATE_QUERY, 100, now);
+	while(ctrl.take(BITDHT_RATE_QUERY, now));
+	now += SEC;
+	ctrl.setRate(BITDHT_RATE_QUERY, 50, now);
+	CHECK(ctrl.take(BITDHT_RATE_QUERY, now));
+	ctrl.setRate(BITDHT_RATE_QUERY, BITDHT_RATE_DEF_QUERY, now);
+
+	/* an unknown type is never allowed, and changes nothing */
+	CHECK(!ctrl.take(-1, now));
+	CHECK(!ctrl.take(BITDHT_RATE_TYPES, now));
+	CHECK(ctrl.waitUsecs(BITDHT_RATE_TYPES, now) == UINT64_MAX);
+	ctrl.charge(BITDHT_RATE_TYPES, now);
+	ctrl.setRate(BITDHT_RATE_TYPES, 1, now);
+	CHECK(ctrl.getRate(BITDHT_RATE_TYPES) == 0);
+
+	REPORT("Set Rate");
+
+	/* adaptive: unanswered requests back off ping and query, not replies */
+	ctrl.setAdaptive(true, now);
+	for(int i = 0; i < BITDHT_RATE_ADAPT_MIN_SAMPLES; i++)
+	{
+		ctrl.sentRequest();
+	}
+	ctrl.adjust(now);
+	CHECK(ctrl.currentRate(BITDHT_RATE_PING) < 100);
+	CHECK(ctrl.currentRate(BITDHT_RATE_QUERY) < BITDHT_RATE_DEF_QUERY);
+	CHECK(ctrl.currentRate(BITDHT_RATE_REPLY) == BITDHT_RATE_DEF_REPLY);
+	CHECK(ctrl.currentRate(BITDHT_RATE_BROADCAST) == BITDHT_RATE_DEF_BROADCAST);
+
+	/* never below the floor */
+	for(int j = 0; j < 100; j++)
+	{
+		for(int i = 0; i < BITDHT_RATE_ADAPT_MIN_SAMPLES; i++)
+		{
+			ctrl.sentRequest();
+		}
+		ctrl.adjust(now);
+	}
+	CHECK(ctrl.currentRate(BITDHT_RATE_PING) >= 100 * BITDHT_RATE_ADAPT_MIN - 0.001);
+
+	/* recovers to the configured rate, and no further */
+	for(int j = 0; j < 100; j++)
+	{
+		for(int i = 0; i < BITDHT_RATE_ADAPT_MIN_SAMPLES; i++)
+		{
+			ctrl.sentRequest();
+			ctrl.gotResponse();
+		}
+		ctrl.adjust(now);
+	}
+	CHECK(ctrl.currentRate(BITDHT_RATE_PING) == 100);
+
+	/* rising round trip times also back off */
+	for(int i = 0; i < 10; i++)
+	{
+		ctrl.addRttSample(50000);
+	}
+	for(int i = 0; i < 50; i++)
+	{
+		ctrl.addRttSample(1000000);
+	}
+	for(int i = 0; i < BITDHT_RATE_ADAPT_MIN_SAMPLES; i++)
+	{
+		ctrl.sentRequest();
+		ctrl.gotResponse();
+	}
+	ctrl.adjust(now);
+	CHECK(ctrl.currentRate(BITDHT_RATE_PING) < 100);
+
+	/* a lasting rise becomes the new baseline within two windows */
+	for(int w = 0; w < 2; w++)
+	{
+		now += BITDHT_RATE_ADAPT_RTT_WINDOW * SEC;
+		ctrl.addRttSample(1000000);
+		for(int i = 0; i < BITDHT_RATE_ADAPT_MIN_SAMPLES; i++)
+		{
+			ctrl.sentRequest();
+			ctrl.gotResponse();
+		}
+		ctrl.adjust(now);
+	}
+	double backedOff = ctrl.currentRate(BITDHT_RATE_PING);
+	ctrl.addRttSample(1000000);
+	for(int i = 0; i < BITDHT_RATE_ADAPT_MIN_SAMPLES; i++)
+	{
+		ctrl.sentRequest();
+		ctrl.gotResponse();
+	}
+	ctrl.adjust(now);
+	CHECK(ctrl.currentRate(BITDHT_RATE_PING) > backedOff);
+
+	/* too few samples: no change */
+	double rate = ctrl.currentRate(BITDHT_RATE_PING);
+	ctrl.sentRequest();
+	ctrl.adjust(now);
+	CHECK(ctrl.currentRate(BITDHT_RATE_PING) == rate);
+
+	REPORT("Adaptive");
+
+	FINALREPORT("bdRateController Tests");
+	return TESTRESULT();
+}
+
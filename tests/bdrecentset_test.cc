@@ -0,0 +1,126 @@
+/*
+ * bitdht/bdrecentset_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "util/bdrecentset.h"
+#include "utest.h"
+
+/*******************************************************************
+ * Test of the recent value set in util/bdrecentset.cc
+ *
+ * Checks values are found while inside the window and forgotten once
+ * they fall out of it, including duplicates and colliding values.
+ */
+
+#define WINDOW		100
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdRecentSet set(WINDOW);
+
+	CHECK(set.window() == WINDOW);
+	CHECK(set.size() == 0);
+	CHECK(!set.contains(0));
+
+	for(uint32_t i = 0; i < WINDOW; i++)
+	{
+		set.add(i * 7919);
+	}
+	CHECK(set.size() == WINDOW);
+
+	bool allFound = true;
+	for(uint32_t i = 0; i < WINDOW; i++)
+	{
+		allFound &= set.contains(i * 7919);
+	}
+	CHECK(allFound);
+	CHECK(!set.contains(7));
+
+	REPORT("Within Window");
+
+	/* each new value pushes out the oldest */
+	set.add(123456789);
+	CHECK(set.size() == WINDOW);
+	CHECK(!set.contains(0));
+	CHECK(set.contains(7919));
+	CHECK(set.contains(123456789));
+
+	/* a full turn forgets everything else */
+	for(uint32_t i = 0; i < WINDOW; i++)
+	{
+		set.add(1000000 + i);
+	}
+	bool noneFound = true;
+	for(uint32_t i = 0; i < WINDOW; i++)
+	{
+		noneFound &= !set.contains(i * 7919);
+	}
+	CHECK(noneFound);
+	CHECK(!set.contains(123456789));
+
+	REPORT("Eviction");
+
+	/* a duplicate stays until its last copy leaves the window */
+	set.clear();
+	CHECK(set.size() == 0);
+	CHECK(!set.contains(1000000));
+	set.add(42);
+	for(uint32_t i = 0; i < WINDOW / 2; i++)
+	{
+		set.add(i + 1000);
+	}
+	set.add(42);
+	for(uint32_t i = 0; i < WINDOW / 2; i++)
+	{
+		set.add(i + 2000);
+	}
+	CHECK(set.contains(42));	/* first copy evicted */
+	for(uint32_t i = 0; i < WINDOW / 2; i++)
+	{
+		set.add(i + 3000);
+	}
+	CHECK(!set.contains(42));
+
+	/* values sharing a bucket (differ only in the low bits the
+	 * hash throws away) survive each other's removal
+	 */
+	set.clear();
+	for(uint32_t i = 0; i < 3 * WINDOW; i++)
+	{
+		set.add(i << 20);
+	}
+	allFound = true;
+	for(uint32_t i = 2 * WINDOW; i < 3 * WINDOW; i++)
+	{
+		allFound &= set.contains(i << 20);
+	}
+	CHECK(allFound);
+	CHECK(!set.contains((2 * WINDOW - 1) << 20));
+
+	REPORT("Duplicates and Collisions");
+
+	FINALREPORT("bdRecentSet Tests");
+	return TESTRESULT();
+}
+
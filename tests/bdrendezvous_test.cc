@@ -0,0 +1,153 @@
+/*
+ * bitdht/bdrendezvous_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdrendezvous.h"
+#include "bitdht/bdstddht.h"
+#include "utest.h"
+
+/*******************************************************************
+ * Test of the rendezvous table in bdrendezvous.cc
+ *
+ * Checks pairing, de-duplication, re-announcing, expiry, the size
+ * bound, the per address bound and the keyed hash.
+ */
+
+#define SEC	1000000ULL
+#define N_ENTRIES	16
+#define N_PER_SOURCE	4
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdRendezvousTable table(N_ENTRIES);
+	uint64_t now = 1000 * SEC;
+
+	bdId a, b, c;
+	bdStdRandomId(&a);
+	bdStdRandomId(&b);
+	bdStdRandomId(&c);
+
+	/* one end alone doesn't pair */
+	bdId match;
+	CHECK(table.add(&a, &(b.id), now, match) == BITDHT_RDV_NEW);
+	CHECK(table.add(&a, &(b.id), now + SEC, match) == BITDHT_RDV_DUPLICATE);
+	CHECK(table.add(&c, &(b.id), now + SEC, match) == BITDHT_RDV_NEW);
+	CHECK(table.size() == 2);
+	CHECK(table.duplicates() == 1);
+
+	std::list<bdRendezvousEntry> unpaired;
+	table.getUnpaired(unpaired);
+	CHECK(unpaired.size() == 2);
+
+	/* the other end pairs them, with the address it was last heard from */
+	a.addr.sin_port = htons(ntohs(a.addr.sin_port) + 1);
+	CHECK(table.add(&a, &(b.id), now + 2 * SEC, match) == BITDHT_RDV_DUPLICATE);
+	CHECK(table.add(&b, &(a.id), now + 3 * SEC, match) == BITDHT_RDV_PAIRED);
+	CHECK(match == a);
+	CHECK(table.pairings() == 1);
+	CHECK(table.matchUsecs().count() == 1);
+	CHECK(table.matchUsecs().percentile(0.5) >= 3 * SEC);
+
+	unpaired.clear();
+	table.getUnpaired(unpaired);
+	CHECK(unpaired.size() == 1);
+	CHECK(unpaired.front().mFrom == c);
+
+	REPORT("Pairing");
+
+	/* repeats aren't announced again, until the repair period is up */
+	CHECK(table.add(&a, &(b.id), now + 4 * SEC, match) == BITDHT_RDV_DUPLICATE);
+	CHECK(table.add(&b, &(a.id), now + 5 * SEC, match) == BITDHT_RDV_DUPLICATE);
+	CHECK(table.add(&a, &(b.id), now + (BITDHT_RDV_REPAIR_PERIOD + 4) * SEC, match) == BITDHT_RDV_PAIRED);
+	CHECK(match == b);
+	CHECK(table.pairings() == 1);
+
+	REPORT("Repeats");
+
+	/* expiry: from when the request was last heard */
+	table.expire(now + (BITDHT_RDV_TTL) * SEC);
+	CHECK(table.size() == 3);
+	now += (BITDHT_RDV_REPAIR_PERIOD + 4) * SEC;
+	table.expire(now + (BITDHT_RDV_TTL + BITDHT_RDV_SWEEP_PERIOD) * SEC);
+	CHECK(table.size() == 0);
+	CHECK(table.expired() == 3);
+
+	REPORT("Expiry");
+
+	/* bounded */
+	table.resetCounters();
+	bdId id;
+	for(int i = 0; i < N_ENTRIES; i++)
+	{
+		bdStdRandomId(&id);
+		CHECK(table.add(&id, &(a.id), now, match) == BITDHT_RDV_NEW);
+	}
+	CHECK(table.add(&b, &(a.id), now, match) == BITDHT_RDV_FULL);
+	CHECK(table.refused() == 1);
+	table.clear();
+	CHECK(table.size() == 0);
+
+	REPORT("Size Limit");
+
+	/* one address gets its share, and no more, until some expire */
+	bdRendezvousTable shared(N_ENTRIES, N_PER_SOURCE);
+	bdId crowd[N_PER_SOURCE + 1];
+	for(int i = 0; i < N_PER_SOURCE + 1; i++)
+	{
+		bdStdRandomId(&(crowd[i]));
+		crowd[i].addr = a.addr;
+		crowd[i].addr.sin_port = htons(1000 + i);
+	}
+	for(int i = 0; i < N_PER_SOURCE; i++)
+	{
+		CHECK(shared.add(&(crowd[i]), &(b.id), now, match) == BITDHT_RDV_NEW);
+	}
+	CHECK(shared.add(&(crowd[N_PER_SOURCE]), &(b.id), now, match) == BITDHT_RDV_FULL);
+	CHECK(shared.add(&(crowd[0]), &(b.id), now + SEC, match) == BITDHT_RDV_DUPLICATE);
+	CHECK(shared.add(&c, &(b.id), now, match) == BITDHT_RDV_NEW);
+	CHECK(shared.refused() == 1);
+
+	shared.expire(now + (BITDHT_RDV_TTL + BITDHT_RDV_SWEEP_PERIOD) * SEC);
+	CHECK(shared.size() == 0);
+	CHECK(shared.add(&(crowd[N_PER_SOURCE]), &(b.id), now, match) == BITDHT_RDV_NEW);
+
+	REPORT("Per Source Limit");
+
+	/* the hash is keyed, and every byte of the ids counts */
+	bdRendezvousKey key;
+	key.mFrom = a.id;
+	key.mTo = b.id;
+	bdRendezvousKey tail = key;
+	tail.mFrom.data[BITDHT_KEY_LEN - 1] ^= 1;
+	bdRendezvousKeyHash hash1(1), hash2(2);
+	CHECK(hash1(key) != hash2(key));
+	CHECK(hash1(key) != hash1(tail));
+	CHECK(hash1(key) == hash1(key));
+
+	REPORT("Keyed Hash");
+
+	FINALREPORT("bdRendezvousTable Tests");
+	return TESTRESULT();
+}
+
@@ -0,0 +1,188 @@
+/*
+ * bitdht/bdring_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "util/bdring.h"
+#include "util/bdthreads.h"
+#include "utest.h"
+
+#include <unistd.h>
+#include <sched.h>
+
+/*******************************************************************
+ * Test of the lock-free ring in bdring.h
+ *
+ * Checks order, overflow and wrap around from one thread, then has
+ * several producer threads race one consumer.
+ */
+
+#define PRODUCERS	4
+#define PER_PRODUCER	200000
+
+class bdRingItem
+{
+public:
+	uint32_t mProducer;
+	uint32_t mSeq;
+};
+
+class bdRingProducer: public bdThread
+{
+public:
+	bdRingProducer(bdRing<bdRingItem> *ring, uint32_t id)
+		:mRing(ring), mId(id), mDone(false) { return; }
+
+	virtual void run()
+	{
+		for(uint32_t i = 0; i < PER_PRODUCER; i++)
+		{
+			uint32_t pos;
+			bdRingItem *item;
+			while(NULL == (item = mRing->claim(pos)))
+			{
+				sched_yield();	/* full: let the consumer catch up */
+			}
+			item->mProducer = mId;
+			item->mSeq = i;
+			mRing->publish(pos);
+		}
+		mDone = true;
+	}
+
+	bdRing<bdRingItem> *mRing;
+	uint32_t mId;
+	volatile bool mDone;
+};
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdRing<bdRingItem> ring(5);
+	CHECK(ring.capacity() == 8);
+	CHECK(ring.front() == NULL);
+	CHECK(ring.size() == 0);
+
+	/* fill, overflow */
+	uint32_t pos;
+	for(uint32_t i = 0; i < 8; i++)
+	{
+		bdRingItem *item = ring.claim(pos);
+		CHECK(item != NULL);
+		item->mSeq = i;
+		ring.publish(pos);
+	}
+	CHECK(ring.size() == 8);
+	CHECK(ring.claim(pos) == NULL);
+	CHECK(ring.claim(pos) == NULL);
+	CHECK(ring.overflows() == 2);
+
+	/* drain in order */
+	for(uint32_t i = 0; i < 8; i++)
+	{
+		bdRingItem *item = ring.front();
+		CHECK((item != NULL) && (item->mSeq == i));
+		ring.pop();
+	}
+	CHECK(ring.front() == NULL);
+	CHECK(ring.highWater() == 8);
+
+	/* a claimed but unpublished cell holds up the consumer */
+	bdRingItem *first = ring.claim(pos);
+	uint32_t firstPos = pos;
+	bdRingItem *second = ring.claim(pos);
+	second->mSeq = 2;
+	ring.publish(pos);
+	CHECK(ring.front() == NULL);
+	first->mSeq = 1;
+	ring.publish(firstPos);
+	CHECK(ring.front()->mSeq == 1);
+	ring.pop();
+	CHECK(ring.front()->mSeq == 2);
+	ring.pop();
+
+	/* many laps round the ring */
+	bool ordered = true;
+	for(uint32_t i = 0; i < 1000; i++)
+	{
+		bdRingItem *item = ring.claim(pos);
+		item->mSeq = i;
+		ring.publish(pos);
+		if ((i % 3) == 2)
+		{
+			for(uint32_t j = i - 2; j <= i; j++)
+			{
+				ordered &= (ring.front()->mSeq == j);
+				ring.pop();
+			}
+		}
+	}
+	CHECK(ordered);
+
+	REPORT("Single Thread");
+
+	/* producers race, each one's items arrive in its own order */
+	bdRing<bdRingItem> shared(256);
+	bdRingProducer *producers[PRODUCERS];
+	for(uint32_t i = 0; i < PRODUCERS; i++)
+	{
+		producers[i] = new bdRingProducer(&shared, i);
+		producers[i]->start();
+	}
+
+	uint32_t next[PRODUCERS] = { 0 };
+	uint32_t received = 0;
+	ordered = true;
+	while(received < PRODUCERS * PER_PRODUCER)
+	{
+		bdRingItem *item = shared.front();
+		if (!item)
+		{
+			sched_yield();
+			continue;
+		}
+		if ((item->mProducer >= PRODUCERS) || (item->mSeq != next[item->mProducer]))
+		{
+			ordered = false;
+		}
+		else
+		{
+			next[item->mProducer]++;
+		}
+		shared.pop();
+		received++;
+	}
+	CHECK(ordered);
+	CHECK(shared.front() == NULL);
+	for(uint32_t i = 0; i < PRODUCERS; i++)
+	{
+		producers[i]->join();
+		CHECK(producers[i]->mDone);
+		CHECK(next[i] == PER_PRODUCER);
+	}
+
+	REPORT("Multiple Producers");
+
+	FINALREPORT("bdRing Tests");
+	return TESTRESULT();
+}
+
@@ -0,0 +1,146 @@
+/*
+ * bitdht/bdtransid_speed_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdnode.h"
+#include "bitdht/bdstddht.h"
+#include "util/bdtime.h"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sstream>
+#include <iomanip>
+
+/*******************************************************************
+ * Manual microbenchmark of transaction id / token generation.
+ *
+ * Times bdNode::genNewTransId() and genNewToken() against the old
+ * ostringstream + rand() versions, reproduced below. Not part of the
+ * regular test run.
+ */
+
+#define DEF_COUNT	1000000
+
+static unsigned long oldCounter = 0;
+
+static void oldGenNewTransId(bdToken *token)
+{
+	std::ostringstream out;
+	out << std::setw(2) << std::setfill('0') << oldCounter++;
+	std::string num = out.str();
+	int len = num.size();
+	if (len > BITDHT_TOKEN_MAX_LEN)
+		len = BITDHT_TOKEN_MAX_LEN;
+
+	for(int i = 0; i < len; i++)
+	{
+		token->data[i] = num[i];
+	}
+	token->len = len;
+}
+
+static void oldGenNewToken(bdToken *token)
+{
+	std::ostringstream out;
+	out << std::setw(4) << std::setfill('0') << rand() << std::setw(4) << std::setfill('0') << rand();
+	std::string num = out.str();
+	int len = num.size();
+	if (len > BITDHT_TOKEN_MAX_LEN)
+		len = BITDHT_TOKEN_MAX_LEN;
+
+	for(int i = 0; i < len; i++)
+	{
+		token->data[i] = num[i];
+	}
+	token->len = len;
+}
+
+static uint32_t sink = 0;
+
+static void report(const char *name, uint64_t start, int count)
+{
+	uint64_t usecs = bdClockUsecs() - start;
+	printf("%-24s: %8.1lf nsecs per call\n", name, 1000.0 * usecs / count);
+}
+
+int main(int argc, char **argv)
+{
+	int count = DEF_COUNT;
+
+	int c;
+	while((c = getopt(argc, argv, "n:")) != -1)
+	{
+		switch(c)
+		{
+			case 'n':
+				count = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-n count]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	bdDhtFunctions *fns = new bdStdDht();
+	bdNodeId ownId;
+	bdStdRandomNodeId(&ownId);
+	bdNode node(&ownId, "bdTEST", "", "", fns, new PacketCallback());
+
+	bdToken token;
+	uint64_t start;
+
+	start = bdClockUsecs();
+	for(int i = 0; i < count; i++)
+	{
+		oldGenNewTransId(&token);
+		sink += token.data[0];
+	}
+	report("old genNewTransId()", start, count);
+
+	start = bdClockUsecs();
+	for(int i = 0; i < count; i++)
+	{
+		node.genNewTransId(&token);
+		sink += token.data[0];
+	}
+	report("genNewTransId()", start, count);
+
+	start = bdClockUsecs();
+	for(int i = 0; i < count; i++)
+	{
+		oldGenNewToken(&token);
+		sink += token.data[0];
+	}
+	report("old genNewToken()", start, count);
+
+	start = bdClockUsecs();
+	for(int i = 0; i < count; i++)
+	{
+		node.genNewToken(&token);
+		sink += token.data[0];
+	}
+	report("genNewToken()", start, count);
+
+	return (sink == 0x12345678);	/* keep the loops */
+}
+
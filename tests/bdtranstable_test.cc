@@ -0,0 +1,170 @@
+/*
+ * bitdht/bdtranstable_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdtranstable.h"
+#include "bitdht/bdmsgs.h"
+#include "utest.h"
+
+#include <string.h>
+#include <stdio.h>
+
+/*******************************************************************
+ * Test of the transaction table in bdtranstable.cc
+ *
+ * Checks replies only match the (tid, address) they were sent with,
+ * that entries expire on time, and that the table stays consistent
+ * as it grows and entries are removed.
+ */
+
+#define N_TRANS		5000
+
+INITTEST();
+
+static void makeTid(bdToken *tid, int n)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%02d", n);
+	tid->len = strlen(buf);
+	memcpy(tid->data, buf, tid->len);
+}
+
+static void makeAddr(struct sockaddr_in *addr, int n)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(0x0a000000 + n);
+	addr->sin_port = htons(6881);
+}
+
+int main(int argc, char **argv)
+{
+	bdTransTable table;
+	time_t now = 1000000;
+	bdTransEntry entry;
+	bdToken tid;
+	struct sockaddr_in addr;
+
+	bdNodeId target;
+	memset(target.data, 0x42, BITDHT_KEY_LEN);
+
+	makeTid(&tid, 1);
+	makeAddr(&addr, 1);
+	table.expire(now);
+	table.add(&tid, &addr, BITDHT_MSG_TYPE_FIND_NODE, &target, 5000, now);
+	CHECK(table.size() == 1);
+
+	/* wrong port / address / tid don't match */
+	struct sockaddr_in other = addr;
+	other.sin_port = htons(6882);
+	CHECK(!table.match(&tid, &other, entry));
+	makeAddr(&other, 2);
+	CHECK(!table.match(&tid, &other, entry));
+	bdToken otherTid;
+	makeTid(&otherTid, 2);
+	CHECK(!table.match(&otherTid, &addr, entry));
+	CHECK(table.unmatched() == 3);
+
+	/* the real reply matches - once */
+	CHECK(table.match(&tid, &addr, entry));
+	CHECK(entry.mMsgType == BITDHT_MSG_TYPE_FIND_NODE);
+	CHECK(entry.mSendUsecs == 5000);
+	CHECK(0 == memcmp(entry.mTarget.data, target.data, BITDHT_KEY_LEN));
+	CHECK(!table.match(&tid, &addr, entry));
+	CHECK(table.matched() == 1);
+	CHECK(table.size() == 0);
+
+	REPORT("Matching");
+
+	/* expiry */
+	table.resetCounters();
+	table.add(&tid, &addr, BITDHT_MSG_TYPE_PING, NULL, 0, now);
+	table.expire(now + BITDHT_TRANS_TIMEOUT - 1);
+	CHECK(table.size() == 1);
+	table.expire(now + BITDHT_TRANS_TIMEOUT);
+	CHECK(table.size() == 0);
+	CHECK(table.expired() == 1);
+	CHECK(!table.match(&tid, &addr, entry));
+
+	/* a long gap between calls still expires everything due */
+	now += 1000;
+	table.expire(now);
+	table.add(&tid, &addr, BITDHT_MSG_TYPE_PING, NULL, 0, now);
+	table.expire(now + 10 * BITDHT_TRANS_WHEEL_SLOTS);
+	CHECK(table.size() == 0);
+	CHECK(table.expired() == 2);
+
+	/* re-sent request: expires from the later send */
+	now += 10 * BITDHT_TRANS_WHEEL_SLOTS;
+	table.add(&tid, &addr, BITDHT_MSG_TYPE_PING, NULL, 0, now);
+	table.add(&tid, &addr, BITDHT_MSG_TYPE_PING, NULL, 0, now + 5);
+	CHECK(table.size() == 1);
+	table.expire(now + BITDHT_TRANS_TIMEOUT);
+	CHECK(table.size() == 1);
+	table.expire(now + BITDHT_TRANS_TIMEOUT + 5);
+	CHECK(table.size() == 0);
+
+	REPORT("Expiry");
+
+	/* growth, and removal from the middle of probe runs */
+	table.resetCounters();
+	now += 1000;
+	table.expire(now);
+	for(int i = 0; i < N_TRANS; i++)
+	{
+		makeTid(&tid, i);
+		makeAddr(&addr, i % 17);
+		table.add(&tid, &addr, BITDHT_MSG_TYPE_PING, NULL, i, now);
+	}
+	CHECK(table.size() == N_TRANS);
+	CHECK(table.capacity() >= 2 * N_TRANS);
+
+	/* remove every third */
+	for(int i = 0; i < N_TRANS; i += 3)
+	{
+		makeTid(&tid, i);
+		makeAddr(&addr, i % 17);
+		CHECK(table.match(&tid, &addr, entry));
+		CHECK(entry.mSendUsecs == (uint64_t) i);
+	}
+
+	/* the rest are all still found */
+	bool allFound = true;
+	for(int i = 0; i < N_TRANS; i++)
+	{
+		makeTid(&tid, i);
+		makeAddr(&addr, i % 17);
+		bool found = table.match(&tid, &addr, entry);
+		if (found != (i % 3 != 0))
+		{
+			allFound = false;
+		}
+	}
+	CHECK(allFound);
+	CHECK(table.size() == 0);
+
+	REPORT("Growth and Removal");
+
+	FINALREPORT("bdTransTable Tests");
+	return TESTRESULT();
+}
+
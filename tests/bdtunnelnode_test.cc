@@ -0,0 +1,174 @@
+/*
+ * bitdht/bdtunnelnode_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "bitdht/bdtunnelnode.h"
+#include "bitdht/bdstddht.h"
+#include "utest.h"
+
+/*******************************************************************
+ * Test of the per-tunnel scheduling in bdtunnelnode.cc
+ *
+ * Checks connecting retries and their backoff, keepalives only on an
+ * idle link, and that dead tunnels are removed and reported.
+ */
+
+#define SEC	1000000
+
+static int sentMsgs(bdTunnelNode &node)
+{
+	int count = 0;
+	bdMsgSlot *slot;
+	while(NULL != (slot = node.popOutgoingMsg()))
+	{
+		node.releaseOutgoingMsg(slot);
+		count++;
+	}
+	return count;
+}
+
+/* msgs sent by stepping the clock in 10ms steps to now + usecs */
+static int runFor(bdTunnelNode &node, uint64_t &now, uint64_t usecs)
+{
+	uint64_t end = now + usecs;
+	int count = 0;
+	for(; now < end; now += 10000)
+	{
+		node.sendTunnelMsgs(now);
+		count += sentMsgs(node);
+	}
+	return count;
+}
+
+static uint32_t tunnelState(bdTunnelNode &node, const bdId &id)
+{
+	std::map<bdId, bdTunnelReqStatus> statusMap;
+	node.tunnelStatus(statusMap);
+	std::map<bdId, bdTunnelReqStatus>::iterator it = statusMap.find(id);
+	if (it == statusMap.end())
+	{
+		return 0;
+	}
+	return it->second.mStatus;
+}
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	bdDhtFunctions *fns = new bdStdDht();
+	bdNodeId ownId;
+	bdStdRandomNodeId(&ownId);
+	bdTunnelNode node(ownId, fns);
+
+	uint64_t now = 1000 * (uint64_t) SEC;
+	uint64_t wait;
+	CHECK(!node.nextTunnelSend(wait, now));
+
+	/* connecting: first newconn straight away, then 250ms, 500ms, 1s ... */
+	bdId peer;
+	bdStdRandomId(&peer);
+	node.addTunnel(&peer);
+	node.addTunnel(&peer);	/* once only */
+	CHECK(tunnelState(node, peer) == BITDHT_TUNNEL_CONNECTING);
+	CHECK(node.nextTunnelSend(wait, now));
+	CHECK(wait == 0);
+
+	CHECK(runFor(node, now, 1) == 1);
+	CHECK(runFor(node, now, SEC / 4 - 10000) == 0);
+	CHECK(runFor(node, now, 20000) == 1);
+	CHECK(node.nextTunnelSend(wait, now));
+	CHECK((wait > 0) && (wait <= SEC / 2));
+
+	/* 250ms, 500ms, 1s, 2s, 4s, 4s ... over 30 secs: 11 more */
+	int retries = runFor(node, now, 29 * SEC);
+	CHECK((retries >= 9) && (retries <= 11));
+
+	/* gives up after the connect timeout */
+	runFor(node, now, 2 * SEC);
+	CHECK(tunnelState(node, peer) == 0);
+	std::list<bdId> dead;
+	node.popDeadTunnels(dead);
+	CHECK(dead.size() == 1);
+	CHECK(dead.front() == peer);
+	dead.clear();
+	node.popDeadTunnels(dead);
+	CHECK(dead.empty());
+	CHECK(!node.nextTunnelSend(wait, now));
+
+	REPORT("Connecting Backoff");
+
+	/* connected: quiet until the link has been idle */
+	node.addTunnel(&peer);
+	CHECK(runFor(node, now, 1) == 1);
+	node.tunnelActivity(&peer, now);
+	CHECK(tunnelState(node, peer) == BITDHT_TUNNEL_CONNECTED);
+	CHECK(!node.nextTunnelSend(wait, now));
+
+	/* the peer keeps talking: no keepalives at all */
+	int sent = 0;
+	for(int i = 0; i < 10; i++)
+	{
+		sent += runFor(node, now, 10 * SEC);
+		node.tunnelActivity(&peer, now);
+	}
+	CHECK(sent == 0);
+
+	/* silence: one keepalive per idle period */
+	sent = runFor(node, now, BITDHT_TUNNEL_KEEPALIVE_IDLE * (uint64_t) SEC + 20000);
+	CHECK(sent == 1);
+	node.tunnelActivity(&peer, now);
+
+	/* activity from anyone else doesn't count */
+	bdId other;
+	bdStdRandomId(&other);
+	node.tunnelActivity(&other, now);
+	CHECK(tunnelState(node, other) == 0);
+
+	REPORT("Keepalive");
+
+	/* dead once the peer stops answering */
+	sent = runFor(node, now, (BITDHT_TUNNEL_DEAD_TIMEOUT + 1) * (uint64_t) SEC);
+	CHECK(sent == BITDHT_TUNNEL_DEAD_TIMEOUT / BITDHT_TUNNEL_KEEPALIVE_IDLE);
+	CHECK(tunnelState(node, peer) == 0);
+	node.popDeadTunnels(dead);
+	CHECK(dead.size() == 1);
+
+	/* a hundred connected tunnels, talking: no traffic */
+	for(int i = 0; i < 100; i++)
+	{
+		bdId id;
+		bdStdRandomId(&id);
+		node.addTunnel(&id);
+		node.tunnelActivity(&id, now);
+	}
+	CHECK(runFor(node, now, 10 * SEC) == 0);
+
+	node.shutdownNode();
+	CHECK(runFor(node, now, 100 * SEC) == 0);
+
+	REPORT("Dead Tunnels");
+
+	FINALREPORT("bdTunnelNode Tests");
+	return TESTRESULT();
+}
+
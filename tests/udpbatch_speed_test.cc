@@ -0,0 +1,231 @@
+/*
+ * bitdht/udpbatch_speed_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "udp/udpstack.h"
+#include "util/bdthreads.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*******************************************************************
+ * Manual benchmark of batched datagram I/O in UdpLayer on loopback.
+ *
+ * For each batch size: a child process blasts packets at a UdpStack,
+ * then the stack sends the same number to an unread socket. Reports
+ * socket calls and CPU time per packet each way. Not part of the
+ * regular test run.
+ */
+
+#define DEF_PORT	17750
+#define DEF_COUNT	200000
+#define DEF_SIZE	100
+#define RECV_IDLE_USECS	500000	/* receive run ends after this long without a packet */
+
+class CountingReceiver: public UdpReceiver
+{
+public:
+	CountingReceiver()
+		:mCount(0) { return; }
+
+	virtual int recvPkt(void *data, int size, struct sockaddr_in &from)
+	{
+		mCount++;
+		return 1;
+	}
+	virtual int status(std::ostream &out) { return 1; }
+
+	volatile uint32_t mCount;
+};
+
+static uint64_t cpuUsecs()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL +
+		usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void blast(struct sockaddr_in &to, int count, int size)
+{
+	int sock = socket(PF_INET, SOCK_DGRAM, 0);
+	char buf[UDP_RECV_BUF_SIZE];
+	memset(buf, 0, sizeof(buf));
+	for(int i = 0; i < count; i++)
+	{
+		sendto(sock, buf, size, 0, (struct sockaddr *) &to, sizeof(to));
+	}
+	close(sock);
+}
+
+static void runRecv(UdpStack *udpstack, CountingReceiver *counter, struct sockaddr_in &addr,
+		int batch, int count, int size)
+{
+	udpstack->setRecvBatch(batch);
+
+	uint64_t calls0, pkts0, sendCalls, sendPkts;
+	udpstack->getIOStats(calls0, pkts0, sendCalls, sendPkts);
+	uint32_t count0 = counter->mCount;
+	uint64_t cpu0 = cpuUsecs();
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		blast(addr, count, size);
+		_exit(0);
+	}
+	waitpid(pid, NULL, 0);
+
+	uint32_t last = counter->mCount;
+	do
+	{
+		last = counter->mCount;
+		usleep(RECV_IDLE_USECS);
+	} while(last != counter->mCount);
+
+	uint64_t cpu = cpuUsecs() - cpu0;
+	uint64_t calls, pkts;
+	udpstack->getIOStats(calls, pkts, sendCalls, sendPkts);
+	calls -= calls0;
+	pkts -= pkts0;
+	uint32_t recvd = counter->mCount - count0;
+
+	printf("recv batch %2d : %6u pkts (%4.1f%% lost) %7llu calls, %.3f calls/pkt, %.2f cpu usecs/pkt\n",
+			batch, recvd, 100.0 * (count - recvd) / count, (unsigned long long) calls,
+			pkts ? (double) calls / pkts : 0.0, recvd ? (double) cpu / recvd : 0.0);
+}
+
+static void runSend(UdpStack *udpstack, struct sockaddr_in &to, int batch, int count, int size)
+{
+	char buf[UDP_RECV_BUF_SIZE];
+	memset(buf, 0, sizeof(buf));
+	struct bdnet_dgram msgs[BDNET_BATCH_MAX];
+	for(int i = 0; i < batch; i++)
+	{
+		msgs[i].buf = buf;
+		msgs[i].len = size;
+		msgs[i].addr = to;
+	}
+
+	uint64_t recvCalls, recvPkts, calls0, pkts0;
+	udpstack->getIOStats(recvCalls, recvPkts, calls0, pkts0);
+	uint64_t cpu0 = cpuUsecs();
+
+	for(int sent = 0; sent < count; sent += batch)
+	{
+		int n = (count - sent < batch) ? count - sent : batch;
+		udpstack->sendPktBatch(msgs, n, 64);
+	}
+
+	uint64_t cpu = cpuUsecs() - cpu0;
+	uint64_t calls, pkts;
+	udpstack->getIOStats(recvCalls, recvPkts, calls, pkts);
+	calls -= calls0;
+	pkts -= pkts0;
+
+	printf("send batch %2d : %6llu pkts %7llu calls, %.3f calls/pkt, %.2f cpu usecs/pkt\n",
+			batch, (unsigned long long) pkts, (unsigned long long) calls,
+			pkts ? (double) calls / pkts : 0.0, pkts ? (double) cpu / pkts : 0.0);
+}
+
+int main(int argc, char **argv)
+{
+	int port = DEF_PORT;
+	int count = DEF_COUNT;
+	int size = DEF_SIZE;
+	int batch = 0; /* all of them */
+
+	int c;
+	while((c = getopt(argc, argv, "p:n:s:b:")) != -1)
+	{
+		switch(c)
+		{
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 's':
+				size = atoi(optarg);
+				break;
+			case 'b':
+				batch = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-p port] [-n packets] [-s size] [-b batch]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if ((size < 1) || (size > UDP_RECV_BUF_SIZE) || (count < 1) ||
+		(batch < 0) || (batch > BDNET_BATCH_MAX))
+	{
+		fprintf(stderr, "size must be 1 to %d bytes, batch 1 to %d\n",
+				UDP_RECV_BUF_SIZE, BDNET_BATCH_MAX);
+		return 1;
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	UdpStack *udpstack = new UdpStack(addr);
+	CountingReceiver *counter = new CountingReceiver();
+	udpstack->addReceiver(counter);
+
+	/* sends go to a socket no one reads: the kernel drops what overflows */
+	struct sockaddr_in sinkAddr = addr;
+	sinkAddr.sin_port = 0;
+	int sink = socket(PF_INET, SOCK_DGRAM, 0);
+	bind(sink, (struct sockaddr *) &sinkAddr, sizeof(sinkAddr));
+	socklen_t len = sizeof(sinkAddr);
+	getsockname(sink, (struct sockaddr *) &sinkAddr, &len);
+
+	int batches[] = { 1, 4, 16, 32, 64 };
+	int nbatches = sizeof(batches) / sizeof(batches[0]);
+	if (batch)
+	{
+		batches[0] = batch;
+		nbatches = 1;
+	}
+
+	printf("%d packets of %d bytes each way\n", count, size);
+	for(int i = 0; i < nbatches; i++)
+	{
+		runRecv(udpstack, counter, addr, batches[i], count, size);
+	}
+	for(int i = 0; i < nbatches; i++)
+	{
+		runSend(udpstack, sinkAddr, batches[i], count, size);
+	}
+
+	close(sink);
+	return 0;
+}
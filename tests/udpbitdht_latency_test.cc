@@ -0,0 +1,166 @@
+/*
+ * bitdht/udpbitdht_latency_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "udp/udpbitdht.h"
+#include "udp/udpstack.h"
+#include "bitdht/bdstddht.h"
+#include "bitdht/bdmsgs.h"
+#include "util/bdhistogram.h"
+#include "util/bdtime.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/*******************************************************************
+ * Manual benchmark of a UdpBitDht node on loopback.
+ *
+ * Measures ping -> pong round trip latency, and the cpu time / context
+ * switches used by an idle node. Not part of the regular test run.
+ */
+
+#define DEF_PORT		17500
+#define DEF_PINGS		200
+#define DEF_IDLE_SECS		10
+#define PONG_TIMEOUT_SECS	3
+
+static uint64_t tvUsecs(struct timeval &tv)
+{
+	return ((uint64_t) tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+int main(int argc, char **argv)
+{
+	int port = DEF_PORT;
+	int pings = DEF_PINGS;
+	int idleSecs = DEF_IDLE_SECS;
+
+	int c;
+	while((c = getopt(argc, argv,"p:n:i:")) != -1)
+	{
+		switch (c)
+		{
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'n':
+			pings = atoi(optarg);
+			break;
+		case 'i':
+			idleSecs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s -p <port> -n <pings> -i <idle secs>\n", argv[0]);
+			return 1;
+		}
+	}
+
+	bdDhtFunctions *fns = new bdStdDht();
+
+	bdNodeId id;
+	bdStdRandomNodeId(&id);
+
+	struct sockaddr_in local;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	local.sin_port = htons(port);
+	UdpStack *udpstack = new UdpStack(local);
+
+	std::string dhtVersion = "dbTEST";
+	UdpBitDht *bitdht = new UdpBitDht(udpstack, &id, dhtVersion,
+			"/nonexistent/bdboot.txt", "", fns, new PacketCallback());
+	udpstack->addReceiver(bitdht);
+
+	bitdht->start();
+	bitdht->startDht();
+
+	/* idle node: nothing to do but its own timers */
+	struct rusage start, end;
+	getrusage(RUSAGE_SELF, &start);
+	uint64_t wallStart = bdClockUsecs();
+	sleep(idleSecs);
+	getrusage(RUSAGE_SELF, &end);
+	uint64_t wallEnd = bdClockUsecs();
+
+	uint64_t cpu = tvUsecs(end.ru_utime) + tvUsecs(end.ru_stime)
+			- tvUsecs(start.ru_utime) - tvUsecs(start.ru_stime);
+	uint64_t wall = wallEnd - wallStart;
+	long switches = (end.ru_nvcsw - start.ru_nvcsw) + (end.ru_nivcsw - start.ru_nivcsw);
+
+	printf("Idle: %d secs, cpu %.3f%%, %.1f context switches/sec\n", idleSecs,
+			100.0 * cpu / wall, switches * 1000000.0 / wall);
+
+	/* ping the node from a plain socket */
+	int sock = socket(PF_INET, SOCK_DGRAM, 0);
+	struct timeval tv;
+	tv.tv_sec = PONG_TIMEOUT_SECS;
+	tv.tv_usec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	bdNodeId clientId;
+	bdStdRandomNodeId(&clientId);
+
+	bdHistogram hist;
+	uint64_t total = 0;
+	int lost = 0;
+	for(int i = 0; i < pings; i++)
+	{
+		char msg[BITDHT_MAX_PKTSIZE];
+		bdToken tid;
+		tid.len = 4;
+		memcpy(tid.data, &i, 4);
+		int len = bitdht_create_ping_msg(&tid, &clientId, msg, BITDHT_MAX_PKTSIZE);
+
+		uint64_t sent = bdClockUsecs();
+		sendto(sock, msg, len, 0, (struct sockaddr *) &local, sizeof(local));
+
+		char reply[BITDHT_MAX_PKTSIZE];
+		if (0 >= recvfrom(sock, reply, BITDHT_MAX_PKTSIZE, 0, NULL, NULL))
+		{
+			lost++;
+			continue;
+		}
+
+		uint64_t rtt = bdClockUsecs() - sent;
+		hist.add(rtt);
+		total += rtt;
+	}
+
+	uint32_t count = hist.count();
+	printf("Ping: %d sent, %u answered, %d lost\n", pings, count, lost);
+	if (count)
+	{
+		printf("Ping RTT: mean %llu usecs, p50 < %llu usecs, p99 < %llu usecs\n",
+				(unsigned long long) (total / count),
+				(unsigned long long) hist.percentile(0.5),
+				(unsigned long long) hist.percentile(0.99));
+	}
+
+	close(sock);
+	return 0;
+}
+
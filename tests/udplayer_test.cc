@@ -0,0 +1,257 @@
+/*
+ * bitdht/udplayer_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "udp/udpstack.h"
+#include "utest.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+/*******************************************************************
+ * Test of the lock-free send / receive path in udplayer.cc
+ *
+ * Sends from one thread while another resets the socket under it, then
+ * checks packets still flow both ways on the new socket. Finally moves
+ * batches of datagrams each way.
+ */
+
+#define LAYER_PORT	17700
+#define RECV_USECS	300000
+#define RESETS		5
+#define BATCH		40
+
+class CountingReceiver: public UdpReceiver
+{
+public:
+	CountingReceiver()
+		:mCount(0) { return; }
+
+	virtual int recvPkt(void *data, int size, struct sockaddr_in &from)
+	{
+		mCount++;
+		return 1;
+	}
+	virtual int status(std::ostream &out) { return 1; }
+
+	volatile int mCount;
+};
+
+class BusySender: public bdThread
+{
+public:
+	BusySender(UdpStack *stack, struct sockaddr_in &to)
+		:mStack(stack), mTo(to), mStop(false), mSent(0) { return; }
+
+	virtual void run()
+	{
+		while(!mStop)
+		{
+			/* alternate ttls, so setTTL() races reset() too */
+			if (0 < mStack->sendPkt("x", 1, mTo, 64 + (mSent % 2)))
+			{
+				mSent++;
+			}
+		}
+	}
+
+	UdpStack *mStack;
+	struct sockaddr_in mTo;
+	volatile bool mStop;
+	volatile int mSent;
+};
+
+static struct sockaddr_in loopback(int port)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	return addr;
+}
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in local = loopback(LAYER_PORT);
+	UdpStack *udpstack = new UdpStack(local);
+	CountingReceiver *counter = new CountingReceiver();
+	udpstack->addReceiver(counter);
+
+	/* a plain socket to talk to it */
+	int sock = socket(PF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in client = loopback(0);
+	bind(sock, (struct sockaddr *) &client, sizeof(client));
+	socklen_t len = sizeof(client);
+	getsockname(sock, (struct sockaddr *) &client, &len);
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = RECV_USECS;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	sendto(sock, "ping", 4, 0, (struct sockaddr *) &local, sizeof(local));
+	usleep(RECV_USECS);
+	CHECK(counter->mCount == 1);
+
+	char buf[64];
+	CHECK(0 < udpstack->sendPkt("pong", 4, client, 64));
+	CHECK(4 == recv(sock, buf, sizeof(buf), 0));
+
+	REPORT("Send and Receive");
+
+	/* send flat out while the socket is replaced under the sender */
+	struct sockaddr_in sink = loopback(LAYER_PORT + 10);
+	BusySender sender(udpstack, sink);
+	sender.start();
+	for(int i = 0; i < RESETS; i++)
+	{
+		usleep(20000);
+		local = loopback(LAYER_PORT + 1 + (i % 2));
+		udpstack->resetAddress(local);
+	}
+	int sent = sender.mSent;
+	usleep(20000);
+	sender.mStop = true;
+	sender.join();
+	CHECK(sender.mSent > sent);	/* still sending after the last reset */
+
+	/* the new socket works both ways */
+	int before = counter->mCount;
+	sendto(sock, "ping", 4, 0, (struct sockaddr *) &local, sizeof(local));
+	usleep(RECV_USECS);
+	CHECK(counter->mCount == before + 1);
+
+	while(0 < recv(sock, buf, sizeof(buf), MSG_DONTWAIT));
+	CHECK(0 < udpstack->sendPkt("pong", 4, client, 64));
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	CHECK(4 == recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *) &from, &fromlen));
+	CHECK(from.sin_port == local.sin_port);
+
+	REPORT("Reset While Sending");
+
+	/* a batch goes out in one call, in order */
+	uint64_t recvCalls, recvPkts, sendCalls, sendPkts;
+	udpstack->getIOStats(recvCalls, recvPkts, sendCalls, sendPkts);
+
+	char payloads[BATCH][8];
+	struct bdnet_dgram batch[BATCH];
+	for(int i = 0; i < BATCH; i++)
+	{
+		snprintf(payloads[i], sizeof(payloads[i]), "b%02d", i);
+		batch[i].buf = payloads[i];
+		batch[i].len = 3;
+		batch[i].addr = client;
+	}
+	CHECK(BATCH == udpstack->sendPktBatch(batch, BATCH, 64));
+
+	bool inOrder = true;
+	for(int i = 0; i < BATCH; i++)
+	{
+		if ((3 != recv(sock, buf, sizeof(buf), 0)) || (0 != memcmp(buf, payloads[i], 3)))
+		{
+			inOrder = false;
+		}
+	}
+	CHECK(inOrder);
+
+	uint64_t sendCalls2, sendPkts2;
+	udpstack->getIOStats(recvCalls, recvPkts, sendCalls2, sendPkts2);
+	CHECK(sendCalls2 == sendCalls + 1);
+	CHECK(sendPkts2 == sendPkts + BATCH);
+
+	/* and every datagram of an incoming batch is delivered */
+	udpstack->setRecvBatch(2 * BDNET_BATCH_MAX); /* clamped */
+	before = counter->mCount;
+	for(int i = 0; i < BATCH; i++)
+	{
+		batch[i].addr = local;
+	}
+	int calls = 0;
+	CHECK(BATCH == bdnet_sendto_batch(sock, batch, BATCH, 0, &calls));
+	CHECK(calls == 1);
+	usleep(RECV_USECS);
+	CHECK(counter->mCount == before + BATCH);
+
+	uint64_t recvCalls2, recvPkts2;
+	udpstack->getIOStats(recvCalls2, recvPkts2, sendCalls2, sendPkts2);
+	CHECK(recvPkts2 == recvPkts + BATCH);
+	CHECK(recvCalls2 > recvCalls);
+	CHECK(recvCalls2 <= recvCalls + BATCH);
+
+	/* past BDNET_BATCH_MAX a batch takes a call per chunk */
+	const int LONG_BATCH = 2 * BDNET_BATCH_MAX + 1;
+	struct bdnet_dgram longBatch[LONG_BATCH];
+	for(int i = 0; i < LONG_BATCH; i++)
+	{
+		longBatch[i].buf = payloads[0];
+		longBatch[i].len = 3;
+		longBatch[i].addr = client;
+	}
+	udpstack->getIOStats(recvCalls, recvPkts, sendCalls, sendPkts);
+	CHECK(LONG_BATCH == udpstack->sendPktBatch(longBatch, LONG_BATCH, 64));
+	udpstack->getIOStats(recvCalls, recvPkts, sendCalls2, sendPkts2);
+	CHECK(sendCalls2 == sendCalls + 3);
+	CHECK(sendPkts2 == sendPkts + LONG_BATCH);
+	while(0 < recv(sock, buf, sizeof(buf), MSG_DONTWAIT));
+
+	REPORT("Batched Send and Receive");
+
+	/* a datagram that can't go out is skipped, not the end of the batch
+	 * (broadcast without SO_BROADCAST fails with EACCES)
+	 */
+	struct sockaddr_in unroutable = local;
+	unroutable.sin_addr.s_addr = htonl(INADDR_BROADCAST);
+	for(int i = 0; i < BATCH; i++)
+	{
+		batch[i].addr = local;
+	}
+	batch[BATCH / 2].addr = unroutable;
+	before = counter->mCount;
+	CHECK(BATCH - 1 == bdnet_sendto_batch(sock, batch, BATCH, 0, NULL));
+	usleep(RECV_USECS);
+	CHECK(counter->mCount == before + BATCH - 1);
+
+	REPORT("Undeliverable Datagram In A Batch");
+
+	/* a datagram too big for the buffer is dropped, not cut short */
+	static char big[UDP_RECV_BUF_SIZE + 1];
+	memset(big, 'x', sizeof(big));
+	before = counter->mCount;
+	CHECK(udpstack->getTruncated() == 0);
+	sendto(sock, big, UDP_RECV_BUF_SIZE + 1, 0, (struct sockaddr *) &local, sizeof(local));
+	sendto(sock, big, UDP_RECV_BUF_SIZE, 0, (struct sockaddr *) &local, sizeof(local));
+	usleep(RECV_USECS);
+	CHECK(counter->mCount == before + 1);
+	CHECK(udpstack->getTruncated() == 1);
+
+	REPORT("Oversized Datagrams");
+
+	close(sock);
+
+	FINALREPORT("UdpLayer Tests");
+	return TESTRESULT();
+}
+
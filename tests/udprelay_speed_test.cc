@@ -0,0 +1,172 @@
+/*
+ * bitdht/udprelay_speed_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "udp/udprelay.h"
+#include "util/bdthreads.h"
+#include "util/bdtime.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/*******************************************************************
+ * Manual throughput benchmark of the relay fast path on loopback.
+ *
+ * One client blasts relay packets at a UdpRelayReceiver, the other
+ * counts what comes out; reports packets per second sent, forwarded
+ * and received. Not part of the regular test run.
+ */
+
+#define DEF_PORT	17650
+#define DEF_COUNT	200000
+#define DEF_SIZE	512
+#define RECV_IDLE_USECS	500000	/* receiver gives up after this long without a packet */
+
+static int openClient(struct sockaddr_in &addr)
+{
+	int sock = socket(PF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+
+	socklen_t len = sizeof(addr);
+	getsockname(sock, (struct sockaddr *) &addr, &len);
+
+	int bufsize = 4 * 1024 * 1024;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	return sock;
+}
+
+class RelaySink: public bdThread
+{
+public:
+	RelaySink(int sock)
+		:mSock(sock), mCount(0), mLastUsecs(0) { return; }
+
+	virtual void run()
+	{
+		struct timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = RECV_IDLE_USECS;
+		setsockopt(mSock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		char buf[BITDHT_MAX_PKTSIZE];
+		while(0 < recv(mSock, buf, sizeof(buf), 0))
+		{
+			mCount++;
+			mLastUsecs = bdClockUsecs();
+		}
+	}
+
+	int mSock;
+	uint32_t mCount;
+	uint64_t mLastUsecs;
+};
+
+int main(int argc, char **argv)
+{
+	int port = DEF_PORT;
+	int count = DEF_COUNT;
+	int size = DEF_SIZE;
+
+	int c;
+	while((c = getopt(argc, argv, "p:n:s:")) != -1)
+	{
+		switch(c)
+		{
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 's':
+				size = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-p port] [-n packets] [-s size]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if ((size < UDP_RELAY_HDR_LEN) || (size > BITDHT_MAX_PKTSIZE))
+	{
+		fprintf(stderr, "size must be %d to %d bytes\n", UDP_RELAY_HDR_LEN, BITDHT_MAX_PKTSIZE);
+		return 1;
+	}
+
+	struct sockaddr_in relayAddr;
+	memset(&relayAddr, 0, sizeof(relayAddr));
+	relayAddr.sin_family = AF_INET;
+	relayAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	relayAddr.sin_port = htons(port);
+
+	UdpStack *udpstack = new UdpStack(relayAddr);
+	UdpRelayReceiver *relay = new UdpRelayReceiver(udpstack);
+	udpstack->addReceiver(relay);
+	relay->setQuota(count, ((uint64_t) count) * size);
+
+	struct sockaddr_in addrA, addrB;
+	int sockA = openClient(addrA);
+	int sockB = openClient(addrB);
+
+	uint32_t session = 1;
+	relay->addSession(session, 1, addrA, addrB);
+
+	RelaySink sink(sockB);
+	sink.start();
+
+	char buf[BITDHT_MAX_PKTSIZE];
+	memset(buf, 0, sizeof(buf));
+	udprelay_build_hdr(session, 1, buf, size);
+
+	uint64_t start = bdClockUsecs();
+	for(int i = 0; i < count; i++)
+	{
+		sendto(sockA, buf, size, 0, (struct sockaddr *) &relayAddr, sizeof(relayAddr));
+	}
+	uint64_t sent = bdClockUsecs();
+
+	sink.join();
+	uint64_t end = sink.mLastUsecs;
+	if (end < sent)
+	{
+		end = sent;
+	}
+
+	printf("Packet size      : %d bytes\n", size);
+	printf("Sent             : %d in %.3f secs, %.0f pkts/sec\n", count,
+			(sent - start) / 1000000.0, count * 1000000.0 / (sent - start));
+	printf("Forwarded        : %u, %.0f pkts/sec\n", relay->forwarded(),
+			relay->forwarded() * 1000000.0 / (end - start));
+	printf("Received         : %u, %.0f pkts/sec (%.1f%% lost)\n", sink.mCount,
+			sink.mCount * 1000000.0 / (end - start),
+			100.0 * (count - sink.mCount) / count);
+
+	close(sockA);
+	close(sockB);
+	return 0;
+}
+
@@ -0,0 +1,347 @@
+/*
+ * bitdht/udprelay_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "udp/udprelay.h"
+#include "bitdht/bdnode.h"
+#include "bitdht/bdstddht.h"
+#include "bitdht/bdmsgs.h"
+#include "util/bdrandom.h"
+#include "utest.h"
+
+#include <unistd.h>
+#include <string.h>
+
+/*******************************************************************
+ * Test of the relay fast path in udprelay.cc
+ *
+ * Runs a relay on a loopback UdpStack, with two plain sockets standing
+ * in for NATed clients. Checks forwarding both ways, that strangers,
+ * unknown sessions and wrong nonces are dropped, that a pairing can't
+ * move or block a live session, the quotas and idle expiry, and that a
+ * refused pairing tells the ends not to relay.
+ */
+
+#define RELAY_PORT	17600
+#define RECV_USECS	300000
+
+/* counts whatever the relay passes down the stack */
+class CountingReceiver: public UdpSubReceiver
+{
+public:
+	CountingReceiver(UdpPublisher *pub)
+		:UdpSubReceiver(pub), mCount(0) { return; }
+
+	virtual int recvPkt(void *data, int size, struct sockaddr_in &from)
+	{
+		mCount++;
+		return 1;
+	}
+	virtual int status(std::ostream &out) { return 1; }
+
+	volatile int mCount;
+};
+
+static int openClient(struct sockaddr_in &addr)
+{
+	int sock = socket(PF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	bind(sock, (struct sockaddr *) &addr, sizeof(addr));
+
+	socklen_t len = sizeof(addr);
+	getsockname(sock, (struct sockaddr *) &addr, &len);
+
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = RECV_USECS;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	return sock;
+}
+
+#define NONCE		0x0123456789abcdefULL
+
+static void sendRelay(int sock, uint32_t sessionId, const char *payload, struct sockaddr_in &relay,
+		uint64_t nonce = NONCE)
+{
+	char buf[1024];
+	int len = udprelay_build_hdr(sessionId, nonce, buf, sizeof(buf));
+	int plen = strlen(payload);
+	memcpy(buf + len, payload, plen);
+	sendto(sock, buf, len + plen, 0, (struct sockaddr *) &relay, sizeof(relay));
+}
+
+/* true if the payload arrives, from the relay, under the session's header */
+static bool recvRelay(int sock, uint32_t sessionId, const char *payload, struct sockaddr_in &relay,
+		uint64_t nonce = NONCE)
+{
+	char buf[1024];
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	int len = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *) &from, &fromlen);
+
+	uint32_t id;
+	uint64_t n;
+	int plen = strlen(payload);
+	return ((len == UDP_RELAY_HDR_LEN + plen) &&
+		(from.sin_port == relay.sin_port) &&
+		udprelay_parse_hdr(buf, len, id, n) && (id == sessionId) && (n == nonce) &&
+		(0 == memcmp(buf + UDP_RELAY_HDR_LEN, payload, plen)));
+}
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	/* header and session id */
+	char hdr[UDP_RELAY_HDR_LEN];
+	uint32_t id = 0;
+	uint64_t nonce = 0;
+	CHECK(-1 == udprelay_build_hdr(1, NONCE, hdr, UDP_RELAY_HDR_LEN - 1));
+	CHECK(UDP_RELAY_HDR_LEN == udprelay_build_hdr(0xdeadbeef, NONCE, hdr, sizeof(hdr)));
+	CHECK(udprelay_parse_hdr(hdr, sizeof(hdr), id, nonce));
+	CHECK(id == 0xdeadbeef);
+	CHECK(nonce == NONCE);
+	CHECK(!udprelay_parse_hdr(hdr, sizeof(hdr) - 1, id, nonce));
+	hdr[0] = 'X';
+	CHECK(!udprelay_parse_hdr(hdr, sizeof(hdr), id, nonce));
+
+	bdId peerA, peerB;
+	bdStdRandomId(&peerA);
+	bdStdRandomId(&peerB);
+	CHECK(udprelay_session_id(&(peerA.id), &(peerB.id)) == udprelay_session_id(&(peerB.id), &(peerA.id)));
+	CHECK(udprelay_session_id(&(peerA.id), &(peerB.id)) != udprelay_session_id(&(peerA.id), &(peerA.id)));
+
+	/* the rendezvous node hands the nonce to both ends in ask_conn */
+	bdToken tid;
+	tid.len = 4;
+	memcpy(tid.data, "tid1", 4);
+	char msg[BITDHT_MAX_PKTSIZE];
+	int mlen = bitdht_ask_conn_msg(&tid, &(peerA.id), &(peerA.id), &peerB, NONCE, msg, sizeof(msg));
+	CHECK(mlen > 0);
+	CHECK(NULL != memmem(msg, mlen, "2:rn8:\x01\x23\x45\x67\x89\xab\xcd\xef", 14));
+	mlen = bitdht_ask_conn_msg(&tid, &(peerA.id), &(peerA.id), &peerB, 0, msg, sizeof(msg));
+	CHECK(NULL == memmem(msg, mlen, "2:rn", 4));
+
+	/* and no nonce, no session */
+	bdSecureRandom(nonce);
+	CHECK(nonce != 0);
+
+	REPORT("Header and Session Id");
+
+	struct sockaddr_in relayAddr;
+	memset(&relayAddr, 0, sizeof(relayAddr));
+	relayAddr.sin_family = AF_INET;
+	relayAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	relayAddr.sin_port = htons(RELAY_PORT);
+
+	UdpStack *udpstack = new UdpStack(relayAddr);
+	UdpRelayReceiver *relay = new UdpRelayReceiver(udpstack);
+	CountingReceiver *below = new CountingReceiver(udpstack);
+	udpstack->addReceiver(relay);
+	udpstack->addReceiver(below);
+
+	struct sockaddr_in addrA, addrB, addrC;
+	int sockA = openClient(addrA);
+	int sockB = openClient(addrB);
+	int sockC = openClient(addrC);
+
+	/* the rendezvous pairing authorises the session */
+	peerA.addr = addrA;
+	peerB.addr = addrB;
+	UdpRelayCallback callback(relay);
+	callback.onPairedCallback(&peerA, &peerB, 0);
+	CHECK(relay->size() == 0);
+	callback.onPairedCallback(&peerA, &peerB, NONCE);
+	CHECK(relay->size() == 1);
+	uint32_t session = udprelay_session_id(&(peerA.id), &(peerB.id));
+
+	sendRelay(sockA, session, "hello B", relayAddr);
+	CHECK(recvRelay(sockB, session, "hello B", relayAddr));
+	sendRelay(sockB, session, "hello A", relayAddr);
+	CHECK(recvRelay(sockA, session, "hello A", relayAddr));
+	CHECK(relay->forwarded() == 2);
+	CHECK(relay->forwardedBytes() == 2 * (UDP_RELAY_HDR_LEN + 7));
+
+	REPORT("Forwarding");
+
+	/* a stranger, and an unknown session, get nowhere */
+	sendRelay(sockC, session, "intruder", relayAddr);
+	CHECK(!recvRelay(sockB, session, "intruder", relayAddr));
+	CHECK(!recvRelay(sockA, session, "intruder", relayAddr));
+	sendRelay(sockA, session + 1, "lost", relayAddr);
+	CHECK(!recvRelay(sockB, session + 1, "lost", relayAddr));
+	/* knowing the node ids isn't enough without the nonce */
+	sendRelay(sockA, session, "guess", relayAddr, NONCE + 1);
+	CHECK(!recvRelay(sockB, session, "guess", relayAddr, NONCE + 1));
+	CHECK(relay->dropped() == 3);
+
+	/* anything else goes on down the stack */
+	CHECK(below->mCount == 0);
+	sendto(sockA, "d1:ad2:id20:", 12, 0, (struct sockaddr *) &relayAddr, sizeof(relayAddr));
+	usleep(RECV_USECS);
+	CHECK(below->mCount == 1);
+	CHECK(relay->forwarded() == 2);
+
+	REPORT("Drops");
+
+	/* a pairing from other addresses under the same id gets a session of
+	 * its own: the live one is neither moved nor blocked
+	 */
+	bdId fakeA = peerA;
+	fakeA.addr = addrC;
+	CHECK(relay->allowPair(&fakeA, &peerB, NONCE + 2));
+	CHECK(relay->size() == 2);
+	sendRelay(sockA, session, "still", relayAddr);
+	CHECK(recvRelay(sockB, session, "still", relayAddr));
+	sendRelay(sockC, session, "hijack", relayAddr);
+	CHECK(!recvRelay(sockB, session, "hijack", relayAddr));
+	CHECK(relay->removeSession(session, NONCE + 2));
+
+	/* and an id and nonce that are in use can't be re-aimed */
+	CHECK(!relay->addSession(session, NONCE, addrC, addrB));
+	CHECK(relay->refused() == 1);
+	sendRelay(sockA, session, "again", relayAddr);
+	CHECK(recvRelay(sockB, session, "again", relayAddr));
+
+	/* re-pairing the same ends rotates the nonce */
+	CHECK(relay->allowPair(&peerB, &peerA, NONCE + 3));
+	sendRelay(sockA, session, "old", relayAddr);
+	CHECK(!recvRelay(sockB, session, "old", relayAddr));
+	sendRelay(sockA, session, "new", relayAddr, NONCE + 3);
+	CHECK(recvRelay(sockB, session, "new", relayAddr, NONCE + 3));
+	CHECK(relay->allowPair(&peerA, &peerB, NONCE));
+	CHECK(relay->size() == 1);
+	CHECK(relay->forwarded() == 5);
+
+	REPORT("Re-Pairing");
+
+	/* quotas */
+	relay->setQuota(7, UDP_RELAY_DEF_MAX_BYTES);
+	sendRelay(sockA, session, "three", relayAddr);
+	CHECK(recvRelay(sockB, session, "three", relayAddr));
+	sendRelay(sockB, session, "four", relayAddr);
+	CHECK(recvRelay(sockA, session, "four", relayAddr));
+	sendRelay(sockA, session, "five", relayAddr);
+	CHECK(!recvRelay(sockB, session, "five", relayAddr));
+	CHECK(relay->overQuota() == 1);
+
+	relay->setQuota(UDP_RELAY_DEF_MAX_PACKETS, 3 * (UDP_RELAY_HDR_LEN + 7));
+	CHECK(relay->removeSession(session, NONCE));
+	CHECK(!relay->removeSession(session, NONCE));
+	CHECK(relay->allowPair(&peerB, &peerA, NONCE));
+	for(int i = 0; i < 3; i++)
+	{
+		sendRelay(sockA, session, "1234567", relayAddr);
+		CHECK(recvRelay(sockB, session, "1234567", relayAddr));
+	}
+	sendRelay(sockA, session, "1", relayAddr);
+	CHECK(!recvRelay(sockB, session, "1", relayAddr));
+	CHECK(relay->overQuota() == 2);
+
+	REPORT("Quotas");
+
+	/* idle expiry */
+	time_t now = time(NULL);
+	relay->expire(now);
+	CHECK(relay->size() == 1);
+	relay->expire(now + UDP_RELAY_IDLE_TIMEOUT + 2);
+	CHECK(relay->size() == 0);
+	CHECK(relay->expired() == 1);
+
+	/* table limit */
+	for(uint32_t i = 0; i < UDP_RELAY_MAX_SESSIONS; i++)
+	{
+		CHECK(relay->addSession(i, NONCE, addrA, addrB));
+	}
+	CHECK(!relay->addSession(UDP_RELAY_MAX_SESSIONS, NONCE, addrA, addrB));
+	CHECK(relay->addSession(0, NONCE, addrB, addrA));
+	CHECK(!relay->addSession(0, NONCE, addrB, addrC));
+	CHECK(relay->size() == UDP_RELAY_MAX_SESSIONS);
+
+	REPORT("Expiry");
+
+	/* a rendezvous node whose relay refuses the pairing (the table is
+	 * full) sends both ends nonce 0, so neither tries to relay
+	 */
+	bdDhtFunctions *fns = new bdStdDht();
+	bdNodeId rdvId;
+	bdStdRandomNodeId(&rdvId);
+	bdNode *rdv = new bdNode(&rdvId, "bdTEST", "", "", fns, new UdpRelayCallback(relay));
+	int rnAsks = 0;
+	int asks = 0;
+	for(int round = 0; round < 2; round++)
+	{
+		/* then again, with room in the table (and a new pair, as the
+		 * rendezvous won't re-announce the last one yet)
+		 */
+		if (round == 1)
+		{
+			relay->expire(time(NULL) + UDP_RELAY_IDLE_TIMEOUT + 2);
+		}
+		bdId ends[2];
+		bdStdRandomId(&(ends[0]));
+		bdStdRandomId(&(ends[1]));
+		ends[0].addr = addrA;
+		ends[1].addr = addrB;
+		for(int i = 0; i < 2; i++)
+		{
+			bdId &from = ends[i];
+			bdId &to = ends[1 - i];
+			bdToken btid;
+			btid.len = 4;
+			memcpy(btid.data, round ? "bc1r" : "bc0r", 4);
+			mlen = bitdht_broadcast_conn_msg(&btid, &(from.id), &(from.id), &(to.id), msg, sizeof(msg));
+			rdv->incomingMsg(&(from.addr), msg, mlen);
+		}
+		rdv->processIncomingMsgs();
+
+		bdMsgSlot *slot;
+		while(NULL != (slot = rdv->popOutgoingMsg()))
+		{
+			if (NULL != memmem(slot->data, slot->mSize, "7:askconn", 9))
+			{
+				asks++;
+				if (NULL != memmem(slot->data, slot->mSize, "2:rn", 4))
+				{
+					rnAsks++;
+				}
+			}
+			rdv->releaseOutgoingMsg(slot);
+		}
+		CHECK(rnAsks == (round ? 2 : 0));
+	}
+	CHECK(asks == 4);
+	CHECK(relay->size() == 1);
+
+	REPORT("Refused Pairing");
+
+	close(sockA);
+	close(sockB);
+	close(sockC);
+
+	FINALREPORT("UdpRelayReceiver Tests");
+	return TESTRESULT();
+}
+
@@ -0,0 +1,215 @@
+/*
+ * bitdht/udpshard_speed_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "udp/udpstack.h"
+#include "util/bdthreads.h"
+#include "util/bdtime.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/wait.h>
+
+/*******************************************************************
+ * Manual loopback load test of UdpStack receive shards.
+ *
+ * For 1, 2, 4 ... shards: child processes blast packets from many
+ * source ports at the stack, whose receiver hashes each one a number
+ * of times (standing in for decoding), so a single receive thread is
+ * the bottleneck. Reports packets per second received and the speedup
+ * over one shard - which needs as many free cores as shards. Not part
+ * of the regular test run.
+ */
+
+#define DEF_PORT	17850
+#define DEF_COUNT	400000
+#define DEF_SIZE	100
+#define DEF_WORK_ROUNDS	20	/* hashes of the packet per packet */
+#define DEF_MAX_SHARDS	4
+#define SENDERS		4
+#define SENDER_SOCKS	16	/* source ports per sender, for the kernel to spread */
+#define RECV_IDLE_USECS	500000	/* a run ends after this long without a packet */
+
+class BusyReceiver: public UdpReceiver
+{
+public:
+	BusyReceiver(int workRounds)
+		:mWorkRounds(workRounds), mSink(0), mCount(0), mFirstUsecs(0), mLastUsecs(0) { return; }
+
+	virtual int recvPkt(void *data, int size, struct sockaddr_in &from)
+	{
+		uint64_t now = bdClockUsecs();
+
+		/* FNV-1a, cpu bound */
+		uint32_t h = 2166136261u;
+		for(int r = 0; r < mWorkRounds; r++)
+		{
+			for(int i = 0; i < size; i++)
+			{
+				h = (h ^ ((unsigned char *) data)[i]) * 16777619u;
+			}
+		}
+		mSink = h;
+
+		uint64_t zero = 0;
+		mFirstUsecs.compare_exchange_strong(zero, now);
+		mLastUsecs.store(bdClockUsecs());
+		mCount++;
+		return 1;
+	}
+	virtual int status(std::ostream &out) { return 1; }
+
+	int mWorkRounds;
+	volatile uint32_t mSink;
+	std::atomic<uint32_t> mCount;
+	std::atomic<uint64_t> mFirstUsecs;
+	std::atomic<uint64_t> mLastUsecs;
+};
+
+static void blast(struct sockaddr_in &to, int count, int size)
+{
+	int socks[SENDER_SOCKS];
+	for(int i = 0; i < SENDER_SOCKS; i++)
+	{
+		socks[i] = socket(PF_INET, SOCK_DGRAM, 0);
+	}
+
+	char buf[UDP_RECV_BUF_SIZE];
+	memset(buf, 0, sizeof(buf));
+	for(int i = 0; i < count; i++)
+	{
+		sendto(socks[i % SENDER_SOCKS], buf, size, 0, (struct sockaddr *) &to, sizeof(to));
+	}
+
+	for(int i = 0; i < SENDER_SOCKS; i++)
+	{
+		close(socks[i]);
+	}
+}
+
+static double runShards(int shards, int port, int count, int size, int workRounds)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	/* not torn down: each run gets a port of its own */
+	UdpStack *udpstack = new UdpStack(addr, shards);
+	BusyReceiver *receiver = new BusyReceiver(workRounds);
+	udpstack->addReceiver(receiver);
+
+	pid_t pids[SENDERS];
+	for(int i = 0; i < SENDERS; i++)
+	{
+		pids[i] = fork();
+		if (pids[i] == 0)
+		{
+			blast(addr, count / SENDERS, size);
+			_exit(0);
+		}
+	}
+	for(int i = 0; i < SENDERS; i++)
+	{
+		waitpid(pids[i], NULL, 0);
+	}
+
+	uint32_t last;
+	do
+	{
+		last = receiver->mCount;
+		usleep(RECV_IDLE_USECS);
+	} while(last != receiver->mCount);
+	udpstack->removeReceiver(receiver);
+
+	uint32_t recvd = receiver->mCount;
+	uint64_t usecs = receiver->mLastUsecs - receiver->mFirstUsecs;
+	double rate = usecs ? recvd * 1000000.0 / usecs : 0.0;
+
+	printf("%2d shards (%2d open) : %7u pkts (%4.1f%% lost) in %.3f secs, %.0f pkts/sec\n",
+			shards, udpstack->shards(), recvd, 100.0 * (count - recvd) / count,
+			usecs / 1000000.0, rate);
+	return rate;
+}
+
+int main(int argc, char **argv)
+{
+	int port = DEF_PORT;
+	int count = DEF_COUNT;
+	int size = DEF_SIZE;
+	int workRounds = DEF_WORK_ROUNDS;
+	int maxShards = DEF_MAX_SHARDS;
+
+	int c;
+	while((c = getopt(argc, argv, "p:n:s:w:N:")) != -1)
+	{
+		switch(c)
+		{
+			case 'p':
+				port = atoi(optarg);
+				break;
+			case 'n':
+				count = atoi(optarg);
+				break;
+			case 's':
+				size = atoi(optarg);
+				break;
+			case 'w':
+				workRounds = atoi(optarg);
+				break;
+			case 'N':
+				maxShards = atoi(optarg);
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-p port] [-n packets] [-s size] [-w hash rounds] [-N max shards]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if ((size < 1) || (size > UDP_RECV_BUF_SIZE) || (count < SENDERS) ||
+		(maxShards < 1) || (maxShards > UDP_MAX_SHARDS))
+	{
+		fprintf(stderr, "size must be 1 to %d bytes, shards 1 to %d\n",
+				UDP_RECV_BUF_SIZE, UDP_MAX_SHARDS);
+		return 1;
+	}
+
+	printf("%d packets of %d bytes, %d hash rounds each\n", count, size, workRounds);
+
+	double base = 0;
+	for(int shards = 1; shards <= maxShards; shards *= 2)
+	{
+		double rate = runShards(shards, port + shards, count, size, workRounds);
+		if (shards == 1)
+		{
+			base = rate;
+		}
+		else if (base > 0)
+		{
+			printf("                      speedup x%.2f\n", rate / base);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * bitdht/udpshard_test.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "udp/udpstack.h"
+#include "utest.h"
+
+#include <unistd.h>
+#include <string.h>
+
+/*******************************************************************
+ * Test of the SO_REUSEPORT receive shards in udpstack.cc
+ *
+ * Many clients ping a sharded UdpStack, which echoes from the receive
+ * thread. Checks the kernel spreads them over the shards, and every
+ * reply - and a later one sent from another thread - leaves from the
+ * shard the client was heard on.
+ */
+
+#define SHARD_PORT	17800
+#define SHARDS		4
+#define CLIENTS		32
+#define RECV_USECS	300000
+
+class EchoReceiver: public UdpReceiver
+{
+public:
+	EchoReceiver(UdpStack *stack)
+		:mStack(stack), mCount(0) { return; }
+
+	virtual int recvPkt(void *data, int size, struct sockaddr_in &from)
+	{
+		mStack->sendPkt(data, size, from, 64);
+		mCount++;
+		return 1;
+	}
+	virtual int status(std::ostream &out) { return 1; }
+
+	UdpStack *mStack;
+	std::atomic<int> mCount;
+};
+
+static struct sockaddr_in loopback(int port)
+{
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	return addr;
+}
+
+static bool shardsBalanced(UdpStack *stack, int &used)
+{
+	bool balanced = true;
+	used = 0;
+	for(int i = 0; i < stack->shards(); i++)
+	{
+		uint64_t recvCalls, recvPkts, sendCalls, sendPkts;
+		stack->getShardIOStats(i, recvCalls, recvPkts, sendCalls, sendPkts);
+		if (recvPkts != sendPkts)
+		{
+			balanced = false;
+		}
+		if (recvPkts)
+		{
+			used++;
+		}
+	}
+	return balanced;
+}
+
+INITTEST();
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in local = loopback(SHARD_PORT);
+	UdpStack *udpstack = new UdpStack(local, SHARDS);
+	EchoReceiver *echo = new EchoReceiver(udpstack);
+	udpstack->addReceiver(echo);
+
+#ifdef SO_REUSEPORT
+	CHECK(udpstack->shards() == SHARDS);
+#else
+	CHECK(udpstack->shards() == 1);
+#endif
+
+	/* a fixed port is needed to share it */
+	struct sockaddr_in anyport = loopback(0);
+	UdpStack *ephemeral = new UdpStack(anyport, SHARDS);
+	CHECK(ephemeral->shards() == 1);
+
+	REPORT("Shard Setup");
+
+	int socks[CLIENTS];
+	struct timeval tv;
+	tv.tv_sec = 0;
+	tv.tv_usec = RECV_USECS;
+	for(int i = 0; i < CLIENTS; i++)
+	{
+		socks[i] = socket(PF_INET, SOCK_DGRAM, 0);
+		struct sockaddr_in client = loopback(0);
+		bind(socks[i], (struct sockaddr *) &client, sizeof(client));
+		setsockopt(socks[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		sendto(socks[i], "ping", 4, 0, (struct sockaddr *) &local, sizeof(local));
+	}
+
+	int replies = 0;
+	for(int i = 0; i < CLIENTS; i++)
+	{
+		char buf[64];
+		struct sockaddr_in from;
+		socklen_t fromlen = sizeof(from);
+		if ((4 == recvfrom(socks[i], buf, sizeof(buf), 0, (struct sockaddr *) &from, &fromlen)) &&
+			(from.sin_port == local.sin_port))
+		{
+			replies++;
+		}
+	}
+	CHECK(replies == CLIENTS);
+	CHECK(echo->mCount == CLIENTS);
+
+	int used = 0;
+	CHECK(shardsBalanced(udpstack, used));
+#ifdef SO_REUSEPORT
+	CHECK(used > 1);
+#endif
+
+	REPORT("Replies From The Receiving Shard");
+
+	/* sent from this thread, they still follow the client's shard */
+	for(int i = 0; i < CLIENTS; i++)
+	{
+		struct sockaddr_in client;
+		socklen_t len = sizeof(client);
+		getsockname(socks[i], (struct sockaddr *) &client, &len);
+		client.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		/* counts as a receive on the shard, to compare against */
+		sendto(socks[i], "ping", 4, 0, (struct sockaddr *) &local, sizeof(local));
+		usleep(1000);
+		udpstack->sendPkt("late", 4, client, 64);
+	}
+	usleep(RECV_USECS);
+
+	uint64_t total = 0;
+	for(int i = 0; i < udpstack->shards(); i++)
+	{
+		uint64_t recvCalls, recvPkts, sendCalls, sendPkts;
+		udpstack->getShardIOStats(i, recvCalls, recvPkts, sendCalls, sendPkts);
+		/* per client: two pings in, two echoes and a late reply out */
+		CHECK(2 * sendPkts == 3 * recvPkts);
+		total += recvPkts;
+	}
+	CHECK(total == 2 * CLIENTS);
+
+	REPORT("Later Sends Follow The Peer");
+
+	/* removing a receiver waits for deliveries on every shard */
+	CHECK(udpstack->removeReceiver(echo));
+	for(int i = 0; i < CLIENTS; i++)
+	{
+		sendto(socks[i], "ping", 4, 0, (struct sockaddr *) &local, sizeof(local));
+		close(socks[i]);
+	}
+	usleep(RECV_USECS);
+	CHECK(echo->mCount == 2 * CLIENTS);
+
+	REPORT("Remove Receiver");
+
+	FINALREPORT("UdpStack Shard Tests");
+	return TESTRESULT();
+}
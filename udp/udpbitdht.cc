@@ -58,7 +58,7 @@ UdpBitDht::UdpBitDht(UdpPublisher *pub,
 		const std::string &bootstrapfile,
 		const std::string &whitelist,
 		bdDhtFunctions *fns, PacketCallback *packetCallback) :
-		UdpSubReceiver(pub), mFns(fns)
+		UdpSubReceiver(pub), mFns(fns), mSendBatch(UDP_DEF_BATCH)
 {
 	std::string usedVersion;
 
@@ -93,6 +93,7 @@ void UdpBitDht::addFindNode(bdNodeId *id, uint32_t mode)
 	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
 	mBitDhtManager->addFindNode(id, mode);
+	mReactor.wakeup();
 }
 
 void UdpBitDht::removeFindNode(bdNodeId *id)
@@ -100,6 +101,7 @@ void UdpBitDht::removeFindNode(bdNodeId *id)
 	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
 	mBitDhtManager->removeFindNode(id);
+	mReactor.wakeup();
 }
 
 void UdpBitDht::removeAllFindNode()
@@ -107,6 +109,7 @@ void UdpBitDht::removeAllFindNode()
 	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
 	mBitDhtManager->removeAllFindNode();
+	mReactor.wakeup();
 }
 
 void UdpBitDht::findDhtValue(bdNodeId *id, std::string key, uint32_t mode)
@@ -114,6 +117,7 @@ void UdpBitDht::findDhtValue(bdNodeId *id, std::string key, uint32_t mode)
 	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
 	mBitDhtManager->findDhtValue(id, key, mode);
+	mReactor.wakeup();
 }
 
 /***** Add / Remove Callback Clients *****/
@@ -151,14 +155,18 @@ int UdpBitDht:: startDht()
 {
 	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
-	return mBitDhtManager->startDht();
+	int ret = mBitDhtManager->startDht();
+	mReactor.wakeup();
+	return ret;
 }
 
 int UdpBitDht:: stopDht()
 {
 	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
-	return mBitDhtManager->stopDht();
+	int ret = mBitDhtManager->stopDht();
+	mReactor.wakeup();
+	return ret;
 }
 
 int UdpBitDht::stateDht() 
@@ -182,25 +190,114 @@ uint32_t UdpBitDht::statsBDVersionSize()
 	return mBitDhtManager->statsBDVersionSize();
 }
 
+double	UdpBitDht::statsAddrCacheHitRate()
+{
+	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
+
+	return mBitDhtManager->statsAddrCacheHitRate();
+}
+
+void	UdpBitDht::setQueryPeriod(time_t period)
+{
+	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
+
+	mBitDhtManager->setQueryPeriod(period);
+}
+
+void	UdpBitDht::setMaxQueries(uint32_t maxQueries)
+{
+	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
+
+	mBitDhtManager->setMaxQueries(maxQueries);
+}
+
+void	UdpBitDht::setMsgRate(int type, double rate)
+{
+	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
+
+	mBitDhtManager->setMsgRate(type, rate);
+	mReactor.wakeup();
+}
+
+void	UdpBitDht::setSendBatch(int count)
+{
+	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
+
+	if (count < 1)
+	{
+		count = 1;
+	}
+	else if (count > BDNET_BATCH_MAX)
+	{
+		count = BDNET_BATCH_MAX;
+	}
+	mSendBatch = count;
+}
+
+void	UdpBitDht::setRecvShards(int shards)
+{
+	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
+
+	mBitDhtManager->setIncomingShards((shards > 0) ? shards : 1);
+}
+
+void	UdpBitDht::setAdaptiveMsgRate(bool adaptive)
+{
+	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
+
+	mBitDhtManager->setAdaptiveMsgRate(adaptive);
+}
+
+int	UdpBitDht::loadBlackList(const std::string &file)
+{
+	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
+
+	return mBitDhtManager->loadBlackList(file);
+}
+
+bool	UdpBitDht::getExternalAddress(struct sockaddr_in &addr)
+{
+	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
+
+	return mBitDhtManager->getExternalAddress(addr);
+}
+
+uint32_t UdpBitDht::getNatType()
+{
+	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
+
+	return mBitDhtManager->getNatType();
+}
+
 /******************* Internals *************************/
 
 /***** Iteration / Loop Management *****/
 
 /*** Overloaded from UdpSubReceiver ***/
+/* runs in the receive thread, and never takes dhtMtx: the blacklist has
+ * its own lock, the packet check is stateless and the datagram goes
+ * into the node's lock-free incoming ring. So receiving never waits
+ * for an iteration to finish.
+ */
 int UdpBitDht::recvPkt(void *data, int size, struct sockaddr_in &from)
 {
-	/* pass onto bitdht */
-	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
 #ifdef DEBUG_UDP_BITDHT
 	LOG.info("UdpBitDht::recvPkt() ******************************* Address:%s:%d",
 			inet_ntoa(from.sin_addr), htons(from.sin_port));
 #endif
 
+	/* blacklisted: swallow it before it is decoded or queued */
+	if (mBitDhtManager->isMemberOfBlackList(from))
+	{
+		return 1;
+	}
+
 	/* check packet suitability */
 	if (mBitDhtManager->isBitDhtPacket((char *) data, size, from))
 	{
-		mBitDhtManager->incomingMsg(&from, (char *) data, size);
+		mBitDhtManager->incomingMsg(&from, (char *) data, size, UdpLayer::recvShard());
+		mReactor.wakeup();
 		return 1;
 	}
 	else {
@@ -221,52 +318,127 @@ int UdpBitDht::status(std::ostream &out)
 }
 
 /*** Overloaded from iThread ***/
-#define MAX_MSG_PER_TICK	100
-#define TICK_PAUSE_USEC		20000  /* 20ms secs .. max messages = 50 x 100 = 5000 */
+#define ITERATION_USEC		1000000 /* the manager's timers assume one iteration per second */
 
 void UdpBitDht::run()
 {
+	uint64_t nextIteration = bdClockUsecs();
+
 	while(1)
 	{
-		while(tick())
+		uint64_t now = bdClockUsecs();
+		if (now >= nextIteration)
 		{
-			usleep(TICK_PAUSE_USEC);
+			bdStackMutex stack(dhtMtx);
+			mBitDhtManager->iteration();
+
+			nextIteration += ITERATION_USEC;
+			if (nextIteration <= now)
+			{
+				nextIteration = now + ITERATION_USEC; /* fell behind, don't catch up */
+			}
+		}
+		else
+		{
+			/* woken early - answer what has arrived, send what is now allowed */
+			bdStackMutex stack(dhtMtx);
+			mBitDhtManager->fastIteration();
 		}
 
+		tick();
+
+		/* sleep until the next iteration, or the next paced send */
+		uint64_t deadline = nextIteration;
+		uint64_t waitUsecs;
 		{
 			bdStackMutex stack(dhtMtx);
-			mBitDhtManager->iteration();
+			if (mBitDhtManager->nextPacedSend(waitUsecs))
+			{
+				now = bdClockUsecs();
+				if ((deadline > now) && (waitUsecs < deadline - now))
+				{
+					deadline = now + waitUsecs;
+				}
+			}
 		}
-		sleep(1);
+
+		mReactor.wait(deadline);
 	}
 }
 
+/* outgoing messages are paced by the node's rate controller,
+ * so just pass on everything that is queued - straight from the
+ * node's slot, the only copy is into the kernel. Up to mSendBatch
+ * msgs go down in one syscall.
+ */
 int UdpBitDht::tick()
 {
 	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
 	/* pass on messages from the node */
 	int i = 0;
-	char data[BITDHT_MAX_PKTSIZE];
-	struct sockaddr_in toAddr;
-	int size = BITDHT_MAX_PKTSIZE;
+	bdMsgSlot *msg;
+
+	struct bdnet_dgram batch[BDNET_BATCH_MAX];
+	bdMsgSlot *slots[BDNET_BATCH_MAX];
+	int nbatch = 0;
 
-	while((i < MAX_MSG_PER_TICK) && (mBitDhtManager->outgoingMsg(&toAddr, data, &size)))
+	while(NULL != (msg = mBitDhtManager->popOutgoingMsg()))
 	{
 #ifdef DEBUG_UDP_BITDHT 
-		LOG.info("UdpBitDht::tick() outgoing msg(%d) to %s", size, toAddr);
+		LOG.info("UdpBitDht::tick() outgoing msg(%d) to %s:%d", msg->mSize,
+				inet_ntoa(msg->addr.sin_addr), ntohs(msg->addr.sin_port));
 #endif
 
-		sendPkt(data, size, toAddr, BITDHT_TTL);
+		if (msg->mRepeat > 1)
+		{
+			/* keep the order: anything batched goes first */
+			flushBatch(batch, slots, nbatch);
+
+			/* punch burst: one syscall for all the copies */
+			sendPktBurst(msg->data, msg->mSize, msg->addr, BITDHT_TTL, msg->mRepeat);
+			mBitDhtManager->releaseOutgoingMsg(msg);
+		}
+		else
+		{
+			batch[nbatch].buf = msg->data;
+			batch[nbatch].len = msg->mSize;
+			batch[nbatch].addr = msg->addr;
+			slots[nbatch] = msg;
+			if (++nbatch >= mSendBatch)
+			{
+				flushBatch(batch, slots, nbatch);
+			}
+		}
 
 		// iterate
 		i++;
-		size = BITDHT_MAX_PKTSIZE; // reset msg size!
+	}
+	flushBatch(batch, slots, nbatch);
+
+	return i;
+}
+
+/* called with dhtMtx held */
+void UdpBitDht::flushBatch(struct bdnet_dgram *batch, bdMsgSlot **slots, int &count)
+{
+	if (count == 0)
+	{
+		return;
 	}
 
-	if (i == MAX_MSG_PER_TICK)
+	if (count == 1)
 	{
-		return 1; /* keep on ticking */
+		sendPkt(batch[0].buf, batch[0].len, batch[0].addr, BITDHT_TTL);
 	}
-	return 0;
+	else
+	{
+		sendPktBatch(batch, count, BITDHT_TTL);
+	}
+
+	for(int i = 0; i < count; i++)
+	{
+		mBitDhtManager->releaseOutgoingMsg(slots[i]);
+	}
+	count = 0;
 }
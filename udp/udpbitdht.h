@@ -32,6 +32,7 @@
 #include <string>
 
 #include "udp/udpstack.h"
+#include "util/bdreactor.h"
 #include "bitdht/bdiface.h"
 #include "bitdht/bdmanager.h"
 
@@ -84,6 +85,32 @@ public:
 	virtual int stateDht();
 	virtual uint32_t statsNetworkSize();
 	virtual uint32_t statsBDVersionSize();
+	double	statsAddrCacheHitRate();
+
+	/* re-lookup scheduling of tracked peers */
+	void	setQueryPeriod(time_t period);
+	void	setMaxQueries(uint32_t maxQueries);
+
+	/* outbound rate limits (msgs/sec), see bitdht/bdratectrl.h */
+	void	setMsgRate(int type, double rate);
+	void	setAdaptiveMsgRate(bool adaptive);
+
+	/* outgoing msgs handed down per send syscall (1 - BDNET_BATCH_MAX) */
+	void	setSendBatch(int count);
+
+	/* a queue into the node per receive shard of the UdpStack */
+	void	setRecvShards(int shards);
+
+	/* blacklisted senders are dropped on arrival, see bitdht/bdblacklist.h
+	 * returns the number of rules added, -1 if the file can't be read.
+	 */
+	int	loadBlackList(const std::string &file);
+
+	/* our external address as voted by peers, and the NAT type
+	 * (BITDHT_NAT_xxx) judged from their reports. see bitdht/bdextaddr.h
+	 */
+	bool	getExternalAddress(struct sockaddr_in &addr);
+	uint32_t getNatType();
 
 	/******************* Internals *************************/
 	/***** Iteration / Loop Management *****/
@@ -101,9 +128,13 @@ public:
 
 private:
 
+	void	flushBatch(struct bdnet_dgram *batch, bdMsgSlot **slots, int &count);
+
 	bdMutex dhtMtx; /* for all class data (below) */
+	bdReactor mReactor; /* run() sleeps here, woken by packets and api calls */
 	bdNodeManager *mBitDhtManager;
 	bdDhtFunctions *mFns;
+	int	mSendBatch;
 };
 
 
@@ -30,6 +30,7 @@
 #include <iomanip>
 #include <string.h>
 #include <stdlib.h>
+#include <sched.h>
 
 #include "util/bdlog.h"
 
@@ -164,8 +165,19 @@ std::string printPktOffset(unsigned int offset, void *d, unsigned int size)
 
 
 
-UdpLayer::UdpLayer(UdpReceiver *udpr, struct sockaddr_in &local) :
-				recv(udpr), laddr(local), errorState(0), ttl(UDP_DEF_TTL)
+/* set once by each receive thread */
+static thread_local int udplayer_recv_shard = 0;
+
+int UdpLayer::recvShard()
+{
+	return udplayer_recv_shard;
+}
+
+UdpLayer::UdpLayer(UdpReceiver *udpr, struct sockaddr_in &local, int shard, bool reusePort) :
+				recv(udpr), laddr(local), mShard(shard), mReusePort(reusePort),
+				errorState(0), sockfd(-1),
+				ttl(UDP_DEF_TTL), mSenders(0), mRecvBatch(UDP_DEF_BATCH),
+				mRecvCalls(0), mRecvPkts(0), mSendCalls(0), mSendPkts(0), mRecvTrunc(0)
 {
 	openSocket();
 	return;
@@ -175,7 +187,13 @@ int UdpLayer::status(std::ostream &out)
 {
 	out << "UdpLayer::status()" << std::endl;
 	out << "localaddr: " << laddr << std::endl;
-	out << "sockfd: " << sockfd << std::endl;
+	out << "shard: " << mShard << std::endl;
+	out << "sockfd: " << sockfd.load() << std::endl;
+	out << "recv: " << mRecvPkts.load() << " pkts in " << mRecvCalls.load() << " calls";
+	out << " (batch " << mRecvBatch.load() << ")" << std::endl;
+	out << "send: " << mSendPkts.load() << " pkts in " << mSendCalls.load() << " calls";
+	out << std::endl;
+	out << "truncated: " << mRecvTrunc.load() << std::endl;
 	out << std::endl;
 	return 1;
 }
@@ -195,6 +213,7 @@ int UdpLayer::reset(struct sockaddr_in &local)
 #endif
 		stopThread = true;
 	}
+	mReactor.wakeup();
 #ifdef DEBUG_UDP_LAYER
 	debug << "UdpLayer::reset() joining" << std::endl;
 #endif
@@ -227,9 +246,18 @@ int UdpLayer::closeSocket()
 	/* close socket if open */
 	sockMtx.lock();   /********** LOCK MUTEX *********/
 
-	if (sockfd > 0)
+	/* no new sends can start on the old socket, then wait out the
+	 * ones already in the syscall (the recv thread has been joined).
+	 */
+	int fd = sockfd.exchange(-1);
+	while(mSenders.load() != 0)
+	{
+		sched_yield();
+	}
+
+	if (fd > 0)
 	{
-		bdnet_close(sockfd);
+		bdnet_close(fd);
 	}
 
 	sockMtx.unlock(); /******** UNLOCK MUTEX *********/
@@ -242,68 +270,101 @@ void UdpLayer::run()
 }
 
 /* higher level interface */
+#define MAX_PKTS_PER_WAKEUP	64
+
 void UdpLayer::recv_loop()
 {
-	int maxsize = 16000;
-	void *inbuf = malloc(maxsize);
+	/* one buffer per batch entry, receivers may modify them in place */
+	char *inbuf = (char *) malloc(BDNET_BATCH_MAX * UDP_RECV_BUF_SIZE);
+	struct bdnet_dgram msgs[BDNET_BATCH_MAX];
+	for(int i = 0; i < BDNET_BATCH_MAX; i++)
+	{
+		msgs[i].buf = inbuf + i * UDP_RECV_BUF_SIZE;
+		msgs[i].size = UDP_RECV_BUF_SIZE;
+	}
+	udplayer_recv_shard = mShard;
 
-	int status;
-	struct timeval timeout;
+	{
+		bdStackMutex stack(sockMtx);   /********** LOCK MUTEX *********/
+		mReactor.addFd(sockfd.load());
+	}
 
 	while(1)
 	{
-		fd_set rset;
-		for(;;)
+		/* check if we need to stop */
+		bool toStop = false;
+		{
+			bdStackMutex stack(sockMtx);   /********** LOCK MUTEX *********/
+			toStop = stopThread;
+		}
+
+		if (toStop)
 		{
-			/* check if we need to stop */
-			bool toStop = false;
+#ifdef DEBUG_UDP_LAYER
+			debug << "UdpLayer::recv_loop() stopping thread" << std::endl;
+#endif
 			{
 				bdStackMutex stack(sockMtx);   /********** LOCK MUTEX *********/
-				toStop = stopThread;
+				mReactor.removeFd(sockfd.load());
 			}
+			free(inbuf);
+			stop();
+		}
+
+		/* sleep until data arrives, or reset() wakes us */
+		if (!(mReactor.wait(0) & BITDHT_REACTOR_EVENT_FD))
+		{
+			continue;
+		}
 
-			if (toStop)
+		/* non-blocking socket: take what is queued, epoll fires again for the rest */
+		int batch = mRecvBatch.load(std::memory_order_relaxed);
+		for(int done = 0; done < MAX_PKTS_PER_WAKEUP; )
+		{
+			int n = receiveUdpBatch(msgs, batch);
+			if (n <= 0)
 			{
 #ifdef DEBUG_UDP_LAYER
-				debug << "UdpLayer::recv_loop() stopping thread" << std::endl;
+				debug << "UdpLayer::recv_loop() not ready" << std::endl;
 #endif
-				stop();
+				break;
 			}
 
-			FD_ZERO(&rset);
-			FD_SET(sockfd, &rset);
-			timeout.tv_sec = 0;
-			timeout.tv_usec = 500000;       /* 500 ms timeout */
-			status = select(sockfd+1, &rset, NULL, NULL, &timeout);
-			if (status > 0)
+#ifdef DEBUG_UDP_LAYER
+			debug << "UdpLayer::recv_loop() " << n << " pkts" << std::endl;
+#endif
+			/* half a datagram is no use to anyone above */
+			int kept = 0;
+			for(int i = 0; i < n; i++)
 			{
-				break;  /* data available, go read it */
+				if (msgs[i].trunc)
+				{
+					continue;
+				}
+				if (i != kept)
+				{
+					struct bdnet_dgram tmp = msgs[kept];
+					msgs[kept] = msgs[i];
+					msgs[i] = tmp;
+				}
+				kept++;
 			}
-			else if (status < 0) 
+			if (kept < n)
 			{
-#ifdef DEBUG_UDP_LAYER
-				debug << "UdpLayer::recv_loop() Error: " << bdnet_errno() << std::endl;
-#endif
+				mRecvTrunc.fetch_add(n - kept, std::memory_order_relaxed);
 			}
-		};
 
-		int nsize = maxsize;
-		struct sockaddr_in from;
-		if (0 < receiveUdpPacket(inbuf, &nsize, from))
-		{
-#ifdef DEBUG_UDP_LAYER
-			debug << "UdpLayer::readPkt()  from : " << from << std::endl;
-			debug << printPkt(inbuf, nsize);
-#endif
 			// send to reciever.
-			recv -> recvPkt(inbuf, nsize, from);
-		}
-		else
-		{
-#ifdef DEBUG_UDP_LAYER
-			debug << "UdpLayer::readPkt() not ready" << from;
-			debug << std::endl;
-#endif
+			if (kept > 0)
+			{
+				recv -> recvPktBatch(msgs, kept);
+			}
+
+			done += n;
+			if (n < batch)
+			{
+				break; /* drained */
+			}
 		}
 	}
 	return;
@@ -327,13 +388,109 @@ int UdpLayer::sendPkt(const void *data, int size, sockaddr_in &to, int ttl)
 	return size;
 }
 
+int UdpLayer::sendPktBurst(const void *data, int size, sockaddr_in &to, int ttl, int count)
+{
+	if (ttl != getTTL())
+	{
+		setTTL(ttl);
+	}
+
+#ifdef DEBUG_UDP_LAYER
+	debug << "UdpLayer::sendPktBurst() x" << count << " to: " << to << std::endl;
+#endif
+	return sendUdpBurst(data, size, to, count);
+}
+
+int UdpLayer::sendPktBatch(const struct bdnet_dgram *msgs, int count, int ttl)
+{
+	if (ttl != getTTL())
+	{
+		setTTL(ttl);
+	}
+
+#ifdef DEBUG_UDP_LAYER
+	debug << "UdpLayer::sendPktBatch() x" << count << std::endl;
+#endif
+	return sendUdpBatch(msgs, count);
+}
+
+void UdpLayer::setRecvBatch(int count)
+{
+	if (count < 1)
+	{
+		count = 1;
+	}
+	else if (count > BDNET_BATCH_MAX)
+	{
+		count = BDNET_BATCH_MAX;
+	}
+	mRecvBatch.store(count);
+}
+
+int UdpLayer::getRecvBatch()
+{
+	return mRecvBatch.load();
+}
+
+void UdpLayer::getIOStats(uint64_t &recvCalls, uint64_t &recvPkts,
+		uint64_t &sendCalls, uint64_t &sendPkts)
+{
+	recvCalls = mRecvCalls.load();
+	recvPkts = mRecvPkts.load();
+	sendCalls = mSendCalls.load();
+	sendPkts = mSendPkts.load();
+}
+
+uint64_t UdpLayer::getTruncated()
+{
+	return mRecvTrunc.load();
+}
+
+/* default for receivers that can't do better */
+int UdpReceiver::recvPktBatch(struct bdnet_dgram *msgs, int count)
+{
+	for(int i = 0; i < count; i++)
+	{
+		recvPkt(msgs[i].buf, msgs[i].len, msgs[i].addr);
+	}
+	return count;
+}
+
+/* default for publishers that can't do better */
+int UdpPublisher::sendPktBurst(const void *data, int size, struct sockaddr_in &to, int ttl, int count)
+{
+	int sent = 0;
+	for(int i = 0; i < count; i++)
+	{
+		if (0 < sendPkt(data, size, to, ttl))
+		{
+			sent++;
+		}
+	}
+	return sent;
+}
+
+int UdpPublisher::sendPktBatch(const struct bdnet_dgram *msgs, int count, int ttl)
+{
+	int sent = 0;
+	for(int i = 0; i < count; i++)
+	{
+		struct sockaddr_in to = msgs[i].addr;
+		if (0 < sendPkt(msgs[i].buf, msgs[i].len, to, ttl))
+		{
+			sent++;
+		}
+	}
+	return sent;
+}
+
 /* setup connections */
 int UdpLayer::openSocket()	
 {
 	sockMtx.lock();   /********** LOCK MUTEX *********/
 
-	/* make a socket */
-	sockfd = bdnet_socket(PF_INET, SOCK_DGRAM, 0);
+	/* make a socket, published once it is set up */
+	int fd = bdnet_socket(PF_INET, SOCK_DGRAM, 0);
 #ifdef DEBUG_UDP_LAYER
 	debug << "UpdStreamer::openSocket()" << std::endl;
 #endif
@@ -344,12 +501,26 @@ int UdpLayer::openSocket()
 	bdnet_inet_aton("127.0.0.1", &(laddr.sin_addr));
 #endif
 
+#ifdef SO_REUSEPORT
+	/* every shard sets it before binding, or the later binds fail */
+	if (mReusePort)
+	{
+		int on = 1;
+		if (-1 == bdnet_setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)))
+		{
+#ifdef DEBUG_UDP_LAYER
+			debug << "Failed to set SO_REUSEPORT" << std::endl;
+#endif
+		}
+	}
+#endif
+
 #ifdef OPEN_UNIVERSAL_PORT
 	struct sockaddr_in tmpaddr = laddr;
 	tmpaddr.sin_addr.s_addr = 0;
-	if (0 != bdnet_bind(sockfd, (struct sockaddr *) (&tmpaddr), sizeof(tmpaddr)))
+	if (0 != bdnet_bind(fd, (struct sockaddr *) (&tmpaddr), sizeof(tmpaddr)))
 #else
-	if (0 != bdnet_bind(sockfd, (struct sockaddr *) (&laddr), sizeof(laddr)))
+	if (0 != bdnet_bind(fd, (struct sockaddr *) (&laddr), sizeof(laddr)))
 #endif
 	{
 #ifdef DEBUG_UDP_LAYER
@@ -359,11 +530,12 @@ int UdpLayer::openSocket()
 		errorState = EADDRINUSE;
 		//exit(1);
 
+		sockfd.store(fd);
 		sockMtx.unlock(); /******** UNLOCK MUTEX *********/
 		return -1;
 	}
 
-	if (-1 == bdnet_fcntl(sockfd, F_SETFL, O_NONBLOCK))
+	if (-1 == bdnet_fcntl(fd, F_SETFL, O_NONBLOCK))
 	{
 #ifdef DEBUG_UDP_LAYER
 		debug << "Failed to Make Non-Blocking" << std::endl;
@@ -373,7 +545,7 @@ int UdpLayer::openSocket()
 #ifdef UDP_ENABLE_BROADCAST
 	/* Setup socket for broadcast. */
 	int val = 1;
-	if (-1 == setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, &val, sizeof(int)))
+	if (-1 == setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &val, sizeof(int)))
 	{
 #ifdef DEBUG_UDP_LAYER
 		debug << "Failed to Make Socket Broadcast" << std::endl;
@@ -382,6 +554,7 @@ int UdpLayer::openSocket()
 #endif
 
 	errorState = 0;
+	sockfd.store(fd);
 
 #ifdef DEBUG_UDP_LAYER
 	debug << "Socket Bound to : " << laddr << std::endl;
@@ -405,14 +578,17 @@ int UdpLayer::openSocket()
 	return 1;
 }
 
+/* rarely changes: callers compare against the cached value first */
 int UdpLayer::setTTL(int t)
 {
-	sockMtx.lock();   /********** LOCK MUTEX *********/
-
-	int err = bdnet_setsockopt(sockfd, IPPROTO_IP, IP_TTL, &t, sizeof(int));
-	ttl = t;
-
-	sockMtx.unlock(); /******** UNLOCK MUTEX *********/
+	int err = -1;
+	int fd = acquireSocket();
+	if (fd >= 0)
+	{
+		err = bdnet_setsockopt(fd, IPPROTO_IP, IP_TTL, &t, sizeof(int));
+		releaseSocket();
+	}
+	ttl.store(t, std::memory_order_relaxed);
 
 #ifdef DEBUG_UDP_LAYER
 	debug << "UdpLayer::setTTL(" << t << ") returned: " << err;
@@ -424,13 +600,26 @@ int UdpLayer::setTTL(int t)
 
 int UdpLayer::getTTL()
 {
-	sockMtx.lock();   /********** LOCK MUTEX *********/
-
-	int t = ttl;
+	return ttl.load(std::memory_order_relaxed);
+}
 
-	sockMtx.unlock(); /******** UNLOCK MUTEX *********/
+/* seq_cst on both sides: either closeSocket() sees the count, or the
+ * sender sees the socket has gone.
+ */
+int UdpLayer::acquireSocket()
+{
+	mSenders.fetch_add(1);
+	int fd = sockfd.load();
+	if (fd < 0)
+	{
+		mSenders.fetch_sub(1);
+	}
+	return fd;
+}
 
-	return t;
+void UdpLayer::releaseSocket()
+{
+	mSenders.fetch_sub(1);
 }
 
 /* monitoring / updates */
@@ -465,31 +654,24 @@ int UdpLayer::tick()
 
 /******************* Internals *************************************/
 
-int UdpLayer::receiveUdpPacket(void *data, int *size, struct sockaddr_in &from)
+int UdpLayer::receiveUdpBatch(struct bdnet_dgram *msgs, int count)
 {
-	struct sockaddr_in fromaddr;
-	socklen_t fromsize = sizeof(fromaddr);
-	int insize = *size;
-
-	sockMtx.lock();   /********** LOCK MUTEX *********/
-
-	insize = bdnet_recvfrom(sockfd,data,insize,0,
-			(struct sockaddr*)&fromaddr,&fromsize);
-
-	sockMtx.unlock(); /******** UNLOCK MUTEX *********/
-
-	if (0 < insize)
+	/* only the recv thread reads, and reset() joins it before the
+	 * socket is closed.
+	 */
+	int calls = 0;
+	int n = bdnet_recvfrom_batch(sockfd.load(std::memory_order_relaxed), msgs, count, 0, &calls);
+
+	mRecvCalls.fetch_add(calls, std::memory_order_relaxed);
+	if (n > 0)
 	{
 #ifdef DEBUG_UDP_LAYER
-		debug << "receiveUdpPacket() from: " << fromaddr;
-		debug << " Size: " << insize;
+		debug << "receiveUdpBatch() " << n << " pkts, first from: " << msgs[0].addr;
 		debug << std::endl;
 #endif
-		*size = insize;
-		from = fromaddr;
-		return insize;
+		mRecvPkts.fetch_add(n, std::memory_order_relaxed);
 	}
-	return -1;
+	return n;
 }
 
 int UdpLayer::sendUdpPacket(const void *data, int size, struct sockaddr_in &to)
@@ -501,16 +683,81 @@ int UdpLayer::sendUdpPacket(const void *data, int size, struct sockaddr_in &to)
 #endif
 	struct sockaddr_in toaddr = to;
 
-	sockMtx.lock();   /********** LOCK MUTEX *********/
+	int fd = acquireSocket();
+	if (fd < 0)
+	{
+		return -1;
+	}
 
-	bdnet_sendto(sockfd, data, size, 0, 
+	int ret = bdnet_sendto(fd, data, size, 0, 
 			(struct sockaddr *) &(toaddr),
 			sizeof(toaddr));
 
-	sockMtx.unlock(); /******** UNLOCK MUTEX *********/
+	releaseSocket();
+
+	mSendCalls.fetch_add(1, std::memory_order_relaxed);
+	if (ret >= 0)
+	{
+		mSendPkts.fetch_add(1, std::memory_order_relaxed);
+	}
 	return 1;
 }
 
+/* one syscall per BDNET_BATCH_MAX of the burst, where the platform allows */
+int UdpLayer::sendUdpBurst(const void *data, int size, struct sockaddr_in &to, int count)
+{
+#ifdef DEBUG_UDP_LAYER
+	debug << "UdpLayer::sendUdpBurst(): size: " << size << " x" << count;
+	debug << " To: " << to << std::endl;
+#endif
+	struct sockaddr_in toaddr = to;
+
+	int fd = acquireSocket();
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	int calls = 0;
+	int sent = bdnet_sendto_burst(fd, data, size, 0,
+			(struct sockaddr *) &(toaddr),
+			sizeof(toaddr), count, &calls);
+
+	releaseSocket();
+
+	mSendCalls.fetch_add(calls, std::memory_order_relaxed);
+	if (sent > 0)
+	{
+		mSendPkts.fetch_add(sent, std::memory_order_relaxed);
+	}
+	return sent;
+}
+
+/* one syscall per BDNET_BATCH_MAX packets, where the platform allows */
+int UdpLayer::sendUdpBatch(const struct bdnet_dgram *msgs, int count)
+{
+#ifdef DEBUG_UDP_LAYER
+	debug << "UdpLayer::sendUdpBatch(): x" << count << std::endl;
+#endif
+	int fd = acquireSocket();
+	if (fd < 0)
+	{
+		return 0;
+	}
+
+	int calls = 0;
+	int sent = bdnet_sendto_batch(fd, msgs, count, 0, &calls);
+
+	releaseSocket();
+
+	mSendCalls.fetch_add(calls, std::memory_order_relaxed);
+	if (sent > 0)
+	{
+		mSendPkts.fetch_add(sent, std::memory_order_relaxed);
+	}
+	return (sent > 0) ? sent : 0;
+}
+
 
 /**************************** LossyUdpLayer - for Testing **************/
 
@@ -523,28 +770,37 @@ LossyUdpLayer::LossyUdpLayer(UdpReceiver *udpr,
 }
 LossyUdpLayer::~LossyUdpLayer() { return; }
 
-int LossyUdpLayer::receiveUdpPacket(void *data, int *size, struct sockaddr_in &from)
+/* each packet of the batch takes its own chances */
+int LossyUdpLayer::receiveUdpBatch(struct bdnet_dgram *msgs, int count)
 {
-	double prob = (1.0 * (rand() / (RAND_MAX + 1.0)));
-
-	if (prob < lossFraction)
+	int n = UdpLayer::receiveUdpBatch(msgs, count);
+	int kept = 0;
+	for(int i = 0; i < n; i++)
 	{
-		/* but discard */
-		if (0 < UdpLayer::receiveUdpPacket(data, size, from))
+		double prob = (1.0 * (rand() / (RAND_MAX + 1.0)));
+		if (prob < lossFraction)
 		{
+			/* discard */
 			std::ostringstream debug;
-			debug << "LossyUdpLayer::receiveUdpPacket() Dropping packet!";
-			debug << printPkt(data, *size);
-			debug << "LossyUdpLayer::receiveUdpPacket() Packet Dropped!";
+			debug << "LossyUdpLayer::receiveUdpBatch() Dropping packet!";
+			debug << printPkt(msgs[i].buf, msgs[i].len);
+			debug << "LossyUdpLayer::receiveUdpBatch() Packet Dropped!";
 			LOG.info(debug.str().c_str());
+			continue;
 		}
 
-		size = 0;
-		return -1;
+		/* swap, so every entry keeps a buffer of its own */
+		if (kept != i)
+		{
+			struct bdnet_dgram tmp = msgs[kept];
+			msgs[kept] = msgs[i];
+			msgs[i] = tmp;
+		}
+		kept++;
 	}
 
-	// otherwise read normally;
-	return UdpLayer::receiveUdpPacket(data, size, from);
+	/* a short batch ends this wakeup, the reactor fires again for the rest */
+	return (n > 0) ? kept : n;
 }
 
 int LossyUdpLayer::sendUdpPacket(const void *data, int size, struct sockaddr_in &to)
@@ -565,3 +821,23 @@ int LossyUdpLayer::sendUdpPacket(const void *data, int size, struct sockaddr_in
 	// otherwise read normally;
 	return UdpLayer::sendUdpPacket(data, size, to);
 }
+
+/* each copy takes its own chances */
+int LossyUdpLayer::sendUdpBurst(const void *data, int size, struct sockaddr_in &to, int count)
+{
+	for(int i = 0; i < count; i++)
+	{
+		sendUdpPacket(data, size, to);
+	}
+	return count;
+}
+
+int LossyUdpLayer::sendUdpBatch(const struct bdnet_dgram *msgs, int count)
+{
+	for(int i = 0; i < count; i++)
+	{
+		struct sockaddr_in to = msgs[i].addr;
+		sendUdpPacket(msgs[i].buf, msgs[i].len, to);
+	}
+	return count;
+}
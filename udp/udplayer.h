@@ -28,10 +28,12 @@
 
 #include "util/bdthreads.h"
 #include "util/bdnet.h"
+#include "util/bdreactor.h"
 
 #include <iosfwd>
 #include <list>
 #include <deque>
+#include <atomic>
 
 /* careful - duplicate definitions */
 //std::ostream &operator<<(std::ostream &out,  const struct sockaddr_in &addr);
@@ -46,13 +48,23 @@ std::string printPktOffset(unsigned int offset, void *d, unsigned int size);
 
 /* UdpLayer ..... is the bottom layer which 
  * just sends and receives Udp packets.
+ *
+ * Datagrams are moved in batches - one recvmmsg()/sendmmsg() for
+ * up to a batch of packets, where the platform has them (see
+ * util/bdnet.h). Batch sizes run from 1 (a syscall per packet) to
+ * BDNET_BATCH_MAX.
  */
 
+#define UDP_DEF_BATCH		32
+#define UDP_RECV_BUF_SIZE	16384	/* per datagram, larger ones are dropped */
+
 class UdpReceiver
 {
 public:
 	virtual ~UdpReceiver() {}
 	virtual int recvPkt(void *data, int size, struct sockaddr_in &from) = 0;
+	/* a batch from one syscall. default hands each to recvPkt() */
+	virtual int recvPktBatch(struct bdnet_dgram *msgs, int count);
 	virtual int status(std::ostream &out) = 0;
 };
 
@@ -61,6 +73,10 @@ class UdpPublisher
 public:
 	virtual ~UdpPublisher() {}
 	virtual	int sendPkt(const void *data, int size, struct sockaddr_in &to, int ttl) = 0;
+	/* the same packet count times, back to back. returns the number sent */
+	virtual	int sendPktBurst(const void *data, int size, struct sockaddr_in &to, int ttl, int count);
+	/* different packets (len and addr set), in order. returns the number sent */
+	virtual	int sendPktBatch(const struct bdnet_dgram *msgs, int count, int ttl);
 };
 
 
@@ -68,9 +84,18 @@ class UdpLayer: public bdThread
 {
 public:
 
-	UdpLayer(UdpReceiver *recv, struct sockaddr_in &local);
+	/* shard: index of this layer's socket when several share the port
+	 * with SO_REUSEPORT (reusePort), see UdpStack.
+	 */
+	UdpLayer(UdpReceiver *recv, struct sockaddr_in &local,
+			int shard = 0, bool reusePort = false);
 	virtual ~UdpLayer() { return; }
 
+	/* the shard of the layer whose receive thread is calling, 0 from
+	 * any other thread.
+	 */
+	static	int recvShard();
+
 	int 	reset(struct sockaddr_in &local); /* calls join, close, openSocket */
 
 	int     status(std::ostream &out);
@@ -87,35 +112,72 @@ public:
 	/* Higher Level Interface */
 	//int  readPkt(void *data, int *size, struct sockaddr_in &from);
 	int  sendPkt(const void *data, int size, struct sockaddr_in &to, int ttl);
+	int  sendPktBurst(const void *data, int size, struct sockaddr_in &to, int ttl, int count);
+	int  sendPktBatch(const struct bdnet_dgram *msgs, int count, int ttl);
+
+	/* datagrams taken per receive syscall (1 - BDNET_BATCH_MAX) */
+	void	setRecvBatch(int count);
+	int	getRecvBatch();
 
 	/* monitoring / updates */
 	int okay();
 	int tick();
 
+	/* socket calls made and datagrams moved, since the start */
+	void	getIOStats(uint64_t &recvCalls, uint64_t &recvPkts,
+			uint64_t &sendCalls, uint64_t &sendPkts);
+	/* datagrams dropped for not fitting UDP_RECV_BUF_SIZE */
+	uint64_t getTruncated();
+
 
 	/* data */
 	/* internals */
 protected:
 
-	virtual	int receiveUdpPacket(void *data, int *size, struct sockaddr_in &from);
+	/* the number received, <= 0 if none waiting */
+	virtual	int receiveUdpBatch(struct bdnet_dgram *msgs, int count);
 	virtual	int sendUdpPacket(const void *data, int size, struct sockaddr_in &to);
+	virtual	int sendUdpBurst(const void *data, int size, struct sockaddr_in &to, int count);
+	virtual	int sendUdpBatch(const struct bdnet_dgram *msgs, int count);
 
 	int setTTL(int t);
 	int getTTL();
 
+	/* the socket for one send: -1 while reset() is swapping it.
+	 * a valid fd must be handed back with releaseSocket().
+	 */
+	int	acquireSocket();
+	void	releaseSocket();
+
 	/* low level */
 private:
 
 	UdpReceiver *recv;
 
 	struct sockaddr_in laddr; /* local addr */
+	int	mShard;
+	bool	mReusePort;
 
 	int  errorState;
-	int sockfd;
-	int ttl;
 	bool stopThread;
 
-	bdMutex sockMtx;
+	/* the send / receive path is lock free: reset() swaps the socket
+	 * out, then waits for senders still using the old one to finish
+	 * before closing it.
+	 */
+	std::atomic<int> sockfd;
+	std::atomic<int> ttl;
+	std::atomic<int> mSenders;	/* in the middle of a send */
+	std::atomic<int> mRecvBatch;
+
+	std::atomic<uint64_t> mRecvCalls;
+	std::atomic<uint64_t> mRecvPkts;
+	std::atomic<uint64_t> mSendCalls;
+	std::atomic<uint64_t> mSendPkts;
+	std::atomic<uint64_t> mRecvTrunc;
+
+	bdMutex sockMtx; /* for open / close / reset, and the data below */
+	bdReactor mReactor; /* recv thread waits on the socket here */
 };
 
 
@@ -128,8 +190,10 @@ public:
 
 protected:
 
-	virtual int receiveUdpPacket(void *data, int *size, struct sockaddr_in &from);
+	virtual int receiveUdpBatch(struct bdnet_dgram *msgs, int count);
 	virtual int sendUdpPacket(const void *data, int size, struct sockaddr_in &to);
+	virtual int sendUdpBurst(const void *data, int size, struct sockaddr_in &to, int count);
+	virtual int sendUdpBatch(const struct bdnet_dgram *msgs, int count);
 
 	double lossFraction;
 };
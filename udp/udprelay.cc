@@ -0,0 +1,357 @@
+/*
+ * udp/udprelay.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "udp/udprelay.h"
+#include "util/bdlog.h"
+
+#include <iostream>
+#include <string.h>
+
+/***
+ * #define DEBUG_UDP_RELAY 1
+ ***/
+
+static const char udprelay_magic[4] = { 'B', 'D', 'R', 'L' };
+
+int	udprelay_build_hdr(uint32_t sessionId, uint64_t nonce, void *data, int size)
+{
+	if (size < UDP_RELAY_HDR_LEN)
+	{
+		return -1;
+	}
+
+	uint32_t netId = htonl(sessionId);
+	uint32_t netNonceHi = htonl((uint32_t) (nonce >> 32));
+	uint32_t netNonceLo = htonl((uint32_t) nonce);
+	memcpy(data, udprelay_magic, 4);
+	memcpy(((char *) data) + 4, &netId, 4);
+	memcpy(((char *) data) + 8, &netNonceHi, 4);
+	memcpy(((char *) data) + 12, &netNonceLo, 4);
+	return UDP_RELAY_HDR_LEN;
+}
+
+bool	udprelay_parse_hdr(const void *data, int size, uint32_t &sessionId, uint64_t &nonce)
+{
+	if ((size < UDP_RELAY_HDR_LEN) || (0 != memcmp(data, udprelay_magic, 4)))
+	{
+		return false;
+	}
+
+	uint32_t netId, netNonceHi, netNonceLo;
+	memcpy(&netId, ((const char *) data) + 4, 4);
+	memcpy(&netNonceHi, ((const char *) data) + 8, 4);
+	memcpy(&netNonceLo, ((const char *) data) + 12, 4);
+	sessionId = ntohl(netId);
+	nonce = ((uint64_t) ntohl(netNonceHi) << 32) | ntohl(netNonceLo);
+	return true;
+}
+
+/* FNV-1a over the lower id then the higher */
+uint32_t udprelay_session_id(const bdNodeId *a, const bdNodeId *b)
+{
+	if (memcmp(a->data, b->data, BITDHT_KEY_LEN) > 0)
+	{
+		const bdNodeId *tmp = a;
+		a = b;
+		b = tmp;
+	}
+
+	uint32_t h = 2166136261u;
+	for(int i = 0; i < BITDHT_KEY_LEN; i++)
+	{
+		h = (h ^ a->data[i]) * 16777619u;
+	}
+	for(int i = 0; i < BITDHT_KEY_LEN; i++)
+	{
+		h = (h ^ b->data[i]) * 16777619u;
+	}
+	return h;
+}
+
+static bool sameAddr(const struct sockaddr_in &a, const struct sockaddr_in &b)
+{
+	return ((a.sin_addr.s_addr == b.sin_addr.s_addr) && (a.sin_port == b.sin_port));
+}
+
+/******************************************************************/
+
+UdpRelayReceiver::UdpRelayReceiver(UdpPublisher *pub)
+	:UdpSubReceiver(pub), mMaxPackets(UDP_RELAY_DEF_MAX_PACKETS),
+	mMaxBytes(UDP_RELAY_DEF_MAX_BYTES), mIdleTimeout(UDP_RELAY_IDLE_TIMEOUT),
+	mSweepTS(0), mCounterForwarded(0), mCounterForwardedBytes(0),
+	mCounterDropped(0), mCounterOverQuota(0), mCounterExpired(0),
+	mCounterRefused(0)
+{
+	return;
+}
+
+void	UdpRelayReceiver::setQuota(uint32_t maxPackets, uint64_t maxBytes)
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+	mMaxPackets = maxPackets;
+	mMaxBytes = maxBytes;
+}
+
+void	UdpRelayReceiver::setIdleTimeout(time_t secs)
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+	mIdleTimeout = secs;
+}
+
+static bool sameEnds(const UdpRelaySession &session, const struct sockaddr_in &a,
+		const struct sockaddr_in &b)
+{
+	return ((sameAddr(a, session.mAddrs[0]) && sameAddr(b, session.mAddrs[1])) ||
+		(sameAddr(a, session.mAddrs[1]) && sameAddr(b, session.mAddrs[0])));
+}
+
+bool	UdpRelayReceiver::addSession(uint32_t sessionId, uint64_t nonce, const struct sockaddr_in &a,
+		const struct sockaddr_in &b)
+{
+	time_t now = time(NULL);
+
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+
+	UdpRelaySessionMap::iterator it = mSessions.find(std::make_pair(sessionId, nonce));
+	if (it != mSessions.end())
+	{
+		/* pairings are unauthenticated: never let one move a live
+		 * session, or it could be hijacked or aimed at someone else.
+		 */
+		if (!sameEnds(it->second, a, b))
+		{
+#ifdef DEBUG_UDP_RELAY
+			LOG.info("UdpRelayReceiver::addSession() refusing to move session %u", sessionId);
+#endif
+			mCounterRefused++;
+			return false;
+		}
+		it->second.mLastTS = now;
+		return true;
+	}
+
+	/* a re-pairing of the same ends brings a new nonce, but not a new quota */
+	UdpRelaySession session;
+	session.mAddrs[0] = a;
+	session.mAddrs[1] = b;
+	session.mPackets = 0;
+	session.mBytes = 0;
+	session.mStartTS = now;
+	for(it = mSessions.begin(); it != mSessions.end(); it++)
+	{
+		if ((it->first.first == sessionId) && (sameEnds(it->second, a, b)))
+		{
+			session.mPackets = it->second.mPackets;
+			session.mBytes = it->second.mBytes;
+			session.mStartTS = it->second.mStartTS;
+			mSessions.erase(it);
+			break;
+		}
+	}
+
+	if (mSessions.size() >= UDP_RELAY_MAX_SESSIONS)
+	{
+		expire_locked(now);
+	}
+	if (mSessions.size() >= UDP_RELAY_MAX_SESSIONS)
+	{
+#ifdef DEBUG_UDP_RELAY
+		LOG.info("UdpRelayReceiver::addSession() table full, refusing %u", sessionId);
+#endif
+		return false;
+	}
+
+	session.mNonce = nonce;
+	session.mLastTS = now;
+	mSessions.insert(std::make_pair(std::make_pair(sessionId, nonce), session));
+
+#ifdef DEBUG_UDP_RELAY
+	LOG.info("UdpRelayReceiver::addSession() %u", sessionId);
+#endif
+	return true;
+}
+
+bool	UdpRelayReceiver::allowPair(const bdId *a, const bdId *b, uint64_t nonce)
+{
+	if (!nonce)
+	{
+		return false;	/* the node couldn't make a secret */
+	}
+	return addSession(udprelay_session_id(&(a->id), &(b->id)), nonce, a->addr, b->addr);
+}
+
+bool	UdpRelayReceiver::removeSession(uint32_t sessionId, uint64_t nonce)
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+	return (0 < mSessions.erase(std::make_pair(sessionId, nonce)));
+}
+
+void	UdpRelayReceiver::expire(time_t now)
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+	expire_locked(now);
+}
+
+void	UdpRelayReceiver::expire_locked(time_t now)
+{
+	mSweepTS = now;
+
+	UdpRelaySessionMap::iterator it;
+	for(it = mSessions.begin(); it != mSessions.end();)
+	{
+		if (now - it->second.mLastTS > mIdleTimeout)
+		{
+#ifdef DEBUG_UDP_RELAY
+			LOG.info("UdpRelayReceiver::expire() session %u idle, %u packets relayed",
+					it->first.first, it->second.mPackets);
+#endif
+			it = mSessions.erase(it);
+			mCounterExpired++;
+		}
+		else
+		{
+			it++;
+		}
+	}
+}
+
+uint32_t UdpRelayReceiver::size()
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+	return mSessions.size();
+}
+
+uint32_t UdpRelayReceiver::forwarded()
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+	return mCounterForwarded;
+}
+
+uint64_t UdpRelayReceiver::forwardedBytes()
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+	return mCounterForwardedBytes;
+}
+
+uint32_t UdpRelayReceiver::dropped()
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+	return mCounterDropped;
+}
+
+uint32_t UdpRelayReceiver::overQuota()
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+	return mCounterOverQuota;
+}
+
+uint32_t UdpRelayReceiver::expired()
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+	return mCounterExpired;
+}
+
+uint32_t UdpRelayReceiver::refused()
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+	return mCounterRefused;
+}
+
+int	UdpRelayReceiver::recvPkt(void *data, int size, struct sockaddr_in &from)
+{
+	uint32_t sessionId;
+	uint64_t nonce;
+	if (!udprelay_parse_hdr(data, size, sessionId, nonce))
+	{
+		/* not ours: pass it on down the stack */
+		return 0;
+	}
+
+	time_t now = time(NULL);
+	struct sockaddr_in to;
+	{
+		bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+
+		if (now - mSweepTS >= UDP_RELAY_SWEEP_PERIOD)
+		{
+			expire_locked(now);
+		}
+
+		/* a wrong nonce is an unknown session */
+		UdpRelaySessionMap::iterator it = mSessions.find(std::make_pair(sessionId, nonce));
+		if (it == mSessions.end())
+		{
+			mCounterDropped++;
+			return 1;
+		}
+
+		UdpRelaySession &session = it->second;
+
+		if (sameAddr(from, session.mAddrs[0]))
+		{
+			to = session.mAddrs[1];
+		}
+		else if (sameAddr(from, session.mAddrs[1]))
+		{
+			to = session.mAddrs[0];
+		}
+		else
+		{
+			mCounterDropped++;
+			return 1;
+		}
+
+		if ((session.mPackets >= mMaxPackets) || (session.mBytes + size > mMaxBytes))
+		{
+#ifdef DEBUG_UDP_RELAY
+			LOG.info("UdpRelayReceiver::recvPkt() session %u over quota", sessionId);
+#endif
+			mCounterOverQuota++;
+			return 1;
+		}
+
+		session.mPackets++;
+		session.mBytes += size;
+		session.mLastTS = now;
+		mCounterForwarded++;
+		mCounterForwardedBytes += size;
+	}
+
+	/* header and all, straight out of the receive buffer */
+	sendPkt(data, size, to, UDP_RELAY_TTL);
+	return 1;
+}
+
+int	UdpRelayReceiver::status(std::ostream &out)
+{
+	bdStackMutex stack(relayMtx); /********** MUTEX LOCKED *************/
+
+	out << "UdpRelayReceiver::status()" << std::endl;
+	out << "sessions: " << mSessions.size() << std::endl;
+	out << "forwarded: " << mCounterForwarded << " packets, ";
+	out << mCounterForwardedBytes << " bytes" << std::endl;
+	out << "dropped: " << mCounterDropped << " over quota: " << mCounterOverQuota;
+	out << " expired: " << mCounterExpired << " refused: " << mCounterRefused << std::endl;
+	return 1;
+}
+
@@ -0,0 +1,171 @@
+#ifndef UDP_RELAY_CLASS_H
+#define UDP_RELAY_CLASS_H
+
+/*
+ * udp/udprelay.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+/*******
+ * UDP Relay for peers that cannot hole-punch.
+ *
+ * A rendezvous node that pairs a connection request (see
+ * bdRendezvousTable) already knows both ends' external addresses. With
+ * relay mode on, it also authorises a relay session for the pair: a
+ * datagram arriving from one end, starting with the relay header, is
+ * sent on unchanged to the other end.
+ *
+ * Forwarding happens in the receive thread, straight out of the
+ * UdpLayer's buffer - no copy, no queue, no wake up of the DHT thread.
+ * Each session has a packet and byte quota, and is dropped once idle.
+ *
+ * Header (16 bytes): "BDRL" + session id + nonce (network order). The
+ * session id is udprelay_session_id() of the two node ids, so either
+ * end can work it out for itself. The nonce is random, drawn by the
+ * rendezvous node for each pairing and sent only to the two ends (in
+ * their ask_conn), so knowing the node ids is not enough to use the
+ * session. Sessions are looked up by id and nonce together: the 32 bit
+ * id is cheap to collide, so a pairing of other ends with the same id
+ * just gets a session of its own. A re-pairing of the same ends takes
+ * the new nonce over from the old session, quota and all.
+ *
+ * Relay mode is enabled by adding a UdpRelayReceiver to the UdpStack
+ * ahead of the UdpBitDht, and passing the node a UdpRelayCallback.
+ ******/
+
+#include "udp/udpstack.h"
+#include "bitdht/bdiface.h"
+
+#include <iosfwd>
+#include <unordered_map>
+#include <utility>
+
+#define UDP_RELAY_HDR_LEN		16
+#define UDP_RELAY_MAX_SESSIONS		256
+#define UDP_RELAY_IDLE_TIMEOUT		60	/* secs */
+#define UDP_RELAY_SWEEP_PERIOD		10	/* secs */
+#define UDP_RELAY_DEF_MAX_PACKETS	100000	/* per session */
+#define UDP_RELAY_DEF_MAX_BYTES		(64 * 1024 * 1024)	/* per session */
+#define UDP_RELAY_TTL			64
+
+/* writes the header to data, returns its length (or -1 if size is too small) */
+int	udprelay_build_hdr(uint32_t sessionId, uint64_t nonce, void *data, int size);
+/* true if data starts with a relay header */
+bool	udprelay_parse_hdr(const void *data, int size, uint32_t &sessionId, uint64_t &nonce);
+/* the same whichever order the ids are given in */
+uint32_t udprelay_session_id(const bdNodeId *a, const bdNodeId *b);
+
+class UdpRelaySession
+{
+public:
+	struct sockaddr_in mAddrs[2];
+	uint64_t mNonce;
+	uint32_t mPackets;
+	uint64_t mBytes;
+	time_t	mStartTS;
+	time_t	mLastTS;	/* last forwarded packet */
+};
+
+/* sessions are keyed by (session id, nonce) */
+class UdpRelayKeyHash
+{
+public:
+	size_t operator()(const std::pair<uint32_t, uint64_t> &key) const
+	{
+		/* the nonce is already random */
+		return (size_t) (key.second ^ key.first);
+	}
+};
+
+typedef std::unordered_map<std::pair<uint32_t, uint64_t>, UdpRelaySession, UdpRelayKeyHash>
+		UdpRelaySessionMap;
+
+class UdpRelayReceiver: public UdpSubReceiver
+{
+public:
+	UdpRelayReceiver(UdpPublisher *pub);
+	virtual ~UdpRelayReceiver() { return; }
+
+	/* per session limits (applied to every session) */
+	void	setQuota(uint32_t maxPackets, uint64_t maxBytes);
+	void	setIdleTimeout(time_t secs);
+
+	/* false if the table is full, or the same id and nonce exist with
+	 * other addresses. A session of the same ends under another nonce
+	 * is replaced, keeping its quota.
+	 */
+	bool	addSession(uint32_t sessionId, uint64_t nonce, const struct sockaddr_in &a,
+			const struct sockaddr_in &b);
+	/* adds the session for a rendezvous pairing */
+	bool	allowPair(const bdId *a, const bdId *b, uint64_t nonce);
+	bool	removeSession(uint32_t sessionId, uint64_t nonce);
+	/* drops sessions idle for longer than the timeout */
+	void	expire(time_t now);
+	uint32_t size();
+
+	uint32_t forwarded();
+	uint64_t forwardedBytes();
+	uint32_t dropped();	/* unknown session, wrong nonce, or not from one of its ends */
+	uint32_t overQuota();
+	uint32_t refused();	/* pairings that tried to move a live session */
+	uint32_t expired();
+
+	/*** Overloaded from UdpSubReceiver ***/
+	virtual int recvPkt(void *data, int size, struct sockaddr_in &from);
+	virtual int status(std::ostream &out);
+
+private:
+	void	expire_locked(time_t now);
+
+	bdMutex relayMtx; /* for all class data (below) */
+
+	UdpRelaySessionMap mSessions;
+	uint32_t mMaxPackets;
+	uint64_t mMaxBytes;
+	time_t	mIdleTimeout;
+	time_t	mSweepTS;
+
+	uint32_t mCounterForwarded;
+	uint64_t mCounterForwardedBytes;
+	uint32_t mCounterDropped;
+	uint32_t mCounterOverQuota;
+	uint32_t mCounterExpired;
+	uint32_t mCounterRefused;
+};
+
+/* hands rendezvous pairings to a UdpRelayReceiver */
+class UdpRelayCallback: public PacketCallback
+{
+public:
+	UdpRelayCallback(UdpRelayReceiver *relay)
+		:mRelay(relay) { return; }
+
+	virtual bool onPairedCallback(const bdId *a, const bdId *b, uint64_t nonce)
+	{
+		return mRelay->allowPair(a, b, nonce);
+	}
+
+private:
+	UdpRelayReceiver *mRelay;
+};
+
+#endif
+
@@ -42,18 +42,113 @@
 //#define DEBUG_UDP_RECV	1
 
 
-UdpStack::UdpStack(struct sockaddr_in &local) :
-udpLayer(NULL), laddr(local)
+UdpStack::UdpStack(struct sockaddr_in &local, int shards) :
+laddr(local), mNumShards(shards)
 {
+	if (mNumShards > UDP_MAX_SHARDS)
+	{
+		mNumShards = UDP_MAX_SHARDS;
+	}
+#ifdef SO_REUSEPORT
+	/* each socket would get its own ephemeral port */
+	if (laddr.sin_port == 0)
+	{
+		mNumShards = 1;
+	}
+#else
+	mNumShards = 1;
+#endif
+	if (mNumShards < 1)
+	{
+		mNumShards = 1;
+	}
+
+	for(int i = 0; i < UDP_AFFINITY_SLOTS; i++)
+	{
+		mAffinity[i].store(0, std::memory_order_relaxed);
+	}
+
 	openSocket();
 	return;
 }
 
+int UdpStack::shards()
+{
+	return mLayers.size();
+}
+
 bool UdpStack::resetAddress(struct sockaddr_in &local)
 {
 	LOG.info("UdpStack::resetAddress():%s:%d",
 			inet_ntoa(local.sin_addr), htons(local.sin_port));
-	return udpLayer->reset(local);
+
+	/* peers will hash to different shards on the new port */
+	for(int i = 0; i < UDP_AFFINITY_SLOTS; i++)
+	{
+		mAffinity[i].store(0, std::memory_order_relaxed);
+	}
+
+	int ret = 1;
+	for(uint32_t i = 0; i < mLayers.size(); i++)
+	{
+		if (!mLayers[i]->reset(local))
+		{
+			ret = 0;
+		}
+	}
+	return ret;
+}
+
+/* FNV-1a over address and port */
+uint32_t UdpStack::affinitySlot(const struct sockaddr_in &addr)
+{
+	uint32_t h = 2166136261u;
+	const unsigned char *p = (const unsigned char *) &(addr.sin_addr.s_addr);
+	for(int i = 0; i < 4; i++)
+	{
+		h = (h ^ p[i]) * 16777619u;
+	}
+	p = (const unsigned char *) &(addr.sin_port);
+	for(int i = 0; i < 2; i++)
+	{
+		h = (h ^ p[i]) * 16777619u;
+	}
+	return h & (UDP_AFFINITY_SLOTS - 1);
+}
+
+/* a racy cache: a lost update or a colliding peer only means a send
+ * from a different socket on the same port.
+ */
+void UdpStack::noteShard(const struct sockaddr_in &from, int shard)
+{
+	uint64_t key = ((uint64_t) ntohl(from.sin_addr.s_addr) << 32) |
+			((uint64_t) ntohs(from.sin_port) << 16) | (uint64_t) shard;
+	std::atomic<uint64_t> &slot = mAffinity[affinitySlot(from)];
+	if (slot.load(std::memory_order_relaxed) != key)
+	{
+		slot.store(key, std::memory_order_relaxed);
+	}
+}
+
+UdpLayer *UdpStack::sendLayer(const struct sockaddr_in &to)
+{
+	if (mLayers.size() == 1)
+	{
+		return mLayers[0];
+	}
+
+	uint32_t idx = affinitySlot(to);
+	uint64_t entry = mAffinity[idx].load(std::memory_order_relaxed);
+	uint64_t peer = ((uint64_t) ntohl(to.sin_addr.s_addr) << 16) | ntohs(to.sin_port);
+	if ((entry != 0) && ((entry >> 16) == peer))
+	{
+		uint32_t shard = entry & 0xffff;
+		if (shard < mLayers.size())
+		{
+			return mLayers[shard];
+		}
+	}
+	return mLayers[idx % mLayers.size()];
 }
 
 /* higher level interface */
@@ -64,7 +159,17 @@ int UdpStack::recvPkt(void *data, int size, struct sockaddr_in &from)
 	LOG.info("UdpStack::recvPkt(" << size << ") from: " << from;
 #endif
 
-	bdStackMutex stack(stackMtx);   /********** LOCK MUTEX *********/
+	int shard = UdpLayer::recvShard();
+	if (shard >= (int) mLayers.size())
+	{
+		shard = 0; /* another stack's receive thread */
+	}
+	if (mLayers.size() > 1)
+	{
+		noteShard(from, shard);
+	}
+
+	bdStackMutex stack(*(mShardMtx[shard]));   /********** LOCK MUTEX *********/
 
 	std::list<UdpReceiver *>::iterator it;
 	for(it = mReceivers.begin(); it != mReceivers.end(); it++)
@@ -82,6 +187,37 @@ int UdpStack::recvPkt(void *data, int size, struct sockaddr_in &from)
 	return 1;
 }
 
+int UdpStack::recvPktBatch(struct bdnet_dgram *msgs, int count)
+{
+	int shard = UdpLayer::recvShard();
+	if (shard >= (int) mLayers.size())
+	{
+		shard = 0; /* another stack's receive thread */
+	}
+	if (mLayers.size() > 1)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			noteShard(msgs[i].addr, shard);
+		}
+	}
+
+	bdStackMutex stack(*(mShardMtx[shard]));   /********** LOCK MUTEX *********/
+
+	for(int i = 0; i < count; i++)
+	{
+		std::list<UdpReceiver *>::iterator it;
+		for(it = mReceivers.begin(); it != mReceivers.end(); it++)
+		{
+			if ((*it)->recvPkt(msgs[i].buf, msgs[i].len, msgs[i].addr))
+			{
+				break;
+			}
+		}
+	}
+	return count;
+}
+
 int  UdpStack::sendPkt(const void *data, int size, struct sockaddr_in &to, int ttl)
 {
 	/* print packet information */
@@ -92,7 +228,74 @@ int  UdpStack::sendPkt(const void *data, int size, struct sockaddr_in &to, int t
 #endif
 
 	/* send to udpLayer */
-	return udpLayer->sendPkt(data, size, to, ttl);
+	return sendLayer(to)->sendPkt(data, size, to, ttl);
+}
+
+int  UdpStack::sendPktBurst(const void *data, int size, struct sockaddr_in &to, int ttl, int count)
+{
+	return sendLayer(to)->sendPktBurst(data, size, to, ttl, count);
+}
+
+/* split into runs bound for the same shard */
+int  UdpStack::sendPktBatch(const struct bdnet_dgram *msgs, int count, int ttl)
+{
+	int sent = 0;
+	int start = 0;
+	while(start < count)
+	{
+		UdpLayer *layer = sendLayer(msgs[start].addr);
+		int end = start + 1;
+		while((end < count) && (layer == sendLayer(msgs[end].addr)))
+		{
+			end++;
+		}
+		sent += layer->sendPktBatch(&(msgs[start]), end - start, ttl);
+		start = end;
+	}
+	return sent;
+}
+
+void UdpStack::setRecvBatch(int count)
+{
+	for(uint32_t i = 0; i < mLayers.size(); i++)
+	{
+		mLayers[i]->setRecvBatch(count);
+	}
+}
+
+void UdpStack::getIOStats(uint64_t &recvCalls, uint64_t &recvPkts,
+		uint64_t &sendCalls, uint64_t &sendPkts)
+{
+	recvCalls = recvPkts = sendCalls = sendPkts = 0;
+	for(uint32_t i = 0; i < mLayers.size(); i++)
+	{
+		uint64_t rc, rp, sc, sp;
+		mLayers[i]->getIOStats(rc, rp, sc, sp);
+		recvCalls += rc;
+		recvPkts += rp;
+		sendCalls += sc;
+		sendPkts += sp;
+	}
+}
+
+void UdpStack::getShardIOStats(int shard, uint64_t &recvCalls, uint64_t &recvPkts,
+		uint64_t &sendCalls, uint64_t &sendPkts)
+{
+	recvCalls = recvPkts = sendCalls = sendPkts = 0;
+	if ((shard >= 0) && (shard < (int) mLayers.size()))
+	{
+		mLayers[shard]->getIOStats(recvCalls, recvPkts, sendCalls, sendPkts);
+	}
+}
+
+uint64_t UdpStack::getTruncated()
+{
+	uint64_t truncated = 0;
+	for(uint32_t i = 0; i < mLayers.size(); i++)
+	{
+		truncated += mLayers[i]->getTruncated();
+	}
+	return truncated;
 }
 
 int UdpStack::status(std::ostream &out)
@@ -114,7 +317,10 @@ int UdpStack::status(std::ostream &out)
 		out << std::endl;
 	}
 
-	udpLayer->status(out);
+	for(uint32_t i = 0; i < mLayers.size(); i++)
+	{
+		mLayers[i]->status(out);
+	}
 
 	return 1;
 }
@@ -122,14 +328,29 @@ int UdpStack::status(std::ostream &out)
 /* setup connections */
 int UdpStack::openSocket()	
 {
-	udpLayer = new UdpLayer(this, laddr);
+	/* the mutexes exist before any receive thread can use them */
+	for(int i = 0; i < mNumShards; i++)
+	{
+		mShardMtx.push_back(new bdMutex());
+	}
+	for(int i = 0; i < mNumShards; i++)
+	{
+		mLayers.push_back(new UdpLayer(this, laddr, i, mNumShards > 1));
+	}
 	return 1;
 }
 
 /* monitoring / updates */
 int UdpStack::okay()
 {
-	return udpLayer->okay();
+	for(uint32_t i = 0; i < mLayers.size(); i++)
+	{
+		if (!mLayers[i]->okay())
+		{
+			return 0;
+		}
+	}
+	return 1;
 }
 
 int UdpStack::close()
@@ -140,9 +361,35 @@ int UdpStack::close()
 
 
 /* add a TCPonUDP stream */
+/* writers hold every shard's mutex, see udpstack.h */
+class UdpShardsLock
+{
+public:
+	UdpShardsLock(std::vector<bdMutex *> &mtxs)
+		:mMtxs(mtxs)
+	{
+		for(uint32_t i = 0; i < mMtxs.size(); i++)
+		{
+			mMtxs[i]->lock();
+		}
+	}
+
+	~UdpShardsLock()
+	{
+		for(uint32_t i = 0; i < mMtxs.size(); i++)
+		{
+			mMtxs[i]->unlock();
+		}
+	}
+
+private:
+	std::vector<bdMutex *> &mMtxs;
+};
+
 int UdpStack::addReceiver(UdpReceiver *recv)
 {
 	bdStackMutex stack(stackMtx);   /********** LOCK MUTEX *********/
+	UdpShardsLock shards(mShardMtx);   /********** LOCK MUTEX *********/
 
 	/* check for duplicate */
 	std::list<UdpReceiver *>::iterator it;
@@ -166,6 +413,7 @@ int UdpStack::addReceiver(UdpReceiver *recv)
 int UdpStack::removeReceiver(UdpReceiver *recv)
 {
 	bdStackMutex stack(stackMtx);   /********** LOCK MUTEX *********/
+	UdpShardsLock shards(mShardMtx);   /********** LOCK MUTEX *********/
 
 	/* check for duplicate */
 	std::list<UdpReceiver *>::iterator it;
@@ -208,3 +456,13 @@ int  UdpSubReceiver::sendPkt(const void *data, int size, struct sockaddr_in &to,
 	/* send to udpLayer */
 	return mPublisher->sendPkt(data, size, to, ttl);
 }
+
+int  UdpSubReceiver::sendPktBurst(const void *data, int size, struct sockaddr_in &to, int ttl, int count)
+{
+	return mPublisher->sendPktBurst(data, size, to, ttl, count);
+}
+
+int  UdpSubReceiver::sendPktBatch(const struct bdnet_dgram *msgs, int count, int ttl)
+{
+	return mPublisher->sendPktBatch(msgs, count, ttl);
+}
@@ -36,6 +36,8 @@
 
 #include <iosfwd>
 #include <map>
+#include <vector>
+#include <atomic>
 
 #include "udp/udplayer.h"
 
@@ -47,8 +49,23 @@
  * 
  * This infact becomes the holder of the UdpLayer, and all controls
  * go through the StackReceiver.
+ *
+ * Sharding: with shards > 1 the stack opens that many UdpLayers on the
+ * same port (SO_REUSEPORT), each with its own receive thread, and the
+ * kernel spreads peers across them. A packet to a peer leaves from the
+ * socket that peer was last heard on, so the 4-tuple is the same both
+ * ways; peers not heard from are spread by address. Pair it with
+ * UdpBitDht::setRecvShards() so each thread gets its own queue into
+ * the DHT.
+ *
+ * The receiver list is read under the calling shard's own mutex, and
+ * only changed with all of them held - so the shards never wait for
+ * each other, and removeReceiver() still waits out any delivery.
  */
 
+#define UDP_MAX_SHARDS		16
+#define UDP_AFFINITY_SLOTS	4096	/* peer -> shard cache, power of 2 */
+
 class UdpSubReceiver: public UdpReceiver
 {
 public:
@@ -56,6 +73,8 @@ public:
 
 	/* calls mPublisher->sendPkt */
 	virtual int sendPkt(const void *data, int size, struct sockaddr_in &to, int ttl);
+	virtual int sendPktBurst(const void *data, int size, struct sockaddr_in &to, int ttl, int count);
+	virtual int sendPktBatch(const struct bdnet_dgram *msgs, int count, int ttl);
 	/* callback for recved data (overloaded from UdpReceiver) */
 	//virtual int recvPkt(void *data, int size, struct sockaddr_in &from) = 0;
 
@@ -67,9 +86,12 @@ class UdpStack: public UdpReceiver, public UdpPublisher
 {
 public:
 
-	UdpStack(struct sockaddr_in &local);
+	/* shards > 1 needs a fixed port, and SO_REUSEPORT: otherwise 1 */
+	UdpStack(struct sockaddr_in &local, int shards = 1);
 	virtual ~UdpStack() { return; }
 
+	int	shards();
+
 	bool resetAddress(struct sockaddr_in &local);
 
 
@@ -80,9 +102,24 @@ public:
 	/* Packet IO */
 	/* pass-through send packets */
 	virtual int sendPkt(const void *data, int size, struct sockaddr_in &to, int ttl);
+	virtual int sendPktBurst(const void *data, int size, struct sockaddr_in &to, int ttl, int count);
+	virtual int sendPktBatch(const struct bdnet_dgram *msgs, int count, int ttl);
 	/* callback for recved data (overloaded from UdpReceiver) */
 
 	virtual int recvPkt(void *data, int size, struct sockaddr_in &from);
+	/* the receiver list is locked once for the whole batch */
+	virtual int recvPktBatch(struct bdnet_dgram *msgs, int count);
+
+	/* datagrams per receive syscall, see UdpLayer */
+	void	setRecvBatch(int count);
+	/* summed over the shards */
+	void	getIOStats(uint64_t &recvCalls, uint64_t &recvPkts,
+			uint64_t &sendCalls, uint64_t &sendPkts);
+	/* just the one shard */
+	void	getShardIOStats(int shard, uint64_t &recvCalls, uint64_t &recvPkts,
+			uint64_t &sendCalls, uint64_t &sendPkts);
+	/* oversized datagrams dropped, summed over the shards */
+	uint64_t getTruncated();
 
 	int  status(std::ostream &out);
 
@@ -97,11 +134,21 @@ public:
 
 private:
 
-	UdpLayer *udpLayer;
+	/* the shard to send to this peer from */
+	UdpLayer *sendLayer(const struct sockaddr_in &to);
+	void	noteShard(const struct sockaddr_in &from, int shard);
+	uint32_t affinitySlot(const struct sockaddr_in &addr);
+
+	std::vector<UdpLayer *> mLayers;	/* fixed once open */
+	std::vector<bdMutex *> mShardMtx;	/* read lock on mReceivers, one per shard */
+
+	/* ((addr << 32) | (port << 16) | shard), 0 if empty */
+	std::atomic<uint64_t> mAffinity[UDP_AFFINITY_SLOTS];
 
 	bdMutex stackMtx; /* for all class data (below) */
 
 	struct sockaddr_in laddr; /* local addr */
+	int	mNumShards;
 
 	std::list<UdpReceiver *> mReceivers;
 };
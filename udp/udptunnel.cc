@@ -78,6 +78,7 @@ void UdpTunnel::connectNode(const bdId *id)
 	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
 	mTunnelManager->connectNode(id);
+	mReactor.wakeup();
 }
 
 void UdpTunnel::disconnectNode(const bdId *id)
@@ -85,6 +86,7 @@ void UdpTunnel::disconnectNode(const bdId *id)
 	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
 	mTunnelManager->disconnectNode(id);
+	mReactor.wakeup();
 }
 
 /***** Add / Remove Callback Clients *****/
@@ -107,14 +109,18 @@ int UdpTunnel::startTunnel()
 {
 	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
-	return mTunnelManager->startTunnel();
+	int ret = mTunnelManager->startTunnel();
+	mReactor.wakeup();
+	return ret;
 }
 
 int UdpTunnel::stopTunnel()
 {
 	bdStackMutex stack(dhtMtx); /********** MUTEX LOCKED *************/
 
-	return mTunnelManager->stopTunnel();
+	int ret = mTunnelManager->stopTunnel();
+	mReactor.wakeup();
+	return ret;
 }
 
 int UdpTunnel::stateDht()
@@ -139,6 +145,7 @@ int UdpTunnel::recvPkt(void *data, int size, struct sockaddr_in &from)
 
 	if (mTunnelManager->isBitDhtPacket((char *) data, size, from)) {
 		mTunnelManager->incomingMsg(&from, (char *) data, size);
+		mReactor.wakeup();
 
 		return 1;
 	}
@@ -156,20 +163,63 @@ int UdpTunnel::status(std::ostream &out)
 /*** Overloaded from iThread ***/
 #define MAX_MSG_PER_TICK	100
 #define TICK_PAUSE_USEC		20000  /* 20ms secs .. max messages = 50 x 100 = 5000 */
+#define ITERATION_USEC		1000000 /* the managers' timers assume one iteration per second */
 
 void UdpTunnel::run()
 {
+	uint64_t nextIteration = bdClockUsecs();
+	uint64_t nextTick = 0;
+
 	while(1)
 	{
-		while(tick())
+		uint64_t now = bdClockUsecs();
+		if (now >= nextIteration)
 		{
-			usleep(TICK_PAUSE_USEC);
+			bdStackMutex stack(dhtMtx);
+			mTunnelManager->iteration();
+
+			nextIteration += ITERATION_USEC;
+			if (nextIteration <= now)
+			{
+				nextIteration = now + ITERATION_USEC; /* fell behind, don't catch up */
+			}
 		}
+		else
 		{
+			/* woken early - answer what has arrived, send due retries */
 			bdStackMutex stack(dhtMtx);
-			mTunnelManager->iteration();
+			mTunnelManager->processIncoming();
+		}
+
+		uint64_t deadline = nextIteration;
+		if (now >= nextTick)
+		{
+			nextTick = 0;
+			if (tick())
+			{
+				nextTick = now + TICK_PAUSE_USEC;
+			}
 		}
-		sleep(1);
+		if ((nextTick) && (nextTick < deadline))
+		{
+			deadline = nextTick;
+		}
+
+		/* connecting tunnels retry faster than once an iteration */
+		uint64_t waitUsecs;
+		{
+			bdStackMutex stack(dhtMtx);
+			if (mTunnelManager->nextTunnelSend(waitUsecs))
+			{
+				now = bdClockUsecs();
+				if ((deadline > now) && (waitUsecs < deadline - now))
+				{
+					deadline = now + waitUsecs;
+				}
+			}
+		}
+
+		mReactor.wait(deadline);
 	}
 }
 
@@ -179,22 +229,21 @@ int UdpTunnel::tick()
 
 	/* pass on messages from the node */
 	int i = 0;
-	char data[BITDHT_MAX_PKTSIZE];
-	struct sockaddr_in toAddr;
-	int size = BITDHT_MAX_PKTSIZE;
+	bdMsgSlot *msg;
 
-	while((i < MAX_MSG_PER_TICK) && (mTunnelManager->outgoingMsg(&toAddr, data, &size)))
+	/* sent straight from the node's slot */
+	while((i < MAX_MSG_PER_TICK) && (NULL != (msg = mTunnelManager->popOutgoingMsg())))
 	{
 #ifdef DEBUG_UDP_BITDHT 
-		LOG << log4cpp::Priority::INFO << "UdpTunnel::tick() outgoing msg(" << size << ") to " << toAddr;
-		LOG << log4cpp::Priority::INFO << std::endl;
+		LOG.info("UdpTunnel::tick() outgoing msg(%d) to %s:%d", msg->mSize,
+				inet_ntoa(msg->addr.sin_addr), ntohs(msg->addr.sin_port));
 #endif
 
-		sendPkt(data, size, toAddr, BITDHT_TTL);
+		sendPkt(msg->data, msg->mSize, msg->addr, BITDHT_TTL);
+		mTunnelManager->releaseOutgoingMsg(msg);
 
 		// iterate
 		i++;
-		size = BITDHT_MAX_PKTSIZE; // reset msg size!
 	}
 
 	if (i == MAX_MSG_PER_TICK)
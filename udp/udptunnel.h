@@ -32,6 +32,7 @@
 #include <string>
 
 #include "udp/udpstack.h"
+#include "util/bdreactor.h"
 #include "bitdht/bdiface.h"
 #include "bitdht/bdtunnelmanager.h"
 
@@ -88,6 +89,7 @@ public:
 private:
 
 	bdMutex dhtMtx; /* for all class data (below) */
+	bdReactor mReactor; /* run() sleeps here, woken by packets and api calls */
 	bdTunnelManager *mTunnelManager;
 	bdDhtFunctions *mFns;
 };
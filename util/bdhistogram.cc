@@ -0,0 +1,81 @@
+/*
+ * util/bdhistogram.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+
+#include "util/bdhistogram.h"
+#include <stdlib.h>
+
+bdHistogram::bdHistogram()
+{
+	reset();
+}
+
+void	bdHistogram::add(uint64_t usecs)
+{
+	int bucket = 0;
+	while((bucket < BITDHT_HISTOGRAM_BUCKETS - 1) && (usecs >= (1ULL << bucket)))
+	{
+		bucket++;
+	}
+	mBuckets[bucket]++;
+	mCount++;
+}
+
+void	bdHistogram::reset()
+{
+	for(int i = 0; i < BITDHT_HISTOGRAM_BUCKETS; i++)
+	{
+		mBuckets[i] = 0;
+	}
+	mCount = 0;
+}
+
+uint32_t bdHistogram::count()
+{
+	return mCount;
+}
+
+uint64_t bdHistogram::percentile(double fraction)
+{
+	if (mCount == 0)
+	{
+		return 0;
+	}
+
+	uint32_t target = (uint32_t) (fraction * mCount);
+	if (target >= mCount)
+	{
+		target = mCount - 1;
+	}
+
+	uint32_t seen = 0;
+	for(int i = 0; i < BITDHT_HISTOGRAM_BUCKETS; i++)
+	{
+		seen += mBuckets[i];
+		if (seen > target)
+		{
+			return (1ULL << i);
+		}
+	}
+	return (1ULL << (BITDHT_HISTOGRAM_BUCKETS - 1));
+}
@@ -0,0 +1,56 @@
+#ifndef BITDHT_HISTOGRAM_H
+#define BITDHT_HISTOGRAM_H
+
+/*
+ * util/bdhistogram.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+
+#include <inttypes.h>
+
+/* Latency Histogram.
+ *
+ * Power of two buckets (in usecs): bucket n counts samples < 2^n usecs,
+ * so percentiles are only accurate to a factor of two - plenty for
+ * telling 1ms from 1sec. Fixed size, no allocation on add().
+ */
+
+#define BITDHT_HISTOGRAM_BUCKETS	32
+
+class bdHistogram
+{
+public:
+	bdHistogram();
+
+	void	add(uint64_t usecs);
+	void	reset();
+
+	uint32_t count();
+	/* upper bound (usecs) of the bucket holding the given fraction (0-1) of samples */
+	uint64_t percentile(double fraction);
+
+private:
+	uint32_t mBuckets[BITDHT_HISTOGRAM_BUCKETS];
+	uint32_t mCount;
+};
+
+#endif
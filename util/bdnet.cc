@@ -30,6 +30,21 @@
 #include <stdlib.h>
 #include <string.h>
 
+/* the batch functions tally their syscalls for the caller */
+static inline void bdnet_count_call(int *calls)
+{
+	if (calls)
+	{
+		(*calls)++;
+	}
+}
+
+/* a full send buffer ends a batch - any other error is the datagram's own */
+static inline bool bdnet_send_blocked(int err)
+{
+	return ((err == EAGAIN) || (err == EWOULDBLOCK) || (err == EINPROGRESS));
+}
+
 /********************************** WINDOWS/UNIX SPECIFIC PART ******************/
 #if defined(_WIN32) || defined(__MINGW32__)
 
@@ -210,6 +225,74 @@ ssize_t bdnet_sendto(int s, const void *buf, size_t len, int flags,
 	return ret;
 }
 
+int bdnet_sendto_burst(int s, const void *buf, size_t len, int flags,
+ 				const struct sockaddr *to, socklen_t tolen, int count,
+				int *calls)
+{
+	int sent = 0;
+	for(int i = 0; i < count; i++)
+	{
+		bdnet_count_call(calls);
+		if (0 > bdnet_sendto(s, buf, len, flags, to, tolen))
+		{
+			return sent ? sent : -1;
+		}
+		sent++;
+	}
+	return sent;
+}
+
+int bdnet_recvfrom_batch(int s, struct bdnet_dgram *msgs, int count, int flags,
+				int *calls)
+{
+	if (count > BDNET_BATCH_MAX)
+	{
+		count = BDNET_BATCH_MAX;
+	}
+
+	int recvd = 0;
+	for(; recvd < count; recvd++)
+	{
+		socklen_t fromlen = sizeof(struct sockaddr_in);
+		bdnet_count_call(calls);
+		ssize_t ret = bdnet_recvfrom(s, msgs[recvd].buf, msgs[recvd].size, flags,
+				(struct sockaddr *) &(msgs[recvd].addr), &fromlen);
+		msgs[recvd].trunc = 0;
+		if (ret < 0)
+		{
+			/* winsock fills the buffer, then fails the call */
+			if (bdnet_errno() != EMSGSIZE)
+			{
+				break;
+			}
+			ret = msgs[recvd].size;
+			msgs[recvd].trunc = 1;
+		}
+		msgs[recvd].len = ret;
+	}
+	return recvd ? recvd : -1;
+}
+
+int bdnet_sendto_batch(int s, const struct bdnet_dgram *msgs, int count, int flags,
+				int *calls)
+{
+	int sent = 0;
+	for(int i = 0; i < count; i++)
+	{
+		bdnet_count_call(calls);
+		if (0 <= bdnet_sendto(s, msgs[i].buf, msgs[i].len, flags,
+				(const struct sockaddr *) &(msgs[i].addr), sizeof(struct sockaddr_in)))
+		{
+			sent++;
+		}
+		else if (bdnet_send_blocked(bdnet_errno()))
+		{
+			break;
+		}
+	}
+	return sent ? sent : -1;
+}
+
 int bdnet_w2u_errno(int err)
 {
 	/* switch */
@@ -240,6 +323,9 @@ int bdnet_w2u_errno(int err)
 		case WSAEUSERS:
 			return EUSERS;
 			break;
+		case WSAEMSGSIZE:
+			return EMSGSIZE;
+			break;
 		/* This one is returned for UDP recvfrom, when nothing there
 		 * but not a real error... translate into EINPROGRESS
 		 */
@@ -342,6 +428,183 @@ ssize_t bdnet_sendto(int s, const void *buf, size_t len, int flags,
 	return sendto(s, buf, len, flags, to, tolen);
 }
 
+#define BDNET_BURST_MAX	64
+
+int bdnet_sendto_burst(int s, const void *buf, size_t len, int flags,
+ 				const struct sockaddr *to, socklen_t tolen, int count,
+				int *calls)
+{
+	int sent = 0;
+#ifdef __linux__
+	/* every entry points at the same buffer and address */
+	struct iovec iov;
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+
+	struct mmsghdr msgs[BDNET_BURST_MAX];
+	int n = (count < BDNET_BURST_MAX) ? count : BDNET_BURST_MAX;
+	memset(msgs, 0, n * sizeof(struct mmsghdr));
+	for(int i = 0; i < n; i++)
+	{
+		msgs[i].msg_hdr.msg_name = (void *) to;
+		msgs[i].msg_hdr.msg_namelen = tolen;
+		msgs[i].msg_hdr.msg_iov = &iov;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while(sent < count)
+	{
+		int batch = count - sent;
+		if (batch > n)
+		{
+			batch = n;
+		}
+
+		bdnet_count_call(calls);
+		int ret = sendmmsg(s, msgs, batch, flags);
+		if (ret <= 0)
+		{
+			return sent ? sent : -1;
+		}
+		sent += ret;
+	}
+#else
+	for(; sent < count; sent++)
+	{
+		bdnet_count_call(calls);
+		if (0 > sendto(s, buf, len, flags, to, tolen))
+		{
+			return sent ? sent : -1;
+		}
+	}
+#endif
+	return sent;
+}
+
+int bdnet_recvfrom_batch(int s, struct bdnet_dgram *msgs, int count, int flags,
+				int *calls)
+{
+	if (count > BDNET_BATCH_MAX)
+	{
+		count = BDNET_BATCH_MAX;
+	}
+
+#ifdef __linux__
+	struct iovec iovs[BDNET_BATCH_MAX];
+	struct mmsghdr hdrs[BDNET_BATCH_MAX];
+	memset(hdrs, 0, count * sizeof(struct mmsghdr));
+	for(int i = 0; i < count; i++)
+	{
+		iovs[i].iov_base = msgs[i].buf;
+		iovs[i].iov_len = msgs[i].size;
+		hdrs[i].msg_hdr.msg_name = &(msgs[i].addr);
+		hdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		hdrs[i].msg_hdr.msg_iov = &(iovs[i]);
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	bdnet_count_call(calls);
+	int ret = recvmmsg(s, hdrs, count, flags, NULL);
+	for(int i = 0; i < ret; i++)
+	{
+		msgs[i].len = hdrs[i].msg_len;
+		msgs[i].trunc = (hdrs[i].msg_hdr.msg_flags & MSG_TRUNC) ? 1 : 0;
+	}
+	return (ret > 0) ? ret : -1;
+#else
+	/* recvmsg() rather than recvfrom(), for MSG_TRUNC */
+	int recvd = 0;
+	for(; recvd < count; recvd++)
+	{
+		struct iovec iov;
+		iov.iov_base = msgs[recvd].buf;
+		iov.iov_len = msgs[recvd].size;
+
+		struct msghdr hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.msg_name = &(msgs[recvd].addr);
+		hdr.msg_namelen = sizeof(struct sockaddr_in);
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+
+		bdnet_count_call(calls);
+		ssize_t ret = recvmsg(s, &hdr, flags);
+		if (ret < 0)
+		{
+			break;
+		}
+		msgs[recvd].len = ret;
+		msgs[recvd].trunc = (hdr.msg_flags & MSG_TRUNC) ? 1 : 0;
+	}
+	return recvd ? recvd : -1;
+#endif
+}
+
+int bdnet_sendto_batch(int s, const struct bdnet_dgram *msgs, int count, int flags,
+				int *calls)
+{
+	int sent = 0;
+#ifdef __linux__
+	struct iovec iovs[BDNET_BATCH_MAX];
+	struct mmsghdr hdrs[BDNET_BATCH_MAX];
+
+	int done = 0;
+	while(done < count)
+	{
+		int batch = count - done;
+		if (batch > BDNET_BATCH_MAX)
+		{
+			batch = BDNET_BATCH_MAX;
+		}
+
+		memset(hdrs, 0, batch * sizeof(struct mmsghdr));
+		for(int i = 0; i < batch; i++)
+		{
+			const struct bdnet_dgram &msg = msgs[done + i];
+			iovs[i].iov_base = msg.buf;
+			iovs[i].iov_len = msg.len;
+			hdrs[i].msg_hdr.msg_name = (void *) &(msg.addr);
+			hdrs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+			hdrs[i].msg_hdr.msg_iov = &(iovs[i]);
+			hdrs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		bdnet_count_call(calls);
+		int ret = sendmmsg(s, hdrs, batch, flags);
+		if (ret > 0)
+		{
+			done += ret;
+			sent += ret;
+			continue;
+		}
+
+		/* sendmmsg() stops at the first datagram that fails: unless the
+		 * socket is full, skip just that one and carry on with the rest.
+		 */
+		if ((ret < 0) && bdnet_send_blocked(errno))
+		{
+			break;
+		}
+		done++;
+	}
+#else
+	for(int i = 0; i < count; i++)
+	{
+		bdnet_count_call(calls);
+		if (0 <= sendto(s, msgs[i].buf, msgs[i].len, flags,
+				(const struct sockaddr *) &(msgs[i].addr), sizeof(struct sockaddr_in)))
+		{
+			sent++;
+		}
+		else if (bdnet_send_blocked(errno))
+		{
+			break;
+		}
+	}
+#endif
+	return sent ? sent : -1;
+}
+
 
 #endif
 /********************************** WINDOWS/UNIX SPECIFIC PART ******************/
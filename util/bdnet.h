@@ -77,6 +77,28 @@ extern "C" {
  * ssize_t bdnet_sendto(int s, const void *buf, size_t len, int flags, 
  * 				const struct sockaddr *to, socklen_t tolen);
  *
+ * int bdnet_sendto_burst(int s, const void *buf, size_t len, int flags,
+ * 				const struct sockaddr *to, socklen_t tolen, int count,
+ * 				int *calls);
+ * 		the same datagram count times - one syscall per
+ * 		BDNET_BATCH_MAX where the platform has sendmmsg(). returns
+ * 		the number sent, -1 on error.
+ *
+ * int bdnet_recvfrom_batch(int s, struct bdnet_dgram *msgs, int count, int flags,
+ * 				int *calls);
+ * int bdnet_sendto_batch(int s, const struct bdnet_dgram *msgs, int count, int flags,
+ * 				int *calls);
+ * 		different datagrams - one syscall per BDNET_BATCH_MAX where
+ * 		the platform has recvmmsg()/sendmmsg(), a loop elsewhere.
+ * 		recv takes at most BDNET_BATCH_MAX. return the number
+ * 		received/sent, -1 if none (errno as for recvfrom/sendto).
+ * 		a received datagram that didn't fit its buffer comes back
+ * 		with trunc set. a datagram that can't be sent (bad address,
+ * 		unreachable) is skipped and the rest still go; only a full
+ * 		socket buffer ends the batch early.
+ *
+ * 		all three add the syscalls they made to *calls, if not NULL.
+ *
  * There are some non-standard ones as well:
  * int bdnet_errno();  	for internal networking errors 
  * int bdnet_init();  		required for windows 
@@ -97,6 +119,26 @@ ssize_t bdnet_recvfrom(int s, void *buf, size_t len, int flags,
                               struct sockaddr *from, socklen_t *fromlen);
 ssize_t bdnet_sendto(int s, const void *buf, size_t len, int flags, 
  				const struct sockaddr *to, socklen_t tolen);
+int bdnet_sendto_burst(int s, const void *buf, size_t len, int flags,
+ 				const struct sockaddr *to, socklen_t tolen, int count,
+				int *calls);
+
+/* one datagram of a batch */
+#define BDNET_BATCH_MAX		64
+
+struct bdnet_dgram
+{
+	void *buf;
+	size_t size;			/* buffer space (recv) */
+	size_t len;			/* datagram length (filled by recv) */
+	int trunc;			/* cut short to fit size (filled by recv) */
+	struct sockaddr_in addr;	/* source (filled by recv) / destination */
+};
+
+int bdnet_recvfrom_batch(int s, struct bdnet_dgram *msgs, int count, int flags,
+				int *calls);
+int bdnet_sendto_batch(int s, const struct bdnet_dgram *msgs, int count, int flags,
+				int *calls);
 
 /* address filling */
 int bdnet_inet_aton(const char *name, struct in_addr *addr);
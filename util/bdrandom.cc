@@ -0,0 +1,74 @@
+/*
+ * util/bdrandom.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "util/bdrandom.h"
+#include "util/bdtime.h"
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+bdRandom::bdRandom()
+{
+	seed(bdClockUsecs() ^ ((uint64_t) getpid() << 32) ^ (uint64_t) (uintptr_t) this);
+}
+
+/* splitmix64 the seed, so similar seeds still give unrelated streams */
+void	bdRandom::seed(uint64_t seed)
+{
+	uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z = z ^ (z >> 31);
+
+	/* xorshift must never be zero */
+	mState = z ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+uint64_t bdRandom::next()
+{
+	mState ^= mState >> 12;
+	mState ^= mState << 25;
+	mState ^= mState >> 27;
+	return mState * 0x2545F4914F6CDD1DULL;
+}
+
+uint32_t bdRandom::next32()
+{
+	/* the high bits are the better ones */
+	return (uint32_t) (next() >> 32);
+}
+
+bool	bdSecureRandom(uint64_t &value)
+{
+	int fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	ssize_t len = read(fd, &value, sizeof(value));
+	close(fd);
+	return (len == (ssize_t) sizeof(value));
+}
+
@@ -0,0 +1,58 @@
+#ifndef BITDHT_RANDOM_H
+#define BITDHT_RANDOM_H
+
+/*
+ * util/bdrandom.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+
+/* Fast Pseudo Random Numbers.
+ *
+ * xorshift64* - a few cycles per number, no locking, no allocation.
+ * Good enough to make transaction ids and tokens hard to guess off
+ * the wire; not for key material. Seeded from the clock, pid and the
+ * object's address, so separate nodes get separate streams.
+ */
+
+class bdRandom
+{
+public:
+	bdRandom();
+
+	void	seed(uint64_t seed);
+	uint64_t next();
+	uint32_t next32();
+
+private:
+	uint64_t mState;
+};
+
+/* Unguessable numbers, for secrets handed to a chosen few (relay
+ * nonces): bdRandom's state can be worked out from its output, this
+ * reads the system's entropy source instead. A file read per call.
+ * false if there is none.
+ */
+bool	bdSecureRandom(uint64_t &value);
+
+#endif
@@ -0,0 +1,336 @@
+/*
+ * util/bdreactor.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "util/bdreactor.h"
+#include "util/bdnet.h"
+#include "util/bdlog.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+#include <errno.h>
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#if !defined(_WIN32) && !defined(__MINGW32__)
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+/***
+ * #define DEBUG_REACTOR 1
+ ***/
+
+#define REACTOR_MAX_EVENTS	16
+
+#if defined(__linux__)
+
+bdReactor::bdReactor()
+	:mArmedDeadline(0), mWoken(false)
+{
+	mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	mWakeupFds[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	mWakeupFds[1] = -1;
+	mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = mWakeupFds[0];
+	epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeupFds[0], &ev);
+	ev.data.fd = mTimerFd;
+	epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mTimerFd, &ev);
+
+	if ((mEpollFd < 0) || (mWakeupFds[0] < 0) || (mTimerFd < 0))
+	{
+		LOG.info("bdReactor::bdReactor() ERROR creating epoll/eventfd/timerfd: %d", errno);
+	}
+}
+
+bdReactor::~bdReactor()
+{
+	close(mTimerFd);
+	close(mWakeupFds[0]);
+	close(mEpollFd);
+}
+
+bool	bdReactor::addFd(int fd)
+{
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (0 != epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev))
+	{
+		return false;
+	}
+	mFds.push_back(fd);
+	return true;
+}
+
+bool	bdReactor::removeFd(int fd)
+{
+	mFds.remove(fd);
+	return (0 == epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL));
+}
+
+void	bdReactor::wakeup()
+{
+	bdStackMutex stack(mWakeupMtx); /********** MUTEX LOCKED *************/
+
+	/* coalesce: one write until the waiting thread notices */
+	if (mWoken)
+	{
+		return;
+	}
+	mWoken = true;
+
+	uint64_t one = 1;
+	if (sizeof(one) != write(mWakeupFds[0], &one, sizeof(one)))
+	{
+#ifdef DEBUG_REACTOR
+		LOG.info("bdReactor::wakeup() write failed: %d", errno);
+#endif
+	}
+}
+
+void	bdReactor::drainWakeup()
+{
+	bdStackMutex stack(mWakeupMtx); /********** MUTEX LOCKED *************/
+
+	uint64_t count;
+	while(0 < read(mWakeupFds[0], &count, sizeof(count))) ;
+	mWoken = false;
+}
+
+int	bdReactor::wait(uint64_t deadline)
+{
+	/* only touch the timer when the deadline moves */
+	if (deadline != mArmedDeadline)
+	{
+		struct itimerspec its;
+		its.it_interval.tv_sec = 0;
+		its.it_interval.tv_nsec = 0;
+		its.it_value.tv_sec = deadline / 1000000;
+		its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+		timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &its, NULL);
+		mArmedDeadline = deadline;
+	}
+
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	int n = epoll_wait(mEpollFd, events, REACTOR_MAX_EVENTS, -1);
+	if (n < 0)
+	{
+#ifdef DEBUG_REACTOR
+		LOG.info("bdReactor::wait() epoll_wait error: %d", errno);
+#endif
+		return 0;
+	}
+
+	int flags = 0;
+	for(int i = 0; i < n; i++)
+	{
+		if (events[i].data.fd == mWakeupFds[0])
+		{
+			drainWakeup();
+			flags |= BITDHT_REACTOR_EVENT_WAKEUP;
+		}
+		else if (events[i].data.fd == mTimerFd)
+		{
+			uint64_t expired;
+			while(0 < read(mTimerFd, &expired, sizeof(expired))) ;
+			mArmedDeadline = 0; /* one shot - disarmed now */
+			flags |= BITDHT_REACTOR_EVENT_TIMER;
+		}
+		else
+		{
+			flags |= BITDHT_REACTOR_EVENT_FD;
+		}
+	}
+
+	if ((deadline) && (bdClockUsecs() >= deadline))
+	{
+		flags |= BITDHT_REACTOR_EVENT_TIMER;
+	}
+
+#ifdef DEBUG_REACTOR
+	LOG.info("bdReactor::wait() events: %d flags: %x", n, flags);
+#endif
+
+	return flags;
+}
+
+#else /* select() fallback */
+
+bdReactor::bdReactor()
+	:mWoken(false)
+{
+	mWakeupFds[0] = -1;
+	mWakeupFds[1] = -1;
+#if !defined(_WIN32) && !defined(__MINGW32__)
+	if (0 == pipe(mWakeupFds))
+	{
+		fcntl(mWakeupFds[0], F_SETFL, O_NONBLOCK);
+		fcntl(mWakeupFds[1], F_SETFL, O_NONBLOCK);
+	}
+#endif
+}
+
+bdReactor::~bdReactor()
+{
+#if !defined(_WIN32) && !defined(__MINGW32__)
+	close(mWakeupFds[0]);
+	close(mWakeupFds[1]);
+#endif
+}
+
+bool	bdReactor::addFd(int fd)
+{
+	mFds.push_back(fd);
+	return true;
+}
+
+bool	bdReactor::removeFd(int fd)
+{
+	mFds.remove(fd);
+	return true;
+}
+
+void	bdReactor::wakeup()
+{
+	bdStackMutex stack(mWakeupMtx); /********** MUTEX LOCKED *************/
+
+	if (mWoken)
+	{
+		return;
+	}
+	mWoken = true;
+
+#if !defined(_WIN32) && !defined(__MINGW32__)
+	char c = 0;
+	if (1 != write(mWakeupFds[1], &c, 1))
+	{
+#ifdef DEBUG_REACTOR
+		LOG.info("bdReactor::wakeup() write failed: %d", errno);
+#endif
+	}
+#endif
+}
+
+void	bdReactor::drainWakeup()
+{
+	bdStackMutex stack(mWakeupMtx); /********** MUTEX LOCKED *************/
+
+#if !defined(_WIN32) && !defined(__MINGW32__)
+	char buf[64];
+	while(0 < read(mWakeupFds[0], buf, sizeof(buf))) ;
+#endif
+	mWoken = false;
+}
+
+int	bdReactor::wait(uint64_t deadline)
+{
+	fd_set rset;
+	FD_ZERO(&rset);
+	int maxfd = -1;
+
+	std::list<int>::iterator it;
+	for(it = mFds.begin(); it != mFds.end(); it++)
+	{
+		FD_SET(*it, &rset);
+		if (*it > maxfd)
+		{
+			maxfd = *it;
+		}
+	}
+	if (mWakeupFds[0] >= 0)
+	{
+		FD_SET(mWakeupFds[0], &rset);
+		if (mWakeupFds[0] > maxfd)
+		{
+			maxfd = mWakeupFds[0];
+		}
+	}
+
+	struct timeval timeout;
+	struct timeval *timeoutp = NULL;
+	uint64_t waitUsecs = 0;
+	bool bounded = (deadline != 0);
+	if (deadline)
+	{
+		uint64_t now = bdClockUsecs();
+		waitUsecs = (deadline > now) ? (deadline - now) : 0;
+	}
+#if defined(_WIN32) || defined(__MINGW32__)
+	/* no wakeup fd - poll for wakeup() instead */
+	if ((!bounded) || (waitUsecs > BITDHT_REACTOR_MAX_WAIT_USECS))
+	{
+		waitUsecs = BITDHT_REACTOR_MAX_WAIT_USECS;
+	}
+	bounded = true;
+#endif
+	if (bounded)
+	{
+		timeout.tv_sec = waitUsecs / 1000000;
+		timeout.tv_usec = waitUsecs % 1000000;
+		timeoutp = &timeout;
+	}
+
+	int n = select(maxfd + 1, &rset, NULL, NULL, timeoutp);
+	if (n < 0)
+	{
+		return 0;
+	}
+
+	int flags = 0;
+	for(it = mFds.begin(); it != mFds.end(); it++)
+	{
+		if (FD_ISSET(*it, &rset))
+		{
+			flags |= BITDHT_REACTOR_EVENT_FD;
+		}
+	}
+
+	bool woken = false;
+	{
+		bdStackMutex stack(mWakeupMtx); /********** MUTEX LOCKED *************/
+		woken = mWoken;
+	}
+	if (woken)
+	{
+		drainWakeup();
+		flags |= BITDHT_REACTOR_EVENT_WAKEUP;
+	}
+
+	if ((deadline) && (bdClockUsecs() >= deadline))
+	{
+		flags |= BITDHT_REACTOR_EVENT_TIMER;
+	}
+
+	return flags;
+}
+
+#endif
+
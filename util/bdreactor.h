@@ -0,0 +1,87 @@
+#ifndef BITDHT_REACTOR_H
+#define BITDHT_REACTOR_H
+
+/*
+ * util/bdreactor.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+
+#include <inttypes.h>
+#include <list>
+
+#include "util/bdthreads.h"
+#include "util/bdtime.h"
+
+/* Event Loop Wait.
+ *
+ * Blocks a thread until one of its file descriptors is readable, its
+ * deadline passes, or another thread calls wakeup().
+ *
+ * On Linux this is epoll, with an eventfd for wakeups and a timerfd for
+ * the deadline. Elsewhere it falls back to select() and a self-pipe
+ * (Windows has no pipe to select on, so there the wait is capped at
+ * BITDHT_REACTOR_MAX_WAIT_USECS and wakeup() only takes effect then).
+ *
+ * Readiness is level triggered: a partially drained socket fires again.
+ */
+
+#define BITDHT_REACTOR_EVENT_FD		0x0001	/* a registered fd is readable */
+#define BITDHT_REACTOR_EVENT_WAKEUP	0x0002	/* wakeup() was called */
+#define BITDHT_REACTOR_EVENT_TIMER	0x0004	/* the deadline passed */
+
+#define BITDHT_REACTOR_MAX_WAIT_USECS	100000
+
+class bdReactor
+{
+public:
+	bdReactor();
+	~bdReactor();
+
+	bool	addFd(int fd);
+	bool	removeFd(int fd);
+
+	/* safe to call from any thread */
+	void	wakeup();
+
+	/* deadline in bdClockUsecs() time, 0 = none.
+	 * returns BITDHT_REACTOR_EVENT_ flags, 0 on error.
+	 */
+	int	wait(uint64_t deadline);
+
+private:
+
+	void	drainWakeup();
+
+	std::list<int> mFds;
+
+	int	mWakeupFds[2];	/* eventfd uses [0] only */
+#if defined(__linux__)
+	int	mEpollFd;
+	int	mTimerFd;
+	uint64_t mArmedDeadline;
+#endif
+	bool	mWoken;
+	bdMutex	mWakeupMtx;
+};
+
+#endif
+
@@ -0,0 +1,160 @@
+/*
+ * util/bdrecentset.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "util/bdrecentset.h"
+
+bdRecentSet::bdRecentSet(uint32_t window)
+	:mHead(0), mCount(0)
+{
+	if (window < 1)
+	{
+		window = 1;
+	}
+	mRing.resize(window);
+
+	/* at most half full */
+	uint32_t bits = 4;
+	while((1u << bits) < 2 * window)
+	{
+		bits++;
+	}
+	Slot empty = {0, 0};
+	mSlots.resize(1u << bits, empty);
+	mMask = (1u << bits) - 1;
+	mShift = 32 - bits;
+}
+
+void	bdRecentSet::add(uint32_t value)
+{
+	if (mCount == mRing.size())
+	{
+		/* forget the oldest */
+		remove(mRing[mHead]);
+	}
+	else
+	{
+		mCount++;
+	}
+
+	mRing[mHead] = value;
+	mHead = (mHead + 1) % mRing.size();
+
+	int idx = find(value);
+	if (idx >= 0)
+	{
+		mSlots[idx].mRefs++;
+		return;
+	}
+
+	uint32_t i = bucket(value);
+	while(mSlots[i].mRefs)
+	{
+		i = (i + 1) & mMask;
+	}
+	mSlots[i].mValue = value;
+	mSlots[i].mRefs = 1;
+}
+
+bool	bdRecentSet::contains(uint32_t value)
+{
+	return (find(value) >= 0);
+}
+
+void	bdRecentSet::clear()
+{
+	Slot empty = {0, 0};
+	for(uint32_t i = 0; i < mSlots.size(); i++)
+	{
+		mSlots[i] = empty;
+	}
+	mHead = 0;
+	mCount = 0;
+}
+
+uint32_t bdRecentSet::size()
+{
+	return mCount;
+}
+
+uint32_t bdRecentSet::window()
+{
+	return mRing.size();
+}
+
+/* fibonacci hashing: the top bits of value * 2^32/phi */
+uint32_t bdRecentSet::bucket(uint32_t value)
+{
+	return (value * 2654435769u) >> mShift;
+}
+
+int	bdRecentSet::find(uint32_t value)
+{
+	uint32_t i = bucket(value);
+	while(mSlots[i].mRefs)
+	{
+		if (mSlots[i].mValue == value)
+		{
+			return i;
+		}
+		i = (i + 1) & mMask;
+	}
+	return -1;
+}
+
+void	bdRecentSet::remove(uint32_t value)
+{
+	int idx = find(value);
+	if (idx < 0)
+	{
+		return;
+	}
+
+	if (--mSlots[idx].mRefs == 0)
+	{
+		erase(idx);
+	}
+}
+
+/* backward shift delete, so lookups never need tombstones */
+void	bdRecentSet::erase(uint32_t idx)
+{
+	uint32_t hole = idx;
+	uint32_t j = idx;
+	while(true)
+	{
+		j = (j + 1) & mMask;
+		if (!mSlots[j].mRefs)
+		{
+			break;
+		}
+
+		uint32_t home = bucket(mSlots[j].mValue);
+		if (((j - home) & mMask) >= ((j - hole) & mMask))
+		{
+			mSlots[hole] = mSlots[j];
+			hole = j;
+		}
+	}
+	mSlots[hole].mRefs = 0;
+}
+
@@ -0,0 +1,74 @@
+#ifndef BITDHT_RECENT_SET_H
+#define BITDHT_RECENT_SET_H
+
+/*
+ * util/bdrecentset.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <vector>
+
+/* Recent Value Set.
+ *
+ * Remembers the last mWindow values added, and answers "was this one
+ * of them?" in O(1): a ring holds the values in insertion order (so
+ * the oldest can be evicted), and a small open addressed hash set,
+ * kept at most half full, holds them for lookup. Duplicates are
+ * reference counted, so evicting one copy doesn't forget the other.
+ */
+
+class bdRecentSet
+{
+public:
+	bdRecentSet(uint32_t window);
+
+	void	add(uint32_t value);
+	bool	contains(uint32_t value);
+	void	clear();
+
+	uint32_t size();
+	uint32_t window();
+
+private:
+	class Slot
+	{
+	public:
+		uint32_t mValue;
+		uint32_t mRefs;	/* 0 = empty */
+	};
+
+	uint32_t bucket(uint32_t value);
+	int	find(uint32_t value);	/* slot index, or -1 */
+	void	remove(uint32_t value);
+	void	erase(uint32_t idx);
+
+	std::vector<uint32_t> mRing;
+	uint32_t mHead;		/* next ring position to write */
+	uint32_t mCount;	/* values in the ring */
+
+	std::vector<Slot> mSlots;
+	uint32_t mMask;
+	uint32_t mShift;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef BITDHT_RING_H
+#define BITDHT_RING_H
+
+/*
+ * util/bdring.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+/* Bounded Lock-Free Ring.
+ *
+ * Hands items from any number of producer threads to one consumer
+ * without a mutex: a producer claims a cell, fills it in place and
+ * publishes it; the consumer reads the oldest published cell in place
+ * and pops it. Each cell carries a sequence number (after Vyukov's
+ * bounded queue), so producers only contend on one compare-and-swap,
+ * and a full ring fails the claim - counted as an overflow - instead
+ * of waiting for the consumer.
+ */
+
+template<class T>
+class bdRing
+{
+public:
+	/* capacity is rounded up to a power of 2 */
+	bdRing(uint32_t capacity)
+		:mEnqueue(0), mOverflows(0), mDequeue(0), mHighWater(0)
+	{
+		uint32_t cap = 2;
+		while(cap < capacity)
+		{
+			cap <<= 1;
+		}
+		mMask = cap - 1;
+		mCells = new Cell[cap];
+		for(uint32_t i = 0; i < cap; i++)
+		{
+			mCells[i].mSeq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	~bdRing()
+	{
+		delete [] mCells;
+	}
+
+	/**** producers (any thread) ****/
+
+	/* a cell to fill in, then publish(pos). NULL if the ring is full */
+	T	*claim(uint32_t &pos)
+	{
+		pos = mEnqueue.load(std::memory_order_relaxed);
+		while(1)
+		{
+			Cell *cell = &(mCells[pos & mMask]);
+			uint32_t seq = cell->mSeq.load(std::memory_order_acquire);
+			int32_t diff = (int32_t) (seq - pos);
+			if (diff == 0)
+			{
+				if (mEnqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					return &(cell->mData);
+				}
+				/* lost the race: pos has been reloaded */
+			}
+			else if (diff < 0)
+			{
+				/* the consumer hasn't popped this cell a lap ago */
+				mOverflows.fetch_add(1, std::memory_order_relaxed);
+				return NULL;
+			}
+			else
+			{
+				pos = mEnqueue.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void	publish(uint32_t pos)
+	{
+		mCells[pos & mMask].mSeq.store(pos + 1, std::memory_order_release);
+	}
+
+	/**** the consumer (one thread) ****/
+
+	/* the oldest published item, NULL if there is none */
+	T	*front()
+	{
+		Cell *cell = &(mCells[mDequeue & mMask]);
+		if (cell->mSeq.load(std::memory_order_acquire) != mDequeue + 1)
+		{
+			return NULL;
+		}
+
+		uint32_t used = size();
+		if (used > mHighWater)
+		{
+			mHighWater = used;
+		}
+		return &(cell->mData);
+	}
+
+	/* releases the item returned by front() */
+	void	pop()
+	{
+		mCells[mDequeue & mMask].mSeq.store(mDequeue + mMask + 1, std::memory_order_release);
+		mDequeue++;
+	}
+
+	/* cells claimed and not yet popped */
+	uint32_t size()
+	{
+		return mEnqueue.load(std::memory_order_relaxed) - mDequeue;
+	}
+
+	uint32_t capacity()
+	{
+		return mMask + 1;
+	}
+
+	uint32_t highWater()
+	{
+		return mHighWater;
+	}
+
+	/* safe from any thread */
+	uint32_t overflows()
+	{
+		return mOverflows.load(std::memory_order_relaxed);
+	}
+
+private:
+	class Cell
+	{
+	public:
+		std::atomic<uint32_t> mSeq;
+		T	mData;
+	};
+
+	Cell	*mCells;
+	uint32_t mMask;
+
+	/* producer side, kept off the consumer's cache line. padded rather
+	 * than alignas(64): pre-C++17 new doesn't honour over-alignment.
+	 */
+	char	mPad0[64];
+	std::atomic<uint32_t> mEnqueue;
+	std::atomic<uint32_t> mOverflows;
+
+	char	mPad1[64];
+	uint32_t mDequeue;
+	uint32_t mHighWater;
+};
+
+#endif
+
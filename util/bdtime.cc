@@ -0,0 +1,49 @@
+/*
+ * util/bdtime.cc
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+#include "util/bdtime.h"
+
+#if defined(_WIN32) || defined(__MINGW32__)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+uint64_t bdClockUsecs()
+{
+#if defined(_WIN32) || defined(__MINGW32__)
+	static LARGE_INTEGER freq;
+	if (freq.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&freq);
+	}
+	LARGE_INTEGER count;
+	QueryPerformanceCounter(&count);
+	return (uint64_t) ((count.QuadPart / freq.QuadPart) * 1000000 +
+			((count.QuadPart % freq.QuadPart) * 1000000) / freq.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
@@ -0,0 +1,41 @@
+#ifndef BITDHT_TIME_H
+#define BITDHT_TIME_H
+
+/*
+ * util/bdtime.h
+ *
+ * BitDHT: An Flexible DHT library.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License Version 3 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+ * USA.
+ *
+ * Please report all bugs and problems to "bitdht@lunamutt.com".
+ *
+ */
+
+
+#include <inttypes.h>
+
+/* Monotonic Clock.
+ *
+ * Every timeout, deadline, rate and latency in the library is measured
+ * in bdClockUsecs() - CLOCK_MONOTONIC, so none of them jump when the
+ * wall clock is stepped. The value is only meaningful relative to
+ * another reading; dates still come from time(NULL).
+ */
+
+/* monotonic microseconds */
+uint64_t bdClockUsecs();
+
+#endif